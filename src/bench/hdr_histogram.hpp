@@ -0,0 +1,151 @@
+#ifndef HDR_HISTOGRAM_HPP
+#define HDR_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+// High dynamic range latency histogram (same bucketing as HdrHistogram):
+// values from 1 to highest_trackable_value with 3 significant digits
+// (max 0.1% error), fixed memory, O(1) record.
+// Not thread safe: one histogram per thread, merge() them at the end.
+class HdrHistogram {
+
+  private:
+    static constexpr int sub_bucket_half_count_magnitude = 10;
+    static constexpr int64_t sub_bucket_half_count = int64_t( 1 ) << sub_bucket_half_count_magnitude; // 1024
+    static constexpr int64_t sub_bucket_count = sub_bucket_half_count * 2; // 2048 -> 3 significant digits
+    static constexpr int64_t sub_bucket_mask = sub_bucket_count - 1;
+
+    int64_t highest_trackable_value;
+    std::vector< uint64_t > counts;
+    uint64_t total_count = 0;
+    int64_t min_value = INT64_MAX;
+    int64_t max_value = 0;
+    double sum = 0;
+
+    static int bucketIndex( int64_t value ) {
+      return 63 - __builtin_clzll( uint64_t( value | sub_bucket_mask ) ) - sub_bucket_half_count_magnitude;
+    }
+
+    static size_t countsIndex( int64_t value ) {
+
+      const int bucket_idx = bucketIndex( value );
+      const int64_t sub_bucket_idx = value >> bucket_idx;
+
+      return size_t( ( int64_t( bucket_idx + 1 ) << sub_bucket_half_count_magnitude ) + sub_bucket_idx - sub_bucket_half_count );
+    }
+
+    static int64_t lowestEquivalentValue( size_t idx ) {
+
+      int bucket_idx = int( idx >> sub_bucket_half_count_magnitude ) - 1;
+      int64_t sub_bucket_idx = int64_t( idx & ( sub_bucket_half_count - 1 ) ) + sub_bucket_half_count;
+
+      if ( bucket_idx < 0 ) {
+        sub_bucket_idx -= sub_bucket_half_count;
+        bucket_idx = 0;
+      }
+
+      return sub_bucket_idx << bucket_idx;
+    }
+
+    static int64_t highestEquivalentValue( size_t idx ) {
+
+      const int64_t lowest = lowestEquivalentValue( idx );
+
+      return lowest + ( int64_t( 1 ) << bucketIndex( lowest ) ) - 1;
+    }
+
+  public:
+    HdrHistogram( int64_t highest_trackable_value = 3600LL * 1000 * 1000 ) { // 1 hour in us
+      this->highest_trackable_value = std::max< int64_t >( highest_trackable_value, sub_bucket_count );
+      counts.resize( countsIndex( this->highest_trackable_value ) + 1, 0 );
+    }
+
+    void record( int64_t value, uint64_t count = 1 ) {
+
+      value = std::min( std::max< int64_t >( value, 0 ), highest_trackable_value );
+
+      counts[ countsIndex( value ) ] += count;
+      total_count += count;
+      sum += double( value ) * count;
+      min_value = std::min( min_value, value );
+      max_value = std::max( max_value, value );
+    }
+
+    // Coordinated omission correction for a caller that waited for each response
+    // before sending the next one: a response that took longer than the expected
+    // interval hid the requests that should have been sent meanwhile, record them too.
+    void recordCorrected( int64_t value, int64_t expected_interval ) {
+
+      record( value );
+
+      if ( expected_interval <= 0 )
+        return;
+
+      for ( int64_t missing = value - expected_interval; missing >= expected_interval; missing -= expected_interval )
+        record( missing );
+    }
+
+    void merge( const HdrHistogram& other ) {
+
+      // Same layout as long as both track the same range
+      if ( other.counts.size() != counts.size() ) {
+        for ( size_t i = 0; i < other.counts.size(); ++i ) {
+          if ( other.counts[ i ] > 0 )
+            record( lowestEquivalentValue( i ), other.counts[ i ] );
+        }
+        return;
+      }
+
+      for ( size_t i = 0; i < counts.size(); ++i )
+        counts[ i ] += other.counts[ i ];
+
+      total_count += other.total_count;
+      sum += other.sum;
+      min_value = std::min( min_value, other.min_value );
+      max_value = std::max( max_value, other.max_value );
+    }
+
+    uint64_t count() const {
+      return total_count;
+    }
+
+    double mean() const {
+      return total_count > 0 ? sum / total_count : 0;
+    }
+
+    int64_t min() const {
+      return total_count > 0 ? min_value : 0;
+    }
+
+    int64_t max() const {
+      return max_value;
+    }
+
+    // percentile in [ 0, 100 ]
+    int64_t valueAtPercentile( double percentile ) const {
+
+      if ( total_count == 0 )
+        return 0;
+
+      percentile = std::min( std::max( percentile, 0.0 ), 100.0 );
+
+      const uint64_t target = std::max< uint64_t >( 1, uint64_t( percentile / 100.0 * total_count + 0.5 ) );
+
+      uint64_t cumulative = 0;
+
+      for ( size_t i = 0; i < counts.size(); ++i ) {
+
+        cumulative += counts[ i ];
+
+        if ( cumulative >= target )
+          return std::min( highestEquivalentValue( i ), max_value );
+      }
+
+      return max_value;
+    }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef IMAGE_SET_HPP
+#define IMAGE_SET_HPP
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+// Sorted, so every run sends the same sequence
+std::vector< std::string > loadImageSet( const std::string& images_dir ) {
+
+  const std::vector< std::string > extensions = { ".png", ".jpg", ".jpeg", ".bmp", ".webp" };
+
+  std::vector< std::filesystem::path > paths;
+
+  for ( const auto& entry : std::filesystem::directory_iterator( images_dir ) ) {
+
+    if ( !entry.is_regular_file() )
+      continue;
+
+    std::string extension = entry.path().extension().string();
+    std::transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+
+    if ( std::find( extensions.begin(), extensions.end(), extension ) != extensions.end() )
+      paths.push_back( entry.path() );
+  }
+
+  std::sort( paths.begin(), paths.end() );
+
+  std::vector< std::string > images;
+
+  for ( const auto& path : paths ) {
+    std::ifstream file( path, std::ios::binary );
+    images.emplace_back( std::istreambuf_iterator< char >( file ), std::istreambuf_iterator< char >() );
+  }
+
+  return images;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef LOAD_STATS_HPP
+#define LOAD_STATS_HPP
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "hdr_histogram.hpp"
+
+
+enum class LoadRpc {
+  RECOGNIZE_BYTES,
+  DETECT,
+  RECOGNIZE_BASE64,
+  COUNT
+};
+
+const int load_rpc_count = static_cast< int >( LoadRpc::COUNT );
+const std::array< std::string, load_rpc_count > load_rpc_names = { "bytes", "detect", "base64" };
+
+
+// Per worker results, merged at the end
+struct LoadStats {
+  std::array< HdrHistogram, load_rpc_count > latency_us;
+  std::array< uint64_t, load_rpc_count > ok{};
+  std::array< std::map< int, uint64_t >, load_rpc_count > errors; // < grpc::StatusCode, count >
+
+  void merge( const LoadStats& other ) {
+    for ( int i = 0; i < load_rpc_count; ++i ) {
+      latency_us[ i ].merge( other.latency_us[ i ] );
+      ok[ i ] += other.ok[ i ];
+      for ( const auto& error : other.errors[ i ] )
+        errors[ i ][ error.first ] += error.second;
+    }
+  }
+};
+
+
+nlohmann::ordered_json latencyJson( const HdrHistogram& histogram ) {
+
+  nlohmann::ordered_json latency;
+  latency["count"] = histogram.count();
+  latency["min"] = histogram.min();
+  latency["mean"] = histogram.mean();
+
+  const std::vector< std::pair< std::string, double > > percentiles = {
+    { "p50", 50 }, { "p75", 75 }, { "p90", 90 }, { "p95", 95 }, { "p99", 99 }, { "p99.9", 99.9 }, { "p99.99", 99.99 }
+  };
+
+  for ( const auto& percentile : percentiles )
+    latency[ percentile.first ] = histogram.valueAtPercentile( percentile.second );
+
+  latency["max"] = histogram.max();
+
+  return latency;
+}
+
+
+// Adds ok / error counts and latency percentiles, per rpc and overall, to the report
+void loadStatsJson( const LoadStats& stats, double duration_s, nlohmann::ordered_json& report ) {
+
+  HdrHistogram all_latency_us;
+  uint64_t all_ok = 0;
+  uint64_t all_errors = 0;
+
+  report["rpcs"] = nlohmann::ordered_json::object();
+
+  for ( int i = 0; i < load_rpc_count; ++i ) {
+
+    uint64_t errors = 0;
+    nlohmann::ordered_json errors_json = nlohmann::ordered_json::object();
+
+    for ( const auto& error : stats.errors[ i ] ) {
+      errors += error.second;
+      errors_json[ std::to_string( error.first ) ] = error.second;
+    }
+
+    if ( stats.ok[ i ] == 0 && errors == 0 )
+      continue;
+
+    nlohmann::ordered_json rpc_json;
+    rpc_json["ok"] = stats.ok[ i ];
+    rpc_json["errors"] = errors;
+    rpc_json["errors_by_code"] = errors_json;
+    rpc_json["latency"] = latencyJson( stats.latency_us[ i ] );
+
+    report["rpcs"][ load_rpc_names[ i ] ] = rpc_json;
+
+    all_latency_us.merge( stats.latency_us[ i ] );
+    all_ok += stats.ok[ i ];
+    all_errors += errors;
+  }
+
+  report["ok"] = all_ok;
+  report["errors"] = all_errors;
+  report["achieved_rps"] = duration_s > 0 ? ( all_ok + all_errors ) / duration_s : 0;
+  report["latency"] = latencyJson( all_latency_us );
+}
+
+#endif
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+# make_db_fixture.py: writes the fixture of "ppocr_bench --mode db-compare --fixture DIR", detector probability
+# maps ( 8-bit grayscale PNG, probability = value / 255 ) and the boxes DB postprocessing must find on them.
+#
+# The maps hold filled axis-aligned rectangles, so the expected boxes follow in closed form from the steps of
+# FastDeploy's DBDetectorPostprocessor: the region's contour is the rectangle of its pixel centres, its score
+# the rectangle's value, the unclip distance area * unclip_ratio / perimeter on every side, then the corners
+# rounded, clamped to the map and ordered top-left, top-right, bottom-right, bottom-left.
+#
+# Pure Python, no dependencies. e.g. python make_db_fixture.py --output ./fixtures/db_compare
+
+import argparse
+import json
+import math
+import os
+import struct
+import zlib
+
+SETTINGS = {
+    "det_db_thresh": 0.3,
+    "det_db_box_thresh": 0.6,
+    "det_db_unclip_ratio": 1.5,
+    "det_db_score_mode": "slow",
+    "use_dilation": False,
+}
+
+TEXT = 230  # 0.90: a text region
+FAINT = 128  # 0.50: above det_db_thresh, its box below det_db_box_thresh
+
+# name: ( width, height, [ ( x0, y0, x1, y1, value ) ] ), pixel centres, inclusive
+MAPS = {
+    "blank.png": (64, 48, []),
+    "lines.png": (320, 176, [
+        (20, 20, 200, 44, TEXT),  # A line
+        (20, 70, 90, 88, TEXT),  # Two words two pixels apart: two boxes
+        (93, 70, 150, 88, TEXT),
+        (290, 100, 319, 130, TEXT),  # On the edge: clamped
+        (20, 120, 140, 140, FAINT),  # Scored out
+        (200, 150, 201, 151, TEXT),  # Too small
+        (230, 160, 300, 170, TEXT),
+    ]),
+    "vertical.png": (96, 320, [
+        (30, 16, 62, 300, TEXT),  # Vertical text
+    ]),
+}
+
+
+def write_png(path, width, height, pixels):
+    """8-bit grayscale, rows of bytes"""
+
+    def chunk(kind, data):
+        return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data) & 0xffffffff)
+
+    raw = b"".join(b"\x00" + bytes(row) for row in pixels)
+
+    with open(path, "wb") as file:
+        file.write(b"\x89PNG\r\n\x1a\n")
+        file.write(chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 0, 0, 0, 0)))
+        file.write(chunk(b"IDAT", zlib.compress(raw, 9)))
+        file.write(chunk(b"IEND", b""))
+
+
+def round_half_up(value):
+    return int(math.floor(value + 0.5))
+
+
+def expected_box(width, height, rect):
+    """The box of one rectangle, None when DB postprocessing drops it"""
+
+    x0, y0, x1, y1, value = rect
+    box_width, box_height = x1 - x0, y1 - y0
+
+    if value / 255.0 <= SETTINGS["det_db_thresh"] or max(box_width, box_height) < 3:
+        return None
+    if value / 255.0 < SETTINGS["det_db_box_thresh"]:
+        return None
+
+    distance = box_width * box_height * SETTINGS["det_db_unclip_ratio"] / (2 * (box_width + box_height))
+
+    for edge in (x0 - distance, x1 + distance, y0 - distance, y1 + distance):
+        if abs(edge - math.floor(edge) - 0.5) < 0.05:
+            raise ValueError("ambiguous rounding of %s, move it" % (rect,))
+
+    left = min(max(round_half_up(x0 - distance), 0), width - 1)
+    right = min(max(round_half_up(x1 + distance), 0), width - 1)
+    top = min(max(round_half_up(y0 - distance), 0), height - 1)
+    bottom = min(max(round_half_up(y1 + distance), 0), height - 1)
+
+    if right - left <= 4 or bottom - top <= 4:
+        return None
+
+    return [left, top, right, top, right, bottom, left, bottom]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--output", required=True)
+    args = parser.parse_args()
+
+    os.makedirs(args.output, exist_ok=True)
+
+    expected = {"settings": SETTINGS, "maps": {}}
+
+    for name, (width, height, rects) in MAPS.items():
+
+        pixels = [[0] * width for _ in range(height)]
+
+        for x0, y0, x1, y1, value in rects:
+            for y in range(y0, y1 + 1):
+                for x in range(x0, x1 + 1):
+                    pixels[y][x] = value
+
+        write_png(os.path.join(args.output, name), width, height, pixels)
+
+        boxes = [expected_box(width, height, rect) for rect in rects]
+        expected["maps"][name] = [box for box in boxes if box is not None]
+
+    with open(os.path.join(args.output, "expected_boxes.json"), "w") as file:
+        json.dump(expected, file, indent=4)
+        file.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,965 @@
+// ppocr_bench: runs a directory of images through the full request path
+// ( request -> decode -> scheduler -> pipeline -> response serialization )
+// and reports throughput, latency percentiles and allocations per request as JSON.
+//
+// --backend fake        deterministic fake models, measures the service overhead only
+// --backend fastdeploy  the models of the selected settings preset
+//
+// --mode direct  calls the PPOCRService handlers directly
+// --mode grpc    goes through an in-process gRPC channel (adds proto (de)serialization)
+// --mode db-compare  runs the FastDeploy and the native DB postprocessing on the same
+//                    detector output and reports how many boxes match ( --backend fastdeploy ),
+//                    or with --fixture DIR on the probability maps of make_db_fixture.py against their
+//                    expected boxes ( no models needed ). Exits with 1 on missing or extra boxes
+// --mode preprocess-compare  builds the detector input of every image and the recognizer input of its
+//                    detected lines with FastDeploy's preprocessors, the fused scalar reference and the
+//                    fused SIMD kernel of this CPU, and reports their largest difference, shape
+//                    mismatches and time ( --backend fastdeploy )
+// --mode ctc-compare  decodes the recognizer output of the detected lines with FastDeploy's postprocessor,
+//                    the native CTC decoder's scalar reference and its SIMD kernel, and reports the texts
+//                    that differ, the largest score difference and their time ( --backend fastdeploy )
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include "ocr_service.grpc.pb.h"
+#include "../service_grpc/ppocr_service.hpp"
+#include "image_set.hpp"
+
+
+// Allocation counting (whole process, the gRPC mode includes the server threads)
+
+static std::atomic< uint64_t > allocation_count{ 0 };
+static std::atomic< uint64_t > allocation_bytes{ 0 };
+
+void* operator new( std::size_t size ) {
+
+  allocation_count.fetch_add( 1, std::memory_order_relaxed );
+  allocation_bytes.fetch_add( size, std::memory_order_relaxed );
+
+  void* ptr = std::malloc( size == 0 ? 1 : size );
+
+  if ( ptr == nullptr )
+    throw std::bad_alloc();
+
+  return ptr;
+}
+
+void* operator new[]( std::size_t size ) {
+  return operator new( size );
+}
+
+void operator delete( void* ptr ) noexcept {
+  std::free( ptr );
+}
+
+void operator delete[]( void* ptr ) noexcept {
+  std::free( ptr );
+}
+
+void operator delete( void* ptr, std::size_t ) noexcept {
+  std::free( ptr );
+}
+
+void operator delete[]( void* ptr, std::size_t ) noexcept {
+  std::free( ptr );
+}
+
+
+// Deterministic stand-in for the models: a fixed grid of text boxes per frame,
+// a fixed text per line, optional sleeps to emulate model time.
+class FakeOCRBackend : public OCRBackend {
+
+  private:
+    int lines_per_frame;
+    std::chrono::microseconds det_time;
+    std::chrono::microseconds rec_time_per_line;
+
+  public:
+    FakeOCRBackend( int lines_per_frame, int det_us, int rec_us_per_line ) {
+      this->lines_per_frame = lines_per_frame;
+      this->det_time = std::chrono::microseconds( det_us );
+      this->rec_time_per_line = std::chrono::microseconds( rec_us_per_line );
+    }
+
+    bool initialized() const override {
+      return true;
+    }
+
+    bool detect(
+      const cv::Mat &image,
+      std::vector< std::array< int, 8 > > *boxes,
+      RequestTimings *timings
+    ) override {
+
+      StageTimer timer;
+
+      if ( det_time.count() > 0 )
+        std::this_thread::sleep_for( det_time );
+
+      boxes->clear();
+
+      const int line_height = std::max( 1, image.rows / std::max( 1, lines_per_frame ) );
+      const int box_height = std::max( 1, line_height * 3 / 4 );
+      const int left = image.cols / 10;
+      const int right = std::max( left + 1, image.cols - image.cols / 10 );
+
+      for ( int i = 0; i < lines_per_frame && ( i + 1 ) * line_height <= image.rows; ++i ) {
+        const int top = i * line_height;
+        const int bottom = top + box_height;
+        boxes->push_back( { left, top, right, top, right, bottom, left, bottom } );
+      }
+
+      timings->det_infer_us = timer.elapsedMicros();
+      metrics().observe( MetricHistogram::DETECT_US, timings->det_infer_us );
+      metrics().observe( MetricHistogram::BOXES_PER_FRAME, boxes->size() );
+
+      return true;
+    }
+
+    bool hasClassifier() const override {
+      return true;
+    }
+
+    float getClsThresh() override {
+      return 0.9;
+    }
+
+    bool classify(
+      const std::vector< cv::Mat > &text_images,
+      size_t start_idx,
+      size_t end_idx,
+      std::vector< int32_t > *cls_labels,
+      std::vector< float > *cls_scores
+    ) override {
+
+      for ( size_t i = start_idx; i < end_idx; ++i ) {
+        ( *cls_labels )[ i ] = 0;
+        ( *cls_scores )[ i ] = 0.99;
+      }
+
+      return true;
+    }
+
+    bool recognize(
+      const std::vector< cv::Mat > &text_images,
+      size_t start_idx,
+      size_t end_idx,
+      const std::vector< int > &indices,
+      std::vector< std::string > *texts,
+      std::vector< float > *rec_scores
+    ) override {
+
+      if ( rec_time_per_line.count() > 0 )
+        std::this_thread::sleep_for( rec_time_per_line * ( end_idx - start_idx ) );
+
+      for ( size_t i = start_idx; i < end_idx; ++i ) {
+        const int idx = indices[ i ];
+        ( *texts )[ idx ] = "fake text line " + std::to_string( idx );
+        ( *rec_scores )[ idx ] = 0.95;
+      }
+
+      return true;
+    }
+};
+
+
+struct BenchOptions {
+  std::string images_dir;
+  std::string backend = "fake"; // fake | fastdeploy
+  std::string mode = "direct"; // direct | grpc | db-compare | preprocess-compare | ctc-compare
+  std::string language_code;
+  std::string output_file;
+  int iterations = 5; // Passes over the image set
+  int warmup = 1;
+  int fake_lines = 20;
+  int fake_det_us = 0;
+  int fake_rec_us = 0;
+  int box_tolerance_px = 2; // db-compare: max vertex distance of matching boxes
+  std::string fixture_dir; // db-compare: probability maps and expected boxes instead of --images
+  AppOptions app_options;
+};
+
+void printBenchUsage() {
+  std::cout << "Usage: ppocr_bench --images DIR [--backend fake|fastdeploy] [--mode direct|grpc|db-compare|preprocess-compare|ctc-compare]\n"
+               "                   [--language CODE] [--iterations N] [--warmup N]\n"
+               "                   [--presets ROOT] [--preset NAME] [--output FILE]\n"
+               "                   [--fake-lines N] [--fake-det-us N] [--fake-rec-us N]\n"
+               "                   [--box-tolerance-px N] [--fixture DIR]\n"
+            << std::endl;
+}
+
+bool handleBenchArgs( int argc, char *argv[], BenchOptions& options ) {
+
+  for ( int i = 1; i < argc; ++i ) {
+
+    const std::string arg = argv[ i ];
+
+    if ( i + 1 >= argc ) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[ ++i ];
+
+    if ( arg == "--images" ) options.images_dir = value;
+    else if ( arg == "--backend" ) options.backend = value;
+    else if ( arg == "--mode" ) options.mode = value;
+    else if ( arg == "--language" ) options.language_code = value;
+    else if ( arg == "--iterations" ) options.iterations = std::atoi( value.c_str() );
+    else if ( arg == "--warmup" ) options.warmup = std::atoi( value.c_str() );
+    else if ( arg == "--presets" ) options.app_options.app_settings_preset_root = value;
+    else if ( arg == "--preset" ) options.app_options.app_settings_preset_name = value;
+    else if ( arg == "--output" ) options.output_file = value;
+    else if ( arg == "--fake-lines" ) options.fake_lines = std::atoi( value.c_str() );
+    else if ( arg == "--fake-det-us" ) options.fake_det_us = std::atoi( value.c_str() );
+    else if ( arg == "--fake-rec-us" ) options.fake_rec_us = std::atoi( value.c_str() );
+    else if ( arg == "--box-tolerance-px" ) options.box_tolerance_px = std::atoi( value.c_str() );
+    else if ( arg == "--fixture" ) options.fixture_dir = value;
+    else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  const bool compare_mode = options.mode == "db-compare" || options.mode == "preprocess-compare" || options.mode == "ctc-compare";
+
+  const bool db_fixture = options.mode == "db-compare" && !options.fixture_dir.empty();
+
+  if ( ( options.images_dir.empty() && !db_fixture ) ||
+       ( options.backend != "fake" && options.backend != "fastdeploy" ) ||
+       ( options.mode != "direct" && options.mode != "grpc" && !compare_mode ) ||
+       ( compare_mode && options.backend != "fastdeploy" && !db_fixture ) ) {
+    return false;
+  }
+
+  return true;
+}
+
+double percentile( const std::vector< double >& sorted_values, double p ) {
+
+  if ( sorted_values.empty() )
+    return 0;
+
+  const size_t idx = std::min( sorted_values.size() - 1, size_t( p * ( sorted_values.size() - 1 ) + 0.5 ) );
+
+  return sorted_values[ idx ];
+}
+
+
+// Largest coordinate difference between the vertices of two boxes
+int boxDistance( const std::array< int, 8 >& a, const std::array< int, 8 >& b ) {
+
+  int distance = 0;
+
+  for ( size_t i = 0; i < a.size(); ++i )
+    distance = std::max( distance, std::abs( a[ i ] - b[ i ] ) );
+
+  return distance;
+}
+
+// Greedy matching, each actual box is used once. Returns the expected boxes matched within tolerance_px
+size_t matchBoxes(
+  const std::vector< std::array< int, 8 > >& expected,
+  const std::vector< std::array< int, 8 > >& actual,
+  int tolerance_px,
+  int* max_matched_distance
+) {
+
+  std::vector< bool > used( actual.size(), false );
+  size_t matched = 0;
+
+  for ( const auto& expected_box : expected ) {
+
+    int best_distance = std::numeric_limits< int >::max();
+    size_t best_idx = 0;
+
+    for ( size_t i = 0; i < actual.size(); ++i ) {
+      const int distance = boxDistance( expected_box, actual[ i ] );
+      if ( !used[ i ] && distance < best_distance ) {
+        best_distance = distance;
+        best_idx = i;
+      }
+    }
+
+    if ( best_distance <= tolerance_px ) {
+      used[ best_idx ] = true;
+      matched++;
+      *max_matched_distance = std::max( *max_matched_distance, best_distance );
+    }
+  }
+
+  return matched;
+}
+
+// Runs the detector once per image, then both DB postprocessors on its output
+nlohmann::ordered_json compareDBPostprocessors(
+  InferenceManager& inference_manager,
+  const std::string& language_code,
+  const std::vector< std::string >& images,
+  const BenchOptions& options
+) {
+
+  Models models = inference_manager.getModels( language_code );
+  DBPostprocessor native_postprocessor;
+
+  size_t fastdeploy_boxes = 0, native_boxes = 0, matched_boxes = 0;
+  int max_matched_distance = 0;
+  double fastdeploy_total_ms = 0, native_total_ms = 0;
+  size_t runs = 0;
+
+  for ( const auto& image_str : images ) {
+
+    const cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+
+    std::vector< fastdeploy::FDTensor > output_tensors;
+    std::array< int, 4 > det_img_info;
+    RequestTimings timings;
+
+    if ( image.empty() || !runTextDetector( models.detection_model, image, &output_tensors, &det_img_info, &timings, models.shape_buckets, models.fused_preprocessor ) ) {
+      std::cerr << "Skipping an image the detector could not run on" << std::endl;
+      continue;
+    }
+
+    std::vector< std::array< int, 8 > > expected, actual;
+
+    for ( int i = 0; i < std::max( 1, options.iterations ); ++i ) {
+
+      auto started_at = std::chrono::steady_clock::now();
+      postprocessTextDetection( models.detection_model, output_tensors, det_img_info, &expected );
+      fastdeploy_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+      started_at = std::chrono::steady_clock::now();
+      postprocessTextDetection( models.detection_model, output_tensors, det_img_info, &actual, &native_postprocessor );
+      native_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+      runs++;
+    }
+
+    fastdeploy_boxes += expected.size();
+    native_boxes += actual.size();
+    matched_boxes += matchBoxes( expected, actual, options.box_tolerance_px, &max_matched_distance );
+  }
+
+  const double run_count = std::max< size_t >( 1, runs );
+
+  nlohmann::ordered_json report;
+  report["backend"] = options.backend;
+  report["mode"] = options.mode;
+  report["language_code"] = language_code;
+  report["images"] = images.size();
+  report["box_tolerance_px"] = options.box_tolerance_px;
+  report["boxes"] = {
+    { "fastdeploy", fastdeploy_boxes },
+    { "native", native_boxes },
+    { "matched", matched_boxes },
+    { "fastdeploy_only", fastdeploy_boxes - matched_boxes },
+    { "native_only", native_boxes - matched_boxes },
+    { "max_matched_distance_px", max_matched_distance }
+  };
+  report["postprocess_mean_ms"] = {
+    { "fastdeploy", fastdeploy_total_ms / run_count },
+    { "native", native_total_ms / run_count }
+  };
+  report["passed"] = matched_boxes == fastdeploy_boxes && matched_boxes == native_boxes;
+
+  return report;
+}
+
+// Both DB postprocessors on the probability maps of a fixture ( make_db_fixture.py ), with the fixture's
+// settings: every expected box must be found within --box-tolerance-px, and no other
+nlohmann::ordered_json checkDBFixture( const BenchOptions& options ) {
+
+  nlohmann::ordered_json report;
+  report["mode"] = options.mode;
+  report["fixture"] = options.fixture_dir;
+  report["box_tolerance_px"] = options.box_tolerance_px;
+  report["passed"] = false;
+
+  const std::string expected_file = options.fixture_dir + sep + "expected_boxes.json";
+
+  if ( !std::filesystem::exists( expected_file ) ) {
+    std::cerr << expected_file << " not found" << std::endl;
+    return report;
+  }
+
+  const nlohmann::json fixture = readJsonFile( expected_file );
+  const nlohmann::json& fixture_settings = fixture["settings"];
+
+  fastdeploy::vision::ocr::DBDetectorPostprocessor settings;
+  settings.SetDetDBThresh( fixture_settings["det_db_thresh"].get< double >() );
+  settings.SetDetDBBoxThresh( fixture_settings["det_db_box_thresh"].get< double >() );
+  settings.SetDetDBUnclipRatio( fixture_settings["det_db_unclip_ratio"].get< double >() );
+  settings.SetDetDBScoreMode( fixture_settings["det_db_score_mode"].get< std::string >() );
+  settings.SetUseDilation( fixture_settings["use_dilation"].get< bool >() );
+
+  DBPostprocessor native_postprocessor;
+
+  size_t expected_boxes = 0, missing_boxes = 0, extra_boxes = 0;
+  int max_matched_distance = 0;
+  nlohmann::ordered_json failures = nlohmann::ordered_json::array();
+
+  for ( const auto& map_entry : fixture["maps"].items() ) {
+
+    const cv::Mat map = cv::imread( options.fixture_dir + sep + map_entry.key(), cv::IMREAD_GRAYSCALE );
+
+    if ( map.empty() ) {
+      std::cerr << "Failed to read " << map_entry.key() << std::endl;
+      return report;
+    }
+
+    cv::Mat probabilities;
+    map.convertTo( probabilities, CV_32F, 1.0 / 255 );
+
+    std::vector< fastdeploy::FDTensor > output_tensors( 1 );
+    output_tensors[ 0 ].SetExternalData( { 1, 1, probabilities.rows, probabilities.cols }, fastdeploy::FDDataType::FP32, probabilities.data );
+
+    const std::array< int, 4 > det_img_info = { probabilities.cols, probabilities.rows, probabilities.cols, probabilities.rows };
+
+    std::vector< std::array< int, 8 > > expected;
+
+    for ( const auto& box : map_entry.value() )
+      expected.push_back( box.get< std::array< int, 8 > >() );
+
+    expected_boxes += expected.size();
+
+    std::vector< std::vector< std::array< int, 8 > > > fastdeploy_boxes;
+    std::vector< std::array< int, 8 > > native_boxes;
+
+    if ( !settings.Run( output_tensors, &fastdeploy_boxes, { det_img_info } ) ||
+         !native_postprocessor.Run( output_tensors[ 0 ], det_img_info, settings, &native_boxes ) ) {
+      std::cerr << "Failed to postprocess " << map_entry.key() << std::endl;
+      return report;
+    }
+
+    const std::pair< std::string, const std::vector< std::array< int, 8 > >* > implementations[] = {
+      { "fastdeploy", &fastdeploy_boxes[ 0 ] },
+      { "native", &native_boxes }
+    };
+
+    for ( const auto& implementation : implementations ) {
+
+      const size_t matched = matchBoxes( expected, *implementation.second, options.box_tolerance_px, &max_matched_distance );
+
+      if ( matched == expected.size() && matched == implementation.second->size() )
+        continue;
+
+      missing_boxes += expected.size() - matched;
+      extra_boxes += implementation.second->size() - matched;
+
+      failures.push_back( {
+        { "map", map_entry.key() },
+        { "postprocessor", implementation.first },
+        { "expected", expected },
+        { "found", *implementation.second }
+      } );
+    }
+  }
+
+  report["boxes"] = {
+    { "expected", expected_boxes },
+    { "missing", missing_boxes },
+    { "extra", extra_boxes },
+    { "max_matched_distance_px", max_matched_distance }
+  };
+  report["failures"] = failures;
+  report["passed"] = failures.empty();
+
+  return report;
+}
+
+
+// Detector inputs of the FastDeploy preprocessor and of the fused one ( scalar reference and SIMD kernel )
+nlohmann::ordered_json comparePreprocessors(
+  InferenceManager& inference_manager,
+  const std::string& language_code,
+  const std::vector< std::string >& images,
+  const BenchOptions& options
+) {
+
+  Models models = inference_manager.getModels( language_code );
+  auto& detector_preprocessor = models.detection_model->GetPreprocessor();
+  auto& recognizer_preprocessor = models.recognition_model->GetPreprocessor();
+
+  const FusedPreprocessor scalar_preprocessor( SimdLevel::SCALAR );
+  const FusedPreprocessor simd_preprocessor;
+
+  double fastdeploy_total_ms = 0, scalar_total_ms = 0, simd_total_ms = 0;
+  float max_scalar_diff = 0, max_simd_diff = 0; // Against FastDeploy, against the scalar reference
+  size_t runs = 0, shape_mismatches = 0;
+
+  // The same for the recognizer input, one batch per rec_batch_size lines as the pipeline runs them
+  double rec_fastdeploy_total_ms = 0, rec_scalar_total_ms = 0, rec_simd_total_ms = 0;
+  float rec_max_scalar_diff = 0, rec_max_simd_diff = 0;
+  size_t rec_runs = 0, rec_batches = 0, rec_lines = 0, rec_shape_mismatches = 0;
+
+  auto maxDifference = []( const fastdeploy::FDTensor& a, const fastdeploy::FDTensor& b ) {
+
+    const float* a_data = static_cast< const float* >( a.Data() );
+    const float* b_data = static_cast< const float* >( b.Data() );
+
+    float difference = 0;
+    for ( int i = 0; i < a.Numel(); ++i )
+      difference = std::max( difference, std::abs( a_data[ i ] - b_data[ i ] ) );
+
+    return difference;
+  };
+
+  for ( const auto& image_str : images ) {
+
+    const cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+
+    if ( image.empty() || !FusedPreprocessor::supports( image ) )
+      continue;
+
+    std::vector< fastdeploy::FDTensor > expected;
+    fastdeploy::FDTensor scalar_input, simd_input;
+    std::array< int, 4 > det_img_info;
+
+    for ( int i = 0; i < std::max( 1, options.iterations ); ++i ) {
+
+      std::vector< cv::Mat > batch = { image };
+      std::vector< fastdeploy::vision::FDMat > fd_images = fastdeploy::vision::WrapMat( batch );
+
+      auto started_at = std::chrono::steady_clock::now();
+      detector_preprocessor.Run( &fd_images, &expected );
+      fastdeploy_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+      started_at = std::chrono::steady_clock::now();
+      scalar_preprocessor.detectorInput( image, detector_preprocessor.GetMaxSideLen(), &scalar_input, &det_img_info );
+      scalar_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+      started_at = std::chrono::steady_clock::now();
+      simd_preprocessor.detectorInput( image, detector_preprocessor.GetMaxSideLen(), &simd_input, &det_img_info );
+      simd_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+      runs++;
+    }
+
+    if ( expected.empty() || expected[0].shape != scalar_input.shape ) {
+      shape_mismatches++;
+      continue;
+    }
+
+    max_scalar_diff = std::max( max_scalar_diff, maxDifference( expected[0], scalar_input ) );
+    max_simd_diff = std::max( max_simd_diff, maxDifference( scalar_input, simd_input ) );
+
+    std::vector< std::array< int, 8 > > boxes;
+    RequestTimings timings;
+
+    if ( !detectText( models.detection_model, image, &boxes, &timings, models.db_postprocessor, models.shape_buckets, models.fused_preprocessor ) )
+      continue;
+
+    std::vector< cv::Mat > text_images;
+    std::vector< int > indices;
+
+    for ( size_t i = 0; i < boxes.size(); ++i ) {
+      text_images.push_back( fastdeploy::vision::ocr::GetRotateCropImage( image, boxes[ i ] ) );
+      indices.push_back( int( i ) );
+    }
+
+    const std::vector< int > rec_image_shape = recognizer_preprocessor.GetRecImageShape();
+
+    for ( size_t start_idx = 0; start_idx < text_images.size(); start_idx += rec_batch_size ) {
+
+      const size_t end_idx = std::min( text_images.size(), start_idx + rec_batch_size );
+
+      std::vector< fastdeploy::FDTensor > rec_expected;
+      fastdeploy::FDTensor rec_scalar_input, rec_simd_input;
+      bool fastdeploy_ok = true, scalar_ok = true, simd_ok = true;
+
+      for ( int i = 0; i < std::max( 1, options.iterations ); ++i ) {
+
+        std::vector< fastdeploy::vision::FDMat > fd_images = fastdeploy::vision::WrapMat( text_images );
+
+        auto started_at = std::chrono::steady_clock::now();
+        fastdeploy_ok = recognizer_preprocessor.Run( &fd_images, &rec_expected, start_idx, end_idx, indices );
+        rec_fastdeploy_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        started_at = std::chrono::steady_clock::now();
+        scalar_ok = scalar_preprocessor.recognizerInput( text_images, start_idx, end_idx, indices, rec_image_shape, &rec_scalar_input );
+        rec_scalar_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        started_at = std::chrono::steady_clock::now();
+        simd_ok = simd_preprocessor.recognizerInput( text_images, start_idx, end_idx, indices, rec_image_shape, &rec_simd_input );
+        rec_simd_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        rec_runs++;
+      }
+
+      rec_batches++;
+      rec_lines += end_idx - start_idx;
+
+      // A batch the fused preprocessing refuses ( lines that are not 8 bit BGR ) counts as a mismatch too
+      if ( !fastdeploy_ok || !scalar_ok || !simd_ok || rec_expected.empty() ||
+           rec_expected[0].shape != rec_scalar_input.shape || rec_scalar_input.shape != rec_simd_input.shape ) {
+        rec_shape_mismatches++;
+        continue;
+      }
+
+      rec_max_scalar_diff = std::max( rec_max_scalar_diff, maxDifference( rec_expected[0], rec_scalar_input ) );
+      rec_max_simd_diff = std::max( rec_max_simd_diff, maxDifference( rec_scalar_input, rec_simd_input ) );
+    }
+  }
+
+  const double run_count = std::max< size_t >( 1, runs );
+  const double rec_run_count = std::max< size_t >( 1, rec_runs );
+
+  nlohmann::ordered_json report;
+  report["backend"] = options.backend;
+  report["mode"] = options.mode;
+  report["language_code"] = language_code;
+  report["images"] = images.size();
+  report["simd"] = simdLevelName( simd_preprocessor.simdLevel() );
+  report["shape_mismatches"] = shape_mismatches;
+  report["max_difference"] = {
+    { "scalar_vs_fastdeploy", max_scalar_diff },
+    { "simd_vs_scalar", max_simd_diff }
+  };
+  report["preprocess_mean_ms"] = {
+    { "fastdeploy", fastdeploy_total_ms / run_count },
+    { "scalar", scalar_total_ms / run_count },
+    { "simd", simd_total_ms / run_count }
+  };
+  report["recognizer"] = {
+    { "lines", rec_lines },
+    { "batches", rec_batches },
+    { "shape_mismatches", rec_shape_mismatches },
+    { "max_difference", {
+      { "scalar_vs_fastdeploy", rec_max_scalar_diff },
+      { "simd_vs_scalar", rec_max_simd_diff }
+    } },
+    { "preprocess_mean_ms", {
+      { "fastdeploy", rec_fastdeploy_total_ms / rec_run_count },
+      { "scalar", rec_scalar_total_ms / rec_run_count },
+      { "simd", rec_simd_total_ms / rec_run_count }
+    } }
+  };
+
+  return report;
+}
+
+// Recognizer output of the lines of every image, decoded by FastDeploy's postprocessor and the native
+// CTC decoder ( scalar reference and SIMD kernel )
+nlohmann::ordered_json compareCTCDecoders(
+  InferenceManager& inference_manager,
+  const std::string& language_code,
+  const std::vector< std::string >& images,
+  const BenchOptions& options
+) {
+
+  Models models = inference_manager.getModels( language_code );
+
+  const auto simd_decoder = CTCDecoder::fromLabelFile( models.rec_label_file );
+
+  if ( simd_decoder == nullptr )
+    return nlohmann::ordered_json();
+
+  const CTCDecoder scalar_decoder( *simd_decoder, SimdLevel::SCALAR );
+
+  double fastdeploy_total_ms = 0, scalar_total_ms = 0, simd_total_ms = 0;
+  float max_score_diff = 0;
+  size_t runs = 0, lines = 0, text_mismatches = 0, simd_mismatches = 0;
+
+  for ( const auto& image_str : images ) {
+
+    const cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+
+    std::vector< std::array< int, 8 > > boxes;
+    RequestTimings timings;
+
+    if ( image.empty() || !detectText( models.detection_model, image, &boxes, &timings, models.db_postprocessor, models.shape_buckets, models.fused_preprocessor ) )
+      continue;
+
+    std::vector< cv::Mat > text_images;
+    std::vector< int > indices;
+
+    for ( size_t i = 0; i < boxes.size(); ++i ) {
+      text_images.push_back( fastdeploy::vision::ocr::GetRotateCropImage( image, boxes[ i ] ) );
+      indices.push_back( int( i ) );
+    }
+
+    // One batch per rec_batch_size lines, as the pipeline runs them
+    for ( size_t start_idx = 0; start_idx < text_images.size(); start_idx += rec_batch_size ) {
+
+      const size_t end_idx = std::min( text_images.size(), start_idx + rec_batch_size );
+
+      std::vector< fastdeploy::vision::FDMat > fd_images = fastdeploy::vision::WrapMat( text_images );
+      std::vector< fastdeploy::FDTensor > input_tensors, output_tensors;
+
+      if ( !models.recognition_model->GetPreprocessor().Run( &fd_images, &input_tensors, start_idx, end_idx, indices ) )
+        continue;
+
+      input_tensors[0].name = models.recognition_model->InputInfoOfRuntime(0).name;
+
+      if ( !models.recognition_model->Infer( input_tensors, &output_tensors ) )
+        continue;
+
+      std::vector< std::string > expected, scalar_texts, simd_texts;
+      std::vector< float > expected_scores, scalar_scores, simd_scores;
+
+      for ( int i = 0; i < std::max( 1, options.iterations ); ++i ) {
+
+        auto started_at = std::chrono::steady_clock::now();
+        models.recognition_model->GetPostprocessor().Run( output_tensors, &expected, &expected_scores, start_idx, text_images.size(), indices );
+        fastdeploy_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        started_at = std::chrono::steady_clock::now();
+        scalar_decoder.decodeBatch( output_tensors[0], &scalar_texts, &scalar_scores, start_idx, text_images.size(), indices );
+        scalar_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        started_at = std::chrono::steady_clock::now();
+        simd_decoder->decodeBatch( output_tensors[0], &simd_texts, &simd_scores, start_idx, text_images.size(), indices );
+        simd_total_ms += std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+
+        runs++;
+      }
+
+      for ( size_t i = start_idx; i < end_idx; ++i ) {
+        lines++;
+        text_mismatches += expected[ i ] != scalar_texts[ i ];
+        simd_mismatches += scalar_texts[ i ] != simd_texts[ i ] || scalar_scores[ i ] != simd_scores[ i ];
+        max_score_diff = std::max( max_score_diff, std::abs( expected_scores[ i ] - scalar_scores[ i ] ) );
+      }
+    }
+  }
+
+  const double run_count = std::max< size_t >( 1, runs );
+
+  nlohmann::ordered_json report;
+  report["backend"] = options.backend;
+  report["mode"] = options.mode;
+  report["language_code"] = language_code;
+  report["images"] = images.size();
+  report["lines"] = lines;
+  report["simd"] = simdLevelName( simd_decoder->simdLevel() );
+  report["mismatches"] = {
+    { "scalar_vs_fastdeploy_texts", text_mismatches },
+    { "simd_vs_scalar_lines", simd_mismatches }
+  };
+  report["max_score_difference"] = max_score_diff;
+  report["decode_mean_ms"] = {
+    { "fastdeploy", fastdeploy_total_ms / run_count },
+    { "scalar", scalar_total_ms / run_count },
+    { "simd", simd_total_ms / run_count }
+  };
+
+  return report;
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  BenchOptions options;
+
+  if ( !handleBenchArgs( argc, argv, options ) ) {
+    printBenchUsage();
+    return 1;
+  }
+
+  if ( !options.fixture_dir.empty() && options.mode == "db-compare" ) {
+
+    nlohmann::ordered_json report = checkDBFixture( options );
+
+    std::cout << std::setw(4) << report << std::endl;
+
+    if ( !options.output_file.empty() )
+      writeJsonFile( report, options.output_file );
+
+    return report["passed"].get< bool >() ? 0 : 1;
+  }
+
+  const std::vector< std::string > images = loadImageSet( options.images_dir );
+
+  if ( images.empty() ) {
+    std::cerr << "No images found in " << options.images_dir << std::endl;
+    return 1;
+  }
+
+  PPOCRService service( options.app_options );
+
+  std::string language_code = options.language_code;
+  if ( language_code.empty() )
+    language_code = service.getSettingsManager().getDefaultLanguageCode();
+
+  if ( options.mode == "db-compare" || options.mode == "preprocess-compare" || options.mode == "ctc-compare" ) {
+
+    nlohmann::ordered_json report;
+
+    if ( options.mode == "db-compare" )
+      report = compareDBPostprocessors( service.getInferenceManager(), language_code, images, options );
+    else if ( options.mode == "preprocess-compare" )
+      report = comparePreprocessors( service.getInferenceManager(), language_code, images, options );
+    else
+      report = compareCTCDecoders( service.getInferenceManager(), language_code, images, options );
+
+    std::cout << std::setw(4) << report << std::endl;
+
+    if ( !options.output_file.empty() )
+      writeJsonFile( report, options.output_file );
+
+    return report.value( "passed", true ) ? 0 : 1;
+  }
+
+  if ( options.backend == "fake" ) {
+    service.getInferenceManager().setPipeline(
+      language_code,
+      std::make_shared< OCRPipeline >(
+        std::make_shared< FakeOCRBackend >( options.fake_lines, options.fake_det_us, options.fake_rec_us ),
+        cls_batch_size,
+        rec_batch_size
+      )
+    );
+  }
+
+  std::unique_ptr< grpc::Server > server;
+  std::unique_ptr< OCRService::Stub > stub;
+
+  if ( options.mode == "grpc" ) {
+    grpc::ServerBuilder builder;
+    builder.RegisterService( &service );
+    builder.SetMaxReceiveMessageSize( 15 * 1024 * 1024 );
+    server = builder.BuildAndStart();
+    stub = OCRService::NewStub( server->InProcessChannel( grpc::ChannelArguments() ) );
+  }
+
+  RecognizeBytesRequest request;
+  request.set_language_code( language_code );
+  request.set_include_timings( true );
+
+  RequestTimings stage_totals; // Sums, rec_batch_us[ 0 ] holds all recognizer batches
+  stage_totals.rec_batch_us.push_back( 0 );
+
+  auto sendRequest = [&]( const std::string& image, bool record ) -> bool {
+
+    request.set_image_bytes( image );
+
+    // Response on a per-request arena: in direct mode this measures the serialization
+    // path with arena-allocated messages (the sync gRPC server allocates its own)
+    google::protobuf::Arena arena;
+    RecognizeDefaultResponse& response = *google::protobuf::Arena::CreateMessage< RecognizeDefaultResponse >( &arena );
+    Status status;
+
+    if ( stub ) {
+      grpc::ClientContext client_context;
+      status = stub->RecognizeBytes( &client_context, request, &response );
+    }
+    else {
+      grpc::ServerContext server_context;
+      status = service.RecognizeBytes( &server_context, &request, &response );
+    }
+
+    if ( !status.ok() ) {
+      std::cerr << "Request failed: " << status.error_message() << std::endl;
+      return false;
+    }
+
+    if ( record ) {
+      const auto& timings = response.timings();
+      stage_totals.queue_wait_us += timings.queue_wait_us();
+      stage_totals.decode_us += timings.decode_us();
+      stage_totals.det_preprocess_us += timings.det_preprocess_us();
+      stage_totals.det_infer_us += timings.det_infer_us();
+      stage_totals.det_postprocess_us += timings.det_postprocess_us();
+      stage_totals.cls_us += timings.cls_us();
+      for ( const auto batch_us : timings.rec_batch_us() )
+        stage_totals.rec_batch_us[ 0 ] += batch_us;
+      stage_totals.serialize_us += timings.serialize_us();
+    }
+
+    return true;
+  };
+
+  for ( int i = 0; i < options.warmup; ++i ) {
+    for ( const auto& image : images ) {
+      if ( !sendRequest( image, false ) )
+        return 1;
+    }
+  }
+
+  std::vector< double > latencies_ms;
+  latencies_ms.reserve( images.size() * std::max( 0, options.iterations ) );
+
+  const uint64_t allocations_before = allocation_count.load();
+  const uint64_t allocation_bytes_before = allocation_bytes.load();
+  const auto started_at = std::chrono::steady_clock::now();
+
+  for ( int i = 0; i < options.iterations; ++i ) {
+    for ( const auto& image : images ) {
+
+      const auto request_started_at = std::chrono::steady_clock::now();
+
+      if ( !sendRequest( image, true ) )
+        return 1;
+
+      latencies_ms.push_back(
+        std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - request_started_at ).count()
+      );
+    }
+  }
+
+  const double elapsed_s = std::chrono::duration< double >( std::chrono::steady_clock::now() - started_at ).count();
+  const uint64_t allocations = allocation_count.load() - allocations_before;
+  const uint64_t allocated_bytes = allocation_bytes.load() - allocation_bytes_before;
+
+  if ( server )
+    server->Shutdown();
+
+  const double request_count = std::max< size_t >( 1, latencies_ms.size() );
+
+  std::vector< double > sorted_latencies = latencies_ms;
+  std::sort( sorted_latencies.begin(), sorted_latencies.end() );
+
+  double latency_sum_ms = 0;
+  for ( double latency : latencies_ms )
+    latency_sum_ms += latency;
+
+  auto stageMeanMs = [&]( uint64_t total_us ) {
+    return total_us / request_count / 1000.0;
+  };
+
+  nlohmann::ordered_json report;
+  report["backend"] = options.backend;
+  report["mode"] = options.mode;
+  report["language_code"] = language_code;
+  report["images"] = images.size();
+  report["requests"] = latencies_ms.size();
+  report["elapsed_s"] = elapsed_s;
+  report["throughput_rps"] = latencies_ms.size() / elapsed_s;
+  report["latency_ms"] = {
+    { "mean", latency_sum_ms / request_count },
+    { "p50", percentile( sorted_latencies, 0.50 ) },
+    { "p95", percentile( sorted_latencies, 0.95 ) },
+    { "p99", percentile( sorted_latencies, 0.99 ) },
+    { "max", sorted_latencies.empty() ? 0 : sorted_latencies.back() }
+  };
+  report["allocations_per_request"] = allocations / request_count;
+  report["allocated_bytes_per_request"] = allocated_bytes / request_count;
+  report["stage_mean_ms"] = {
+    { "queue_wait", stageMeanMs( stage_totals.queue_wait_us ) },
+    { "decode", stageMeanMs( stage_totals.decode_us ) },
+    { "det_preprocess", stageMeanMs( stage_totals.det_preprocess_us ) },
+    { "det_infer", stageMeanMs( stage_totals.det_infer_us ) },
+    { "det_postprocess", stageMeanMs( stage_totals.det_postprocess_us ) },
+    { "cls", stageMeanMs( stage_totals.cls_us ) },
+    { "rec", stageMeanMs( stage_totals.rec_batch_us[ 0 ] ) },
+    { "serialize", stageMeanMs( stage_totals.serialize_us ) }
+  };
+
+  std::cout << std::setw(4) << report << std::endl;
+
+  if ( !options.output_file.empty() )
+    writeJsonFile( report, options.output_file );
+
+  return 0;
+}
@@ -0,0 +1,417 @@
+// ppocr_calibrate: INT8 post-training quantization workflow of a language preset.
+//
+// dump    runs the fp32 models over an image corpus and writes the detector and recognizer
+//         input tensors (.npy) that quantize_int8.py calibrates the int8 models with
+// report  runs the fp32 and the int8 ( inference_int8.onnx ) models over an image corpus
+//         and reports detection / recognition agreement and latency as JSON
+//
+// Runs from the service directory ( ./presets, ./models ), like the services.
+// The int8 models load with the ONNX_CPU, Open_VINO, ONNX_GPU and Tensor_RT backends.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include "../hpp/settings_manager.hpp"
+#include "../hpp/inference_pipeline_builder.hpp"
+#include "../hpp/memory_manager.hpp"
+#include "../hpp/util.hpp"
+#include "image_set.hpp"
+
+
+struct CalibrateOptions {
+  std::string command; // dump | report
+  std::string images_dir;
+  std::string language_code;
+  std::string output; // dump: directory, report: JSON file (optional)
+  int max_images = 0; // 0 = every image
+  int max_lines = 32; // dump: recognizer samples per image
+  AppOptions app_options;
+};
+
+void printCalibrateUsage() {
+  std::cout << "Usage: ppocr_calibrate dump --images DIR --output DIR [--language CODE] [--max-images N] [--max-lines N]\n"
+               "                            [--presets ROOT] [--preset NAME]\n"
+               "       ppocr_calibrate report --images DIR [--language CODE] [--output FILE] [--max-images N]\n"
+               "                              [--presets ROOT] [--preset NAME]\n"
+            << std::endl;
+}
+
+bool handleCalibrateArgs( int argc, char *argv[], CalibrateOptions& options ) {
+
+  if ( argc < 2 )
+    return false;
+
+  options.command = argv[ 1 ];
+
+  for ( int i = 2; i < argc; ++i ) {
+
+    const std::string arg = argv[ i ];
+
+    if ( i + 1 >= argc ) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[ ++i ];
+
+    if ( arg == "--images" ) options.images_dir = value;
+    else if ( arg == "--language" ) options.language_code = value;
+    else if ( arg == "--output" ) options.output = value;
+    else if ( arg == "--max-images" ) options.max_images = std::atoi( value.c_str() );
+    else if ( arg == "--max-lines" ) options.max_lines = std::atoi( value.c_str() );
+    else if ( arg == "--presets" ) options.app_options.app_settings_preset_root = value;
+    else if ( arg == "--preset" ) options.app_options.app_settings_preset_name = value;
+    else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  if ( options.images_dir.empty() ||
+       ( options.command != "dump" && options.command != "report" ) ||
+       ( options.command == "dump" && options.output.empty() ) ) {
+    return false;
+  }
+
+  return true;
+}
+
+
+// Float32 tensor in the .npy format ( version 1.0 )
+bool writeNpy( const fastdeploy::FDTensor& tensor, const std::string& path ) {
+
+  if ( tensor.dtype != fastdeploy::FDDataType::FP32 )
+    return false;
+
+  std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (";
+  for ( const int64_t dim : tensor.shape )
+    header += std::to_string( dim ) + ", ";
+  header += "), }";
+
+  // Magic, version and header length take 10 bytes, the data starts 64 byte aligned
+  header.append( ( 64 - ( 10 + header.size() + 1 ) % 64 ) % 64, ' ' );
+  header.push_back( '\n' );
+
+  const uint16_t header_size = uint16_t( header.size() );
+  const char header_size_le[] = { char( header_size & 0xff ), char( header_size >> 8 ) };
+
+  std::ofstream file( path, std::ios::binary );
+  file.write( "\x93NUMPY\x01\x00", 8 );
+  file.write( header_size_le, 2 );
+  file.write( header.data(), header.size() );
+  file.write( static_cast< const char* >( tensor.Data() ), tensor.Nbytes() );
+
+  return bool( file );
+}
+
+std::string sampleName( size_t idx ) {
+  std::string name = std::to_string( idx );
+  return std::string( name.size() < 6 ? 6 - name.size() : 0, '0' ) + name + ".npy";
+}
+
+// Detector inputs ( letterboxed like the service when "det_input_buckets" is set ) and
+// recognizer inputs of the text lines the fp32 detector finds
+int dumpCalibrationData( const CalibrateOptions& options, const std::vector< std::string >& images, Models& models ) {
+
+  const std::filesystem::path det_dir = std::filesystem::path( options.output ) / "det";
+  const std::filesystem::path rec_dir = std::filesystem::path( options.output ) / "rec";
+
+  std::filesystem::create_directories( det_dir );
+  std::filesystem::create_directories( rec_dir );
+
+  size_t det_samples = 0, rec_samples = 0;
+
+  for ( const auto& image_str : images ) {
+
+    const cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+
+    if ( image.empty() )
+      continue;
+
+    cv::Mat letterboxed;
+    cv::Size scaled_size;
+
+    const bool use_buckets = models.shape_buckets != nullptr && models.shape_buckets->hasDetectorBuckets();
+
+    if ( use_buckets )
+      models.shape_buckets->letterbox( image, &letterboxed, &scaled_size );
+
+    std::vector< cv::Mat > det_images = { use_buckets ? letterboxed : image };
+    std::vector< fastdeploy::vision::FDMat > fd_det_images = fastdeploy::vision::WrapMat( det_images );
+    std::vector< fastdeploy::FDTensor > det_tensors;
+
+    if ( models.detection_model->GetPreprocessor().Run( &fd_det_images, &det_tensors ) &&
+         writeNpy( det_tensors[0], ( det_dir / sampleName( det_samples ) ).string() ) ) {
+      det_samples++;
+    }
+
+    std::vector< std::array< int, 8 > > boxes;
+    RequestTimings timings;
+
+    if ( !detectText( models.detection_model, image, &boxes, &timings, models.db_postprocessor, models.shape_buckets, models.fused_preprocessor ) )
+      continue;
+
+    for ( size_t i = 0; i < boxes.size() && int( i ) < options.max_lines; ++i ) {
+
+      std::vector< cv::Mat > lines = { fastdeploy::vision::ocr::GetRotateCropImage( image, boxes[ i ] ) };
+      std::vector< fastdeploy::vision::FDMat > fd_lines = fastdeploy::vision::WrapMat( lines );
+      std::vector< fastdeploy::FDTensor > rec_tensors;
+
+      if ( models.recognition_model->GetPreprocessor().Run( &fd_lines, &rec_tensors, 0, 1, { 0 } ) &&
+           writeNpy( rec_tensors[0], ( rec_dir / sampleName( rec_samples ) ).string() ) ) {
+        rec_samples++;
+      }
+    }
+  }
+
+  std::cout << det_samples << " detector and " << rec_samples << " recognizer samples written to " << options.output << "\n"
+               "Next: python quantize_int8.py --model-dir <detection_model_dir> --calibration " << det_dir.string() << "\n"
+               "      python quantize_int8.py --model-dir <recognition_model_dir> --calibration " << rec_dir.string()
+            << std::endl;
+
+  return det_samples > 0 ? 0 : 1;
+}
+
+
+// Text as code points, for the character error rate
+std::vector< uint32_t > codePoints( const std::string& text ) {
+
+  std::vector< uint32_t > points;
+
+  for ( size_t i = 0; i < text.size(); ) {
+
+    const unsigned char lead = text[ i ];
+    const int length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+
+    uint32_t point = length == 1 ? lead : lead & ( 0x3F >> ( length - 1 ) );
+    for ( int k = 1; k < length && i + k < text.size(); ++k )
+      point = ( point << 6 ) | ( static_cast< unsigned char >( text[ i + k ] ) & 0x3F );
+
+    points.push_back( point );
+    i += length;
+  }
+
+  return points;
+}
+
+size_t editDistance( const std::vector< uint32_t >& a, const std::vector< uint32_t >& b ) {
+
+  std::vector< size_t > row( b.size() + 1 );
+
+  for ( size_t j = 0; j <= b.size(); ++j )
+    row[ j ] = j;
+
+  for ( size_t i = 1; i <= a.size(); ++i ) {
+
+    size_t diagonal = row[0];
+    row[0] = i;
+
+    for ( size_t j = 1; j <= b.size(); ++j ) {
+      const size_t substitution = diagonal + ( a[ i - 1 ] != b[ j - 1 ] );
+      diagonal = row[ j ];
+      row[ j ] = std::min( { row[ j ] + 1, row[ j - 1 ] + 1, substitution } );
+    }
+  }
+
+  return row[ b.size() ];
+}
+
+// Intersection over union of the bounding rectangles of two boxes
+float boxIoU( const std::array< int, 8 >& a, const std::array< int, 8 >& b ) {
+
+  auto bounds = []( const std::array< int, 8 >& box ) {
+    return cv::Rect(
+      cv::Point( std::min( { box[0], box[2], box[4], box[6] } ), std::min( { box[1], box[3], box[5], box[7] } ) ),
+      cv::Point( std::max( { box[0], box[2], box[4], box[6] } ), std::max( { box[1], box[3], box[5], box[7] } ) )
+    );
+  };
+
+  const cv::Rect rect_a = bounds( a ), rect_b = bounds( b );
+  const float intersection = float( ( rect_a & rect_b ).area() );
+  const float area_union = float( rect_a.area() + rect_b.area() ) - intersection;
+
+  return area_union > 0 ? intersection / area_union : 0;
+}
+
+double elapsedMs( std::chrono::steady_clock::time_point started_at ) {
+  return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - started_at ).count();
+}
+
+// The int8 results against the fp32 ones as the reference
+int reportAccuracy(
+  const CalibrateOptions& options,
+  const std::vector< std::string >& images,
+  const std::string& language_code,
+  const Models& fp32_models,
+  const Models& int8_models
+) {
+
+  OCRPipeline fp32_pipeline( std::make_shared< FastDeployOCRBackend >( fp32_models ), cls_batch_size, rec_batch_size );
+  OCRPipeline int8_pipeline( std::make_shared< FastDeployOCRBackend >( int8_models ), cls_batch_size, rec_batch_size );
+
+  CancellationCounters counters;
+  const RequestContext context;
+
+  size_t fp32_lines = 0, int8_lines = 0, matched_lines = 0, exact_lines = 0;
+  size_t reference_chars = 0, char_errors = 0;
+  double fp32_ms = 0, int8_ms = 0;
+  size_t frames = 0;
+
+  for ( const auto& image_str : images ) {
+
+    const cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+
+    if ( image.empty() )
+      continue;
+
+    fastdeploy::vision::OCRResult expected, actual;
+    RequestTimings timings;
+
+    auto started_at = std::chrono::steady_clock::now();
+    if ( fp32_pipeline.predict( image, &expected, context, counters, &timings ) != InferenceStatus::OK )
+      continue;
+    const double frame_fp32_ms = elapsedMs( started_at );
+
+    started_at = std::chrono::steady_clock::now();
+    if ( int8_pipeline.predict( image, &actual, context, counters, &timings ) != InferenceStatus::OK )
+      continue;
+    int8_ms += elapsedMs( started_at );
+
+    // Only the frames both precisions completed, so the mean times compare the same frames
+    fp32_ms += frame_fp32_ms;
+
+    frames++;
+    fp32_lines += expected.boxes.size();
+    int8_lines += actual.boxes.size();
+
+    for ( const auto& text : expected.text )
+      reference_chars += codePoints( text ).size();
+
+    // Greedy matching, each int8 line is used once. Missed lines count all their characters as errors
+    std::vector< bool > used( actual.boxes.size(), false );
+
+    for ( size_t i = 0; i < expected.boxes.size(); ++i ) {
+
+      float best_iou = 0.5f; // Minimum overlap of a match
+      int best_idx = -1;
+
+      for ( size_t j = 0; j < actual.boxes.size(); ++j ) {
+        const float iou = boxIoU( expected.boxes[ i ], actual.boxes[ j ] );
+        if ( !used[ j ] && iou >= best_iou ) {
+          best_iou = iou;
+          best_idx = int( j );
+        }
+      }
+
+      const std::vector< uint32_t > reference = codePoints( expected.text[ i ] );
+
+      if ( best_idx < 0 ) {
+        char_errors += reference.size();
+        continue;
+      }
+
+      used[ best_idx ] = true;
+      matched_lines++;
+
+      const size_t errors = editDistance( reference, codePoints( actual.text[ best_idx ] ) );
+      char_errors += errors;
+      exact_lines += errors == 0;
+    }
+  }
+
+  const double frame_count = std::max< size_t >( 1, frames );
+
+  nlohmann::ordered_json report;
+  report["language_code"] = language_code;
+  report["images"] = frames;
+  report["int8_models"] = {
+    { "detection", int8_models.detection_model != fp32_models.detection_model },
+    { "classification", int8_models.classification_model != fp32_models.classification_model },
+    { "recognition", int8_models.recognition_model != fp32_models.recognition_model }
+  };
+  report["detection"] = {
+    { "fp32_lines", fp32_lines },
+    { "int8_lines", int8_lines },
+    { "matched_lines", matched_lines },
+    { "recall", fp32_lines > 0 ? double( matched_lines ) / fp32_lines : 1.0 },
+    { "precision", int8_lines > 0 ? double( matched_lines ) / int8_lines : 1.0 }
+  };
+  report["recognition"] = {
+    { "exact_line_match", fp32_lines > 0 ? double( exact_lines ) / fp32_lines : 1.0 },
+    { "character_error_rate", reference_chars > 0 ? double( char_errors ) / reference_chars : 0.0 }
+  };
+  report["latency_mean_ms"] = {
+    { "fp32", fp32_ms / frame_count },
+    { "int8", int8_ms / frame_count },
+    { "speedup", int8_ms > 0 ? fp32_ms / int8_ms : 0.0 }
+  };
+
+  std::cout << std::setw(4) << report << std::endl;
+
+  if ( !options.output.empty() ) {
+    std::string output_file = options.output;
+    writeJsonFile( report, output_file );
+  }
+
+  return 0;
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  CalibrateOptions options;
+
+  if ( !handleCalibrateArgs( argc, argv, options ) ) {
+    printCalibrateUsage();
+    return 1;
+  }
+
+  std::vector< std::string > images = loadImageSet( options.images_dir );
+
+  if ( options.max_images > 0 && images.size() > size_t( options.max_images ) )
+    images.resize( options.max_images );
+
+  if ( images.empty() ) {
+    std::cerr << "No images found in " << options.images_dir << std::endl;
+    return 1;
+  }
+
+  SettingsManager settings_manager( options.app_options );
+  settings_manager.initSettings();
+
+  const std::string language_code = options.language_code.empty()
+    ? settings_manager.getDefaultLanguageCode()
+    : options.language_code;
+
+  const auto preset_it = settings_manager.language_presets.find( language_code );
+
+  if ( preset_it == settings_manager.language_presets.end() ) {
+    std::cerr << "No language preset for " << language_code << std::endl;
+    return 1;
+  }
+
+  const AppSettingsPreset& app_settings = settings_manager.getAppSettingsPreset();
+
+  LanguagePreset fp32_preset = preset_it->second;
+  fp32_preset.precision = "fp32";
+
+  InferencePipelineBuilder pipeline_builder;
+  Models fp32_models = pipeline_builder.getModels( fp32_preset, app_settings );
+
+  if ( options.command == "dump" )
+    return dumpCalibrationData( options, images, fp32_models );
+
+  LanguagePreset int8_preset = preset_it->second;
+  int8_preset.precision = "int8";
+
+  const Models int8_models = pipeline_builder.getModels( int8_preset, app_settings );
+
+  return reportAccuracy( options, images, language_code, fp32_models, int8_models );
+}
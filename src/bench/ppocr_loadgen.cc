@@ -0,0 +1,451 @@
+// ppocr_loadgen: gRPC load generator for ppocr_infer_service_grpc
+//
+// --mode open    requests arrive at a fixed rate whether or not the server keeps up,
+//                latency is measured from the intended send time, so queueing
+//                (in the client and the server) is part of the result
+// --mode closed  a fixed number of clients, each waits for its response before the next
+//                request; --expected-interval-ms enables coordinated omission correction
+//
+// Latencies are recorded in HDR histograms (microseconds) and reported as JSON.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <nlohmann/json.hpp>
+#include "ocr_service.grpc.pb.h"
+#include "../../includes/cpp-base64-2.rc.08/base64.cpp"
+#include "../hpp/util.hpp"
+#include "image_set.hpp"
+#include "load_stats.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+
+struct LoadOptions {
+  std::string target = "localhost:12345";
+  std::string mode = "open"; // open | closed
+  std::string arrivals = "uniform"; // uniform | poisson (open loop)
+  double rate = 10; // requests / s (open loop)
+  int concurrency = 64; // clients (closed loop) or max requests in flight (open loop)
+  double duration_s = 30;
+  double warmup_s = 0;
+  std::string images_dir;
+  std::vector< std::pair< std::string, double > > rpc_mix = { { "bytes", 1 } };
+  std::vector< std::pair< std::string, double > > language_mix;
+  int deadline_ms = 0; // 0 = none
+  std::string priority = "normal"; // interactive | normal | bulk
+  double expected_interval_ms = 0; // closed loop coordinated omission correction
+  int channels = 1;
+  unsigned int seed = 1;
+  std::string output_file;
+};
+
+// "a=1,b=2.5" -> { { a, 1 }, { b, 2.5 } }
+std::vector< std::pair< std::string, double > > parseMix( const std::string& value ) {
+
+  std::vector< std::pair< std::string, double > > mix;
+  std::stringstream stream( value );
+  std::string item;
+
+  while ( std::getline( stream, item, ',' ) ) {
+
+    if ( item.empty() )
+      continue;
+
+    const size_t eq = item.find( '=' );
+
+    if ( eq == std::string::npos )
+      mix.push_back( { item, 1 } );
+    else
+      mix.push_back( { item.substr( 0, eq ), std::atof( item.substr( eq + 1 ).c_str() ) } );
+  }
+
+  return mix;
+}
+
+void printLoadUsage() {
+  std::cout << "Usage: ppocr_loadgen --images DIR --languages ja=0.7,en=0.3 [--target HOST:PORT]\n"
+               "                     [--mode open|closed] [--rate RPS] [--arrivals uniform|poisson]\n"
+               "                     [--concurrency N] [--duration-s S] [--warmup-s S]\n"
+               "                     [--rpcs bytes=0.8,detect=0.1,base64=0.1] [--deadline-ms MS]\n"
+               "                     [--priority interactive|normal|bulk] [--expected-interval-ms MS]\n"
+               "                     [--channels N] [--seed N] [--output FILE]\n"
+            << std::endl;
+}
+
+bool handleLoadArgs( int argc, char *argv[], LoadOptions& options ) {
+
+  for ( int i = 1; i < argc; ++i ) {
+
+    const std::string arg = argv[ i ];
+
+    if ( i + 1 >= argc ) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[ ++i ];
+
+    if ( arg == "--target" ) options.target = value;
+    else if ( arg == "--mode" ) options.mode = value;
+    else if ( arg == "--arrivals" ) options.arrivals = value;
+    else if ( arg == "--rate" ) options.rate = std::atof( value.c_str() );
+    else if ( arg == "--concurrency" ) options.concurrency = std::atoi( value.c_str() );
+    else if ( arg == "--duration-s" ) options.duration_s = std::atof( value.c_str() );
+    else if ( arg == "--warmup-s" ) options.warmup_s = std::atof( value.c_str() );
+    else if ( arg == "--images" ) options.images_dir = value;
+    else if ( arg == "--rpcs" ) options.rpc_mix = parseMix( value );
+    else if ( arg == "--languages" ) options.language_mix = parseMix( value );
+    else if ( arg == "--deadline-ms" ) options.deadline_ms = std::atoi( value.c_str() );
+    else if ( arg == "--priority" ) options.priority = value;
+    else if ( arg == "--expected-interval-ms" ) options.expected_interval_ms = std::atof( value.c_str() );
+    else if ( arg == "--channels" ) options.channels = std::atoi( value.c_str() );
+    else if ( arg == "--seed" ) options.seed = std::atoi( value.c_str() );
+    else if ( arg == "--output" ) options.output_file = value;
+    else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  if ( options.images_dir.empty() || options.language_mix.empty() ||
+       ( options.mode != "open" && options.mode != "closed" ) ||
+       ( options.mode == "open" && options.rate <= 0 ) ||
+       options.concurrency <= 0 || options.channels <= 0 ) {
+    return false;
+  }
+
+  for ( const auto& rpc : options.rpc_mix ) {
+    if ( std::find( load_rpc_names.begin(), load_rpc_names.end(), rpc.first ) == load_rpc_names.end() ) {
+      std::cerr << "Unknown rpc " << rpc.first << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// One planned request
+struct LoadRequest {
+  Clock::time_point intended_at;
+  LoadRpc rpc;
+  size_t language_idx;
+  size_t image_idx;
+  bool measured; // false during warm up
+};
+
+// Picks rpc / language / image from the configured mixes (deterministic for a given seed)
+class LoadPlanner {
+
+  private:
+    std::mt19937 random;
+    std::vector< LoadRpc > rpcs;
+    std::discrete_distribution< size_t > rpc_distribution;
+    std::discrete_distribution< size_t > language_distribution;
+    std::uniform_int_distribution< size_t > image_distribution;
+
+  public:
+    LoadPlanner( const LoadOptions& options, size_t image_count, unsigned int seed ) : random( seed ) {
+
+      std::vector< double > rpc_weights;
+      for ( const auto& rpc : options.rpc_mix ) {
+        const size_t idx = std::find( load_rpc_names.begin(), load_rpc_names.end(), rpc.first ) - load_rpc_names.begin();
+        rpcs.push_back( static_cast< LoadRpc >( idx ) );
+        rpc_weights.push_back( rpc.second );
+      }
+      rpc_distribution = std::discrete_distribution< size_t >( rpc_weights.begin(), rpc_weights.end() );
+
+      std::vector< double > language_weights;
+      for ( const auto& language : options.language_mix )
+        language_weights.push_back( language.second );
+      language_distribution = std::discrete_distribution< size_t >( language_weights.begin(), language_weights.end() );
+
+      image_distribution = std::uniform_int_distribution< size_t >( 0, image_count - 1 );
+    }
+
+    LoadRequest next( Clock::time_point intended_at, bool measured ) {
+      return { intended_at, rpcs[ rpc_distribution( random ) ], language_distribution( random ), image_distribution( random ), measured };
+    }
+
+    std::mt19937& generator() {
+      return random;
+    }
+};
+
+
+class LoadClient {
+
+  private:
+    const LoadOptions& options;
+    std::vector< std::unique_ptr< ocr_service::OCRService::Stub > > stubs;
+    const std::vector< std::string >& images;
+    std::vector< std::string > base64_images;
+    ocr_service::Priority priority = ocr_service::PRIORITY_NORMAL;
+
+  public:
+    LoadClient( const LoadOptions& options, const std::vector< std::string >& images ) : options( options ), images( images ) {
+
+      for ( int i = 0; i < options.channels; ++i ) {
+        // Separate connections: a unique channel argument stops gRPC from sharing the subchannel
+        grpc::ChannelArguments channel_args;
+        channel_args.SetInt( "ppocr_loadgen.channel", i );
+        channel_args.SetMaxSendMessageSize( 15 * 1024 * 1024 );
+        stubs.push_back( ocr_service::OCRService::NewStub(
+          grpc::CreateCustomChannel( options.target, grpc::InsecureChannelCredentials(), channel_args )
+        ) );
+      }
+
+      for ( const auto& image : images )
+        base64_images.push_back( base64_encode( image ) );
+
+      if ( options.priority == "interactive" )
+        priority = ocr_service::PRIORITY_INTERACTIVE;
+      else if ( options.priority == "bulk" )
+        priority = ocr_service::PRIORITY_BULK;
+    }
+
+    grpc::Status send( const LoadRequest& load_request, size_t worker_idx ) {
+
+      auto& stub = stubs[ worker_idx % stubs.size() ];
+      const std::string& language_code = options.language_mix[ load_request.language_idx ].first;
+      const std::string client_id = "ppocr_loadgen";
+
+      grpc::ClientContext context;
+
+      if ( options.deadline_ms > 0 )
+        context.set_deadline( std::chrono::system_clock::now() + std::chrono::milliseconds( options.deadline_ms ) );
+
+      switch ( load_request.rpc ) {
+
+        case LoadRpc::RECOGNIZE_BYTES: {
+          ocr_service::RecognizeBytesRequest request;
+          ocr_service::RecognizeDefaultResponse response;
+          request.set_image_bytes( images[ load_request.image_idx ] );
+          request.set_language_code( language_code );
+          request.set_priority( priority );
+          request.set_client_id( client_id );
+          return stub->RecognizeBytes( &context, request, &response );
+        }
+
+        case LoadRpc::DETECT: {
+          ocr_service::DetectRequest request;
+          ocr_service::DetectResponse response;
+          request.set_image_bytes( images[ load_request.image_idx ] );
+          request.set_language_code( language_code );
+          request.set_priority( priority );
+          request.set_client_id( client_id );
+          return stub->Detect( &context, request, &response );
+        }
+
+        default: {
+          ocr_service::RecognizeBase64Request request;
+          ocr_service::RecognizeDefaultResponse response;
+          request.set_base64_image( base64_images[ load_request.image_idx ] );
+          request.set_language_code( language_code );
+          request.set_priority( priority );
+          request.set_client_id( client_id );
+          return stub->RecognizeBase64( &context, request, &response );
+        }
+      }
+    }
+};
+
+
+void recordResult(
+  LoadStats& stats,
+  const LoadRequest& load_request,
+  const grpc::Status& status,
+  int64_t latency_us,
+  int64_t expected_interval_us
+) {
+
+  if ( !load_request.measured )
+    return;
+
+  const int rpc_idx = static_cast< int >( load_request.rpc );
+
+  if ( !status.ok() ) {
+    stats.errors[ rpc_idx ][ status.error_code() ]++;
+    return;
+  }
+
+  stats.ok[ rpc_idx ]++;
+  stats.latency_us[ rpc_idx ].recordCorrected( latency_us, expected_interval_us );
+}
+
+int64_t microsSince( Clock::time_point time_point ) {
+  return std::chrono::duration_cast< std::chrono::microseconds >( Clock::now() - time_point ).count();
+}
+
+
+// Open loop: one thread generates arrivals on schedule, workers send them.
+// When every worker is busy the arrivals wait in the queue, and that wait counts.
+LoadStats runOpenLoop( const LoadOptions& options, LoadClient& client, size_t image_count ) {
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque< LoadRequest > queue;
+  bool done = false;
+
+  std::vector< LoadStats > worker_stats( options.concurrency );
+  std::vector< std::thread > workers;
+
+  for ( int w = 0; w < options.concurrency; ++w ) {
+    workers.emplace_back( [ &, w ]() {
+      while ( true ) {
+
+        LoadRequest load_request;
+        {
+          std::unique_lock< std::mutex > lock( mutex );
+          condition.wait( lock, [&]() { return done || !queue.empty(); } );
+
+          if ( queue.empty() )
+            return;
+
+          load_request = queue.front();
+          queue.pop_front();
+        }
+
+        const grpc::Status status = client.send( load_request, w );
+        recordResult( worker_stats[ w ], load_request, status, microsSince( load_request.intended_at ), 0 );
+      }
+    });
+  }
+
+  LoadPlanner planner( options, image_count, options.seed );
+  std::exponential_distribution< double > poisson_gap( options.rate );
+
+  const auto started_at = Clock::now();
+  const auto measure_from = started_at + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( options.warmup_s ) );
+  const auto stop_at = measure_from + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( options.duration_s ) );
+
+  double offset_s = 0;
+
+  while ( true ) {
+
+    const auto intended_at = started_at + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( offset_s ) );
+
+    if ( intended_at >= stop_at )
+      break;
+
+    std::this_thread::sleep_until( intended_at );
+
+    {
+      std::lock_guard< std::mutex > lock( mutex );
+      queue.push_back( planner.next( intended_at, intended_at >= measure_from ) );
+    }
+    condition.notify_one();
+
+    offset_s += options.arrivals == "poisson" ? poisson_gap( planner.generator() ) : 1.0 / options.rate;
+  }
+
+  {
+    std::lock_guard< std::mutex > lock( mutex );
+    done = true;
+  }
+  condition.notify_all();
+
+  for ( auto& worker : workers )
+    worker.join();
+
+  LoadStats stats;
+  for ( const auto& worker_stat : worker_stats )
+    stats.merge( worker_stat );
+
+  return stats;
+}
+
+// Closed loop: every client sends its next request as soon as the previous one returns
+LoadStats runClosedLoop( const LoadOptions& options, LoadClient& client, size_t image_count ) {
+
+  const int64_t expected_interval_us = int64_t( options.expected_interval_ms * 1000 );
+
+  const auto started_at = Clock::now();
+  const auto measure_from = started_at + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( options.warmup_s ) );
+  const auto stop_at = measure_from + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( options.duration_s ) );
+
+  std::vector< LoadStats > worker_stats( options.concurrency );
+  std::vector< std::thread > workers;
+
+  for ( int w = 0; w < options.concurrency; ++w ) {
+    workers.emplace_back( [ &, w ]() {
+
+      LoadPlanner planner( options, image_count, options.seed + w );
+
+      for ( auto now = Clock::now(); now < stop_at; now = Clock::now() ) {
+
+        const LoadRequest load_request = planner.next( now, now >= measure_from );
+        const grpc::Status status = client.send( load_request, w );
+        recordResult( worker_stats[ w ], load_request, status, microsSince( load_request.intended_at ), expected_interval_us );
+      }
+    });
+  }
+
+  for ( auto& worker : workers )
+    worker.join();
+
+  LoadStats stats;
+  for ( const auto& worker_stat : worker_stats )
+    stats.merge( worker_stat );
+
+  return stats;
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  LoadOptions options;
+
+  if ( !handleLoadArgs( argc, argv, options ) ) {
+    printLoadUsage();
+    return 1;
+  }
+
+  const std::vector< std::string > images = loadImageSet( options.images_dir );
+
+  if ( images.empty() ) {
+    std::cerr << "No images found in " << options.images_dir << std::endl;
+    return 1;
+  }
+
+  LoadClient client( options, images );
+
+  LoadStats stats = options.mode == "open" ?
+    runOpenLoop( options, client, images.size() ) :
+    runClosedLoop( options, client, images.size() );
+
+  nlohmann::ordered_json report;
+  report["target"] = options.target;
+  report["mode"] = options.mode;
+  if ( options.mode == "open" ) {
+    report["arrivals"] = options.arrivals;
+    report["target_rate_rps"] = options.rate;
+  }
+  report["concurrency"] = options.concurrency;
+  report["duration_s"] = options.duration_s;
+  report["images"] = images.size();
+  report["latency_unit"] = "us";
+  report["coordinated_omission_corrected"] = options.mode == "open" || options.expected_interval_ms > 0;
+
+  loadStatsJson( stats, options.duration_s, report );
+
+  std::cout << std::setw(4) << report << std::endl;
+
+  if ( !options.output_file.empty() )
+    writeJsonFile( report, options.output_file );
+
+  return 0;
+}
@@ -0,0 +1,274 @@
+// ppocr_replay: re-issues the requests of a capture file ( "capture_file" setting )
+// against a server, at the original pace ( --speed 1 ), scaled ( --speed 2 = twice as fast )
+// or as fast as --concurrency allows ( --speed 0 ).
+//
+// Latencies are measured from the time the request was due (HDR histograms, microseconds),
+// so a server that falls behind the recorded traffic shows it in the tail.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <nlohmann/json.hpp>
+#include "ocr_service.grpc.pb.h"
+#include "../hpp/util.hpp"
+#include "../service_grpc/request_capture.hpp"
+#include "load_stats.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+
+struct ReplayOptions {
+  std::string capture_file;
+  std::string target = "localhost:12345";
+  double speed = 1; // 0 = as fast as possible
+  int concurrency = 64; // Max requests in flight
+  uint64_t limit = 0; // 0 = every captured request
+  bool deadlines = true; // Replay the captured client deadlines
+  std::string output_file;
+};
+
+void printReplayUsage() {
+  std::cout << "Usage: ppocr_replay --capture FILE [--target HOST:PORT] [--speed X] [--concurrency N]\n"
+               "                    [--limit N] [--deadlines on|off] [--output FILE]\n"
+            << std::endl;
+}
+
+bool handleReplayArgs( int argc, char *argv[], ReplayOptions& options ) {
+
+  for ( int i = 1; i < argc; ++i ) {
+
+    const std::string arg = argv[ i ];
+
+    if ( i + 1 >= argc ) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[ ++i ];
+
+    if ( arg == "--capture" ) options.capture_file = value;
+    else if ( arg == "--target" ) options.target = value;
+    else if ( arg == "--speed" ) options.speed = std::atof( value.c_str() );
+    else if ( arg == "--concurrency" ) options.concurrency = std::atoi( value.c_str() );
+    else if ( arg == "--limit" ) options.limit = std::strtoull( value.c_str(), nullptr, 10 );
+    else if ( arg == "--deadlines" ) options.deadlines = value != "off";
+    else if ( arg == "--output" ) options.output_file = value;
+    else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  return !options.capture_file.empty() && options.speed >= 0 && options.concurrency > 0;
+}
+
+
+struct ReplayRequest {
+  Clock::time_point intended_at;
+  ocr_service::CapturedRequest captured;
+};
+
+LoadRpc loadRpcFromCaptured( ocr_service::CapturedRpc rpc ) {
+
+  switch ( rpc ) {
+    case ocr_service::CAPTURED_DETECT:
+      return LoadRpc::DETECT;
+    case ocr_service::CAPTURED_RECOGNIZE_BASE64:
+      return LoadRpc::RECOGNIZE_BASE64;
+    default:
+      return LoadRpc::RECOGNIZE_BYTES;
+  }
+}
+
+grpc::Status sendCaptured(
+  ocr_service::OCRService::Stub* stub,
+  const ocr_service::CapturedRequest& captured,
+  bool deadlines
+) {
+
+  grpc::ClientContext context;
+
+  if ( deadlines && captured.deadline_ms() > 0 )
+    context.set_deadline( std::chrono::system_clock::now() + std::chrono::milliseconds( captured.deadline_ms() ) );
+
+  switch ( captured.rpc() ) {
+
+    case ocr_service::CAPTURED_DETECT: {
+      ocr_service::DetectRequest request;
+      ocr_service::DetectResponse response;
+      request.ParseFromString( captured.request() );
+      return stub->Detect( &context, request, &response );
+    }
+
+    case ocr_service::CAPTURED_RECOGNIZE_BASE64: {
+      ocr_service::RecognizeBase64Request request;
+      ocr_service::RecognizeDefaultResponse response;
+      request.ParseFromString( captured.request() );
+      return stub->RecognizeBase64( &context, request, &response );
+    }
+
+    default: {
+      ocr_service::RecognizeBytesRequest request;
+      ocr_service::RecognizeDefaultResponse response;
+      request.ParseFromString( captured.request() );
+      return stub->RecognizeBytes( &context, request, &response );
+    }
+  }
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  ReplayOptions options;
+
+  if ( !handleReplayArgs( argc, argv, options ) ) {
+    printReplayUsage();
+    return 1;
+  }
+
+  // Oldest segment first
+  std::vector< std::unique_ptr< CaptureReader > > readers;
+
+  for ( const std::string& path : { options.capture_file + ".1", options.capture_file } ) {
+    auto reader = std::make_unique< CaptureReader >( path );
+    if ( reader->isOpen() )
+      readers.push_back( std::move( reader ) );
+  }
+
+  if ( readers.empty() ) {
+    std::cerr << "No capture file found at " << options.capture_file << std::endl;
+    return 1;
+  }
+
+  grpc::ChannelArguments channel_args;
+  channel_args.SetMaxSendMessageSize( 15 * 1024 * 1024 );
+  auto stub = ocr_service::OCRService::NewStub(
+    grpc::CreateCustomChannel( options.target, grpc::InsecureChannelCredentials(), channel_args )
+  );
+
+  const size_t max_queued = size_t( options.concurrency ) * 4; // Bounds memory for --speed 0
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque< ReplayRequest > queue;
+  bool done = false;
+
+  std::vector< LoadStats > worker_stats( options.concurrency );
+  std::vector< std::thread > workers;
+
+  for ( int w = 0; w < options.concurrency; ++w ) {
+    workers.emplace_back( [ &, w ]() {
+      while ( true ) {
+
+        ReplayRequest replay_request;
+        {
+          std::unique_lock< std::mutex > lock( mutex );
+          condition.wait( lock, [&]() { return done || !queue.empty(); } );
+
+          if ( queue.empty() )
+            return;
+
+          replay_request = std::move( queue.front() );
+          queue.pop_front();
+        }
+        condition.notify_all(); // Room in the queue
+
+        const grpc::Status status = sendCaptured( stub.get(), replay_request.captured, options.deadlines );
+
+        const int rpc_idx = static_cast< int >( loadRpcFromCaptured( replay_request.captured.rpc() ) );
+        LoadStats& stats = worker_stats[ w ];
+
+        if ( status.ok() ) {
+          stats.ok[ rpc_idx ]++;
+          stats.latency_us[ rpc_idx ].record(
+            std::chrono::duration_cast< std::chrono::microseconds >( Clock::now() - replay_request.intended_at ).count()
+          );
+        }
+        else {
+          stats.errors[ rpc_idx ][ status.error_code() ]++;
+        }
+      }
+    });
+  }
+
+  const auto started_at = Clock::now();
+  int64_t first_arrival_us = -1;
+  uint64_t replayed = 0;
+  std::map< uint32_t, uint64_t > settings_versions; // < settings_version, requests >
+
+  for ( auto& reader : readers ) {
+
+    ReplayRequest replay_request;
+
+    while ( ( options.limit == 0 || replayed < options.limit ) && reader->next( &replay_request.captured ) ) {
+
+      if ( first_arrival_us < 0 )
+        first_arrival_us = replay_request.captured.arrival_unix_us();
+
+      replay_request.intended_at = Clock::now();
+
+      if ( options.speed > 0 ) {
+        const double offset_us = ( replay_request.captured.arrival_unix_us() - first_arrival_us ) / options.speed;
+        replay_request.intended_at = started_at + std::chrono::microseconds( int64_t( offset_us ) );
+        std::this_thread::sleep_until( replay_request.intended_at );
+      }
+
+      settings_versions[ replay_request.captured.settings_version() ]++;
+
+      {
+        std::unique_lock< std::mutex > lock( mutex );
+        condition.wait( lock, [&]() { return queue.size() < max_queued; } );
+        queue.push_back( std::move( replay_request ) );
+      }
+      condition.notify_all();
+
+      replay_request = ReplayRequest();
+      replayed++;
+    }
+  }
+
+  {
+    std::lock_guard< std::mutex > lock( mutex );
+    done = true;
+  }
+  condition.notify_all();
+
+  for ( auto& worker : workers )
+    worker.join();
+
+  const double elapsed_s = std::chrono::duration< double >( Clock::now() - started_at ).count();
+
+  LoadStats stats;
+  for ( const auto& worker_stat : worker_stats )
+    stats.merge( worker_stat );
+
+  nlohmann::ordered_json report;
+  report["capture_file"] = options.capture_file;
+  report["target"] = options.target;
+  report["speed"] = options.speed;
+  report["concurrency"] = options.concurrency;
+  report["requests"] = replayed;
+  report["elapsed_s"] = elapsed_s;
+  report["latency_unit"] = "us";
+
+  report["settings_versions"] = nlohmann::ordered_json::object();
+  for ( const auto& version : settings_versions )
+    report["settings_versions"][ std::to_string( version.first ) ] = version.second;
+
+  loadStatsJson( stats, elapsed_s, report );
+
+  std::cout << std::setw(4) << report << std::endl;
+
+  if ( !options.output_file.empty() )
+    writeJsonFile( report, options.output_file );
+
+  return 0;
+}
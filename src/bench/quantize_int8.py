@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# quantize_int8.py: writes inference_int8.onnx next to the fp32 model of a PaddleOCR model directory,
+# calibrated on the .npy input tensors written by "ppocr_calibrate dump".
+#
+# Static post-training quantization with ONNX Runtime (QDQ format, int8 per-channel weights),
+# which both the ONNX_CPU and the Open_VINO backends run as int8.
+#
+# Requires: pip install onnx onnxruntime numpy paddle2onnx
+#
+# e.g. python quantize_int8.py --model-dir ./models/ch_PP-OCRv4_det_infer --calibration ./calibration/det
+
+import argparse
+import glob
+import os
+import subprocess
+import sys
+
+import numpy as np
+import onnx
+from onnxruntime.quantization import (CalibrationDataReader, CalibrationMethod, QuantFormat, QuantType,
+                                      quantize_static)
+from onnxruntime.quantization.shape_inference import quant_pre_process
+
+
+class NpyDataReader(CalibrationDataReader):
+    """One calibration sample per .npy file"""
+
+    def __init__(self, files, input_name):
+        self.files = iter(files)
+        self.input_name = input_name
+
+    def get_next(self):
+        path = next(self.files, None)
+        if path is None:
+            return None
+        return {self.input_name: np.load(path).astype(np.float32)}
+
+
+def export_fp32_onnx(model_dir, onnx_file):
+    """inference.pdmodel / inference.pdiparams -> inference.onnx (dynamic input shape)"""
+    subprocess.run([
+        "paddle2onnx",
+        "--model_dir", model_dir,
+        "--model_filename", "inference.pdmodel",
+        "--params_filename", "inference.pdiparams",
+        "--save_file", onnx_file,
+        "--opset_version", "13",
+    ], check=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Writes inference_int8.onnx for a PaddleOCR model directory")
+    parser.add_argument("--model-dir", required=True, help="PaddleOCR model directory (inference.pdmodel)")
+    parser.add_argument("--calibration", required=True, help="Directory of .npy input tensors (ppocr_calibrate dump)")
+    parser.add_argument("--max-samples", type=int, default=300)
+    parser.add_argument("--method", choices=["minmax", "entropy", "percentile"], default="percentile",
+                        help="Activation range calibration")
+    parser.add_argument("--exclude-ops", default="", help="Comma separated op types kept in fp32, e.g. Sigmoid,Softmax")
+    args = parser.parse_args()
+
+    fp32_file = os.path.join(args.model_dir, "inference.onnx")
+    prepared_file = os.path.join(args.model_dir, "inference_prepared.onnx")
+    int8_file = os.path.join(args.model_dir, "inference_int8.onnx")
+
+    samples = sorted(glob.glob(os.path.join(args.calibration, "*.npy")))[:args.max_samples]
+    if not samples:
+        sys.exit("No .npy samples in " + args.calibration)
+
+    if not os.path.exists(fp32_file):
+        export_fp32_onnx(args.model_dir, fp32_file)
+
+    quant_pre_process(fp32_file, prepared_file)
+
+    model = onnx.load(prepared_file)
+    input_name = model.graph.input[0].name
+
+    exclude_op_types = [op for op in args.exclude_ops.split(",") if op]
+    nodes_to_exclude = [node.name for node in model.graph.node if node.op_type in exclude_op_types]
+
+    method = {
+        "minmax": CalibrationMethod.MinMax,
+        "entropy": CalibrationMethod.Entropy,
+        "percentile": CalibrationMethod.Percentile,
+    }[args.method]
+
+    quantize_static(
+        prepared_file,
+        int8_file,
+        NpyDataReader(samples, input_name),
+        quant_format=QuantFormat.QDQ,
+        per_channel=True,
+        activation_type=QuantType.QUInt8,
+        weight_type=QuantType.QInt8,
+        calibrate_method=method,
+        nodes_to_exclude=nodes_to_exclude,
+    )
+
+    os.remove(prepared_file)
+
+    print("{} samples -> {}".format(len(samples), int8_file))
+    print('Set "precision": "int8" in the language preset, then check it with "ppocr_calibrate report"')
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+#ifndef BASE64_DECODER_HPP
+#define BASE64_DECODER_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+// Base64 (standard and URL safe alphabets) straight from a view into a caller owned
+// buffer, so a request body is decoded without intermediate copies.
+// Line breaks and other whitespace are skipped, padding is optional.
+// Returns false on any other character.
+bool base64DecodeInto( std::string_view encoded, std::string* decoded ) {
+
+    static const std::array< int8_t, 256 > decoding_table = []() {
+
+        std::array< int8_t, 256 > table;
+        table.fill( -1 );
+
+        const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for ( int i = 0; i < 64; ++i )
+            table[ static_cast< unsigned char >( alphabet[ i ] ) ] = int8_t( i );
+
+        table[ '-' ] = 62;
+        table[ '_' ] = 63;
+        table[ ' ' ] = table[ '\n' ] = table[ '\r' ] = table[ '\t' ] = -2; // Skipped
+
+        return table;
+    }();
+
+    decoded->clear();
+    decoded->reserve( encoded.size() / 4 * 3 + 3 );
+
+    uint32_t accumulator = 0;
+    int bits = 0;
+
+    for ( size_t i = 0; i < encoded.size(); ++i ) {
+
+        const unsigned char c = static_cast< unsigned char >( encoded[ i ] );
+
+        if ( c == '=' )
+            break;
+
+        const int8_t value = decoding_table[ c ];
+
+        if ( value == -2 )
+            continue;
+
+        if ( value < 0 )
+            return false;
+
+        accumulator = ( accumulator << 6 ) | uint32_t( value );
+        bits += 6;
+
+        if ( bits >= 8 ) {
+            bits -= 8;
+            decoded->push_back( char( ( accumulator >> bits ) & 0xFF ) );
+        }
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef CLASSIFIER_POLICY_HPP
+#define CLASSIFIER_POLICY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+struct ClassifierPolicySettings {
+    std::string mode = "always"; // always | adaptive
+    double sample_ratio = 0.1; // adaptive: share of the lines still classified while nothing flips
+    double low_confidence = 0.6; // adaptive: lines recognized below this score are classified ( and re-recognized if flipped )
+    int flip_memory_frames = 30; // adaptive: frames every line is classified for after a flip
+};
+
+
+// Decides which text lines of a frame go through the angle classifier. Shared by the pipelines of a language,
+// with a state per stream ( client_id of the requests, the requests without one are a stream too ): a flip in one
+// stream doesn't make the others classify every line. "always" classifies every line. "adaptive" does too for
+// flip_memory_frames frames of a stream after a flipped line was found in it; otherwise only a rotating sample
+// of the lines is classified before recognition, and the lines recognized with a low score after it ( a flipped
+// line reads as garbage ), so flipped text is still caught. The streams used the longest ago are forgotten
+class ClassifierPolicy {
+
+    private:
+        static constexpr size_t max_streams = 4096;
+
+        struct Stream {
+            int frames_since_flip = 0;
+            size_t sample_offset = 0; // Rotates the sampled lines between frames
+            uint64_t last_used = 0;
+        };
+
+        ClassifierPolicySettings settings;
+
+        std::mutex mutex;
+        std::unordered_map< std::string, Stream > streams;
+        uint64_t clock = 0;
+
+        Stream& stream( const std::string& stream_id ) {
+
+            auto it = streams.find( stream_id );
+
+            if ( it == streams.end() ) {
+
+                // Forget the stream used the longest ago
+                if ( streams.size() >= max_streams ) {
+                    auto oldest = std::min_element( streams.begin(), streams.end(), []( const auto& a, const auto& b ) {
+                        return a.second.last_used < b.second.last_used;
+                    } );
+                    streams.erase( oldest );
+                }
+
+                it = streams.emplace( stream_id, Stream() ).first;
+                it->second.frames_since_flip = settings.flip_memory_frames; // Quiet until a flip shows up
+            }
+
+            it->second.last_used = ++clock;
+
+            return it->second;
+        }
+
+    public:
+        ClassifierPolicy( const ClassifierPolicySettings& settings = ClassifierPolicySettings() ) : settings( settings ) {
+            this->settings.sample_ratio = std::clamp( settings.sample_ratio, 0.0, 1.0 );
+        }
+
+        bool adaptive() const {
+            return settings.mode == "adaptive";
+        }
+
+        float lowConfidence() const {
+            return float( settings.low_confidence );
+        }
+
+        // Lines to classify before recognition. all_lines is set when every line is ( no low confidence pass needed )
+        std::vector< size_t > linesBeforeRecognition( const std::string& stream_id, size_t line_count, bool* all_lines ) {
+
+            std::vector< size_t > lines;
+
+            *all_lines = !adaptive();
+
+            if ( adaptive() ) {
+
+                std::lock_guard< std::mutex > lock( mutex );
+
+                Stream& current = stream( stream_id );
+
+                *all_lines = current.frames_since_flip < settings.flip_memory_frames;
+
+                if ( !*all_lines ) {
+
+                    if ( settings.sample_ratio <= 0 || line_count == 0 )
+                        return lines;
+
+                    // Every stride-th line, from an offset that moves every frame
+                    const size_t stride = std::max< size_t >( 1, size_t( 1.0 / settings.sample_ratio ) );
+
+                    for ( size_t i = current.sample_offset % stride; i < line_count; i += stride )
+                        lines.push_back( i );
+
+                    current.sample_offset++;
+
+                    return lines;
+                }
+            }
+
+            for ( size_t i = 0; i < line_count; ++i )
+                lines.push_back( i );
+
+            return lines;
+        }
+
+        // After a frame of the stream: were any lines flipped
+        void record( const std::string& stream_id, bool flipped ) {
+
+            if ( !adaptive() )
+                return;
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            Stream& current = stream( stream_id );
+
+            if ( flipped )
+                current.frames_since_flip = 0;
+            else if ( current.frames_since_flip < settings.flip_memory_frames )
+                current.frames_since_flip++;
+        }
+};
+
+#endif
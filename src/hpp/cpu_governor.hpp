@@ -0,0 +1,339 @@
+#ifndef CPU_GOVERNOR_HPP
+#define CPU_GOVERNOR_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Where a request runs: the intra-op threads of its models and which pipeline replica of that size
+struct CpuPlacement {
+    int cpu_threads = 0; // 0 = no governor, the models use the "cpu_threads" setting
+    int replica = 0;
+    int group = -1; // Worker group ( cpu_topology.hpp ) the replica is pinned to, -1 = not pinned
+
+    bool governed() const {
+        return cpu_threads > 0;
+    }
+
+    std::string key() const {
+
+        if ( !governed() )
+            return "";
+
+        return ( group >= 0 ? "g" + std::to_string( group ) + "-" : "" ) + std::to_string( cpu_threads ) + "t" + std::to_string( replica );
+    }
+};
+
+
+// Process wide CPU thread budget, split between intra-op threads and concurrent requests.
+// A request leases the threads its models run with: all of the budget when it is alone,
+// less as other requests run or wait, down to "threads under load" each (one request per core
+// with the default of 1). The leased threads never add up to more than the budget.
+// Model runtimes fix their thread count when they load, so every size is its own set of pipeline
+// replicas ( tiers of budget, budget / 2, ... threads ). The replicas of a language are capped
+// ( max_replicas per group ): the narrowest tiers that don't fit are left out, which raises the
+// threads per request under load instead of multiplying the weights in memory.
+// With worker groups ( one per NUMA node or L3 cache ) every group has its own budget and tiers,
+// and a request goes to the least loaded group.
+class CpuGovernor {
+
+    private:
+        struct Tier {
+            int cpu_threads;
+            std::vector< bool > busy; // One per replica
+        };
+
+        struct Group {
+            std::vector< Tier > tiers; // Widest first
+            int budget = 0;
+            int free_threads = 0;
+            int running = 0;
+        };
+
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        std::vector< Group > groups;
+        bool pinned_groups = false;
+        int budget = 0;
+
+        // max_replicas: of all the tiers, <= 0 = no cap ( the widest tier is always there )
+        static Group makeGroup( int budget, int threads_under_load, int max_replicas ) {
+
+            Group group;
+            group.budget = budget;
+            group.free_threads = budget;
+
+            threads_under_load = std::clamp( threads_under_load, 1, budget );
+
+            int replicas = 0;
+
+            for ( int cpu_threads = budget; ; cpu_threads = std::max( threads_under_load, cpu_threads / 2 ) ) {
+
+                const int tier_replicas = budget / cpu_threads;
+
+                if ( max_replicas > 0 && !group.tiers.empty() && replicas + tier_replicas > max_replicas )
+                    break;
+
+                group.tiers.push_back( { cpu_threads, std::vector< bool >( tier_replicas, false ) } );
+                replicas += tier_replicas;
+
+                if ( cpu_threads == threads_under_load )
+                    break;
+            }
+
+            return group;
+        }
+
+        // Free replica of the widest tier within the fair share and the free threads, -1 if there is none yet
+        static int pickReplica( Group& group, int fair_share, int* tier_idx ) {
+
+            for ( size_t i = 0; i < group.tiers.size(); ++i ) {
+
+                Tier& tier = group.tiers[ i ];
+
+                if ( tier.cpu_threads > fair_share && i + 1 < group.tiers.size() )
+                    continue;
+
+                if ( tier.cpu_threads > group.free_threads )
+                    continue;
+
+                for ( size_t replica = 0; replica < tier.busy.size(); ++replica ) {
+                    if ( !tier.busy[ replica ] ) {
+                        *tier_idx = i;
+                        return replica;
+                    }
+                }
+            }
+
+            return -1;
+        }
+
+        // Group indexes by load: leased share of the budget, then running requests
+        std::vector< size_t > groupsByLoad() const {
+
+            std::vector< size_t > order( groups.size() );
+
+            for ( size_t i = 0; i < order.size(); ++i )
+                order[ i ] = i;
+
+            std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+
+                const Group& group_a = groups[ a ];
+                const Group& group_b = groups[ b ];
+
+                const double load_a = double( group_a.budget - group_a.free_threads ) / group_a.budget;
+                const double load_b = double( group_b.budget - group_b.free_threads ) / group_b.budget;
+
+                if ( load_a != load_b )
+                    return load_a < load_b;
+
+                return group_a.running < group_b.running;
+            } );
+
+            return order;
+        }
+
+    public:
+        // RAII lease of the threads of one request
+        class Lease {
+
+            private:
+                CpuGovernor& governor;
+                CpuPlacement lease_placement;
+
+            public:
+                // waiting: requests queued behind this one, they count against its share
+                Lease( CpuGovernor& governor, size_t waiting ) : governor( governor ) {
+                    lease_placement = governor.acquire( waiting );
+                }
+
+                Lease( const Lease& ) = delete;
+                Lease& operator=( const Lease& ) = delete;
+
+                ~Lease() {
+                    governor.release( lease_placement );
+                }
+
+                const CpuPlacement& placement() const {
+                    return lease_placement;
+                }
+        };
+
+        CpuGovernor() = default;
+
+        // thread_budget: 0 = off, -1 = every hardware thread.
+        // group_cpus: CPUs of each worker group, the budget is split between them by size (empty = one unpinned group).
+        // max_replicas: pipeline replicas of a language per group, <= 0 = no cap
+        void configure( int thread_budget, int threads_under_load, const std::vector< int >& group_cpus = {}, int max_replicas = 0 ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            groups.clear();
+            pinned_groups = !group_cpus.empty();
+
+            int total_cpus = 0;
+            for ( const int cpus : group_cpus )
+                total_cpus += cpus;
+
+            if ( thread_budget < 0 )
+                thread_budget = pinned_groups ? total_cpus : std::max( 1u, std::thread::hardware_concurrency() );
+
+            budget = thread_budget;
+
+            if ( budget <= 0 )
+                return;
+
+            if ( !pinned_groups ) {
+                groups.push_back( makeGroup( budget, threads_under_load, max_replicas ) );
+                return;
+            }
+
+            budget = 0;
+
+            for ( const int cpus : group_cpus ) {
+                const int group_budget = std::max( 1, int( int64_t( thread_budget ) * cpus / std::max( 1, total_cpus ) ) );
+                groups.push_back( makeGroup( group_budget, threads_under_load, max_replicas ) );
+                budget += group_budget;
+            }
+        }
+
+        bool enabled() const {
+            return budget > 0;
+        }
+
+        int groupCount() const {
+            return int( groups.size() );
+        }
+
+        // Threads of a group ( the only one without worker groups )
+        int groupBudget( size_t group_idx ) const {
+            return group_idx < groups.size() ? groups[ group_idx ].budget : 0;
+        }
+
+        // Requests that can run at once: every one at the narrowest tier of its group
+        int maxConcurrentRequests() const {
+
+            if ( !enabled() )
+                return 1;
+
+            int requests = 0;
+            for ( const Group& group : groups )
+                requests += int( group.tiers.back().busy.size() );
+
+            return requests;
+        }
+
+        // Every replica a request can be placed on, to load them ahead of the requests ( the default one when off )
+        std::vector< CpuPlacement > placements() {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            if ( !enabled() )
+                return { CpuPlacement() };
+
+            std::vector< CpuPlacement > all_placements;
+
+            for ( size_t group_idx = 0; group_idx < groups.size(); ++group_idx ) {
+                for ( const Tier& tier : groups[ group_idx ].tiers ) {
+                    for ( size_t replica = 0; replica < tier.busy.size(); ++replica ) {
+                        CpuPlacement placement;
+                        placement.cpu_threads = tier.cpu_threads;
+                        placement.replica = int( replica );
+                        placement.group = pinned_groups ? int( group_idx ) : -1;
+                        all_placements.push_back( placement );
+                    }
+                }
+            }
+
+            return all_placements;
+        }
+
+        int leasedThreads() {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            int leased = 0;
+            for ( const Group& group : groups )
+                leased += group.budget - group.free_threads;
+
+            return leased;
+        }
+
+        // Blocks until the threads are free. Only other running requests hold them, so the wait is bounded by one of them
+        CpuPlacement acquire( size_t waiting ) {
+
+            CpuPlacement placement;
+
+            std::unique_lock< std::mutex > lock( mutex );
+
+            if ( !enabled() )
+                return placement;
+
+            // The waiting requests will spread over the groups too
+            const int waiting_per_group = int( waiting / groups.size() );
+
+            size_t group_idx = 0;
+            int tier_idx = 0;
+            int replica = -1;
+
+            condition.wait( lock, [&]() {
+
+                for ( const size_t i : groupsByLoad() ) {
+
+                    const int fair_share = groups[ i ].budget / ( groups[ i ].running + waiting_per_group + 1 );
+                    replica = pickReplica( groups[ i ], fair_share, &tier_idx );
+
+                    if ( replica >= 0 ) {
+                        group_idx = i;
+                        return true;
+                    }
+                }
+
+                return false;
+            } );
+
+            Group& group = groups[ group_idx ];
+            Tier& tier = group.tiers[ tier_idx ];
+            tier.busy[ replica ] = true;
+            group.free_threads -= tier.cpu_threads;
+            group.running++;
+
+            placement.cpu_threads = tier.cpu_threads;
+            placement.replica = replica;
+            placement.group = pinned_groups ? int( group_idx ) : -1;
+
+            return placement;
+        }
+
+        void release( const CpuPlacement& placement ) {
+
+            if ( !placement.governed() )
+                return;
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+
+                Group& group = groups[ std::max( 0, placement.group ) ];
+
+                for ( Tier& tier : group.tiers ) {
+                    if ( tier.cpu_threads == placement.cpu_threads ) {
+                        tier.busy[ placement.replica ] = false;
+                        break;
+                    }
+                }
+
+                group.free_threads += placement.cpu_threads;
+                group.running--;
+            }
+
+            condition.notify_all();
+        }
+};
+
+#endif
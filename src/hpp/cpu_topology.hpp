@@ -0,0 +1,227 @@
+#ifndef CPU_TOPOLOGY_HPP
+#define CPU_TOPOLOGY_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Cores that share a NUMA node or an L3 cache
+struct CpuGroup {
+    int numa_node = -1; // -1 = unknown
+    std::vector< int > cpus;
+};
+
+
+// "0-3,8,10-11" ( sysfs cpulist format ) -> { 0, 1, 2, 3, 8, 10, 11 }
+std::vector< int > parseCpuList( const std::string& cpu_list ) {
+
+    std::vector< int > cpus;
+    std::stringstream ranges( cpu_list );
+    std::string range;
+
+    while ( std::getline( ranges, range, ',' ) ) {
+
+        if ( range.empty() || range == "\n" )
+            continue;
+
+        const size_t dash = range.find( '-' );
+
+        try {
+            const int first = std::stoi( range.substr( 0, dash ) );
+            const int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+
+            for ( int cpu = first; cpu <= last; ++cpu )
+                cpus.push_back( cpu );
+        }
+        catch ( ... ) {
+            return {};
+        }
+    }
+
+    return cpus;
+}
+
+std::string readFirstLine( const std::string& file_path ) {
+
+    std::ifstream file( file_path );
+    std::string line;
+
+    std::getline( file, line );
+
+    return line;
+}
+
+// CPUs this process may run on
+std::vector< int > allowedCpus() {
+
+    std::vector< int > cpus;
+
+#if defined( __linux__ )
+    cpu_set_t cpu_set;
+    CPU_ZERO( &cpu_set );
+
+    if ( sched_getaffinity( 0, sizeof( cpu_set ), &cpu_set ) == 0 ) {
+        for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+            if ( CPU_ISSET( cpu, &cpu_set ) )
+                cpus.push_back( cpu );
+        }
+    }
+#endif
+
+    return cpus;
+}
+
+// Partitions the allowed CPUs by NUMA node ( mode "numa" ) or by L3 cache ( mode "l3" ), from sysfs.
+// Empty when the topology is unknown ( not Linux, no sysfs ) or there is a single group: nothing to place
+std::vector< CpuGroup > detectCpuGroups( const std::string& mode ) {
+
+    std::vector< CpuGroup > groups;
+
+#if defined( __linux__ )
+    const std::vector< int > allowed = allowedCpus();
+    const std::set< int > allowed_set( allowed.begin(), allowed.end() );
+
+    std::vector< int > numa_node_of( CPU_SETSIZE, -1 );
+
+    for ( int node = 0; node < 1024; ++node ) {
+
+        const std::string cpu_list = readFirstLine( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+
+        if ( cpu_list.empty() ) {
+            if ( node > 0 )
+                break;
+            continue;
+        }
+
+        for ( const int cpu : parseCpuList( cpu_list ) ) {
+            if ( cpu >= 0 && cpu < CPU_SETSIZE )
+                numa_node_of[ cpu ] = node;
+        }
+    }
+
+    std::set< std::vector< int > > seen;
+
+    for ( const int cpu : allowed ) {
+
+        std::vector< int > group_cpus;
+
+        if ( mode == "numa" ) {
+            for ( const int other : allowed ) {
+                if ( numa_node_of[ other ] == numa_node_of[ cpu ] )
+                    group_cpus.push_back( other );
+            }
+        }
+        else if ( mode == "l3" ) {
+
+            const std::string cache_dir = "/sys/devices/system/cpu/cpu" + std::to_string( cpu ) + "/cache/index";
+
+            for ( int index = 0; index < 8 && group_cpus.empty(); ++index ) {
+
+                if ( readFirstLine( cache_dir + std::to_string( index ) + "/level" ) != "3" )
+                    continue;
+
+                for ( const int other : parseCpuList( readFirstLine( cache_dir + std::to_string( index ) + "/shared_cpu_list" ) ) ) {
+                    if ( allowed_set.count( other ) )
+                        group_cpus.push_back( other );
+                }
+            }
+        }
+
+        if ( group_cpus.empty() || !seen.insert( group_cpus ).second )
+            continue;
+
+        CpuGroup group;
+        group.numa_node = numa_node_of[ cpu ];
+        group.cpus = group_cpus;
+
+        groups.push_back( group );
+    }
+
+    // A CPU in two groups means the sysfs view is inconsistent (e.g. no L3 info on some cores)
+    size_t grouped_cpus = 0;
+    for ( const auto& group : groups )
+        grouped_cpus += group.cpus.size();
+
+    if ( grouped_cpus != allowed.size() ) {
+        std::cerr << "Incomplete \"" << mode << "\" CPU topology, worker groups are off" << std::endl;
+        groups.clear();
+    }
+#else
+    std::cerr << "CPU placement \"" << mode << "\" is only available on Linux" << std::endl;
+#endif
+
+    if ( groups.size() == 1 )
+        groups.clear();
+
+    return groups;
+}
+
+
+// Pins the calling thread to a CPU group and prefers its NUMA node for new memory ( first touch:
+// the weights and the buffers a pipeline allocates while pinned stay on the node ).
+// Restores the previous affinity and memory policy when it goes out of scope. No-op without a group
+class ThreadPlacementScope {
+
+    private:
+#if defined( __linux__ )
+        cpu_set_t previous_cpus;
+#endif
+        bool pinned = false;
+        bool memory_policy_set = false;
+
+    public:
+        ThreadPlacementScope( const CpuGroup* group ) {
+
+#if defined( __linux__ )
+            if ( group == nullptr )
+                return;
+
+            cpu_set_t group_cpus;
+            CPU_ZERO( &group_cpus );
+
+            for ( const int cpu : group->cpus )
+                CPU_SET( cpu, &group_cpus );
+
+            if ( pthread_getaffinity_np( pthread_self(), sizeof( previous_cpus ), &previous_cpus ) == 0 )
+                pinned = pthread_setaffinity_np( pthread_self(), sizeof( group_cpus ), &group_cpus ) == 0;
+
+            if ( group->numa_node >= 0 && group->numa_node < 64 ) {
+                const int mpol_preferred = 1; // <numaif.h> MPOL_PREFERRED, without linking libnuma
+                const unsigned long node_mask = 1UL << group->numa_node;
+                memory_policy_set = syscall( SYS_set_mempolicy, mpol_preferred, &node_mask, sizeof( node_mask ) * 8 ) == 0;
+            }
+#else
+            (void) group;
+#endif
+        }
+
+        ThreadPlacementScope( const ThreadPlacementScope& ) = delete;
+        ThreadPlacementScope& operator=( const ThreadPlacementScope& ) = delete;
+
+        ~ThreadPlacementScope() {
+
+#if defined( __linux__ )
+            if ( pinned )
+                pthread_setaffinity_np( pthread_self(), sizeof( previous_cpus ), &previous_cpus );
+
+            if ( memory_policy_set ) {
+                const int mpol_default = 0;
+                syscall( SYS_set_mempolicy, mpol_default, nullptr, 0 );
+            }
+#endif
+        }
+};
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef CTC_DECODER_HPP
+#define CTC_DECODER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fastdeploy/vision.h>
+#include "loop_pool.hpp"
+#include "simd_dispatch.hpp"
+
+
+// Index of the first largest value ( as std::max_element ), and the value
+using ArgmaxKernel = int (*)( const float* values, int count, float* max_value );
+
+// The reference the SIMD kernels must match
+int argmaxScalar( const float* values, int count, float* max_value ) {
+
+    int best = 0;
+
+    for ( int i = 1; i < count; ++i ) {
+        if ( values[ best ] < values[ i ] )
+            best = i;
+    }
+
+    *max_value = values[ best ];
+
+    return best;
+}
+
+// The SIMD kernels take the maximum first, then look for its first index: both passes stay in
+// the L1 cache for one timestep ( a few thousand classes ), and the search stops at the first hit.
+// The max instructions drop NaNs ( or return them, depending on the operand order and the ISA ), so the
+// first pass also looks for NaNs, and a row with any goes to the scalar kernel, which orders them like
+// std::max_element
+
+#if defined( PPOCR_SIMD_X86 )
+
+PPOCR_TARGET_AVX2
+int argmaxAVX2( const float* values, int count, float* max_value ) {
+
+    int i = 0;
+    __m256 maxima = _mm256_set1_ps( -std::numeric_limits< float >::infinity() );
+    __m256 nans = _mm256_setzero_ps();
+
+    for ( ; i + 8 <= count; i += 8 ) {
+        const __m256 row = _mm256_loadu_ps( values + i );
+        maxima = _mm256_max_ps( maxima, row );
+        nans = _mm256_or_ps( nans, _mm256_cmp_ps( row, row, _CMP_UNORD_Q ) );
+    }
+
+    if ( _mm256_movemask_ps( nans ) != 0 )
+        return argmaxScalar( values, count, max_value );
+
+    __m128 half = _mm_max_ps( _mm256_castps256_ps128( maxima ), _mm256_extractf128_ps( maxima, 1 ) );
+    half = _mm_max_ps( half, _mm_movehl_ps( half, half ) );
+    half = _mm_max_ss( half, _mm_shuffle_ps( half, half, 1 ) );
+
+    float best = _mm_cvtss_f32( half );
+
+    for ( ; i < count; ++i ) {
+        if ( std::isnan( values[ i ] ) )
+            return argmaxScalar( values, count, max_value );
+        best = std::max( best, values[ i ] );
+    }
+
+    const __m256 target = _mm256_set1_ps( best );
+
+    for ( i = 0; i + 8 <= count; i += 8 ) {
+
+        const int mask = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_loadu_ps( values + i ), target, _CMP_EQ_OQ ) );
+
+        if ( mask != 0 ) {
+            *max_value = best;
+            return i + lowestSetBit( uint32_t( mask ) );
+        }
+    }
+
+    for ( ; i < count; ++i ) {
+        if ( values[ i ] == best ) {
+            *max_value = best;
+            return i;
+        }
+    }
+
+    return argmaxScalar( values, count, max_value );
+}
+
+PPOCR_TARGET_AVX512
+int argmaxAVX512( const float* values, int count, float* max_value ) {
+
+    int i = 0;
+    __m512 maxima = _mm512_set1_ps( -std::numeric_limits< float >::infinity() );
+    __mmask16 nans = 0;
+
+    for ( ; i + 16 <= count; i += 16 ) {
+        const __m512 row = _mm512_loadu_ps( values + i );
+        maxima = _mm512_max_ps( maxima, row );
+        nans |= _mm512_cmp_ps_mask( row, row, _CMP_UNORD_Q );
+    }
+
+    if ( nans != 0 )
+        return argmaxScalar( values, count, max_value );
+
+    float best = _mm512_reduce_max_ps( maxima );
+
+    for ( ; i < count; ++i ) {
+        if ( std::isnan( values[ i ] ) )
+            return argmaxScalar( values, count, max_value );
+        best = std::max( best, values[ i ] );
+    }
+
+    const __m512 target = _mm512_set1_ps( best );
+
+    for ( i = 0; i + 16 <= count; i += 16 ) {
+
+        const __mmask16 mask = _mm512_cmp_ps_mask( _mm512_loadu_ps( values + i ), target, _CMP_EQ_OQ );
+
+        if ( mask != 0 ) {
+            *max_value = best;
+            return i + lowestSetBit( uint32_t( mask ) );
+        }
+    }
+
+    for ( ; i < count; ++i ) {
+        if ( values[ i ] == best ) {
+            *max_value = best;
+            return i;
+        }
+    }
+
+    return argmaxScalar( values, count, max_value );
+}
+
+#endif
+
+#if defined( PPOCR_SIMD_NEON )
+
+int argmaxNEON( const float* values, int count, float* max_value ) {
+
+    int i = 0;
+    float32x4_t maxima = vdupq_n_f32( -std::numeric_limits< float >::infinity() );
+    uint32x4_t ordered = vdupq_n_u32( 0xffffffff ); // A lane compares unequal to itself only when NaN
+
+    for ( ; i + 4 <= count; i += 4 ) {
+        const float32x4_t row = vld1q_f32( values + i );
+        maxima = vmaxq_f32( maxima, row );
+        ordered = vandq_u32( ordered, vceqq_f32( row, row ) );
+    }
+
+    if ( vminvq_u32( ordered ) == 0 )
+        return argmaxScalar( values, count, max_value );
+
+    float best = vmaxvq_f32( maxima );
+
+    for ( ; i < count; ++i ) {
+        if ( std::isnan( values[ i ] ) )
+            return argmaxScalar( values, count, max_value );
+        best = std::max( best, values[ i ] );
+    }
+
+    const float32x4_t target = vdupq_n_f32( best );
+
+    for ( i = 0; i + 4 <= count; i += 4 ) {
+        if ( vmaxvq_u32( vceqq_f32( vld1q_f32( values + i ), target ) ) != 0 )
+            break;
+    }
+
+    for ( ; i < count; ++i ) {
+        if ( values[ i ] == best ) {
+            *max_value = best;
+            return i;
+        }
+    }
+
+    return argmaxScalar( values, count, max_value );
+}
+
+#endif
+
+ArgmaxKernel argmaxKernel( SimdLevel level ) {
+
+#if defined( PPOCR_SIMD_X86 )
+    if ( level == SimdLevel::AVX512 )
+        return argmaxAVX512;
+    if ( level == SimdLevel::AVX2 )
+        return argmaxAVX2;
+#elif defined( PPOCR_SIMD_NEON )
+    if ( level == SimdLevel::NEON )
+        return argmaxNEON;
+#endif
+
+    return argmaxScalar;
+}
+
+
+// Greedy CTC decoding of the recognizer output, the same results as FastDeploy's RecognizerPostprocessor:
+// argmax class of every timestep, blanks ( class 0 ) and repeats dropped, score the mean probability of
+// the kept characters ( 0 when there are none ). Labels: blank, the lines of the dictionary, " ".
+// The labels are one UTF-8 buffer with offsets, so a line's text is sized once and copied in;
+// the lines of a batch are decoded in parallel when the output is big ( CJK dictionaries ).
+class CTCDecoder {
+
+    private:
+        static constexpr size_t parallel_min_values = 1 << 16; // Per line: timesteps x classes
+
+        std::string label_bytes; // Every label, back to back
+        std::vector< uint32_t > label_offsets; // Label i: [ label_offsets[ i ], label_offsets[ i + 1 ] )
+        SimdLevel simd_level;
+        ArgmaxKernel argmax;
+
+        size_t labelCount() const {
+            return label_offsets.size() - 1;
+        }
+
+    public:
+        // dictionary: the lines of the label file
+        CTCDecoder( const std::vector< std::string >& dictionary, SimdLevel simd_level = detectSimdLevel() )
+            : simd_level( simd_level ), argmax( argmaxKernel( simd_level ) ) {
+
+            std::vector< std::string > labels;
+            labels.reserve( dictionary.size() + 2 );
+            labels.push_back( "#" ); // Blank, never output
+            labels.insert( labels.end(), dictionary.begin(), dictionary.end() );
+            labels.push_back( " " );
+
+            label_offsets.push_back( 0 );
+
+            for ( const auto& label : labels ) {
+                label_bytes += label;
+                label_offsets.push_back( uint32_t( label_bytes.size() ) );
+            }
+        }
+
+        // The labels of decoder, other kernels
+        CTCDecoder( const CTCDecoder& decoder, SimdLevel simd_level )
+            : label_bytes( decoder.label_bytes ), label_offsets( decoder.label_offsets ),
+              simd_level( simd_level ), argmax( argmaxKernel( simd_level ) ) {}
+
+        // The dictionary lines as FastDeploy reads them, nullptr if the file can't be read
+        static std::shared_ptr< CTCDecoder > fromLabelFile( const std::string& label_file ) {
+
+            std::ifstream file( label_file );
+
+            if ( !file ) {
+                std::cerr << "Failed to read the labels of " << label_file << std::endl;
+                return nullptr;
+            }
+
+            std::vector< std::string > dictionary;
+            std::string line;
+
+            while ( std::getline( file, line ) )
+                dictionary.push_back( line );
+
+            return std::make_shared< CTCDecoder >( dictionary );
+        }
+
+        SimdLevel simdLevel() const {
+            return simd_level;
+        }
+
+        // probabilities: [ steps ][ classes ] of one line. False for a class outside the labels
+        bool decodeLine( const float* probabilities, int steps, int classes, std::string* text, float* score ) const {
+
+            thread_local std::vector< int > kept; // Label of each kept timestep
+
+            kept.clear();
+
+            float score_sum = 0;
+            size_t text_bytes = 0;
+            int last_idx = 0;
+
+            for ( int step = 0; step < steps; ++step ) {
+
+                float max_value;
+                const int idx = argmax( probabilities + size_t( step ) * classes, classes, &max_value );
+
+                if ( idx > 0 && !( step > 0 && idx == last_idx ) ) {
+
+                    if ( size_t( idx ) >= labelCount() ) {
+                        std::cerr << "Recognizer class " << idx << " is not in the label file." << std::endl;
+                        return false;
+                    }
+
+                    score_sum += max_value;
+                    kept.push_back( idx );
+                    text_bytes += label_offsets[ idx + 1 ] - label_offsets[ idx ];
+                }
+
+                last_idx = idx;
+            }
+
+            text->resize( text_bytes );
+
+            char* out = &( *text )[ 0 ];
+
+            for ( const int idx : kept ) {
+                const uint32_t length = label_offsets[ idx + 1 ] - label_offsets[ idx ];
+                std::memcpy( out, label_bytes.data() + label_offsets[ idx ], length );
+                out += length;
+            }
+
+            *score = score_sum / ( kept.size() + 1e-6f );
+
+            if ( kept.empty() || std::isnan( *score ) )
+                *score = 0;
+
+            return true;
+        }
+
+        // RecognizerPostprocessor::Run: output [ lines, steps, classes ] of the lines at
+        // indices[ start_idx ... ) ( start_idx ... without indices ), texts / rec_scores sized to total_size
+        bool decodeBatch(
+            const fastdeploy::FDTensor& output,
+            std::vector< std::string >* texts,
+            std::vector< float >* rec_scores,
+            size_t start_idx,
+            size_t total_size,
+            const std::vector< int >& indices
+        ) const {
+
+            if ( output.shape.size() != 3 || output.dtype != fastdeploy::FDDataType::FP32 ) {
+                std::cerr << "Unexpected recognizer output." << std::endl;
+                return false;
+            }
+
+            const int lines = int( output.shape[ 0 ] );
+            const int steps = int( output.shape[ 1 ] );
+            const int classes = int( output.shape[ 2 ] );
+
+            if ( texts->size() < total_size )
+                texts->resize( total_size );
+            if ( rec_scores->size() < total_size )
+                rec_scores->resize( total_size );
+
+            const float* data = static_cast< const float* >( output.Data() );
+
+            std::vector< char > decoded( lines, 1 ); // Written by the workers, no vector< bool >
+
+            auto decodeLines = [&]( const cv::Range& range ) {
+
+                for ( int line = range.start; line < range.end; ++line ) {
+
+                    const size_t result_idx = indices.empty() ? start_idx + line : size_t( indices[ start_idx + line ] );
+
+                    decoded[ line ] = decodeLine(
+                        data + size_t( line ) * steps * classes, steps, classes,
+                        &( *texts )[ result_idx ], &( *rec_scores )[ result_idx ]
+                    );
+                }
+            };
+
+            if ( lines > 1 && size_t( steps ) * classes >= parallel_min_values )
+                parallelFor( cv::Range( 0, lines ), decodeLines );
+            else
+                decodeLines( cv::Range( 0, lines ) );
+
+            for ( const char line_decoded : decoded ) {
+                if ( !line_decoded )
+                    return false;
+            }
+
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef DETECTION_RESOLUTION_HPP
+#define DETECTION_RESOLUTION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "metrics.hpp"
+
+
+struct DetectionResolutionSettings {
+    int min_text_height = 0; // Median text height kept at the detector input, in pixels, 0 = off ( always max_image_width )
+    int full_side = 960; // max_image_width
+    int recheck_frames = 50; // A frame at full resolution every recheck_frames frames of a stream
+    int hysteresis_frames = 5; // Consecutive frames that must allow a lower resolution before the stream moves to it
+};
+
+
+// Picks the detector input resolution of each stream ( language + client_id, required ) from the text heights
+// it detected lately: the lowest of a few scales of max_image_width that keeps the median text height
+// at or above min_text_height. Streams go to a lower scale only after hysteresis_frames frames that all
+// allow it ( with a margin ), and back up at once when the text gets smaller. A periodic frame at full
+// resolution, and the frame after an empty one, catch text that got too small to be seen at all
+class DetectionResolutionController {
+
+    private:
+        static constexpr std::array< double, 5 > scales = { 1.0, 0.75, 0.5, 0.375, 0.25 };
+        static constexpr size_t window_frames = 8; // Frame medians the estimate is the median of
+        static constexpr double downscale_margin = 1.25; // Lower scales must keep this much above the floor
+        static constexpr size_t max_streams = 4096;
+
+        struct Stream {
+            size_t level = 0; // Index in scales
+            int lower_votes = 0; // Consecutive frames allowing a lower level
+            int frames_since_recheck = 0;
+            bool recheck = false; // Next frame at full resolution
+            std::deque< float > heights; // Median text height of the last frames, at full resolution
+            uint64_t last_used = 0;
+        };
+
+        DetectionResolutionSettings settings;
+
+        std::mutex mutex;
+        std::unordered_map< std::string, Stream > streams;
+        uint64_t clock = 0;
+
+        static std::string streamKey( const std::string& language_code, const std::string& stream_id ) {
+            return language_code + "|" + stream_id;
+        }
+
+        // Scale from the frame to a full resolution detector input
+        double fullRatio( const cv::Size& frame_size ) const {
+            const int frame_side = std::max( frame_size.width, frame_size.height );
+            return frame_side > settings.full_side ? double( settings.full_side ) / frame_side : 1.0;
+        }
+
+        Stream& stream( const std::string& key ) {
+
+            auto it = streams.find( key );
+
+            if ( it == streams.end() ) {
+
+                // Forget the stream used the longest ago
+                if ( streams.size() >= max_streams ) {
+                    auto oldest = std::min_element( streams.begin(), streams.end(), []( const auto& a, const auto& b ) {
+                        return a.second.last_used < b.second.last_used;
+                    } );
+                    streams.erase( oldest );
+                }
+
+                it = streams.emplace( key, Stream() ).first;
+            }
+
+            it->second.last_used = ++clock;
+
+            return it->second;
+        }
+
+        // Text height of a box: its shorter side ( vertical lines are taller than wide )
+        static float boxTextHeight( const std::array< int, 8 >& box ) {
+
+            auto distance = [&]( int a, int b ) {
+                return std::hypot( float( box[ 2 * a ] - box[ 2 * b ] ), float( box[ 2 * a + 1 ] - box[ 2 * b + 1 ] ) );
+            };
+
+            const float width = ( distance( 0, 1 ) + distance( 3, 2 ) ) / 2;
+            const float height = ( distance( 0, 3 ) + distance( 1, 2 ) ) / 2;
+
+            return std::min( width, height );
+        }
+
+        static float median( std::vector< float > values ) {
+            std::nth_element( values.begin(), values.begin() + values.size() / 2, values.end() );
+            return values[ values.size() / 2 ];
+        }
+
+    public:
+        DetectionResolutionController( const DetectionResolutionSettings& settings = DetectionResolutionSettings() )
+            : settings( settings ) {}
+
+        bool enabled() const {
+            return settings.min_text_height > 0;
+        }
+
+        // Longest side of the detector input for the next frame of the stream, 0 = max_image_width.
+        // Requests without a client_id are not a stream ( unrelated frames ): always 0
+        int maxSideFor( const std::string& language_code, const std::string& stream_id, const cv::Size& frame_size ) {
+
+            if ( !enabled() || stream_id.empty() )
+                return 0;
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            Stream& current = stream( streamKey( language_code, stream_id ) );
+
+            if ( current.level == 0 )
+                return 0;
+
+            if ( current.recheck || ++current.frames_since_recheck >= settings.recheck_frames ) {
+                current.recheck = false;
+                current.frames_since_recheck = 0;
+                metrics().increment( MetricCounter::DET_RESOLUTION_RECHECKS );
+                return 0;
+            }
+
+            metrics().increment( MetricCounter::DET_REDUCED_RESOLUTION_FRAMES );
+
+            const int full_side = int( std::max( frame_size.width, frame_size.height ) * fullRatio( frame_size ) );
+
+            return std::max( 32, int( full_side * scales[ current.level ] ) );
+        }
+
+        // Boxes detected in the frame ( frame coordinates ) at max_side ( from maxSideFor )
+        void record(
+            const std::string& language_code,
+            const std::string& stream_id,
+            const cv::Size& frame_size,
+            int max_side,
+            const std::vector< std::array< int, 8 > >& boxes
+        ) {
+
+            if ( !enabled() || stream_id.empty() )
+                return;
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            Stream& current = stream( streamKey( language_code, stream_id ) );
+
+            if ( boxes.empty() ) {
+                // Nothing seen at a lower scale: the text may be too small for it
+                if ( max_side > 0 )
+                    current.recheck = true;
+                return;
+            }
+
+            const double full_ratio = fullRatio( frame_size );
+
+            std::vector< float > heights;
+            heights.reserve( boxes.size() );
+
+            for ( const auto& box : boxes )
+                heights.push_back( float( boxTextHeight( box ) * full_ratio ) );
+
+            const float frame_height = median( heights );
+
+            current.heights.push_back( frame_height );
+
+            if ( current.heights.size() > window_frames )
+                current.heights.pop_front();
+
+            const float estimate = median( std::vector< float >( current.heights.begin(), current.heights.end() ) );
+
+            // Lowest scale keeping the text at the floor ( this frame's text too, so smaller text moves the
+            // stream up at once ), and the lowest keeping the usual text there with the margin
+            size_t needed = 0;
+            size_t allowed = 0;
+
+            for ( size_t i = 0; i < scales.size(); ++i ) {
+                if ( std::min( estimate, frame_height ) * scales[ i ] >= settings.min_text_height )
+                    needed = i;
+                if ( estimate * scales[ i ] >= settings.min_text_height * downscale_margin )
+                    allowed = i;
+            }
+
+            if ( needed < current.level ) {
+                current.level = needed;
+                current.lower_votes = 0;
+            }
+            else if ( allowed > current.level ) {
+                if ( ++current.lower_votes >= settings.hysteresis_frames ) {
+                    current.level = allowed;
+                    current.lower_votes = 0;
+                }
+            }
+            else {
+                current.lower_votes = 0;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef FUSED_PREPROCESS_HPP
+#define FUSED_PREPROCESS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fastdeploy/vision.h>
+#include "simd_dispatch.hpp"
+
+
+// One row of BGR bytes to three float planes: plane[ c ][ x ] = src[ x ][ c ] * scale[ c ] + shift[ c ]
+// ( scale and shift fold the 1 / 255, the mean and the std of the model's normalization )
+using NormalizeRowKernel = void (*)(
+    const uint8_t* src,
+    int width,
+    const float* scale,
+    const float* shift,
+    float* plane_0,
+    float* plane_1,
+    float* plane_2
+);
+
+// The reference the SIMD kernels are compared against ( ppocr_bench --mode preprocess-compare )
+void normalizeRowScalar( const uint8_t* src, int width, const float* scale, const float* shift, float* plane_0, float* plane_1, float* plane_2 ) {
+
+    for ( int x = 0; x < width; ++x ) {
+        plane_0[ x ] = src[ 3 * x ] * scale[ 0 ] + shift[ 0 ];
+        plane_1[ x ] = src[ 3 * x + 1 ] * scale[ 1 ] + shift[ 1 ];
+        plane_2[ x ] = src[ 3 * x + 2 ] * scale[ 2 ] + shift[ 2 ];
+    }
+}
+
+#if defined( PPOCR_SIMD_X86 )
+
+// pshufb masks splitting 16 interleaved BGR pixels ( 3 x 16 bytes ) into 16 bytes per channel:
+// masks[ channel ][ source register ], 0x80 zeroes the bytes another register provides
+struct DeinterleaveMasks {
+    alignas( 16 ) uint8_t bytes[ 3 ][ 3 ][ 16 ];
+};
+
+constexpr DeinterleaveMasks makeDeinterleaveMasks() {
+
+    DeinterleaveMasks masks{};
+
+    for ( int channel = 0; channel < 3; ++channel ) {
+        for ( int reg = 0; reg < 3; ++reg ) {
+            for ( int pixel = 0; pixel < 16; ++pixel ) {
+                const int byte = 3 * pixel + channel;
+                masks.bytes[ channel ][ reg ][ pixel ] = byte >= 16 * reg && byte < 16 * ( reg + 1 ) ? uint8_t( byte - 16 * reg ) : 0x80;
+            }
+        }
+    }
+
+    return masks;
+}
+
+constexpr DeinterleaveMasks deinterleave_masks = makeDeinterleaveMasks();
+
+PPOCR_TARGET_AVX2
+void normalizeRowAVX2( const uint8_t* src, int width, const float* scale, const float* shift, float* plane_0, float* plane_1, float* plane_2 ) {
+
+    float* planes[ 3 ] = { plane_0, plane_1, plane_2 };
+
+    __m128i masks[ 3 ][ 3 ];
+    __m256 scales[ 3 ], shifts[ 3 ];
+
+    for ( int channel = 0; channel < 3; ++channel ) {
+        for ( int reg = 0; reg < 3; ++reg )
+            masks[ channel ][ reg ] = _mm_load_si128( reinterpret_cast< const __m128i* >( deinterleave_masks.bytes[ channel ][ reg ] ) );
+        scales[ channel ] = _mm256_set1_ps( scale[ channel ] );
+        shifts[ channel ] = _mm256_set1_ps( shift[ channel ] );
+    }
+
+    int x = 0;
+
+    for ( ; x + 16 <= width; x += 16 ) {
+
+        const __m128i a = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x ) );
+        const __m128i b = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x + 16 ) );
+        const __m128i c = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x + 32 ) );
+
+        for ( int channel = 0; channel < 3; ++channel ) {
+
+            const __m128i values = _mm_or_si128(
+                _mm_or_si128( _mm_shuffle_epi8( a, masks[ channel ][ 0 ] ), _mm_shuffle_epi8( b, masks[ channel ][ 1 ] ) ),
+                _mm_shuffle_epi8( c, masks[ channel ][ 2 ] )
+            );
+
+            const __m256 low = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( values ) );
+            const __m256 high = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_srli_si128( values, 8 ) ) );
+
+            _mm256_storeu_ps( planes[ channel ] + x, _mm256_fmadd_ps( low, scales[ channel ], shifts[ channel ] ) );
+            _mm256_storeu_ps( planes[ channel ] + x + 8, _mm256_fmadd_ps( high, scales[ channel ], shifts[ channel ] ) );
+        }
+    }
+
+    normalizeRowScalar( src + 3 * x, width - x, scale, shift, plane_0 + x, plane_1 + x, plane_2 + x );
+}
+
+PPOCR_TARGET_AVX512
+void normalizeRowAVX512( const uint8_t* src, int width, const float* scale, const float* shift, float* plane_0, float* plane_1, float* plane_2 ) {
+
+    float* planes[ 3 ] = { plane_0, plane_1, plane_2 };
+
+    __m128i masks[ 3 ][ 3 ];
+    __m512 scales[ 3 ], shifts[ 3 ];
+
+    for ( int channel = 0; channel < 3; ++channel ) {
+        for ( int reg = 0; reg < 3; ++reg )
+            masks[ channel ][ reg ] = _mm_load_si128( reinterpret_cast< const __m128i* >( deinterleave_masks.bytes[ channel ][ reg ] ) );
+        scales[ channel ] = _mm512_set1_ps( scale[ channel ] );
+        shifts[ channel ] = _mm512_set1_ps( shift[ channel ] );
+    }
+
+    int x = 0;
+
+    for ( ; x + 16 <= width; x += 16 ) {
+
+        const __m128i a = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x ) );
+        const __m128i b = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x + 16 ) );
+        const __m128i c = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + 3 * x + 32 ) );
+
+        for ( int channel = 0; channel < 3; ++channel ) {
+
+            const __m128i values = _mm_or_si128(
+                _mm_or_si128( _mm_shuffle_epi8( a, masks[ channel ][ 0 ] ), _mm_shuffle_epi8( b, masks[ channel ][ 1 ] ) ),
+                _mm_shuffle_epi8( c, masks[ channel ][ 2 ] )
+            );
+
+            const __m512 pixels = _mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( values ) );
+
+            _mm512_storeu_ps( planes[ channel ] + x, _mm512_fmadd_ps( pixels, scales[ channel ], shifts[ channel ] ) );
+        }
+    }
+
+    normalizeRowScalar( src + 3 * x, width - x, scale, shift, plane_0 + x, plane_1 + x, plane_2 + x );
+}
+
+#endif
+
+#if defined( PPOCR_SIMD_NEON )
+
+void normalizeRowNEON( const uint8_t* src, int width, const float* scale, const float* shift, float* plane_0, float* plane_1, float* plane_2 ) {
+
+    float* planes[ 3 ] = { plane_0, plane_1, plane_2 };
+
+    int x = 0;
+
+    for ( ; x + 16 <= width; x += 16 ) {
+
+        const uint8x16x3_t pixels = vld3q_u8( src + 3 * x ); // Deinterleaves B, G, R
+
+        for ( int channel = 0; channel < 3; ++channel ) {
+
+            const float32x4_t channel_scale = vdupq_n_f32( scale[ channel ] );
+            const float32x4_t channel_shift = vdupq_n_f32( shift[ channel ] );
+
+            const uint16x8_t low = vmovl_u8( vget_low_u8( pixels.val[ channel ] ) );
+            const uint16x8_t high = vmovl_u8( vget_high_u8( pixels.val[ channel ] ) );
+
+            const uint32x4_t quarters[ 4 ] = {
+                vmovl_u16( vget_low_u16( low ) ), vmovl_u16( vget_high_u16( low ) ),
+                vmovl_u16( vget_low_u16( high ) ), vmovl_u16( vget_high_u16( high ) )
+            };
+
+            for ( int i = 0; i < 4; ++i )
+                vst1q_f32( planes[ channel ] + x + 4 * i, vfmaq_f32( channel_shift, vcvtq_f32_u32( quarters[ i ] ), channel_scale ) );
+        }
+    }
+
+    normalizeRowScalar( src + 3 * x, width - x, scale, shift, plane_0 + x, plane_1 + x, plane_2 + x );
+}
+
+#endif
+
+// Kernel of the level, the scalar one when it is not built for this architecture
+NormalizeRowKernel normalizeRowKernel( SimdLevel level ) {
+
+#if defined( PPOCR_SIMD_X86 )
+    if ( level == SimdLevel::AVX512 )
+        return normalizeRowAVX512;
+    if ( level == SimdLevel::AVX2 )
+        return normalizeRowAVX2;
+#elif defined( PPOCR_SIMD_NEON )
+    if ( level == SimdLevel::NEON )
+        return normalizeRowNEON;
+#endif
+
+    return normalizeRowScalar;
+}
+
+
+// Detector and recognizer inputs in one pass over the resized pixels: the BGR bytes are normalized
+// and written planar ( NCHW ) straight into the input tensor, which the caller keeps between frames.
+// FastDeploy's preprocessors resize, then normalize and permute in separate passes and buffers.
+// Same sizes and values as FastDeploy's DBDetectorPreprocessor and RecognizerPreprocessor
+// ( resize with cv::resize, bilinear; no BGR to RGB swap, the models take BGR )
+class FusedPreprocessor {
+
+    private:
+        SimdLevel simd_level;
+        NormalizeRowKernel kernel;
+
+        // ( x / 255 - mean ) / std = x * scale + shift
+        static constexpr std::array< float, 3 > det_mean = { 0.485f, 0.456f, 0.406f };
+        static constexpr std::array< float, 3 > det_std = { 0.229f, 0.224f, 0.225f };
+        static constexpr float rec_mean = 0.5f;
+        static constexpr float rec_std = 0.5f;
+        static constexpr float rec_pad_value = 127.0f; // Right padding of the narrower lines, before normalization
+
+        std::array< float, 3 > det_scale, det_shift;
+        std::array< float, 3 > rec_scale, rec_shift;
+
+        // image rows into the planes of one NCHW sample, rows of plane_width floats
+        void writePlanes( const cv::Mat& image, const std::array< float, 3 >& scale, const std::array< float, 3 >& shift, float* sample, int plane_width ) const {
+
+            const size_t plane_size = size_t( image.rows ) * plane_width;
+
+            for ( int y = 0; y < image.rows; ++y ) {
+                float* row = sample + size_t( y ) * plane_width;
+                kernel( image.ptr< uint8_t >( y ), image.cols, scale.data(), shift.data(), row, row + plane_size, row + 2 * plane_size );
+            }
+        }
+
+    public:
+        FusedPreprocessor( SimdLevel simd_level = detectSimdLevel() ) : simd_level( simd_level ) {
+
+            kernel = normalizeRowKernel( simd_level );
+
+            for ( int c = 0; c < 3; ++c ) {
+                det_scale[ c ] = 1.0f / ( 255.0f * det_std[ c ] );
+                det_shift[ c ] = -det_mean[ c ] / det_std[ c ];
+                rec_scale[ c ] = 1.0f / ( 255.0f * rec_std );
+                rec_shift[ c ] = -rec_mean / rec_std;
+            }
+        }
+
+        SimdLevel simdLevel() const {
+            return simd_level;
+        }
+
+        // 8 bit BGR only, other images go through FastDeploy's preprocessors
+        static bool supports( const cv::Mat& image ) {
+            return image.type() == CV_8UC3;
+        }
+
+        // det_img_info: < width, height, resized width, resized height >, as the detector postprocessing expects
+        bool detectorInput( const cv::Mat& image, int max_side_len, fastdeploy::FDTensor* tensor, std::array< int, 4 >* det_img_info ) const {
+
+            if ( !supports( image ) || image.empty() )
+                return false;
+
+            // DBDetectorPreprocessor: longest side down to max_side_len, both sides rounded to multiples of 32
+            float ratio = 1.0f;
+            if ( std::max( image.cols, image.rows ) > max_side_len )
+                ratio = float( max_side_len ) / std::max( image.cols, image.rows );
+
+            const int resize_w = std::max( int( std::round( float( int( image.cols * ratio ) ) / 32 ) * 32 ), 32 );
+            const int resize_h = std::max( int( std::round( float( int( image.rows * ratio ) ) / 32 ) * 32 ), 32 );
+
+            thread_local cv::Mat resized;
+
+            const cv::Mat* source = &image;
+
+            if ( resize_w != image.cols || resize_h != image.rows ) {
+                cv::resize( image, resized, cv::Size( resize_w, resize_h ), 0, 0, cv::INTER_LINEAR );
+                source = &resized;
+            }
+
+            tensor->Resize( { 1, 3, resize_h, resize_w }, fastdeploy::FDDataType::FP32 );
+
+            writePlanes( *source, det_scale, det_shift, static_cast< float* >( tensor->MutableData() ), resize_w );
+
+            *det_img_info = { image.cols, image.rows, resize_w, resize_h };
+
+            return true;
+        }
+
+        // Lines at indices[ start_idx ... end_idx ), as RecognizerPreprocessor: every line resized to the input
+        // height keeping its aspect ratio, batch width from the widest line ( at least rec_image_shape's ),
+        // narrower lines padded on the right
+        bool recognizerInput(
+            const std::vector< cv::Mat >& text_images,
+            size_t start_idx,
+            size_t end_idx,
+            const std::vector< int >& indices,
+            const std::vector< int >& rec_image_shape, // < channels, height, width >
+            fastdeploy::FDTensor* tensor
+        ) const {
+
+            end_idx = std::min( end_idx, indices.empty() ? text_images.size() : indices.size() );
+
+            if ( start_idx >= end_idx || rec_image_shape.size() != 3 )
+                return false;
+
+            auto lineAt = [&]( size_t i ) -> const cv::Mat& {
+                return text_images[ indices.empty() ? i : size_t( indices[ i ] ) ];
+            };
+
+            const int img_h = rec_image_shape[ 1 ];
+            float max_wh_ratio = float( rec_image_shape[ 2 ] ) / img_h;
+
+            for ( size_t i = start_idx; i < end_idx; ++i ) {
+
+                const cv::Mat& line = lineAt( i );
+
+                if ( !supports( line ) || line.empty() )
+                    return false;
+
+                max_wh_ratio = std::max( max_wh_ratio, float( line.cols ) / line.rows );
+            }
+
+            const int img_w = int( img_h * max_wh_ratio );
+            const size_t sample_size = size_t( 3 ) * img_h * img_w;
+
+            tensor->Resize( { int64_t( end_idx - start_idx ), 3, img_h, img_w }, fastdeploy::FDDataType::FP32 );
+
+            float* samples = static_cast< float* >( tensor->MutableData() );
+
+            thread_local cv::Mat resized;
+
+            for ( size_t i = start_idx; i < end_idx; ++i ) {
+
+                const cv::Mat& line = lineAt( i );
+                float* sample = samples + ( i - start_idx ) * sample_size;
+
+                const int resize_w = std::min( img_w, int( std::ceil( img_h * float( line.cols ) / line.rows ) ) );
+
+                cv::resize( line, resized, cv::Size( resize_w, img_h ), 0, 0, cv::INTER_LINEAR );
+
+                writePlanes( resized, rec_scale, rec_shift, sample, img_w );
+
+                for ( int c = 0; c < 3; ++c ) {
+
+                    const float pad = rec_pad_value * rec_scale[ c ] + rec_shift[ c ];
+                    float* plane = sample + size_t( c ) * img_h * img_w;
+
+                    for ( int y = 0; y < img_h && resize_w < img_w; ++y )
+                        std::fill( plane + size_t( y ) * img_w + resize_w, plane + size_t( y + 1 ) * img_w, pad );
+                }
+            }
+
+            return true;
+        }
+};
+
+#endif
@@ -7,9 +7,17 @@
 #include <fastdeploy/vision.h>
 using json = nlohmann::json;
 
-#include "../../includes/cpp-base64-2.rc.08/base64.cpp"
+#include "base64_decoder.hpp"
+#include "classifier_policy.hpp"
+#include "cpu_governor.hpp"
+#include "detection_resolution.hpp"
 #include "settings_manager.hpp"
 #include "inference_pipeline_builder.hpp"
+#include "json_writer.hpp"
+#include "memory_manager.hpp"
+#include "metrics.hpp"
+#include "model_registry.hpp"
+#include "request_context.hpp"
 #include "util.hpp"
 
 struct ContextResolution {
@@ -17,26 +25,77 @@ struct ContextResolution {
   int height;
 };
 
+// Move-only: the OCR result (one string and box per line) is handed from the
+// pipeline to the serializer without being copied
 struct InferenceResult {
   fastdeploy::vision::OCRResult ocr_result;
   ContextResolution context_resolution;
+  InferenceStatus status = InferenceStatus::OK;
+  RequestTimings timings;
+
+  InferenceResult() = default;
+  InferenceResult( InferenceResult&& ) = default;
+  InferenceResult& operator=( InferenceResult&& ) = default;
+  InferenceResult( const InferenceResult& ) = delete;
+  InferenceResult& operator=( const InferenceResult& ) = delete;
 };
 
 struct DetectionResult {
   fastdeploy::vision::OCRResult ocr_result;
   std::vector< cv::Mat > text_images;
   ContextResolution context_resolution;
+  InferenceStatus status = InferenceStatus::OK;
+  RequestTimings timings;
+
+  DetectionResult() = default;
+  DetectionResult( DetectionResult&& ) = default;
+  DetectionResult& operator=( DetectionResult&& ) = default;
+  DetectionResult( const DetectionResult& ) = delete;
+  DetectionResult& operator=( const DetectionResult& ) = delete;
 };
 
 class InferenceManager {
 
     private:
         InferencePipelineBuilder pipeline_builder;
-        std::unordered_map< std::string, std::shared_ptr<fastdeploy::pipeline::PPOCRv4> > pipelines;
+        std::mutex pipelines_mutex; // replaced_pipelines, classifier_policies ( not held while a pipeline loads )
+        // < language_code + placement key, pipeline >: each one loads once, without blocking the other keys
+        ModelRegistry< OCRPipeline > pipelines{ MetricCounter::PIPELINE_CACHE_HITS, MetricCounter::PIPELINE_CACHE_MISSES };
+        std::unordered_map< std::string, std::shared_ptr< OCRPipeline > > replaced_pipelines; // < language_code, pipeline > setPipeline
+        std::unordered_map< std::string, std::shared_ptr< ClassifierPolicy > > classifier_policies; // < language_code, policy > shared by its replicas
 
         std::map< std::string, LanguagePreset > language_presets;
         AppSettingsPreset app_settings;
 
+        static constexpr size_t max_retained_upload_bytes = 16 * 1024 * 1024;
+
+        LatencyEstimator latency_estimator;
+        CancellationCounters cancellation_counters;
+        std::unique_ptr< DetectionResolutionController > detection_resolution = std::make_unique< DetectionResolutionController >(); // Off until init
+
+        // Pixels the detector runs on: frames are downscaled to max_image_width
+        double detectorPixels( const cv::Mat& image ) const {
+
+            const int side = std::max( image.cols, image.rows );
+            const double ratio = side > app_settings.max_image_width && side > 0 ? double( app_settings.max_image_width ) / side : 1.0;
+
+            return double( image.total() ) * ratio * ratio;
+        }
+
+        // Admission: drop requests that are already cancelled or can't finish before their deadline
+        InferenceStatus admit( const std::string& language_code, const cv::Mat& image, const RequestContext& context ) {
+
+            InferenceStatus status = context.check();
+
+            if ( status == InferenceStatus::OK && !latency_estimator.canFinishInTime( language_code, detectorPixels( image ), context ) )
+                status = InferenceStatus::DEADLINE_EXCEEDED;
+
+            if ( status != InferenceStatus::OK )
+                cancellation_counters.rejected_at_admission++;
+
+            return status;
+        }
+
     public:
         InferenceManager() = default;
 
@@ -46,6 +105,15 @@ class InferenceManager {
         ) {
             this->language_presets = language_presets;
             this->app_settings = app_settings;
+
+            DetectionResolutionSettings resolution_settings;
+            resolution_settings.min_text_height = app_settings.det_min_text_height;
+            resolution_settings.full_side = app_settings.max_image_width;
+            resolution_settings.recheck_frames = app_settings.det_resolution_recheck_frames;
+            resolution_settings.hysteresis_frames = app_settings.det_resolution_hysteresis_frames;
+            detection_resolution = std::make_unique< DetectionResolutionController >( resolution_settings );
+
+            bufferPool().setMaxCachedBytes( size_t( app_settings.buffer_pool_max_mb ) * 1024 * 1024 );
         }
 
         // Initialize one pipeline for each available language preset (uses more RAM)
@@ -65,66 +133,134 @@ class InferenceManager {
             }
         }
 
-        void initPipeline( const std::string language_code ) {
+        // The pipeline of a language and placement, loaded on first use ( nullptr if it can't be ).
+        // Concurrent first requests for it wait for one load, requests for other pipelines don't wait
+        std::shared_ptr< OCRPipeline > initPipeline( const std::string language_code, const CpuPlacement& placement = CpuPlacement() ) {
 
-            auto pipeline_it = pipelines.find( language_code );
+            return pipelines.getOrLoad( language_code + placement.key(), [&]() -> std::shared_ptr< OCRPipeline > {
 
-            if ( pipeline_it != pipelines.end() ) {
-                // std::cout << "Pipeline for [" << language_code << "] already exists!" << std::endl;
-                return;
-            }
+                auto language_preset_it = this->language_presets.find( language_code );
 
-            auto language_preset_it = this->language_presets.find( language_code );
+                if ( language_preset_it == language_presets.end() ) {
+                    std::cout << "Language preset for [" << language_code << "] does not exists!" << std::endl;
+                    return nullptr;
+                }
 
-            if ( language_preset_it == language_presets.end() ) {
-                std::cout << "Language preset for [" << language_code << "] does not exists!" << std::endl;
-                return;
-            }
-            
-            auto language_preset = language_preset_it->second;
-
-            auto new_pipeline = pipeline_builder.buildInferencePipeline(
-                language_preset.detection_model_dir,
-                language_preset.classification_model_dir,
-                language_preset.recognition_model_dir,
-                language_preset.recognition_label_file_dir,
-                app_settings
-            );
+                auto language_preset = language_preset_it->second;
 
-            pipelines[ language_preset.language_code ] = new_pipeline;
-        }        
+                auto new_pipeline = pipeline_builder.buildInferencePipeline(
+                    language_preset.detection_model_dir,
+                    language_preset.classification_model_dir,
+                    language_preset.recognition_model_dir,
+                    language_preset.recognition_label_file_dir,
+                    app_settings,
+                    language_preset.precision,
+                    placement
+                );
 
-        std::shared_ptr< fastdeploy::pipeline::PPOCRv4 > getPipeline( std::string language_code ) {
+                if ( new_pipeline == nullptr )
+                    return nullptr;
 
-            initPipeline( language_code );
+                new_pipeline->setMemoryCap( size_t( app_settings.pipeline_memory_cap_mb ) * 1024 * 1024 );
+                new_pipeline->setNativeCrops( app_settings.crop_extraction == "native" );
 
-            auto it = pipelines.find( language_code );
+                std::lock_guard< std::mutex > lock( pipelines_mutex );
 
-            if ( it != pipelines.end() ) {
+                // The frames of a language flip together, whichever replica runs them
+                auto& classifier_policy = classifier_policies[ language_code ];
 
-                std::shared_ptr< fastdeploy::pipeline::PPOCRv4 > objPtr = it->second; // Retrieve the shared_ptr                
+                if ( classifier_policy == nullptr ) {
+                    ClassifierPolicySettings policy_settings;
+                    policy_settings.mode = app_settings.cls_policy;
+                    policy_settings.sample_ratio = app_settings.cls_sample_ratio;
+                    policy_settings.low_confidence = app_settings.cls_low_confidence;
+                    policy_settings.flip_memory_frames = app_settings.cls_flip_memory_frames;
+                    classifier_policy = std::make_shared< ClassifierPolicy >( policy_settings );
+                }
 
-                return objPtr;
-            } else {
-                std::cerr << language_code <<" not found in the map." << std::endl;
+                new_pipeline->setClassifierPolicy( classifier_policy );
+
+                return new_pipeline;
+            } );
+        }
+
+        // Replaces the pipeline of a language, whatever the placement (e.g. a fake backend for benchmarks)
+        void setPipeline( const std::string language_code, std::shared_ptr< OCRPipeline > pipeline ) {
+            std::lock_guard< std::mutex > lock( pipelines_mutex );
+            replaced_pipelines[ language_code ] = pipeline;
+        }
+
+        std::shared_ptr< OCRPipeline > getPipeline( std::string language_code, const CpuPlacement& placement = CpuPlacement() ) {
+
+            {
+                std::lock_guard< std::mutex > lock( pipelines_mutex );
+
+                auto replaced = replaced_pipelines.find( language_code );
+                if ( replaced != replaced_pipelines.end() )
+                    return replaced->second;
             }
 
-            return pipelines[ language_code ];
+            auto pipeline = initPipeline( language_code, placement );
+
+            if ( pipeline == nullptr )
+                std::cerr << "No pipeline for " << language_code << std::endl;
+
+            return pipeline;
+        }
+
+        // Models of a language, loaded on first use (shared with its pipeline)
+        Models getModels( const std::string& language_code, const CpuPlacement& placement = CpuPlacement() ) {
+            return this->pipeline_builder.getModels( this->language_presets.at( language_code ), app_settings, placement );
         }
 
-        InferenceResult infer( const cv::Mat& image, std::string language_code ) {
+        // placement: the pipeline replica leased from the CPU governor (default: the only one)
+        InferenceResult infer(
+            const cv::Mat& image,
+            std::string language_code,
+            const RequestContext& context = RequestContext(),
+            const CpuPlacement& placement = CpuPlacement()
+        ) {
+
+            InferenceResult infer_result;
 
-            auto ocr_pipeline = getPipeline( language_code );
+            infer_result.status = admit( language_code, image, context );
+
+            if ( infer_result.status != InferenceStatus::OK )
+                return infer_result;
+
+            auto ocr_pipeline = getPipeline( language_code, placement );
+
+            if ( ocr_pipeline == nullptr ) {
+                infer_result.status = InferenceStatus::FAILED;
+                return infer_result;
+            }
 
             // Access properties and call functions                
-            // std::cout << "infer. Initialized: " << ocr_pipeline->Initialized() << std::endl;
+            // std::cout << "infer. Initialized: " << ocr_pipeline->initialized() << std::endl;
 
-            InferenceResult infer_result;            
-            
+            const auto started_at = RequestContext::Clock::now();
 
-            fastdeploy::vision::OCRResult result;
-            if ( !ocr_pipeline->Predict(image, &result) ) {
-                std::cerr << "Failed to predict." << std::endl;
+            // Filled in place, no copy of the lines afterwards
+            fastdeploy::vision::OCRResult& result = infer_result.ocr_result;
+
+            const int det_max_side = detection_resolution->maxSideFor( language_code, context.stream_id, image.size() );
+
+            infer_result.status = ocr_pipeline->predict( image, &result, context, cancellation_counters, &infer_result.timings, det_max_side );
+
+            if ( infer_result.status == InferenceStatus::OK )
+                detection_resolution->record( language_code, context.stream_id, image.size(), det_max_side, result.boxes );
+
+            if ( infer_result.status != InferenceStatus::FAILED ) {
+                latency_estimator.record(
+                    language_code, detectorPixels( image ), RequestContext::Clock::now() - started_at,
+                    infer_result.status == InferenceStatus::OK
+                );
+            }
+
+            if ( infer_result.status != InferenceStatus::OK ) {
+                if ( infer_result.status == InferenceStatus::FAILED )
+                    std::cerr << "Failed to predict." << std::endl;
+                result.Clear(); // Failed requests answer with an empty result
                 return infer_result;
             }
 
@@ -139,75 +275,120 @@ class InferenceManager {
 
             infer_result.context_resolution = context_resolution;
 
-            if ( result.boxes.empty() ) {
-                return infer_result;
-            }
-
-            infer_result.ocr_result = result;
-
-            // ocr_pipeline->ReleaseReusedBuffer();
-
             return infer_result;
         }
 
-        InferenceResult inferBase64( const std::string& base64EncodedImage, std::string language_code ) {
+        InferenceResult inferBase64(
+            std::string_view base64EncodedImage,
+            std::string language_code,
+            const RequestContext& context = RequestContext(),
+            const CpuPlacement& placement = CpuPlacement()
+        ) {
 
             InferenceResult result;
 
+            result.status = context.check();
+
+            if ( result.status != InferenceStatus::OK )
+                return result;
+
+            StageTimer decode_timer;
             cv::Mat image = this->base64ToMat( base64EncodedImage );
-            
+            const uint64_t decode_us = decode_timer.lap( MetricHistogram::DECODE_US );
 
             if ( !image.empty() ) {
                 // Image loaded successfully
                 // cv::imshow("Loaded Image", image);
                 // cv::waitKey(0);
-                return infer( image, language_code );
+                result = infer( image, language_code, context, placement );
+                result.timings.decode_us = decode_us;
+                return result;
             } else {
                 std::cerr << "Failed to load the image." << std::endl;
+                result.status = InferenceStatus::FAILED;
             }
 
             return result;
         }
 
-        InferenceResult inferBufferString( const std::string& image_str, std::string language_code ) {
+        InferenceResult inferBufferString(
+            std::string_view image_str,
+            std::string language_code,
+            const RequestContext& context = RequestContext(),
+            const CpuPlacement& placement = CpuPlacement()
+        ) {
 
             InferenceResult result;
 
-            std::vector<uchar> data(image_str.begin(), image_str.end());
-            cv::Mat image = cv::imdecode( data, cv::IMREAD_COLOR );
-            
+            result.status = context.check();
+
+            if ( result.status != InferenceStatus::OK )
+                return result;
+
+            StageTimer decode_timer;
+            cv::Mat image = decodeImage( image_str.data(), image_str.size() );
+            const uint64_t decode_us = decode_timer.lap( MetricHistogram::DECODE_US );
 
             if ( !image.empty() ) {
                 // Image loaded successfully
                 // cv::imshow("Loaded Image", image);
                 // cv::waitKey(0);
-                return infer( image, language_code );
+                result = infer( image, language_code, context, placement );
+                result.timings.decode_us = decode_us;
+                return result;
             } else {
                 std::cerr << "Failed to load the image." << std::endl;
+                result.status = InferenceStatus::FAILED;
             }
 
             return result;
         }
 
         DetectionResult detect(
-            const std::string& image_str,
+            std::string_view image_str,
             std::string language_code,
-            bool is_base64_encoded
+            bool is_base64_encoded,
+            const RequestContext& context = RequestContext(),
+            const CpuPlacement& placement = CpuPlacement()
         ) {
             // std::cout << "detect" << std::endl;
+            DetectionResult detectionResult;
+
             const auto language_preset_it = this->language_presets.find( language_code );
-            const auto language_preset = language_preset_it->second;
 
-            DetectionResult detectionResult;
+            if ( language_preset_it == language_presets.end() ) {
+                std::cout << "Language preset for [" << language_code << "] does not exists!" << std::endl;
+                detectionResult.status = InferenceStatus::FAILED;
+                return detectionResult;
+            }
+
+            const auto& language_preset = language_preset_it->second;
+
+            // Detection only: the full pipeline latency estimate does not apply
+            detectionResult.status = context.check();
+
+            if ( detectionResult.status != InferenceStatus::OK ) {
+                cancellation_counters.rejected_at_admission++;
+                return detectionResult;
+            }
 
             cv::Mat image;
 
+            StageTimer timer;
+
             if ( is_base64_encoded ) {
                 image = this->base64ToMat( image_str );
             }
             else {
-                std::vector<uchar> data(image_str.begin(), image_str.end());
-                image = cv::imdecode( data, cv::IMREAD_COLOR );
+                image = decodeImage( image_str.data(), image_str.size() );
+            }
+
+            detectionResult.timings.decode_us = timer.lap( MetricHistogram::DECODE_US );
+
+            if ( image.empty() ) {
+                std::cerr << "Failed to load the image." << std::endl;
+                detectionResult.status = InferenceStatus::FAILED;
+                return detectionResult;
             }
 
             // cv::imshow("Loaded Image", image);
@@ -216,16 +397,24 @@ class InferenceManager {
 
             auto models = this->pipeline_builder.getModels(
                 language_preset,
-                app_settings
+                app_settings,
+                placement
             );
 
             auto detector = models.detection_model;
 
+            if ( detector == nullptr ) {
+                std::cerr << "Failed to initialize the detector." << std::endl;
+                detectionResult.status = InferenceStatus::FAILED;
+                return detectionResult;
+            }
 
-            fastdeploy::vision::OCRResult predictionResult;
+            fastdeploy::vision::OCRResult& predictionResult = detectionResult.ocr_result;
 
-            if ( !detector->Predict( image, &predictionResult ) ) {
+            if ( !detectTextWithModels( models, image, &predictionResult.boxes, &detectionResult.timings ) ) {
                 std::cerr << "Failed to predict." << std::endl;
+                predictionResult.Clear();
+                detectionResult.status = InferenceStatus::FAILED;
                 return detectionResult;
             }
 
@@ -239,65 +428,122 @@ class InferenceManager {
                 return detectionResult;
             }
 
-            detectionResult.ocr_result = predictionResult;
-
             detectionResult.text_images.push_back( image );
             
             return detectionResult;
         }
 
-        cv::Mat base64ToMat( const std::string& base64_encoded_image ) {
-            std::cout << "base64ToMat" << std::endl;
-            std::string decoded_data = base64_decode(base64_encoded_image);
+        const CancellationCounters& getCancellationCounters() const {
+            return cancellation_counters;
+        }
 
-            std::string dec_jpg = base64_decode(base64_encoded_image);
-            std::vector< uchar > data(dec_jpg.begin(), dec_jpg.end());
-            
-            return cv::imdecode( cv::Mat(data), 1 );
+        cv::Mat base64ToMat( std::string_view base64_encoded_image ) {
+
+            // Reused by the requests of this thread
+            thread_local std::string dec_jpg;
+
+            if ( !base64DecodeInto( base64_encoded_image, &dec_jpg ) ) {
+                std::cerr << "Invalid base64 image." << std::endl;
+                return cv::Mat();
+            }
+
+            cv::Mat image = decodeImage( dec_jpg.data(), dec_jpg.size() );
+
+            // Don't keep a buffer sized for an unusually large upload
+            if ( dec_jpg.capacity() > max_retained_upload_bytes )
+                std::string().swap( dec_jpg );
+
+            return image;
         }
 };
 
 
-nlohmann::json ocrResultToJson( const InferenceResult& infer_result ) {
+// The HTTP response bodies are written straight from the results (same layout the
+// nlohmann::json version produced: keys in alphabetical order)
 
-  auto ocrResult = infer_result.ocr_result;
-  auto context_resolution = infer_result.context_resolution;
+void contextResolutionToJson( const ContextResolution& context_resolution, JsonWriter& writer ) {
+
+  writer.key( "context_resolution" ).beginObject()
+    .key( "height" ).value( context_resolution.height )
+    .key( "width" ).value( context_resolution.width )
+    .endObject();
+}
+
+void boxToJson( const std::array< int, 8 >& box, JsonWriter& writer ) {
+
+  static const char* const box_vertex_names[ 4 ] = { "top_left", "top_right", "bottom_right", "bottom_left" };
+  static const int box_vertex_order[ 4 ] = { 3, 2, 0, 1 }; // bottom_left, bottom_right, top_left, top_right
+
+  writer.key( "box" ).beginObject();
+
+  for ( const int vertex_idx : box_vertex_order ) {
+    writer.key( box_vertex_names[ vertex_idx ] ).beginObject()
+      .key( "x" ).value( box[ vertex_idx * 2 ] )
+      .key( "y" ).value( box[ vertex_idx * 2 + 1 ] )
+      .endObject();
+  }
+
+  writer.endObject();
+}
 
-  std::array< std::string, 4 > const boxVerticesIndices = { "top_left", "top_right", "bottom_right", "bottom_left" };
+void ocrResultToJson( const InferenceResult& infer_result, std::string_view id, JsonWriter& writer ) {
+
+  const auto& ocr_result = infer_result.ocr_result;
+
+  writer.beginObject();
+
+  contextResolutionToJson( infer_result.context_resolution, writer );
+
+  writer.key( "id" ).value( id );
+
+  writer.key( "results" ).beginArray();
+
+  for ( size_t item_idx = 0; item_idx < ocr_result.text.size(); ++item_idx ) {
+
+    writer.beginObject();
+    boxToJson( ocr_result.boxes[ item_idx ], writer );
+    writer.key( "score" ).value( ocr_result.cls_scores[ item_idx ] );
+    writer.key( "text" ).value( ocr_result.text[ item_idx ] );
+    writer.endObject();
+  }
+
+  writer.endArray();
+  writer.endObject();
+}
+
+void ocrResultToJson( const InferenceResult& infer_result, std::string_view id, std::string& out ) {
+
+  // ~160 bytes per line
+  out.reserve( out.size() + 96 + infer_result.ocr_result.text.size() * 160 );
+
+  JsonWriter writer( out );
+  ocrResultToJson( infer_result, id, writer );
+}
 
-  nlohmann::json resultsJson;
-  resultsJson["id"] = "";
-  resultsJson["results"] = json::array();
-  resultsJson["context_resolution"] = { {"width", context_resolution.width}, {"height", context_resolution.height} };
+void detectionResultToJson( const DetectionResult& detection_result, std::string_view id, std::string& out ) {
 
-  int itemIdx = 0;
-  for ( const std::string& text : ocrResult.text ) {
+  const auto& boxes = detection_result.ocr_result.boxes;
 
-    nlohmann::json itemJson;
-    itemJson["text"] = text;
-    itemJson["box"] = json();
-    itemJson["score"] = ocrResult.cls_scores[itemIdx];
+  out.reserve( out.size() + 96 + boxes.size() * 140 );
 
-    auto const box = ocrResult.boxes[ itemIdx ];
-    int boxVertexIdx = 0;
-    for ( int bAxisIdx = 0; bAxisIdx < 8; ++bAxisIdx ) {
+  JsonWriter writer( out );
 
-      const int x = box[ bAxisIdx ];
-      const int y = box[ bAxisIdx+1 ];
+  writer.beginObject();
 
-      const std::string boxVertexName = boxVerticesIndices[ boxVertexIdx ];
-      itemJson["box"][boxVertexName] = { {"x", x}, { "y", y } };
+  contextResolutionToJson( detection_result.context_resolution, writer );
 
-      boxVertexIdx++; // [ 0 ... 3 ]
-      bAxisIdx++; // [ 0 ... 7]
-    }
+  writer.key( "id" ).value( id );
 
+  writer.key( "results" ).beginArray();
 
-    resultsJson["results"].push_back(itemJson);
-    itemIdx++;
+  for ( const auto& box : boxes ) {
+    writer.beginObject();
+    boxToJson( box, writer );
+    writer.endObject();
   }
 
-  return resultsJson;
+  writer.endArray();
+  writer.endObject();
 }
 
 #endif // PPOCR_INFER
@@ -1,37 +1,162 @@
 #ifndef INFERENCE_MODELS_MANAGER_HPP
 #define INFERENCE_MODELS_MANAGER_HPP
 
+#include <filesystem>
+#include <mutex>
+#include <unordered_set>
 #include <fastdeploy/vision.h>
+#include "cpu_governor.hpp"
+#include "ctc_decoder.hpp"
+#include "db_postprocessor.hpp"
+#include "metrics.hpp"
+#include "model_registry.hpp"
+#include "shape_buckets.hpp"
+#include "text_detector.hpp"
 #include "util.hpp"
 
+int const cls_batch_size = 1;
+int const rec_batch_size = 6;
+
+
+// What a model directory loads from: inference.pdmodel / inference.pdiparams,
+// or inference_int8.onnx for the int8 precision
+struct ModelFiles {
+    std::string model_file;
+    std::string params_file;
+    fastdeploy::ModelFormat format = fastdeploy::ModelFormat::PADDLE;
+    std::string precision = "fp32"; // What was loaded, after the fallbacks
+};
+
+// Everything a model runtime is built from. Loads with the same key share one runtime (the weights)
+struct RuntimeConfig {
+    ModelFiles files;
+    std::string backend;
+    int cpu_threads = 0; // 0 = backend default
+    int cpu_group = -1; // Worker group: each group loads its own weights, on its NUMA node (-1 = not pinned)
+    std::vector< int64_t > shape_info; // Input "x" shape for OpenVINO (-1 = dynamic), empty = the model's
+
+    std::string device() const {
+        return backend.find( "GPU" ) != std::string::npos || backend == "Tensor_RT" ? "gpu" : "cpu";
+    }
+
+    std::string key() const {
+
+        std::string key = files.model_file + "|" + files.params_file + "|" + std::to_string( int( files.format ) ) +
+                          "|" + backend + "|" + device() + "|" + std::to_string( cpu_threads ) + "|" + files.precision + "|" +
+                          std::to_string( cpu_group ) + "|";
+
+        for ( const int64_t dim : shape_info )
+            key += std::to_string( dim ) + ",";
+
+        return key;
+    }
+};
+
 
 struct Models {
     fastdeploy::vision::ocr::DBDetector* detection_model;
     fastdeploy::vision::ocr::Classifier* classification_model;
     fastdeploy::vision::ocr::Recognizer* recognition_model;
+    DBPostprocessor* db_postprocessor = nullptr; // nullptr: the detector's own (FastDeploy) postprocessing
+    const ShapeBuckets* shape_buckets = nullptr; // nullptr: any input shape
+    DetectionProbe detection_probe; // Coarse to fine detection, off by default
+    const FusedPreprocessor* fused_preprocessor = nullptr; // nullptr: FastDeploy's preprocessors
+    const CTCDecoder* ctc_decoder = nullptr; // nullptr: the recognizer's own (FastDeploy) postprocessing
+    std::string rec_label_file;
 };
 
 
+// Loads the models of the pipelines. A model is keyed by its runtime (RuntimeConfig) and by its
+// pre/postprocessing settings: the first one of a runtime owns the weights, models of the same runtime
+// with other settings are Clone()s of it (backends that can't share weights on clone load them again).
+// Safe to call from several threads.
 class InferenceModelsManager {
 
 private:
-    std::unordered_map< std::string, std::shared_ptr< fastdeploy::vision::ocr::DBDetector > > detection_models;
-    std::unordered_map< std::string, std::shared_ptr< fastdeploy::vision::ocr::Classifier > > classification_models;
-    std::unordered_map< std::string, std::shared_ptr< fastdeploy::vision::ocr::Recognizer > > recognition_models;
+    // < RuntimeConfig key, first model loaded with it >
+    ModelRegistry< fastdeploy::vision::ocr::DBDetector > detector_runtimes{ false };
+    ModelRegistry< fastdeploy::vision::ocr::Classifier > classifier_runtimes{ false };
+    ModelRegistry< fastdeploy::vision::ocr::Recognizer > recognizer_runtimes{ false }; // Key + label file
+
+    // < RuntimeConfig key + processing settings, model handed to the pipelines >
+    ModelRegistry< fastdeploy::vision::ocr::DBDetector > detection_models;
+    ModelRegistry< fastdeploy::vision::ocr::Classifier > classification_models;
+    ModelRegistry< fastdeploy::vision::ocr::Recognizer > recognition_models;
+    ModelRegistry< CTCDecoder > ctc_decoders{ false }; // < label file, decoder >
+
+    // Configuring a runtime's first model and cloning it don't overlap
+    std::mutex clone_mutex;
+    std::unordered_set< const void* > claimed_runtimes; // First models already handed out
+
+    std::mutex model_files_mutex;
+    std::unordered_map< std::string, ModelFiles > model_files; // < model_dir|precision, resolved files >
+
+    DBPostprocessor native_db_postprocessor; // Stateless, shared by every detector
+    FusedPreprocessor fused_preprocessor; // Stateless, kernels picked for this CPU
+    std::once_flag fused_preprocessor_logged;
+
+    ShapeBuckets shape_buckets; // From the app settings, the same for every model
+    std::once_flag shape_buckets_initialized;
+
+    // The runtime's first model for the first caller, a clone of it for the next ones, then configured.
+    // The runtime loads outside of the lock, claiming, cloning and configuring under it
+    template< typename Model >
+    std::shared_ptr< Model > modelOfRuntime(
+        ModelRegistry< Model > &runtimes,
+        const RuntimeConfig &runtime_config,
+        const std::function< std::shared_ptr< Model >() > &load,
+        const std::function< void( Model* ) > &configure,
+        const std::string &runtime_key
+    ) {
+
+        std::shared_ptr< Model > runtime_model = runtimes.getOrLoad( runtime_key, [&]() -> std::shared_ptr< Model > {
+
+            std::shared_ptr< Model > model = load();
+
+            if ( model == nullptr || !model->Initialized() ) {
+                std::cerr << "Failed to load " << runtime_config.files.model_file << std::endl;
+                return nullptr;
+            }
+
+            return model;
+        } );
+
+        if ( runtime_model == nullptr )
+            return nullptr;
+
+        std::lock_guard< std::mutex > lock( clone_mutex );
+
+        std::shared_ptr< Model > model = runtime_model;
+
+        if ( !claimed_runtimes.insert( runtime_model.get() ).second ) {
+
+            model.reset( runtime_model->Clone().release() );
 
-    fastdeploy::RuntimeOption det_runtime_option;
-    fastdeploy::RuntimeOption cls_runtime_option;
-    fastdeploy::RuntimeOption rec_runtime_option;
+            if ( model == nullptr || !model->Initialized() ) {
+                std::cerr << "Failed to clone " << runtime_config.files.model_file << std::endl;
+                return nullptr;
+            }
+        }
+
+        configure( model.get() );
+
+        return model;
+    }
 
 public:
     InferenceModelsManager() = default;
 
+    InferenceModelsManager( const InferenceModelsManager& ) = delete;
+    InferenceModelsManager& operator=( const InferenceModelsManager& ) = delete;
+
     Models getOCRModels(
         const std::string &det_model_dir,
         const std::string &cls_model_dir,
         const std::string &rec_model_dir,
         const std::string &rec_label_file,
-        const AppSettingsPreset &app_settings
+        const AppSettingsPreset &app_settings,
+        const std::string &precision = "fp32",
+        const CpuPlacement &placement = CpuPlacement()
     ) {
 
         // std::cout <<"\n  Models: " <<
@@ -41,12 +166,6 @@ public:
         //             "\n  rec_label_file: " << rec_label_file << "\n"
         // << std::endl;
 
-        // The cls and rec model can inference a batch of images now.
-        // User could initialize the inference batch size and set them after create
-        // PP-OCR model.
-        /* int cls_batch_size = 1;
-        int rec_batch_size = 6; */
-
         // If use TRT backend, the dynamic shape will be set as follow.
         // We recommend that users set the length and height of the detection model to
         // a multiple of 32.
@@ -59,125 +178,315 @@ public:
                                     {rec_batch_size, 3, 48, 2304}); */
 
         Models models;
-        models.detection_model = loadDetectionModel( det_model_dir, app_settings );
-        models.classification_model = loadClassificationModel( cls_model_dir, app_settings );
-        models.recognition_model = loadRecognitionModel( rec_model_dir, rec_label_file, app_settings );
+        models.detection_model = loadDetectionModel( det_model_dir, app_settings, &models.db_postprocessor, precision, placement );
+        models.classification_model = loadClassificationModel( cls_model_dir, app_settings, precision, placement );
+        models.recognition_model = loadRecognitionModel( rec_model_dir, rec_label_file, app_settings, &models.ctc_decoder, precision, placement );
+        models.rec_label_file = rec_label_file;
+
+        if ( shape_buckets.hasDetectorBuckets() || shape_buckets.hasRecognizerBuckets() )
+            models.shape_buckets = &shape_buckets;
+
+        models.detection_probe.probe_side = app_settings.det_probe_side;
+        models.detection_probe.full_side = app_settings.max_image_width;
+        models.detection_probe.max_coverage = app_settings.det_probe_max_coverage;
+
+        if ( app_settings.preprocessor == "fused" ) {
+
+            models.fused_preprocessor = &fused_preprocessor;
+
+            std::call_once( fused_preprocessor_logged, [&]() {
+                std::cout << "Fused preprocessing: " << simdLevelName( fused_preprocessor.simdLevel() ) << std::endl;
+            } );
+        }
 
         return models;
     }
 
-    fastdeploy::vision::ocr::DBDetector* loadDetectionModel(
-        const std::string &det_model_dir,
+    // int8 needs a backend that runs ONNX models and the inference_int8.onnx file, otherwise the fp32 model is used.
+    // Resolved once per directory and precision
+    ModelFiles resolveModelFiles(
+        const std::string &model_dir,
+        const std::string &precision,
         const AppSettingsPreset &app_settings
     ) {
 
-        auto model = detection_models.find( det_model_dir );
+        std::lock_guard< std::mutex > lock( model_files_mutex );
 
-        if ( model != detection_models.end() ) {
-            return model->second.get(); // Getting variable from pointer
-        }
-        
-        auto det_model_file = det_model_dir + sep + "inference.pdmodel";
-        auto det_params_file = det_model_dir + sep + "inference.pdiparams";
+        const auto resolved = model_files.find( model_dir + "|" + precision );
 
-        this->initRuntimeOption( det_runtime_option, app_settings );
+        if ( resolved != model_files.end() )
+            return resolved->second;
 
-        if ( app_settings.inference_backend == "Open_VINO" ) {
-            det_runtime_option.openvino_option.SetShapeInfo( 
-                {{ "x", {  1, 3, -1, -1 } }}
-            );
+        ModelFiles& files = model_files[ model_dir + "|" + precision ];
+        files.model_file = model_dir + sep + "inference.pdmodel";
+        files.params_file = model_dir + sep + "inference.pdiparams";
+
+        if ( precision == "fp32" )
+            return files;
+
+        const auto& backend = app_settings.inference_backend;
+        const std::string int8_model_file = model_dir + sep + "inference_int8.onnx";
+
+        if ( precision != "int8" ) {
+            std::cerr << "Unknown precision \"" << precision << "\", using fp32" << std::endl;
+        }
+        else if ( backend != "ONNX_CPU" && backend != "Open_VINO" && backend != "ONNX_GPU" && backend != "Tensor_RT" ) {
+            std::cerr << "The " << backend << " backend can't load " << int8_model_file << ", using fp32" << std::endl;
+        }
+        else if ( !std::filesystem::exists( int8_model_file ) ) {
+            std::cerr << int8_model_file << " not found (see ppocr_calibrate), using fp32" << std::endl;
+        }
+        else {
+            files.model_file = int8_model_file;
+            files.params_file = "";
+            files.format = fastdeploy::ModelFormat::ONNX;
+            files.precision = "int8";
         }
 
-        detection_models[det_model_dir] = std::make_shared< fastdeploy::vision::ocr::DBDetector >(
-            det_model_file, det_params_file, det_runtime_option
-        );
-        
+        return files;
+    }
 
-        assert( detection_models[det_model_dir]->Initialized() );
+    // A governed placement sets the threads of every backend (its sizes stay within the cores),
+    // otherwise the "cpu_threads" setting applies
+    RuntimeConfig makeRuntimeConfig(
+        const std::string &model_dir,
+        const std::string &precision,
+        const AppSettingsPreset &app_settings,
+        const CpuPlacement &placement = CpuPlacement()
+    ) {
 
-        
-        detection_models[det_model_dir]->GetPreprocessor()
-            .SetMaxSideLen( app_settings.max_image_width );
+        RuntimeConfig runtime_config;
+        runtime_config.files = resolveModelFiles( model_dir, precision, app_settings );
+        runtime_config.backend = app_settings.inference_backend;
 
-        detection_models[det_model_dir]->GetPostprocessor()
-            .SetDetDBThresh( app_settings.det_db_thresh );
+        if ( placement.governed() ) {
+            runtime_config.cpu_threads = placement.cpu_threads;
+            runtime_config.cpu_group = placement.group;
+        }
+        else if ( app_settings.cpu_threads > 0 && app_settings.inference_backend != "ONNX_CPU" ) // Change cpu_threads while using ONNX can cause problems
+            runtime_config.cpu_threads = app_settings.cpu_threads;
 
-        detection_models[det_model_dir]->GetPostprocessor()
-            .SetDetDBBoxThresh( app_settings.det_db_box_thresh );
+        return runtime_config;
+    }
 
-        detection_models[det_model_dir]->GetPostprocessor()
-            .SetDetDBUnclipRatio( app_settings.det_db_unclip_ratio );
+    // db_postprocessor (optional): set to the native DB postprocessor when "det_db_postprocessor" is "native".
+    // Each replica of a placement is its own model (a clone of the runtime's first one)
+    fastdeploy::vision::ocr::DBDetector* loadDetectionModel(
+        const std::string &det_model_dir,
+        const AppSettingsPreset &app_settings,
+        DBPostprocessor** db_postprocessor = nullptr,
+        const std::string &precision = "fp32",
+        const CpuPlacement &placement = CpuPlacement()
+    ) {
 
-        detection_models[det_model_dir]->GetPostprocessor()
-            .SetDetDBScoreMode( app_settings.det_db_score_mode );
+        if ( db_postprocessor != nullptr )
+            *db_postprocessor = app_settings.det_db_postprocessor == "native" ? &native_db_postprocessor : nullptr;
+
+        this->initShapeBuckets( app_settings );
+
+        RuntimeConfig runtime_config = makeRuntimeConfig( det_model_dir, precision, app_settings, placement );
+
+        if ( app_settings.inference_backend == "Open_VINO" )
+            runtime_config.shape_info = { 1, 3, -1, -1 };
+
+        // Frames arrive letterboxed with detector buckets, already downscaled to max_image_width
+        const int max_side_len = shape_buckets.hasDetectorBuckets()
+            ? std::max( app_settings.max_image_width, shape_buckets.maxDetectorSide() )
+            : app_settings.max_image_width;
+
+        const std::string model_key = runtime_config.key() + "|" + std::to_string( max_side_len ) +
+            "|" + std::to_string( app_settings.det_db_thresh ) + "|" + std::to_string( app_settings.det_db_box_thresh ) +
+            "|" + std::to_string( app_settings.det_db_unclip_ratio ) + "|" + app_settings.det_db_score_mode +
+            "|" + std::to_string( app_settings.use_dilation ) + "|" + placement.key();
+
+        auto model = detection_models.getOrLoad( model_key, [&]() {
+            return modelOfRuntime< fastdeploy::vision::ocr::DBDetector >(
+                detector_runtimes,
+                runtime_config,
+                [&]() {
+                    return std::make_shared< fastdeploy::vision::ocr::DBDetector >(
+                        runtime_config.files.model_file, runtime_config.files.params_file,
+                        makeRuntimeOption( runtime_config ), runtime_config.files.format
+                    );
+                },
+                [&]( fastdeploy::vision::ocr::DBDetector* detector ) {
+
+                    detector->GetPreprocessor().SetMaxSideLen( max_side_len );
+                    detector->GetPostprocessor().SetDetDBThresh( app_settings.det_db_thresh );
+                    detector->GetPostprocessor().SetDetDBBoxThresh( app_settings.det_db_box_thresh );
+                    detector->GetPostprocessor().SetDetDBUnclipRatio( app_settings.det_db_unclip_ratio );
+                    detector->GetPostprocessor().SetDetDBScoreMode( app_settings.det_db_score_mode );
+                    detector->GetPostprocessor().SetUseDilation( app_settings.use_dilation );
+
+                    if ( shape_buckets.hasDetectorBuckets() )
+                        warmUpDetector( detector );
+
+                    if ( app_settings.det_probe_side > 0 ) {
+                        DetectionProbe probe;
+                        probe.probe_side = app_settings.det_probe_side;
+                        warmUpDetectorInput( detector, probe.inputSide(), probe.inputSide() );
+                    }
+                },
+                runtime_config.key()
+            );
+        } );
 
-        detection_models[det_model_dir]->GetPostprocessor()
-            .SetUseDilation( app_settings.use_dilation );
-        
+        if ( model == nullptr )
+            return nullptr; // Reported by modelOfRuntime
 
-        return detection_models[det_model_dir].get();
+        return model.get();
     }
 
     fastdeploy::vision::ocr::Classifier* loadClassificationModel(
         const std::string &cls_model_dir,
-        const AppSettingsPreset &app_settings
+        const AppSettingsPreset &app_settings,
+        const std::string &precision = "fp32",
+        const CpuPlacement &placement = CpuPlacement()
     ) {
 
-        auto model = classification_models.find( cls_model_dir );
+        const RuntimeConfig runtime_config = makeRuntimeConfig( cls_model_dir, precision, app_settings, placement );
+
+        const std::string model_key = runtime_config.key() + "|" + std::to_string( app_settings.cls_thresh ) + "|" + placement.key();
+
+        auto model = classification_models.getOrLoad( model_key, [&]() {
+            return modelOfRuntime< fastdeploy::vision::ocr::Classifier >(
+                classifier_runtimes,
+                runtime_config,
+                [&]() {
+                    return std::make_shared< fastdeploy::vision::ocr::Classifier >(
+                        runtime_config.files.model_file, runtime_config.files.params_file,
+                        makeRuntimeOption( runtime_config ), runtime_config.files.format
+                    );
+                },
+                [&]( fastdeploy::vision::ocr::Classifier* classifier ) {
+                    classifier->GetPostprocessor().SetClsThresh( app_settings.cls_thresh );
+                },
+                runtime_config.key()
+            );
+        } );
 
-        if ( model != classification_models.end() ) {
-            return model->second.get();
-        }
+        if ( model == nullptr )
+            return nullptr; // Reported by modelOfRuntime
 
-        auto cls_model_file = cls_model_dir + sep + "inference.pdmodel";
-        auto cls_params_file = cls_model_dir + sep + "inference.pdiparams";
+        return model.get();
+    }
 
-        this->initRuntimeOption( cls_runtime_option, app_settings );
+    // ctc_decoder (optional): set to the native CTC decoder of the label file when "rec_postprocessor" is "native"
+    fastdeploy::vision::ocr::Recognizer* loadRecognitionModel(
+        const std::string &rec_model_dir,
+        const std::string &rec_label_file,
+        const AppSettingsPreset &app_settings,
+        const CTCDecoder** ctc_decoder = nullptr,
+        const std::string &precision = "fp32",
+        const CpuPlacement &placement = CpuPlacement()
+    ) {
 
-        classification_models[cls_model_dir] = std::make_shared< fastdeploy::vision::ocr::Classifier >(
-            cls_model_file, cls_params_file, cls_runtime_option
-        );
+        if ( ctc_decoder != nullptr ) {
 
-        assert( classification_models[cls_model_dir]->Initialized() );
+            *ctc_decoder = nullptr;
 
-        classification_models[cls_model_dir]->GetPostprocessor()
-            .SetClsThresh( app_settings.cls_thresh );
+            if ( app_settings.rec_postprocessor == "native" ) {
+                // Stateless, shared by every recognizer of the label file. nullptr ( unreadable file ): FastDeploy's
+                *ctc_decoder = ctc_decoders.getOrLoad( rec_label_file, [&]() {
+                    return CTCDecoder::fromLabelFile( rec_label_file );
+                } ).get();
+            }
+        }
 
-        return classification_models[cls_model_dir].get();
+        this->initShapeBuckets( app_settings );
+
+        const RuntimeConfig runtime_config = makeRuntimeConfig( rec_model_dir, precision, app_settings, placement );
+
+        // The labels are loaded with the weights and the recognizer has no other settings,
+        // so the runtime is per label file and only the replicas are clones
+        const std::string runtime_key = runtime_config.key() + "|" + rec_label_file;
+        const std::string model_key = runtime_key + "|" + placement.key();
+
+        auto model = recognition_models.getOrLoad( model_key, [&]() {
+            return modelOfRuntime< fastdeploy::vision::ocr::Recognizer >(
+                recognizer_runtimes,
+                runtime_config,
+                [&]() {
+                    return std::make_shared< fastdeploy::vision::ocr::Recognizer >(
+                        runtime_config.files.model_file, runtime_config.files.params_file, rec_label_file,
+                        makeRuntimeOption( runtime_config ), runtime_config.files.format
+                    );
+                },
+                [&]( fastdeploy::vision::ocr::Recognizer* recognizer ) {
+                    if ( shape_buckets.hasRecognizerBuckets() )
+                        warmUpRecognizer( recognizer );
+                },
+                runtime_key
+            );
+        } );
+
+        if ( model == nullptr )
+            return nullptr; // Reported by modelOfRuntime
+
+        return model.get();
     }
 
-    fastdeploy::vision::ocr::Recognizer* loadRecognitionModel(
-        const std::string &rec_model_dir,
-        const std::string &rec_label_file,
-        const AppSettingsPreset &app_settings
-    ) {
-        auto model = recognition_models.find( rec_model_dir );
+    // Once: the Models handed out point to it
+    void initShapeBuckets( const AppSettingsPreset &app_settings ) {
+        std::call_once( shape_buckets_initialized, [&]() {
+            shape_buckets = ShapeBuckets( app_settings.det_input_buckets, app_settings.rec_width_buckets, app_settings.max_image_width );
+        } );
+    }
+
+    // One inference on a blank frame of that size, so the backend compiles the input shape at load time
+    void warmUpDetectorInput( fastdeploy::vision::ocr::DBDetector* detector, int width, int height ) {
+
+        const cv::Mat frame = cv::Mat::zeros( height, width, CV_8UC3 );
+
+        std::vector< fastdeploy::FDTensor > output_tensors;
+        std::array< int, 4 > det_img_info;
+        RequestTimings timings;
 
-        if ( model != recognition_models.end() ) {
-            return model->second.get();
+        if ( !runTextDetector( detector, frame, &output_tensors, &det_img_info, &timings ) ) {
+            std::cerr << "Failed to warm up the detector input " << width << "x" << height << std::endl;
+            return;
         }
-        
-        auto rec_model_file = rec_model_dir + sep + "inference.pdmodel";
-        auto rec_params_file = rec_model_dir + sep + "inference.pdiparams";
 
+        std::cout << "Detector input " << width << "x" << height << ": " << timings.det_infer_us / 1000 << "ms" << std::endl;
+    }
+
+    // Every bucket
+    void warmUpDetector( fastdeploy::vision::ocr::DBDetector* detector ) {
+        for ( const auto& bucket : shape_buckets.detectorBuckets() )
+            warmUpDetectorInput( detector, bucket[0], bucket[1] );
+    }
+
+    // Every batch size of every bucket width (the last batch of a request is usually smaller)
+    void warmUpRecognizer( fastdeploy::vision::ocr::Recognizer* recognizer ) {
+
+        std::vector< int > rec_image_shape = recognizer->GetPreprocessor().GetRecImageShape();
+        const std::vector< int > default_rec_image_shape = rec_image_shape;
+
+        for ( const int width : shape_buckets.recognizerWidths() ) {
 
-        this->initRuntimeOption( rec_runtime_option, app_settings );
+            rec_image_shape[2] = width;
+            recognizer->GetPreprocessor().SetRecImageShape( rec_image_shape );
 
-        recognition_models[rec_model_dir] = std::make_shared< fastdeploy::vision::ocr::Recognizer >(
-            rec_model_file, rec_params_file, rec_label_file, rec_runtime_option
-        );
+            for ( int batch_size = 1; batch_size <= rec_batch_size; ++batch_size ) {
 
-        assert( recognition_models[rec_model_dir]->Initialized() );
+                const std::vector< cv::Mat > lines( batch_size, cv::Mat( rec_image_shape[1], width, CV_8UC3, cv::Scalar::all( 127 ) ) );
+                std::vector< std::string > texts;
+                std::vector< float > scores;
 
-        return recognition_models[rec_model_dir].get();
+                if ( !recognizer->BatchPredict( lines, &texts, &scores ) )
+                    std::cerr << "Failed to warm up the recognizer input width " << width << std::endl;
+            }
+        }
+
+        recognizer->GetPreprocessor().SetRecImageShape( default_rec_image_shape );
     }
 
-    fastdeploy::RuntimeOption& initRuntimeOption(
-        fastdeploy::RuntimeOption &runtime_option,
-        const AppSettingsPreset &app_settings
-    ) {
-        auto const backend = app_settings.inference_backend;
-        auto const cpu_threads = app_settings.cpu_threads;
+    // A new option per runtime, nothing is shared between models
+    static fastdeploy::RuntimeOption makeRuntimeOption( const RuntimeConfig &runtime_config ) {
+
+        fastdeploy::RuntimeOption runtime_option;
+
+        auto const& backend = runtime_config.backend;
 
         if ( backend == "Paddle_CPU" ) {
             runtime_option.UseCpu();
@@ -214,13 +523,27 @@ public:
             runtime_option.UseTrtBackend(); // TensorRT | 7
         }
 
-        if ( cpu_threads > 0 && backend != "ONNX_CPU" ) { // Change cpu_threads while using ONNX can cause problems
+        if ( runtime_config.cpu_threads > 0 ) {
             // std::cout << "SetCpuThreadNum: " << cpu_threads << std::endl;
-            runtime_option.SetCpuThreadNum(cpu_threads);
+            runtime_option.SetCpuThreadNum( runtime_config.cpu_threads );
+        }
+
+        if ( !runtime_config.shape_info.empty() && backend == "Open_VINO" ) {
+            runtime_option.openvino_option.SetShapeInfo(
+                {{ "x", runtime_config.shape_info }}
+            );
         }
 
         return runtime_option;
     }
 };
 
-#endif
\ No newline at end of file
+
+// One per process, so a supervisor that loads the models before forking its workers
+// ( "worker_shared_models" ) hands them over, weights shared copy-on-write
+inline InferenceModelsManager& inferenceModelsManager() {
+    static InferenceModelsManager instance;
+    return instance;
+}
+
+#endif
@@ -3,29 +3,30 @@
 
 #include <fastdeploy/vision.h>
 #include "inference_models_manager.hpp"
+#include "ocr_pipeline.hpp"
 #include "util.hpp"
 
-int const cls_batch_size = 1;
-int const rec_batch_size = 6;
-
 
 class InferencePipelineBuilder {
 
 private:
     const std::string models_dir = "./models/";
     const std::string recognition_label_files_dir = "./recognition_label_files/";
-    InferenceModelsManager inference_models_manager;
+    InferenceModelsManager& inference_models_manager = inferenceModelsManager();
     // std::map<std::string, std::vector<int64_t>> shape_info;
 
 public:
     InferencePipelineBuilder() = default;
 
-    std::shared_ptr< fastdeploy::pipeline::PPOCRv4 > buildInferencePipeline(    
+    // nullptr when a model can't be loaded
+    std::shared_ptr< OCRPipeline > buildInferencePipeline(
         const std::string &det_model_dir,
         const std::string &cls_model_dir,
         const std::string &rec_model_dir,
         const std::string &rec_label_file,
-        const AppSettingsPreset &app_settings
+        const AppSettingsPreset &app_settings,
+        const std::string &precision = "fp32",
+        const CpuPlacement &placement = CpuPlacement()
     ) {
 
         Models models = inference_models_manager.getOCRModels(
@@ -33,7 +34,9 @@ public:
             models_dir + cls_model_dir,
             models_dir + rec_model_dir,
             recognition_label_files_dir + rec_label_file,
-            app_settings
+            app_settings,
+            precision,
+            placement
         );
 
         // auto detection_model = inference_models_manager.loadDetectionModel( models_dir + det_model_dir, runtime_option );
@@ -46,45 +49,19 @@ public:
 
         // auto _test = &(*detection_model);
 
-        // The classification model is optional, so the PP-OCR can also be connected
-        // in series as follows
-        // auto ppocr_v3 = fastdeploy::pipeline::PPOCRv3(&det_model, &rec_model);
-        // auto ppocr_v4 =
-        //     fastdeploy::pipeline::PPOCRv4(&det_model, &cls_model, &rec_model);
-        auto pipeline = std::make_shared< fastdeploy::pipeline::PPOCRv4 >(
-            // &( *(detection_model.get()) ),
-            // &( *(classification_model.get()) ),
-            // &( *(recognition_model.get()) )
-
-            // detection_model,
-            // classification_model,
-            // recognition_model
-
-            models.detection_model,
-            models.classification_model,
-            models.recognition_model
-
-
-        );        
-        
-        // Set inference batch size for cls model and rec model, the value could be -1
-        // and 1 to positive infinity.
-        // When inference batch size is set to -1, it means that the inference batch
-        // size
-        // of the cls and rec models will be the same as the number of boxes detected
-        // by the det model.
-        pipeline->SetClsBatchSize(cls_batch_size);
-        pipeline->SetRecBatchSize(rec_batch_size);
-
-        // pipeline2.SetClsBatchSize(cls_batch_size);
-        // pipeline2.SetRecBatchSize(rec_batch_size);
-
-        // std::cout << "Initialized: " << pipeline->Initialized() << std::endl;
-        // std::cout << "Initialized: " << pipeline2.Initialized() << std::endl;
-
-        if (!pipeline->Initialized()) {
+        // The classification model is optional (nullptr skips the cls stage).
+        // Inference batch size for cls model and rec model
+        auto pipeline = std::make_shared< OCRPipeline >(
+            std::make_shared< FastDeployOCRBackend >( models ),
+            cls_batch_size,
+            rec_batch_size
+        );
+
+        // A model that failed to load ( the classifier too, when one is configured ): no pipeline,
+        // so it's not cached and the next request loads again
+        if ( !pipeline->initialized() || ( !cls_model_dir.empty() && models.classification_model == nullptr ) ) {
             std::cerr << "Failed to initialize PP-OCR." << std::endl;
-            // return;
+            return nullptr;
         }
 
         return pipeline;
@@ -102,7 +79,8 @@ public:
 
     Models getModels(
         const LanguagePreset &preset,
-        const AppSettingsPreset &app_settings
+        const AppSettingsPreset &app_settings,
+        const CpuPlacement &placement = CpuPlacement()
     ) {
 
         Models models = this->inference_models_manager.getOCRModels(
@@ -110,7 +88,9 @@ public:
             models_dir + preset.classification_model_dir,
             models_dir + preset.recognition_model_dir,
             recognition_label_files_dir + preset.recognition_label_file_dir,
-            app_settings
+            app_settings,
+            preset.precision,
+            placement
         );
 
         return models;
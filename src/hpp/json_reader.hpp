@@ -0,0 +1,286 @@
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <cctype>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+// Reads the members of a JSON request object without building a document:
+// string values are views into the body (a multi-MB base64 image is not copied),
+// or into an unescaped copy when they contain escape sequences.
+// Nested objects, arrays, numbers and literals are validated and skipped.
+class JsonRequestFields {
+
+    private:
+        std::vector< std::pair< std::string_view, std::string_view > > fields;
+        std::deque< std::string > unescaped; // Stable storage for the escaped strings
+
+        const char* cursor = nullptr;
+        const char* end = nullptr;
+
+        void skipWhitespace() {
+            while ( cursor < end && ( *cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t' ) )
+                cursor++;
+        }
+
+        bool consume( char expected ) {
+
+            skipWhitespace();
+
+            if ( cursor == end || *cursor != expected )
+                return false;
+
+            cursor++;
+            return true;
+        }
+
+        static int hexValue( char c ) {
+            if ( c >= '0' && c <= '9' ) return c - '0';
+            if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+            if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+            return -1;
+        }
+
+        bool readHex4( const char*& p, uint32_t* code_unit ) const {
+
+            if ( end - p < 4 )
+                return false;
+
+            *code_unit = 0;
+
+            for ( int i = 0; i < 4; ++i ) {
+                const int digit = hexValue( p[ i ] );
+                if ( digit < 0 )
+                    return false;
+                *code_unit = *code_unit * 16 + digit;
+            }
+
+            p += 4;
+            return true;
+        }
+
+        static void appendUtf8( uint32_t code_point, std::string& out ) {
+
+            if ( code_point < 0x80 ) {
+                out.push_back( char( code_point ) );
+            }
+            else if ( code_point < 0x800 ) {
+                out.push_back( char( 0xC0 | ( code_point >> 6 ) ) );
+                out.push_back( char( 0x80 | ( code_point & 0x3F ) ) );
+            }
+            else if ( code_point < 0x10000 ) {
+                out.push_back( char( 0xE0 | ( code_point >> 12 ) ) );
+                out.push_back( char( 0x80 | ( ( code_point >> 6 ) & 0x3F ) ) );
+                out.push_back( char( 0x80 | ( code_point & 0x3F ) ) );
+            }
+            else {
+                out.push_back( char( 0xF0 | ( code_point >> 18 ) ) );
+                out.push_back( char( 0x80 | ( ( code_point >> 12 ) & 0x3F ) ) );
+                out.push_back( char( 0x80 | ( ( code_point >> 6 ) & 0x3F ) ) );
+                out.push_back( char( 0x80 | ( code_point & 0x3F ) ) );
+            }
+        }
+
+        // Cursor on the opening quote
+        bool readString( std::string_view* value ) {
+
+            if ( !consume( '"' ) )
+                return false;
+
+            const char* start = cursor;
+
+            // Fast path: no escapes, the value is a view into the body
+            while ( cursor < end && *cursor != '"' && *cursor != '\\' ) {
+                if ( static_cast< unsigned char >( *cursor ) < 0x20 )
+                    return false;
+                cursor++;
+            }
+
+            if ( cursor == end )
+                return false;
+
+            if ( *cursor == '"' ) {
+                *value = std::string_view( start, cursor - start );
+                cursor++;
+                return true;
+            }
+
+            std::string& out = unescaped.emplace_back( start, cursor - start );
+
+            while ( cursor < end && *cursor != '"' ) {
+
+                const char c = *cursor++;
+
+                if ( static_cast< unsigned char >( c ) < 0x20 )
+                    return false;
+
+                if ( c != '\\' ) {
+                    out.push_back( c );
+                    continue;
+                }
+
+                if ( cursor == end )
+                    return false;
+
+                switch ( *cursor++ ) {
+                    case '"': out.push_back( '"' ); break;
+                    case '\\': out.push_back( '\\' ); break;
+                    case '/': out.push_back( '/' ); break;
+                    case 'b': out.push_back( '\b' ); break;
+                    case 'f': out.push_back( '\f' ); break;
+                    case 'n': out.push_back( '\n' ); break;
+                    case 'r': out.push_back( '\r' ); break;
+                    case 't': out.push_back( '\t' ); break;
+                    case 'u': {
+                        uint32_t code_point;
+                        if ( !readHex4( cursor, &code_point ) )
+                            return false;
+
+                        // Surrogate pair
+                        if ( code_point >= 0xD800 && code_point < 0xDC00 ) {
+                            uint32_t low;
+                            if ( end - cursor < 2 || cursor[ 0 ] != '\\' || cursor[ 1 ] != 'u' )
+                                return false;
+                            cursor += 2;
+                            if ( !readHex4( cursor, &low ) || low < 0xDC00 || low > 0xDFFF )
+                                return false;
+                            code_point = 0x10000 + ( ( code_point - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+                        }
+
+                        appendUtf8( code_point, out );
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+
+            if ( cursor == end )
+                return false;
+
+            cursor++;
+            *value = out;
+            return true;
+        }
+
+        bool skipValue( int depth ) {
+
+            if ( depth > 64 )
+                return false;
+
+            skipWhitespace();
+
+            if ( cursor == end )
+                return false;
+
+            std::string_view ignored;
+
+            switch ( *cursor ) {
+
+                case '"':
+                    return readString( &ignored );
+
+                case '{': {
+                    cursor++;
+                    if ( consume( '}' ) )
+                        return true;
+                    do {
+                        if ( !readString( &ignored ) || !consume( ':' ) || !skipValue( depth + 1 ) )
+                            return false;
+                    } while ( consume( ',' ) );
+                    return consume( '}' );
+                }
+
+                case '[': {
+                    cursor++;
+                    if ( consume( ']' ) )
+                        return true;
+                    do {
+                        if ( !skipValue( depth + 1 ) )
+                            return false;
+                    } while ( consume( ',' ) );
+                    return consume( ']' );
+                }
+
+                default: {
+                    // Number, true, false or null
+                    const char* start = cursor;
+                    while ( cursor < end && ( std::isalnum( static_cast< unsigned char >( *cursor ) ) ||
+                            *cursor == '-' || *cursor == '+' || *cursor == '.' ) )
+                        cursor++;
+                    return cursor > start;
+                }
+            }
+        }
+
+    public:
+        // False when the body is not a JSON object
+        bool parse( std::string_view body ) {
+
+            fields.clear();
+            unescaped.clear();
+
+            cursor = body.data();
+            end = body.data() + body.size();
+
+            if ( !consume( '{' ) )
+                return false;
+
+            if ( consume( '}' ) )
+                return true;
+
+            do {
+                std::string_view key;
+
+                if ( !readString( &key ) || !consume( ':' ) )
+                    return false;
+
+                skipWhitespace();
+
+                if ( cursor < end && *cursor == '"' ) {
+                    std::string_view value;
+                    if ( !readString( &value ) )
+                        return false;
+                    fields.emplace_back( key, value );
+                }
+                else if ( !skipValue( 1 ) ) {
+                    return false;
+                }
+
+            } while ( consume( ',' ) );
+
+            if ( !consume( '}' ) )
+                return false;
+
+            skipWhitespace();
+            return cursor == end;
+        }
+
+        // String member, empty when missing (or not a string)
+        std::string_view get( std::string_view key ) const {
+
+            for ( const auto& field : fields ) {
+                if ( field.first == key )
+                    return field.second;
+            }
+
+            return std::string_view();
+        }
+
+        bool has( std::string_view key ) const {
+
+            for ( const auto& field : fields ) {
+                if ( field.first == key )
+                    return true;
+            }
+
+            return false;
+        }
+};
+
+#endif
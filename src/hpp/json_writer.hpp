@@ -0,0 +1,141 @@
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+// Appends JSON text straight to a string, without building a document first.
+// The caller opens/closes objects and arrays in order, commas are handled here.
+class JsonWriter {
+
+    private:
+        std::string& out;
+        bool first_in_scope = true; // No comma before the next value
+
+        void separator() {
+
+            if ( !first_in_scope )
+                out.push_back( ',' );
+
+            first_in_scope = false;
+        }
+
+        void appendEscaped( const char* data, size_t size ) {
+
+            static const char hex_digits[] = "0123456789abcdef";
+
+            out.push_back( '"' );
+
+            size_t run_start = 0;
+
+            for ( size_t i = 0; i < size; ++i ) {
+
+                const unsigned char c = static_cast< unsigned char >( data[ i ] );
+
+                if ( c >= 0x20 && c != '"' && c != '\\' )
+                    continue; // UTF-8 is passed through as is
+
+                out.append( data + run_start, i - run_start );
+                run_start = i + 1;
+
+                switch ( c ) {
+                    case '"': out.append( "\\\"" ); break;
+                    case '\\': out.append( "\\\\" ); break;
+                    case '\n': out.append( "\\n" ); break;
+                    case '\r': out.append( "\\r" ); break;
+                    case '\t': out.append( "\\t" ); break;
+                    case '\b': out.append( "\\b" ); break;
+                    case '\f': out.append( "\\f" ); break;
+                    default: {
+                        const char escaped[] = { '\\', 'u', '0', '0', hex_digits[ c >> 4 ], hex_digits[ c & 0xf ] };
+                        out.append( escaped, sizeof( escaped ) );
+                    }
+                }
+            }
+
+            out.append( data + run_start, size - run_start );
+            out.push_back( '"' );
+        }
+
+    public:
+        JsonWriter( std::string& out ) : out( out ) {}
+
+        JsonWriter& beginObject() {
+            separator();
+            out.push_back( '{' );
+            first_in_scope = true;
+            return *this;
+        }
+
+        JsonWriter& endObject() {
+            out.push_back( '}' );
+            first_in_scope = false;
+            return *this;
+        }
+
+        JsonWriter& beginArray() {
+            separator();
+            out.push_back( '[' );
+            first_in_scope = true;
+            return *this;
+        }
+
+        JsonWriter& endArray() {
+            out.push_back( ']' );
+            first_in_scope = false;
+            return *this;
+        }
+
+        // Object member name, followed by its value
+        JsonWriter& key( std::string_view name ) {
+            separator();
+            appendEscaped( name.data(), name.size() );
+            out.push_back( ':' );
+            first_in_scope = true;
+            return *this;
+        }
+
+        JsonWriter& value( std::string_view text ) {
+            separator();
+            appendEscaped( text.data(), text.size() );
+            return *this;
+        }
+
+        JsonWriter& value( int64_t number ) {
+
+            separator();
+
+            char buffer[ 24 ];
+            const auto written = std::to_chars( buffer, buffer + sizeof( buffer ), number );
+            out.append( buffer, written.ptr );
+
+            return *this;
+        }
+
+        JsonWriter& value( int number ) {
+            return value( int64_t( number ) );
+        }
+
+        // Shortest text that reads back as the same float, null for NaN / infinity (like nlohmann::json)
+        JsonWriter& value( float number ) {
+
+            separator();
+
+            if ( !std::isfinite( number ) ) {
+                out.append( "null" );
+                return *this;
+            }
+
+            char buffer[ 32 ];
+            const auto written = std::to_chars( buffer, buffer + sizeof( buffer ), number );
+            out.append( buffer, written.ptr );
+
+            return *this;
+        }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef LOOP_POOL_HPP
+#define LOOP_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "cpu_topology.hpp"
+
+
+// Threads for the data parallel loops between the model runs of a request ( text crops, CTC decoding,
+// DB postprocessing ), instead of OpenCV's process wide pool, which ignores the threads a request leased
+// from the CPU governor and runs wherever its first caller was pinned. One pool per worker group, its
+// threads pinned to the group. The caller runs stripes too, so a loop never waits on a busy pool
+class LoopPool {
+
+    private:
+        struct Job {
+            const std::function< void( const cv::Range& ) >* body = nullptr;
+            cv::Range range{ 0, 0 };
+            int stripes = 1;
+            std::atomic< int > next_stripe{ 0 };
+            std::atomic< int > done_stripes{ 0 };
+        };
+
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::condition_variable job_done;
+        std::deque< std::shared_ptr< Job > > jobs; // One entry per helper a job asked for
+        std::vector< std::thread > workers;
+        bool stopping = false;
+
+        void runStripes( Job& job ) {
+
+            const int total = job.range.end - job.range.start;
+
+            for ( int stripe = job.next_stripe++; stripe < job.stripes; stripe = job.next_stripe++ ) {
+
+                const cv::Range stripe_range(
+                    job.range.start + int( int64_t( total ) * stripe / job.stripes ),
+                    job.range.start + int( int64_t( total ) * ( stripe + 1 ) / job.stripes )
+                );
+
+                ( *job.body )( stripe_range );
+
+                if ( ++job.done_stripes == job.stripes ) {
+                    { std::lock_guard< std::mutex > lock( mutex ); }
+                    job_done.notify_all();
+                }
+            }
+        }
+
+        void workerLoop( const CpuGroup* group ) {
+
+            ThreadPlacementScope placement_scope( group );
+
+            while ( true ) {
+
+                std::shared_ptr< Job > job;
+
+                {
+                    std::unique_lock< std::mutex > lock( mutex );
+
+                    work_available.wait( lock, [&]() { return stopping || !jobs.empty(); } );
+
+                    if ( stopping )
+                        return;
+
+                    job = jobs.front();
+                    jobs.pop_front();
+                }
+
+                runStripes( *job );
+            }
+        }
+
+    public:
+        // threads: helpers of the callers. group: where they run, nullptr = not pinned
+        LoopPool( int threads, const CpuGroup* group = nullptr ) {
+            for ( int i = 0; i < threads; ++i )
+                workers.emplace_back( [ this, group ]() { workerLoop( group ); } );
+        }
+
+        LoopPool( const LoopPool& ) = delete;
+        LoopPool& operator=( const LoopPool& ) = delete;
+
+        ~LoopPool() {
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+                stopping = true;
+            }
+
+            work_available.notify_all();
+
+            for ( auto& worker : workers )
+                worker.join();
+        }
+
+        // body on stripes of the range, on the calling thread and up to stripes - 1 helpers
+        void run( const cv::Range& range, int stripes, const std::function< void( const cv::Range& ) >& body ) {
+
+            stripes = std::min( stripes, range.end - range.start );
+
+            if ( stripes <= 1 || workers.empty() ) {
+                body( range );
+                return;
+            }
+
+            auto job = std::make_shared< Job >();
+            job->body = &body;
+            job->range = range;
+            job->stripes = stripes;
+
+            const int helpers = std::min( stripes - 1, int( workers.size() ) );
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+                for ( int i = 0; i < helpers; ++i )
+                    jobs.push_back( job );
+            }
+
+            for ( int i = 0; i < helpers; ++i )
+                work_available.notify_one();
+
+            runStripes( *job );
+
+            std::unique_lock< std::mutex > lock( mutex );
+
+            job_done.wait( lock, [&]() { return job->done_stripes == job->stripes; } );
+
+            // Helpers that didn't get to it have nothing left to do
+            jobs.erase( std::remove( jobs.begin(), jobs.end(), job ), jobs.end() );
+        }
+};
+
+// Not pinned, every hardware thread: loops outside of a LoopScope ( no CPU governor, the tools )
+inline LoopPool& defaultLoopPool() {
+    static LoopPool instance( int( std::max( 1u, std::thread::hardware_concurrency() ) ) - 1 );
+    return instance;
+}
+
+
+// The pool and the threads the loops of the calling thread run with, from the lease of its request
+struct LoopContext {
+    LoopPool* pool = nullptr; // nullptr: defaultLoopPool, every hardware thread
+    int threads = 0;
+};
+
+inline LoopContext& loopContext() {
+    thread_local LoopContext context;
+    return context;
+}
+
+class LoopScope {
+
+    private:
+        LoopContext previous;
+
+    public:
+        LoopScope( LoopPool* pool, int threads ) : previous( loopContext() ) {
+            loopContext().pool = pool;
+            loopContext().threads = threads;
+        }
+
+        LoopScope( const LoopScope& ) = delete;
+        LoopScope& operator=( const LoopScope& ) = delete;
+
+        ~LoopScope() {
+            loopContext() = previous;
+        }
+};
+
+
+// cv::parallel_for_ on the loop pool of the calling thread, within its threads
+void parallelFor( const cv::Range& range, const std::function< void( const cv::Range& ) >& body ) {
+
+    const LoopContext& context = loopContext();
+
+    if ( context.pool == nullptr ) {
+        defaultLoopPool().run( range, int( std::max( 1u, std::thread::hardware_concurrency() ) ), body );
+        return;
+    }
+
+    context.pool->run( range, context.threads, body );
+}
+
+#endif
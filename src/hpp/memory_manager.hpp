@@ -0,0 +1,362 @@
+#ifndef MEMORY_MANAGER_HPP
+#define MEMORY_MANAGER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "metrics.hpp"
+
+#if defined( __GLIBC__ )
+#include <malloc.h>
+#endif
+
+#if defined( __linux__ )
+#include <unistd.h>
+#endif
+
+
+// Large per-request buffers (decoded frames) by size class, shared by every pipeline.
+// Classes grow in quarter steps of a power of two (max 25% slack), buffers under
+// min_pooled_bytes are left to malloc. The cached bytes are capped, and trimAbove()
+// gives back the classes bigger than the typical request after an oversized one.
+class BufferPool {
+
+    private:
+        static constexpr size_t min_pooled_bytes = 64 * 1024;
+        static constexpr size_t max_pooled_bytes = size_t( 1 ) << 30;
+
+        std::mutex mutex;
+        std::vector< size_t > class_sizes;
+        std::vector< std::vector< void* > > free_lists; // One per class
+        size_t max_cached_bytes = 256 * 1024 * 1024;
+        size_t cached_bytes = 0;
+        size_t in_use_bytes = 0;
+        size_t retain_limit_bytes = SIZE_MAX; // Bigger buffers are freed on release (set by trimAbove)
+
+        // -1 when the size is not pooled
+        int classIndex( size_t bytes ) const {
+
+            if ( bytes < min_pooled_bytes || bytes > max_pooled_bytes )
+                return -1;
+
+            return int( std::lower_bound( class_sizes.begin(), class_sizes.end(), bytes ) - class_sizes.begin() );
+        }
+
+        // Caller holds the lock
+        void freeCached( size_t class_idx ) {
+
+            for ( void* buffer : free_lists[ class_idx ] )
+                cv::fastFree( buffer );
+
+            cached_bytes -= free_lists[ class_idx ].size() * class_sizes[ class_idx ];
+            free_lists[ class_idx ].clear();
+        }
+
+    public:
+        BufferPool() {
+
+            for ( size_t base = min_pooled_bytes; base < max_pooled_bytes; base *= 2 ) {
+                for ( size_t quarter = 0; quarter < 4; ++quarter )
+                    class_sizes.push_back( base + base / 4 * quarter );
+            }
+            class_sizes.push_back( max_pooled_bytes );
+
+            free_lists.resize( class_sizes.size() );
+        }
+
+        ~BufferPool() {
+            for ( size_t i = 0; i < free_lists.size(); ++i )
+                freeCached( i );
+        }
+
+        void setMaxCachedBytes( size_t max_cached_bytes ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            this->max_cached_bytes = max_cached_bytes;
+
+            for ( size_t i = free_lists.size(); i-- > 0 && cached_bytes > max_cached_bytes; )
+                freeCached( i );
+        }
+
+        void* acquire( size_t bytes ) {
+
+            const int class_idx = classIndex( bytes );
+
+            if ( class_idx < 0 )
+                return cv::fastMalloc( bytes );
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            in_use_bytes += class_sizes[ class_idx ];
+
+            // Big frames are back, keep their buffers again
+            if ( class_sizes[ class_idx ] > retain_limit_bytes )
+                retain_limit_bytes = SIZE_MAX;
+
+            auto& free_list = free_lists[ class_idx ];
+
+            if ( free_list.empty() )
+                return cv::fastMalloc( class_sizes[ class_idx ] );
+
+            void* buffer = free_list.back();
+            free_list.pop_back();
+            cached_bytes -= class_sizes[ class_idx ];
+
+            return buffer;
+        }
+
+        // bytes: the size passed to acquire()
+        void release( void* buffer, size_t bytes ) {
+
+            const int class_idx = classIndex( bytes );
+
+            if ( class_idx < 0 ) {
+                cv::fastFree( buffer );
+                return;
+            }
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            in_use_bytes -= class_sizes[ class_idx ];
+
+            if ( cached_bytes + class_sizes[ class_idx ] > max_cached_bytes || class_sizes[ class_idx ] > retain_limit_bytes ) {
+                cv::fastFree( buffer );
+                return;
+            }
+
+            free_lists[ class_idx ].push_back( buffer );
+            cached_bytes += class_sizes[ class_idx ];
+        }
+
+        // Frees the cached buffers of every class above the one holding `bytes`,
+        // and the ones still in use when they come back (until a request needs that size again)
+        void trimAbove( size_t bytes ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            const size_t first_class = std::lower_bound( class_sizes.begin(), class_sizes.end(), bytes ) - class_sizes.begin() + 1;
+
+            for ( size_t i = first_class; i < free_lists.size(); ++i )
+                freeCached( i );
+
+            retain_limit_bytes = first_class < class_sizes.size() ? class_sizes[ first_class - 1 ] : SIZE_MAX;
+        }
+
+        size_t cachedBytes() {
+            std::lock_guard< std::mutex > lock( mutex );
+            return cached_bytes;
+        }
+
+        size_t inUseBytes() {
+            std::lock_guard< std::mutex > lock( mutex );
+            return in_use_bytes;
+        }
+};
+
+inline BufferPool& bufferPool() {
+    static BufferPool instance;
+    return instance;
+}
+
+
+// cv::Mat allocator on top of the BufferPool (same layout as OpenCV's default allocator)
+class PooledMatAllocator : public cv::MatAllocator {
+
+    public:
+        cv::UMatData* allocate(
+            int dims,
+            const int* sizes,
+            int type,
+            void* data0,
+            size_t* step,
+            cv::AccessFlag /*flags*/,
+            cv::UMatUsageFlags /*usage_flags*/
+        ) const override {
+
+            size_t total = CV_ELEM_SIZE( type );
+
+            for ( int i = dims - 1; i >= 0; i-- ) {
+                if ( step ) {
+                    if ( data0 && step[ i ] != CV_AUTOSTEP )
+                        total = step[ i ];
+                    else
+                        step[ i ] = total;
+                }
+                total *= sizes[ i ];
+            }
+
+            cv::UMatData* u = new cv::UMatData( this );
+            u->data = u->origdata = data0 ? static_cast< uchar* >( data0 ) : static_cast< uchar* >( bufferPool().acquire( total ) );
+            u->size = total;
+
+            if ( data0 )
+                u->flags |= cv::UMatData::USER_ALLOCATED;
+
+            return u;
+        }
+
+        bool allocate( cv::UMatData* u, cv::AccessFlag /*flags*/, cv::UMatUsageFlags /*usage_flags*/ ) const override {
+            return u != nullptr;
+        }
+
+        void deallocate( cv::UMatData* u ) const override {
+
+            if ( u == nullptr )
+                return;
+
+            if ( !( u->flags & cv::UMatData::USER_ALLOCATED ) ) {
+                bufferPool().release( u->origdata, u->size );
+                u->origdata = nullptr;
+            }
+
+            delete u;
+        }
+};
+
+inline PooledMatAllocator& pooledMatAllocator() {
+    static PooledMatAllocator instance;
+    return instance;
+}
+
+// Decodes straight from the encoded bytes (no copy) into a pooled frame
+cv::Mat decodeImage( const char* data, size_t size ) {
+
+    cv::Mat image;
+    image.allocator = &pooledMatAllocator();
+
+    if ( size == 0 )
+        return image;
+
+    cv::Mat buffer( 1, int( size ), CV_8UC1, const_cast< char* >( data ) );
+    cv::imdecode( buffer, cv::IMREAD_COLOR, &image );
+
+    return image;
+}
+
+
+// Decides when a pipeline gives back the buffers its models keep for reuse
+// ( FastDeployModel::ReleaseReusedBuffer ). Those only grow, so after one huge frame
+// they would stay at that size. Trims after a request much bigger than the typical
+// one, and before and after a request whose working set goes over the configured cap.
+// The working set and the pooled buffers ( frame, crops ) are averaged apart: the
+// BufferPool is trimmed to the typical pooled buffer, not to the whole working set.
+class MemoryPolicy {
+
+    private:
+        const double smoothing = 0.1;
+        const double high_watermark_factor = 2.0;
+
+        std::mutex mutex;
+        size_t memory_cap_bytes = 0; // 0 = no cap
+        double typical_bytes = 0; // Moving average of the working set
+        double typical_pooled_bytes = 0; // Moving average of the biggest BufferPool buffer of a request
+
+        static void average( double &typical, size_t bytes, double smoothing ) {
+            if ( typical == 0 )
+                typical = double( bytes );
+            else
+                typical += smoothing * ( double( bytes ) - typical );
+        }
+
+    public:
+        MemoryPolicy() = default;
+
+        void setMemoryCap( size_t memory_cap_bytes ) {
+            std::lock_guard< std::mutex > lock( mutex );
+            this->memory_cap_bytes = memory_cap_bytes;
+        }
+
+        size_t typicalBytes() {
+            std::lock_guard< std::mutex > lock( mutex );
+            return size_t( typical_bytes );
+        }
+
+        // Size of the BufferPool buffers worth keeping ( BufferPool::trimAbove ), 0 before the first request
+        size_t typicalPooledBytes() {
+            std::lock_guard< std::mutex > lock( mutex );
+            return size_t( typical_pooled_bytes );
+        }
+
+        // Before the stages allocate: true when the expected working set is over the cap,
+        // so the buffers kept from the previous requests should be released first
+        bool beforeRequest( size_t expected_working_set_bytes ) {
+            std::lock_guard< std::mutex > lock( mutex );
+            return memory_cap_bytes > 0 && expected_working_set_bytes > memory_cap_bytes;
+        }
+
+        // Returns true when the reused buffers should be released.
+        // pooled_bytes: the biggest BufferPool buffer the request held
+        bool afterRequest( size_t working_set_bytes, size_t pooled_bytes ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            const bool oversized = typical_bytes > 0 && working_set_bytes > high_watermark_factor * typical_bytes;
+            const bool over_cap = memory_cap_bytes > 0 && working_set_bytes > memory_cap_bytes;
+
+            average( typical_bytes, working_set_bytes, smoothing );
+            average( typical_pooled_bytes, pooled_bytes, smoothing );
+
+            return oversized || over_cap;
+        }
+};
+
+
+// Gives freed heap pages back to the OS after a trim
+void releaseFreeHeapMemory() {
+#if defined( __GLIBC__ )
+    malloc_trim( 0 );
+#endif
+}
+
+struct ProcessMemoryStats {
+    size_t resident_bytes = 0;
+    size_t heap_in_use_bytes = 0;
+    size_t heap_arena_bytes = 0;
+};
+
+ProcessMemoryStats readProcessMemoryStats() {
+
+    ProcessMemoryStats stats;
+
+#if defined( __linux__ )
+    std::ifstream statm( "/proc/self/statm" );
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+
+    if ( statm >> total_pages >> resident_pages )
+        stats.resident_bytes = resident_pages * size_t( sysconf( _SC_PAGESIZE ) );
+#endif
+
+#if defined( __GLIBC__ ) && ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 33 ) )
+    const struct mallinfo2 info = mallinfo2();
+    stats.heap_in_use_bytes = info.uordblks + info.hblkhd;
+    stats.heap_arena_bytes = info.arena + info.hblkhd;
+#endif
+
+    return stats;
+}
+
+void registerMemoryMetrics() {
+
+    metrics().addCallback( "ppocr_resident_memory_bytes", "Resident set size of the process", "gauge",
+        []() { return double( readProcessMemoryStats().resident_bytes ); } );
+
+    metrics().addCallback( "ppocr_heap_in_use_bytes", "Heap bytes in use (glibc)", "gauge",
+        []() { return double( readProcessMemoryStats().heap_in_use_bytes ); } );
+
+    metrics().addCallback( "ppocr_heap_arena_bytes", "Heap bytes reserved from the OS (glibc)", "gauge",
+        []() { return double( readProcessMemoryStats().heap_arena_bytes ); } );
+
+    metrics().addCallback( "ppocr_buffer_pool_cached_bytes", "Idle bytes kept by the frame buffer pool", "gauge",
+        []() { return double( bufferPool().cachedBytes() ); } );
+
+    metrics().addCallback( "ppocr_buffer_pool_in_use_bytes", "Frame buffer pool bytes held by requests", "gauge",
+        []() { return double( bufferPool().inUseBytes() ); } );
+}
+
+#endif
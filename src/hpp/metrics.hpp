@@ -0,0 +1,345 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+enum class MetricHistogram {
+    DECODE_US,
+    DETECT_US,
+    CLASSIFY_US,
+    RECOGNIZE_US,
+    SERIALIZE_US,
+    QUEUE_WAIT_US,
+    REQUEST_US,
+    BOXES_PER_FRAME,
+    REC_BATCH_SIZE,
+    COUNT
+};
+
+enum class MetricCounter {
+    PIPELINE_CACHE_HITS,
+    PIPELINE_CACHE_MISSES,
+    MODEL_CACHE_HITS,
+    MODEL_CACHE_MISSES,
+    CAPTURE_WRITTEN,
+    CAPTURE_DROPPED,
+    MEMORY_TRIMS,
+    CLS_LINES_CLASSIFIED,
+    CLS_LINES_SKIPPED,
+    LINES_RERECOGNIZED,
+    DET_PROBE_EMPTY_FRAMES,
+    DET_PROBE_REGION_FRAMES,
+    DET_PROBE_FULL_FRAMES,
+    DET_REDUCED_RESOLUTION_FRAMES,
+    DET_RESOLUTION_RECHECKS,
+    TEXT_CROPS_AXIS_ALIGNED,
+    TEXT_CROPS_WARPED,
+    COUNT
+};
+
+
+const int metric_histogram_count = static_cast< int >( MetricHistogram::COUNT );
+const int metric_counter_count = static_cast< int >( MetricCounter::COUNT );
+const int metric_max_buckets = 16;
+
+
+struct HistogramDefinition {
+    std::string family; // Prometheus metric name
+    std::string help;
+    std::string label; // e.g. stage="decode" (empty for none)
+    double unit_scale; // Recorded unit -> exported unit (us -> s)
+    std::vector< uint64_t > bounds; // Upper bucket bounds in the recorded unit, +Inf is implicit
+};
+
+struct CounterDefinition {
+    std::string family;
+    std::string help;
+    std::string label;
+};
+
+
+inline const std::array< HistogramDefinition, metric_histogram_count >& histogramDefinitions() {
+
+    static const std::vector< uint64_t > duration_bounds = {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+    };
+    static const std::vector< uint64_t > size_bounds = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+
+    static const std::array< HistogramDefinition, metric_histogram_count > definitions = {{
+        { "ppocr_stage_duration_seconds", "Time spent in each request stage", "stage=\"decode\"", 1e-6, duration_bounds },
+        { "ppocr_stage_duration_seconds", "Time spent in each request stage", "stage=\"detect\"", 1e-6, duration_bounds },
+        { "ppocr_stage_duration_seconds", "Time spent in each request stage", "stage=\"classify\"", 1e-6, duration_bounds },
+        { "ppocr_stage_duration_seconds", "Time spent in each request stage", "stage=\"recognize\"", 1e-6, duration_bounds },
+        { "ppocr_stage_duration_seconds", "Time spent in each request stage", "stage=\"serialize\"", 1e-6, duration_bounds },
+        { "ppocr_queue_wait_seconds", "Time requests waited for a scheduler slot", "", 1e-6, duration_bounds },
+        { "ppocr_request_duration_seconds", "Time from arrival to response", "", 1e-6, duration_bounds },
+        { "ppocr_boxes_per_frame", "Text boxes found by the detector per frame", "", 1, size_bounds },
+        { "ppocr_rec_batch_size", "Text lines per recognizer batch", "", 1, size_bounds }
+    }};
+
+    return definitions;
+}
+
+inline const std::array< CounterDefinition, metric_counter_count >& counterDefinitions() {
+
+    static const std::array< CounterDefinition, metric_counter_count > definitions = {{
+        { "ppocr_pipeline_cache_total", "Pipeline lookups by result", "result=\"hit\"" },
+        { "ppocr_pipeline_cache_total", "Pipeline lookups by result", "result=\"miss\"" },
+        { "ppocr_model_cache_total", "Model lookups by result", "result=\"hit\"" },
+        { "ppocr_model_cache_total", "Model lookups by result", "result=\"miss\"" },
+        { "ppocr_capture_requests_total", "Captured requests by result", "result=\"written\"" },
+        { "ppocr_capture_requests_total", "Captured requests by result", "result=\"dropped\"" },
+        { "ppocr_memory_trims_total", "Times a pipeline released its reused buffers", "" },
+        { "ppocr_cls_lines_total", "Text lines by angle classifier decision", "result=\"classified\"" },
+        { "ppocr_cls_lines_total", "Text lines by angle classifier decision", "result=\"skipped\"" },
+        { "ppocr_rerecognized_lines_total", "Low confidence lines found flipped and recognized again", "" },
+        { "ppocr_det_probe_frames_total", "Frames by outcome of the coarse detection pass", "result=\"empty\"" },
+        { "ppocr_det_probe_frames_total", "Frames by outcome of the coarse detection pass", "result=\"regions\"" },
+        { "ppocr_det_probe_frames_total", "Frames by outcome of the coarse detection pass", "result=\"full\"" },
+        { "ppocr_det_reduced_resolution_frames_total", "Frames detected below max_image_width from their stream's text height", "" },
+        { "ppocr_det_resolution_rechecks_total", "Full resolution frames of streams running at a reduced resolution", "" },
+        { "ppocr_text_crops_total", "Text line crops by extraction path", "path=\"axis_aligned\"" },
+        { "ppocr_text_crops_total", "Text line crops by extraction path", "path=\"warped\"" }
+    }};
+
+    return definitions;
+}
+
+
+// Process wide metrics, use metrics() to get the instance.
+// Every thread writes to its own shard (single writer, relaxed atomics, no locks),
+// shards are only summed up when the metrics are scraped. The shard of an exited thread is
+// kept with its values and handed to the next new thread, so the shards don't grow with the
+// threads ever started and the sums never go back.
+class Metrics {
+
+    private:
+        struct HistogramData {
+            std::array< std::atomic< uint64_t >, metric_max_buckets + 1 > buckets{};
+            std::atomic< uint64_t > sum{ 0 };
+            std::atomic< uint64_t > count{ 0 };
+        };
+
+        struct ThreadShard {
+            std::array< HistogramData, metric_histogram_count > histograms;
+            std::array< std::atomic< uint64_t >, metric_counter_count > counters{};
+        };
+
+        struct Callback {
+            std::string family;
+            std::string help;
+            std::string type; // gauge | counter
+            std::function< double() > read;
+        };
+
+        // Returns the shard of its thread to the free shards when the thread exits
+        struct ShardLease {
+            Metrics* owner = nullptr;
+            ThreadShard* shard = nullptr;
+
+            ~ShardLease() {
+                if ( shard != nullptr )
+                    owner->releaseShard( shard );
+            }
+        };
+
+        std::mutex mutex; // Shard registration and scraping only
+        std::vector< std::unique_ptr< ThreadShard > > shards;
+        std::vector< ThreadShard* > free_shards; // Of exited threads, still summed up
+        std::vector< Callback > callbacks;
+
+        static void add( std::atomic< uint64_t >& value, uint64_t amount ) {
+            // Only the owner thread writes, so no read-modify-write instruction is needed
+            value.store( value.load( std::memory_order_relaxed ) + amount, std::memory_order_relaxed );
+        }
+
+        ThreadShard& localShard() {
+
+            thread_local ShardLease lease;
+
+            if ( lease.shard == nullptr ) {
+
+                std::lock_guard< std::mutex > lock( mutex );
+
+                // The values of the previous owner stay, the new one adds to them ( the mutex
+                // orders its last writes before the first of the new owner )
+                if ( !free_shards.empty() ) {
+                    lease.shard = free_shards.back();
+                    free_shards.pop_back();
+                } else {
+                    shards.push_back( std::make_unique< ThreadShard >() );
+                    lease.shard = shards.back().get();
+                }
+
+                lease.owner = this;
+            }
+
+            return *lease.shard;
+        }
+
+        void releaseShard( ThreadShard* shard ) {
+            std::lock_guard< std::mutex > lock( mutex );
+            free_shards.push_back( shard );
+        }
+
+        static std::string formatNumber( double value ) {
+            std::ostringstream out;
+            out << value;
+            return out.str();
+        }
+
+        static std::string formatLabels( const std::string& label, const std::string& extra = "" ) {
+
+            if ( label.empty() && extra.empty() )
+                return "";
+
+            if ( label.empty() || extra.empty() )
+                return "{" + label + extra + "}";
+
+            return "{" + label + "," + extra + "}";
+        }
+
+    public:
+        Metrics() = default;
+
+        void observe( MetricHistogram histogram, uint64_t value ) {
+
+            const auto& bounds = histogramDefinitions()[ static_cast< int >( histogram ) ].bounds;
+            HistogramData& data = localShard().histograms[ static_cast< int >( histogram ) ];
+
+            size_t bucket = 0;
+            while ( bucket < bounds.size() && value > bounds[ bucket ] )
+                bucket++;
+
+            add( data.buckets[ bucket ], 1 );
+            add( data.sum, value );
+            add( data.count, 1 );
+        }
+
+        void increment( MetricCounter counter, uint64_t amount = 1 ) {
+            add( localShard().counters[ static_cast< int >( counter ) ], amount );
+        }
+
+        // Values owned by other components (queue depth, cancellation counters...), read on scrape
+        void addCallback(
+            const std::string& family,
+            const std::string& help,
+            const std::string& type,
+            std::function< double() > read
+        ) {
+            std::lock_guard< std::mutex > lock( mutex );
+            callbacks.push_back( { family, help, type, std::move( read ) } );
+        }
+
+        // Prometheus text exposition format (version 0.0.4)
+        std::string toPrometheusText() {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            std::ostringstream out;
+            std::string last_family;
+
+            const auto& histogram_definitions = histogramDefinitions();
+
+            for ( int h = 0; h < metric_histogram_count; ++h ) {
+
+                const auto& definition = histogram_definitions[ h ];
+
+                std::array< uint64_t, metric_max_buckets + 1 > buckets{};
+                uint64_t sum = 0;
+                uint64_t count = 0;
+
+                for ( const auto& shard : shards ) {
+                    const HistogramData& data = shard->histograms[ h ];
+                    for ( size_t b = 0; b <= definition.bounds.size(); ++b )
+                        buckets[ b ] += data.buckets[ b ].load( std::memory_order_relaxed );
+                    sum += data.sum.load( std::memory_order_relaxed );
+                    count += data.count.load( std::memory_order_relaxed );
+                }
+
+                if ( definition.family != last_family ) {
+                    out << "# HELP " << definition.family << " " << definition.help << "\n";
+                    out << "# TYPE " << definition.family << " histogram\n";
+                    last_family = definition.family;
+                }
+
+                uint64_t cumulative = 0;
+                for ( size_t b = 0; b < definition.bounds.size(); ++b ) {
+                    cumulative += buckets[ b ];
+                    out << definition.family << "_bucket"
+                        << formatLabels( definition.label, "le=\"" + formatNumber( definition.bounds[ b ] * definition.unit_scale ) + "\"" )
+                        << " " << cumulative << "\n";
+                }
+                out << definition.family << "_bucket" << formatLabels( definition.label, "le=\"+Inf\"" ) << " " << count << "\n";
+                out << definition.family << "_sum" << formatLabels( definition.label ) << " " << sum * definition.unit_scale << "\n";
+                out << definition.family << "_count" << formatLabels( definition.label ) << " " << count << "\n";
+            }
+
+            const auto& counter_definitions = counterDefinitions();
+
+            for ( int c = 0; c < metric_counter_count; ++c ) {
+
+                const auto& definition = counter_definitions[ c ];
+
+                uint64_t total = 0;
+                for ( const auto& shard : shards )
+                    total += shard->counters[ c ].load( std::memory_order_relaxed );
+
+                if ( definition.family != last_family ) {
+                    out << "# HELP " << definition.family << " " << definition.help << "\n";
+                    out << "# TYPE " << definition.family << " counter\n";
+                    last_family = definition.family;
+                }
+
+                out << definition.family << formatLabels( definition.label ) << " " << total << "\n";
+            }
+
+            for ( const auto& callback : callbacks ) {
+                out << "# HELP " << callback.family << " " << callback.help << "\n";
+                out << "# TYPE " << callback.family << " " << callback.type << "\n";
+                out << callback.family << " " << callback.read() << "\n";
+            }
+
+            return out.str();
+        }
+};
+
+
+inline Metrics& metrics() {
+    static Metrics instance;
+    return instance;
+}
+
+
+// Measures the time between construction and elapsedMicros()
+class StageTimer {
+
+    private:
+        std::chrono::steady_clock::time_point started_at = std::chrono::steady_clock::now();
+
+    public:
+        uint64_t elapsedMicros() const {
+            return std::chrono::duration_cast< std::chrono::microseconds >(
+                std::chrono::steady_clock::now() - started_at
+            ).count();
+        }
+
+        // Records the elapsed time and restarts the timer
+        uint64_t lap( MetricHistogram histogram ) {
+            const uint64_t elapsed = elapsedMicros();
+            metrics().observe( histogram, elapsed );
+            started_at = std::chrono::steady_clock::now();
+            return elapsed;
+        }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef MODEL_REGISTRY_HPP
+#define MODEL_REGISTRY_HPP
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "metrics.hpp"
+
+
+// Shared models ( or pipelines ) by key. Each key is loaded once: concurrent first requests for a key
+// wait for the one load in progress instead of starting their own (single flight).
+// A failed load (nullptr) is forgotten, so the next request tries again.
+template< typename Model >
+class ModelRegistry {
+
+    private:
+        std::mutex mutex;
+        std::unordered_map< std::string, std::shared_future< std::shared_ptr< Model > > > models;
+        bool record_metrics; // Cache hits / misses
+        MetricCounter hits_counter = MetricCounter::MODEL_CACHE_HITS;
+        MetricCounter misses_counter = MetricCounter::MODEL_CACHE_MISSES;
+
+    public:
+        ModelRegistry( bool record_metrics = true ) : record_metrics( record_metrics ) {}
+
+        ModelRegistry( MetricCounter hits_counter, MetricCounter misses_counter )
+            : record_metrics( true ), hits_counter( hits_counter ), misses_counter( misses_counter ) {}
+
+        std::shared_ptr< Model > getOrLoad( const std::string& key, const std::function< std::shared_ptr< Model >() >& load ) {
+
+            std::promise< std::shared_ptr< Model > > loaded;
+            std::shared_future< std::shared_ptr< Model > > pending;
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+
+                const auto model = models.find( key );
+
+                if ( model != models.end() )
+                    pending = model->second;
+                else
+                    models.emplace( key, loaded.get_future().share() );
+
+                if ( record_metrics )
+                    metrics().increment( pending.valid() ? hits_counter : misses_counter );
+            }
+
+            // Loaded, or being loaded by another thread
+            if ( pending.valid() )
+                return pending.get();
+
+            std::shared_ptr< Model > result;
+
+            try {
+                result = load();
+            }
+            catch ( ... ) {
+                result = nullptr;
+            }
+
+            if ( result == nullptr ) {
+                std::lock_guard< std::mutex > lock( mutex );
+                models.erase( key );
+            }
+
+            loaded.set_value( result );
+
+            return result;
+        }
+};
+
+#endif
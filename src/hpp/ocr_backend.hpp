@@ -0,0 +1,221 @@
+#ifndef OCR_BACKEND_HPP
+#define OCR_BACKEND_HPP
+
+#include <fastdeploy/vision.h>
+#include "inference_models_manager.hpp"
+#include "request_context.hpp"
+#include "text_detector.hpp"
+
+
+// What the OCRPipeline needs from the models.
+// FastDeployOCRBackend runs the real models, the benchmark plugs in a deterministic fake.
+class OCRBackend {
+
+public:
+    virtual ~OCRBackend() = default;
+
+    virtual bool initialized() const = 0;
+
+    virtual bool detect(
+        const cv::Mat &image,
+        std::vector< std::array< int, 8 > > *boxes,
+        RequestTimings *timings
+    ) = 0;
+
+    virtual bool hasClassifier() const = 0;
+
+    virtual float getClsThresh() = 0;
+
+    // Fills cls_labels / cls_scores at [ start_idx, end_idx )
+    virtual bool classify(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        std::vector< int32_t > *cls_labels,
+        std::vector< float > *cls_scores
+    ) = 0;
+
+    // Fills texts / rec_scores at indices[ start_idx ... end_idx )
+    virtual bool recognize(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        const std::vector< int > &indices,
+        std::vector< std::string > *texts,
+        std::vector< float > *rec_scores
+    ) = 0;
+
+    // Height the recognizer scales the lines to, 0 = unknown
+    virtual int recognizerHeight() const {
+        return 0;
+    }
+
+    // Gives back the buffers kept between requests (sized by the biggest request so far)
+    virtual void releaseBuffers() {}
+};
+
+
+// Detection with the models of a preset: coarse to fine when its detection_probe is on, else one pass.
+// Shared by the pipelines and the detection only requests
+bool detectTextWithModels(
+    const Models &models,
+    const cv::Mat &image,
+    std::vector< std::array< int, 8 > > *boxes,
+    RequestTimings *timings
+) {
+    if ( models.detection_probe.enabled() )
+        return detectTextCoarseToFine(
+            models.detection_model, image, boxes, timings, models.detection_probe,
+            models.db_postprocessor, models.shape_buckets, models.fused_preprocessor
+        );
+
+    return detectText( models.detection_model, image, boxes, timings, models.db_postprocessor, models.shape_buckets, models.fused_preprocessor );
+}
+
+
+class FastDeployOCRBackend : public OCRBackend {
+
+private:
+    Models models;
+    std::vector< int > rec_image_shape; // < channels, height, width >, width set per batch with recognizer buckets
+
+    // Pads the batch to the smallest bucket width holding its widest line
+    void setRecognizerWidth(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        const std::vector< int > &indices
+    ) {
+
+        // Same as the recognizer preprocessor: the input is at least as wide as rec_image_shape
+        float max_wh_ratio = 0;
+
+        for ( size_t i = start_idx; i < end_idx && i < indices.size(); ++i ) {
+            const cv::Mat &text_image = text_images[ indices[ i ] ];
+            if ( text_image.rows > 0 )
+                max_wh_ratio = std::max( max_wh_ratio, float( text_image.cols ) / text_image.rows );
+        }
+
+        rec_image_shape[2] = models.shape_buckets->recognizerWidth( int( rec_image_shape[1] * max_wh_ratio ) );
+
+        models.recognition_model->GetPreprocessor().SetRecImageShape( rec_image_shape );
+    }
+
+    // Recognizer::BatchPredict with the fused preprocessing and / or the native CTC decoding
+    // ( the fused preprocessing falls back to FastDeploy's for lines that are not 8 bit BGR )
+    bool recognizeNative(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        const std::vector< int > &indices,
+        std::vector< std::string > *texts,
+        std::vector< float > *rec_scores
+    ) {
+
+        thread_local std::vector< fastdeploy::FDTensor > input_tensors( 1 ); // Kept: sized by the biggest batch so far
+        thread_local std::vector< fastdeploy::FDTensor > output_tensors;
+
+        const bool fused_input = models.fused_preprocessor != nullptr &&
+            models.fused_preprocessor->recognizerInput( text_images, start_idx, end_idx, indices, rec_image_shape, &input_tensors[0] );
+
+        if ( !fused_input ) {
+
+            if ( models.ctc_decoder == nullptr )
+                return models.recognition_model->BatchPredict( text_images, texts, rec_scores, start_idx, end_idx, indices );
+
+            std::vector< fastdeploy::vision::FDMat > fd_images = fastdeploy::vision::WrapMat( text_images );
+
+            if ( !models.recognition_model->GetPreprocessor().Run( &fd_images, &input_tensors, start_idx, end_idx, indices ) ) {
+                std::cerr << "Failed to preprocess the recognizer input." << std::endl;
+                return false;
+            }
+        }
+
+        input_tensors[0].name = models.recognition_model->InputInfoOfRuntime(0).name;
+
+        if ( !models.recognition_model->Infer( input_tensors, &output_tensors ) ) {
+            std::cerr << "Failed to run the recognizer." << std::endl;
+            return false;
+        }
+
+        if ( models.ctc_decoder != nullptr )
+            return models.ctc_decoder->decodeBatch( output_tensors[0], texts, rec_scores, start_idx, text_images.size(), indices );
+
+        return models.recognition_model->GetPostprocessor().Run( output_tensors, texts, rec_scores, start_idx, text_images.size(), indices );
+    }
+
+public:
+    FastDeployOCRBackend( const Models &models ) {
+
+        this->models = models;
+
+        if ( models.recognition_model != nullptr )
+            rec_image_shape = models.recognition_model->GetPreprocessor().GetRecImageShape();
+    }
+
+    bool initialized() const override {
+        return models.detection_model != nullptr && models.detection_model->Initialized() &&
+               models.recognition_model != nullptr && models.recognition_model->Initialized() &&
+               ( models.classification_model == nullptr || models.classification_model->Initialized() );
+    }
+
+    bool detect(
+        const cv::Mat &image,
+        std::vector< std::array< int, 8 > > *boxes,
+        RequestTimings *timings
+    ) override {
+        return detectTextWithModels( models, image, boxes, timings );
+    }
+
+    bool hasClassifier() const override {
+        return models.classification_model != nullptr;
+    }
+
+    float getClsThresh() override {
+        return models.classification_model->GetPostprocessor().GetClsThresh();
+    }
+
+    bool classify(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        std::vector< int32_t > *cls_labels,
+        std::vector< float > *cls_scores
+    ) override {
+        return models.classification_model->BatchPredict( text_images, cls_labels, cls_scores, start_idx, end_idx );
+    }
+
+    bool recognize(
+        const std::vector< cv::Mat > &text_images,
+        size_t start_idx,
+        size_t end_idx,
+        const std::vector< int > &indices,
+        std::vector< std::string > *texts,
+        std::vector< float > *rec_scores
+    ) override {
+
+        if ( models.shape_buckets != nullptr && models.shape_buckets->hasRecognizerBuckets() )
+            setRecognizerWidth( text_images, start_idx, end_idx, indices );
+
+        if ( models.fused_preprocessor != nullptr || models.ctc_decoder != nullptr )
+            return recognizeNative( text_images, start_idx, end_idx, indices, texts, rec_scores );
+
+        return models.recognition_model->BatchPredict( text_images, texts, rec_scores, start_idx, end_idx, indices );
+    }
+
+    int recognizerHeight() const override {
+        return rec_image_shape.size() == 3 ? rec_image_shape[1] : 0;
+    }
+
+    void releaseBuffers() override {
+
+        models.detection_model->ReleaseReusedBuffer();
+
+        if ( models.classification_model != nullptr )
+            models.classification_model->ReleaseReusedBuffer();
+
+        models.recognition_model->ReleaseReusedBuffer();
+    }
+};
+
+#endif
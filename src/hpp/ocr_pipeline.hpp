@@ -0,0 +1,386 @@
+#ifndef OCR_PIPELINE_HPP
+#define OCR_PIPELINE_HPP
+
+#include <numeric>
+#include <fastdeploy/vision.h>
+#include <fastdeploy/vision/ocr/ppocr/utils/ocr_utils.h>
+#include "classifier_policy.hpp"
+#include "memory_manager.hpp"
+#include "metrics.hpp"
+#include "ocr_backend.hpp"
+#include "request_context.hpp"
+#include "text_crops.hpp"
+
+
+// Runs the same stages as fastdeploy::pipeline::PPOCRv4::Predict ( det -> crop -> cls -> rec ),
+// but one at a time, so a cancelled or late request can be dropped between them.
+class OCRPipeline {
+
+private:
+    std::shared_ptr< OCRBackend > backend;
+    size_t cls_batch_size;
+    size_t rec_batch_size;
+    MemoryPolicy memory_policy;
+    std::shared_ptr< ClassifierPolicy > classifier_policy = std::make_shared< ClassifierPolicy >(); // Every line by default
+    bool native_crops = false; // extractTextCrops instead of GetRotateCropImage per line
+
+    // Rough size of what the stages allocate for one request:
+    // frame + detector tensors (3 channel input and 1 channel output, float) + crops + biggest recognizer batch tensor
+    static size_t frameWorkingSetBytes( const cv::Mat &image ) {
+        return image.total() * image.elemSize() + image.total() * 4 * sizeof( float );
+    }
+
+    // Gives back the model buffers kept between requests and the pooled buffers bigger than the typical ones
+    void releaseMemory() {
+        backend->releaseBuffers();
+        bufferPool().trimAbove( memory_policy.typicalPooledBytes() );
+        releaseFreeHeapMemory();
+        metrics().increment( MetricCounter::MEMORY_TRIMS );
+    }
+
+    // Classifies the given lines in cls batches and turns the flipped ones upside up
+    bool classifyLines(
+        std::vector< cv::Mat > &text_images,
+        const std::vector< size_t > &lines,
+        fastdeploy::vision::OCRResult *result,
+        std::vector< size_t > *flipped_lines
+    ) {
+
+        const float cls_thresh = backend->getClsThresh();
+
+        std::vector< cv::Mat > batch_images;
+        std::vector< int32_t > batch_labels;
+        std::vector< float > batch_scores;
+
+        for ( size_t start_idx = 0; start_idx < lines.size(); start_idx += cls_batch_size ) {
+
+            const size_t end_idx = std::min( start_idx + cls_batch_size, lines.size() );
+
+            batch_images.clear();
+            for ( size_t i = start_idx; i < end_idx; ++i )
+                batch_images.push_back( text_images[ lines[ i ] ] ); // Header only
+
+            batch_labels.assign( batch_images.size(), 0 );
+            batch_scores.assign( batch_images.size(), 0 );
+
+            if ( !backend->classify( batch_images, 0, batch_images.size(), &batch_labels, &batch_scores ) )
+                return false;
+
+            for ( size_t i = start_idx; i < end_idx; ++i ) {
+
+                const size_t line = lines[ i ];
+
+                result->cls_labels[ line ] = batch_labels[ i - start_idx ];
+                result->cls_scores[ line ] = batch_scores[ i - start_idx ];
+
+                // Upside down
+                if ( result->cls_labels[ line ] % 2 == 1 && result->cls_scores[ line ] > cls_thresh ) {
+                    cv::rotate( text_images[ line ], text_images[ line ], cv::ROTATE_180 );
+                    flipped_lines->push_back( line );
+                }
+            }
+        }
+
+        metrics().increment( MetricCounter::CLS_LINES_CLASSIFIED, lines.size() );
+
+        return true;
+    }
+
+    // Adaptive classifier: the lines not classified before recognition that were recognized with a low
+    // score are classified now, the flipped ones recognized again. Returns false on a model failure
+    bool reclassifyLowConfidenceLines(
+        std::vector< cv::Mat > &text_images,
+        const std::vector< bool > &classified,
+        const std::vector< float > &width_ratios,
+        fastdeploy::vision::OCRResult *result,
+        std::vector< size_t > *flipped_lines
+    ) {
+
+        std::vector< size_t > unsure_lines;
+
+        for ( size_t i = 0; i < classified.size(); ++i ) {
+            if ( !classified[ i ] && result->rec_scores[ i ] < classifier_policy->lowConfidence() )
+                unsure_lines.push_back( i );
+        }
+
+        const size_t classified_lines = std::count( classified.begin(), classified.end(), true );
+        metrics().increment( MetricCounter::CLS_LINES_SKIPPED, classified.size() - classified_lines - unsure_lines.size() );
+
+        if ( unsure_lines.empty() )
+            return true;
+
+        const size_t flipped_before = flipped_lines->size();
+
+        if ( !classifyLines( text_images, unsure_lines, result, flipped_lines ) )
+            return false;
+
+        std::vector< int > indices( flipped_lines->begin() + flipped_before, flipped_lines->end() );
+
+        std::stable_sort( indices.begin(), indices.end(), [&]( int a, int b ) {
+            return width_ratios[ a ] < width_ratios[ b ];
+        });
+
+        for ( size_t start_idx = 0; start_idx < indices.size(); start_idx += rec_batch_size ) {
+
+            const size_t end_idx = std::min( start_idx + rec_batch_size, indices.size() );
+
+            if ( !backend->recognize( text_images, start_idx, end_idx, indices, &( result->text ), &( result->rec_scores ) ) )
+                return false;
+        }
+
+        metrics().increment( MetricCounter::LINES_RERECOGNIZED, indices.size() );
+
+        return true;
+    }
+
+    // Detection on the frame downscaled to det_max_side ( 0 = as is ), boxes in frame coordinates.
+    // The crops are still cut from the full frame
+    bool detect(
+        const cv::Mat &image,
+        std::vector< std::array< int, 8 > > *boxes,
+        RequestTimings *timings,
+        int det_max_side
+    ) {
+
+        if ( det_max_side <= 0 || std::max( image.cols, image.rows ) <= det_max_side )
+            return backend->detect( image, boxes, timings );
+
+        thread_local cv::Mat det_image;
+
+        StageTimer timer;
+
+        const float ratio = float( det_max_side ) / std::max( image.cols, image.rows );
+        cv::resize(
+            image, det_image,
+            cv::Size( std::max( 1, int( image.cols * ratio ) ), std::max( 1, int( image.rows * ratio ) ) ),
+            0, 0, cv::INTER_AREA
+        );
+
+        const uint64_t resize_us = timer.elapsedMicros();
+
+        if ( !backend->detect( det_image, boxes, timings ) )
+            return false;
+
+        timings->det_preprocess_us += resize_us;
+
+        const float scale_x = float( image.cols ) / det_image.cols;
+        const float scale_y = float( image.rows ) / det_image.rows;
+
+        for ( auto &box : *boxes ) {
+            for ( size_t i = 0; i < box.size(); i += 2 ) {
+                box[ i ] = std::min( image.cols - 1, int( std::round( box[ i ] * scale_x ) ) );
+                box[ i + 1 ] = std::min( image.rows - 1, int( std::round( box[ i + 1 ] * scale_y ) ) );
+            }
+        }
+
+        return true;
+    }
+
+    InferenceStatus runStages(
+        const cv::Mat &image,
+        fastdeploy::vision::OCRResult *result,
+        const RequestContext &context,
+        CancellationCounters &counters,
+        RequestTimings *timings,
+        size_t *working_set_bytes,
+        size_t *pooled_bytes,
+        int det_max_side
+    ) {
+
+        if ( !detect( image, &( result->boxes ), timings, det_max_side ) ) {
+            std::cerr << "Failed to detect." << std::endl;
+            return InferenceStatus::FAILED;
+        }
+
+        fastdeploy::vision::ocr::SortBoxes( &( result->boxes ) );
+
+        const size_t line_count = result->boxes.size();
+
+        if ( line_count == 0 )
+            return InferenceStatus::OK;
+
+        InferenceStatus status = context.check();
+
+        if ( status != InferenceStatus::OK ) {
+            counters.cancelled_after_detection++;
+            counters.skipped_text_lines += line_count;
+            return status;
+        }
+
+        std::vector< cv::Mat > text_images( line_count );
+
+        if ( native_crops && image.depth() == CV_8U ) {
+            const size_t crop_bytes = extractTextCrops( image, result->boxes, backend->recognizerHeight(), &text_images );
+            *working_set_bytes += crop_bytes;
+            *pooled_bytes = std::max( *pooled_bytes, crop_bytes );
+        }
+        else {
+            for ( size_t i = 0; i < line_count; ++i ) {
+                text_images[ i ] = fastdeploy::vision::ocr::GetRotateCropImage( image, result->boxes[ i ] );
+                *working_set_bytes += text_images[ i ].total() * text_images[ i ].elemSize();
+            }
+        }
+
+        result->cls_labels.resize( line_count, 0 );
+        result->cls_scores.resize( line_count, 0 );
+
+        // Lines the classifier skipped keep label 0 ( not flipped ) and score 0
+        bool classified_all_lines = true;
+        std::vector< bool > classified( line_count, false );
+        std::vector< size_t > flipped_lines;
+
+        StageTimer timer; // After the crops: cls_us is the classifier's time only
+
+        if ( backend->hasClassifier() ) {
+
+            const std::vector< size_t > cls_lines = classifier_policy->linesBeforeRecognition( context.stream_id, line_count, &classified_all_lines );
+
+            if ( !classifyLines( text_images, cls_lines, result, &flipped_lines ) ) {
+                std::cerr << "Failed to classify." << std::endl;
+                return InferenceStatus::FAILED;
+            }
+
+            for ( const size_t line : cls_lines )
+                classified[ line ] = true;
+
+            timings->cls_us = timer.elapsedMicros();
+
+            status = context.check();
+
+            if ( status != InferenceStatus::OK ) {
+                counters.cancelled_after_classification++;
+                counters.skipped_text_lines += line_count;
+                return status;
+            }
+        }
+
+        // Batch lines with similar aspect ratio together (less padding)
+        std::vector< float > width_ratios( line_count );
+        for ( size_t i = 0; i < line_count; ++i ) {
+            width_ratios[ i ] = float( text_images[ i ].cols ) / text_images[ i ].rows;
+        }
+
+        std::vector< int > indices( line_count );
+        std::iota( indices.begin(), indices.end(), 0 );
+        std::stable_sort( indices.begin(), indices.end(), [&]( int a, int b ) {
+            return width_ratios[ a ] < width_ratios[ b ];
+        });
+
+        result->text.resize( line_count );
+        result->rec_scores.resize( line_count, 0 );
+
+        size_t rec_tensor_bytes = 0;
+
+        for ( size_t start_idx = 0; start_idx < line_count; start_idx += rec_batch_size ) {
+
+            if ( start_idx > 0 ) {
+
+                status = context.check();
+
+                if ( status != InferenceStatus::OK ) {
+                    counters.cancelled_during_recognition++;
+                    counters.skipped_rec_batches += ( line_count - start_idx + rec_batch_size - 1 ) / rec_batch_size;
+                    counters.skipped_text_lines += line_count - start_idx;
+                    return status;
+                }
+            }
+
+            timer = StageTimer(); // Checkpoints may have waited on the scheduler, the batch starts here
+
+            const size_t end_idx = std::min( start_idx + rec_batch_size, line_count );
+
+            if ( !backend->recognize( text_images, start_idx, end_idx, indices, &( result->text ), &( result->rec_scores ) ) ) {
+                std::cerr << "Failed to recognize." << std::endl;
+                return InferenceStatus::FAILED;
+            }
+
+            timings->rec_batch_us.push_back( timer.lap( MetricHistogram::RECOGNIZE_US ) );
+            metrics().observe( MetricHistogram::REC_BATCH_SIZE, end_idx - start_idx );
+
+            // Sorted by ratio: the last line is the widest of the batch
+            const size_t rec_height = size_t( backend->recognizerHeight() );
+            const size_t batch_width = size_t( rec_height * width_ratios[ indices[ end_idx - 1 ] ] ) + 1;
+            rec_tensor_bytes = std::max( rec_tensor_bytes, ( end_idx - start_idx ) * 3 * rec_height * batch_width * sizeof( float ) );
+        }
+
+        *working_set_bytes += rec_tensor_bytes;
+
+        if ( backend->hasClassifier() && !classified_all_lines ) {
+
+            timer = StageTimer();
+
+            if ( !reclassifyLowConfidenceLines( text_images, classified, width_ratios, result, &flipped_lines ) ) {
+                std::cerr << "Failed to classify." << std::endl;
+                return InferenceStatus::FAILED;
+            }
+
+            timings->cls_us += timer.elapsedMicros();
+        }
+
+        if ( backend->hasClassifier() )
+            classifier_policy->record( context.stream_id, !flipped_lines.empty() );
+
+        return InferenceStatus::OK;
+    }
+
+public:
+    OCRPipeline(
+        std::shared_ptr< OCRBackend > backend,
+        int cls_batch_size,
+        int rec_batch_size
+    ) {
+        this->backend = backend;
+        this->cls_batch_size = cls_batch_size > 0 ? cls_batch_size : 1;
+        this->rec_batch_size = rec_batch_size > 0 ? rec_batch_size : 1;
+    }
+
+    bool initialized() const {
+        return backend->initialized();
+    }
+
+    void setMemoryCap( size_t memory_cap_bytes ) {
+        memory_policy.setMemoryCap( memory_cap_bytes );
+    }
+
+    void setClassifierPolicy( std::shared_ptr< ClassifierPolicy > classifier_policy ) {
+        this->classifier_policy = classifier_policy;
+    }
+
+    void setNativeCrops( bool native_crops ) {
+        this->native_crops = native_crops;
+    }
+
+    InferenceStatus predict(
+        const cv::Mat &image,
+        fastdeploy::vision::OCRResult *result,
+        const RequestContext &context,
+        CancellationCounters &counters,
+        RequestTimings *timings,
+        int det_max_side = 0 // Longest side of the detector input ( DetectionResolutionController ), 0 = max_image_width
+    ) {
+
+        size_t working_set_bytes = frameWorkingSetBytes( image );
+        size_t pooled_bytes = image.total() * image.elemSize(); // The decoded frame
+
+        // Over the cap: make room before the stages allocate, not only once they are done
+        if ( memory_policy.beforeRequest( working_set_bytes ) )
+            releaseMemory();
+
+        const InferenceStatus status = runStages(
+            image, result, context, counters, timings, &working_set_bytes, &pooled_bytes, det_max_side
+        );
+
+        // Both classifier passes of the frame ( before and after recognition ) as one observation
+        if ( timings->cls_us > 0 )
+            metrics().observe( MetricHistogram::CLASSIFY_US, timings->cls_us );
+
+        // Don't keep buffers sized for an oversized frame
+        if ( memory_policy.afterRequest( working_set_bytes, pooled_bytes ) )
+            releaseMemory();
+
+        return status;
+    }
+};
+
+#endif
+
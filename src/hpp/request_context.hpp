@@ -0,0 +1,180 @@
+#ifndef REQUEST_CONTEXT_HPP
+#define REQUEST_CONTEXT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+enum class InferenceStatus {
+    OK,
+    FAILED,
+    CANCELLED, // Client went away
+    DEADLINE_EXCEEDED // Client deadline passed (or can't be met)
+};
+
+
+// Work that was not done because the request was dropped early
+struct CancellationCounters {
+    std::atomic< uint64_t > rejected_at_admission{ 0 }; // det + cls + rec skipped
+    std::atomic< uint64_t > cancelled_after_detection{ 0 }; // cls + rec skipped
+    std::atomic< uint64_t > cancelled_after_classification{ 0 }; // rec skipped
+    std::atomic< uint64_t > cancelled_during_recognition{ 0 }; // remaining rec batches skipped
+    std::atomic< uint64_t > skipped_rec_batches{ 0 };
+    std::atomic< uint64_t > skipped_text_lines{ 0 };
+};
+
+
+// Where the time of a single request went (microseconds)
+struct RequestTimings {
+    uint64_t queue_wait_us = 0;
+    uint64_t decode_us = 0;
+    uint64_t det_preprocess_us = 0;
+    uint64_t det_infer_us = 0;
+    uint64_t det_postprocess_us = 0;
+    uint64_t cls_us = 0;
+    std::vector< uint64_t > rec_batch_us;
+    uint64_t serialize_us = 0;
+    uint64_t total_us = 0;
+};
+
+
+// Per request state passed down to the inference pipeline
+struct RequestContext {
+
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point arrival = Clock::now();
+    Clock::time_point deadline = Clock::time_point::max(); // max = no deadline
+
+    // Set by the transport (e.g. ServerContext::IsCancelled)
+    std::function< bool() > is_cancelled;
+
+    // Frames of one client, e.g. a screen capture ( client_id ): per stream detection resolution
+    std::string stream_id;
+
+    // Set by the scheduler, lets higher priority requests run between pipeline stages
+    std::function< void() > yield;
+
+    bool hasDeadline() const {
+        return deadline != Clock::time_point::max();
+    }
+
+    Clock::duration remaining() const {
+
+        if ( !hasDeadline() )
+            return Clock::duration::max();
+
+        return deadline - Clock::now();
+    }
+
+    bool cancelled() const {
+        return is_cancelled && is_cancelled();
+    }
+
+    // Checkpoint between pipeline stages
+    InferenceStatus check() const {
+
+        if ( yield )
+            yield();
+
+        if ( cancelled() )
+            return InferenceStatus::CANCELLED;
+
+        if ( hasDeadline() && Clock::now() >= deadline )
+            return InferenceStatus::DEADLINE_EXCEEDED;
+
+        return InferenceStatus::OK;
+    }
+};
+
+
+// Keeps a moving average of the full det + cls + rec time per language, per megapixel of detector input,
+// used to reject requests whose deadline can't be met before detection starts.
+// The estimate halves every decay_half_life without samples, so a slow period that made it reject every
+// request with a deadline ( no more samples ) wears off. Runs cut short by their deadline are a lower
+// bound of the full time: they only raise the estimate
+class LatencyEstimator {
+
+    private:
+        const double smoothing = 0.2;
+        const double decay_half_life_s = 10.0;
+        const double min_megapixels = 0.05; // Small frames still pay the fixed costs
+
+        struct Estimate {
+            double ms_per_megapixel = 0;
+            RequestContext::Clock::time_point updated_at;
+        };
+
+        std::mutex mutex;
+        std::unordered_map< std::string, Estimate > estimates; // < language_code, estimate >
+
+        double megapixels( double pixels ) const {
+            return std::max( pixels / 1e6, min_megapixels );
+        }
+
+        // Caller holds the lock
+        double decayedRate( const Estimate& estimate, RequestContext::Clock::time_point now ) const {
+            const double idle_s = std::chrono::duration< double >( now - estimate.updated_at ).count();
+            return estimate.ms_per_megapixel * std::pow( 0.5, std::max( 0.0, idle_s ) / decay_half_life_s );
+        }
+
+    public:
+        LatencyEstimator() = default;
+
+        // pixels: of the detector input. completed: false for a run cut short ( deadline, cancellation )
+        void record( const std::string& language_code, double pixels, RequestContext::Clock::duration elapsed, bool completed = true ) {
+
+            const double sample = std::chrono::duration< double, std::milli >( elapsed ).count() / megapixels( pixels );
+            const auto now = RequestContext::Clock::now();
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            auto it = estimates.find( language_code );
+
+            if ( it == estimates.end() ) {
+                if ( completed )
+                    estimates[ language_code ] = Estimate{ sample, now };
+                return;
+            }
+
+            const double current = decayedRate( it->second, now );
+
+            if ( !completed && sample <= current )
+                return;
+
+            it->second.ms_per_megapixel = current + smoothing * ( sample - current );
+            it->second.updated_at = now;
+        }
+
+        // Returns 0 while there are no samples for the language
+        double expected( const std::string& language_code, double pixels ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            auto it = estimates.find( language_code );
+
+            if ( it == estimates.end() )
+                return 0;
+
+            return decayedRate( it->second, RequestContext::Clock::now() ) * megapixels( pixels );
+        }
+
+        bool canFinishInTime( const std::string& language_code, double pixels, const RequestContext& context ) {
+
+            if ( !context.hasDeadline() )
+                return true;
+
+            const auto remaining_ms = std::chrono::duration< double, std::milli >( context.remaining() ).count();
+
+            return remaining_ms > expected( language_code, pixels );
+        }
+};
+
+#endif
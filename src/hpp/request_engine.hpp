@@ -0,0 +1,484 @@
+#ifndef REQUEST_ENGINE_HPP
+#define REQUEST_ENGINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "cpu_governor.hpp"
+#include "cpu_topology.hpp"
+#include "inference_manager.hpp"
+#include "loop_pool.hpp"
+#include "metrics.hpp"
+#include "request_context.hpp"
+#include "request_scheduler.hpp"
+#include "settings_manager.hpp"
+
+
+enum class ImageEncoding {
+    RAW, // Encoded image file bytes (png, jpg, ...)
+    BASE64
+};
+
+// One OCR request, whatever the transport it came from
+struct EngineRequest {
+    std::string_view image; // Must outlive the call
+    ImageEncoding encoding = ImageEncoding::RAW;
+    std::string language_code;
+    std::string client_id;
+    RequestPriority priority = RequestPriority::NORMAL;
+};
+
+
+// The CPU governor of a process ( one of worker_count workers of the supervisor: it governs its share of
+// the budget ) and its worker groups, from the settings
+void configureCpuGovernor(
+    const AppSettingsPreset& app_settings,
+    int worker_count,
+    CpuGovernor* cpu_governor,
+    std::vector< CpuGroup >* cpu_groups
+) {
+
+    int thread_budget = app_settings.cpu_thread_budget;
+    std::vector< int > group_cpus;
+
+    if ( app_settings.cpu_placement != "none" ) {
+
+        *cpu_groups = detectCpuGroups( app_settings.cpu_placement );
+
+        for ( const auto& group : *cpu_groups ) {
+            group_cpus.push_back( int( group.cpus.size() ) );
+            std::cout << "Worker group " << group_cpus.size() - 1 << ": NUMA node " << group.numa_node << ", " << group.cpus.size() << " CPUs" << std::endl;
+        }
+
+        if ( !cpu_groups->empty() && thread_budget == 0 )
+            thread_budget = -1; // Worker groups need the governor, one thread per CPU of each group
+    }
+
+    if ( worker_count > 1 && thread_budget < 0 ) {
+
+        thread_budget = std::max( 1u, std::thread::hardware_concurrency() );
+
+        if ( !cpu_groups->empty() ) {
+            thread_budget = 0;
+            for ( const int cpus : group_cpus )
+                thread_budget += cpus;
+        }
+    }
+
+    if ( worker_count > 1 && thread_budget > 0 )
+        thread_budget = std::max( 1, thread_budget / worker_count );
+
+    cpu_governor->configure( thread_budget, app_settings.cpu_threads_under_load, group_cpus, app_settings.cpu_max_replicas );
+}
+
+// Supervisor mode with "worker_shared_models": loads the models a worker's pipelines are built from ( every
+// replica of its CPU governor, of the default language or of every language with "initialize_all_language_presets" )
+// into the models manager of this process. The workers forked afterwards find them loaded and share their weights
+// copy-on-write. No pipeline, scheduler or thread of its own: the backends may still start threads
+void preloadWorkerModels( const AppOptions& app_options ) {
+
+    SettingsManager settings_manager( app_options );
+    const AppSettingsPreset app_settings = settings_manager.getAppSettingsPreset();
+
+    CpuGovernor cpu_governor;
+    std::vector< CpuGroup > cpu_groups;
+    configureCpuGovernor( app_settings, app_options.worker_count, &cpu_governor, &cpu_groups );
+
+    std::vector< std::string > language_codes = { settings_manager.getDefaultLanguageCode() };
+
+    if ( app_settings.initialize_all_language_presets ) {
+        language_codes.clear();
+        for ( const auto& language_preset : settings_manager.language_presets )
+            language_codes.push_back( language_preset.first );
+    }
+
+    InferencePipelineBuilder pipeline_builder;
+
+    for ( const auto& language_code : language_codes ) {
+
+        const auto language_preset = settings_manager.language_presets.find( language_code );
+
+        if ( language_preset == settings_manager.language_presets.end() )
+            continue;
+
+        for ( const CpuPlacement& placement : cpu_governor.placements() ) {
+            ThreadPlacementScope placement_scope( placement.group >= 0 ? &cpu_groups[ placement.group ] : nullptr );
+            pipeline_builder.getModels( language_preset->second, app_settings, placement );
+        }
+    }
+}
+
+
+// Transport agnostic core of the services: owns the settings, the pipelines and the
+// scheduler, and runs every request through admission, scheduling and inference.
+// The gRPC and HTTP front ends only translate their requests and responses.
+class RequestEngine {
+
+    private:
+        SettingsManager settings_manager;
+        InferenceManager inference_manager;
+        CpuGovernor cpu_governor;
+        std::vector< CpuGroup > cpu_groups; // Worker groups of the governor, empty = not pinned
+        std::vector< std::unique_ptr< LoopPool > > loop_pools; // One per group of the governor, the parallel loops of its requests
+        RequestScheduler scheduler; // One slot per pipeline replica of the CPU governor (one without it: the models are not thread safe)
+        std::atomic< uint32_t > settings_version{ 0 };
+
+        // Loads the pipelines ( every replica of the CPU governor, pinned to its worker group ) in the background,
+        // with the governor or "initialize_all_language_presets": the default language's ( every language's ) at
+        // startup, another language's after its first request
+        std::mutex preload_mutex;
+        std::condition_variable preload_condition;
+        std::deque< std::string > preload_queue;
+        std::unordered_set< std::string > preloaded_languages;
+        bool stopping = false;
+        std::thread preloader;
+
+        void preloadReplicas( const std::string& language_code ) {
+
+            if ( !preloader.joinable() || settings_manager.language_presets.count( language_code ) == 0 )
+                return;
+
+            {
+                std::lock_guard< std::mutex > lock( preload_mutex );
+
+                if ( !preloaded_languages.insert( language_code ).second )
+                    return;
+
+                preload_queue.push_back( language_code );
+            }
+
+            preload_condition.notify_one();
+        }
+
+        void runPreloader() {
+
+            while ( true ) {
+
+                std::string language_code;
+
+                {
+                    std::unique_lock< std::mutex > lock( preload_mutex );
+
+                    preload_condition.wait( lock, [&]() { return stopping || !preload_queue.empty(); } );
+
+                    if ( stopping )
+                        return;
+
+                    language_code = preload_queue.front();
+                    preload_queue.pop_front();
+                }
+
+                for ( const CpuPlacement& placement : cpu_governor.placements() ) {
+
+                    {
+                        std::lock_guard< std::mutex > lock( preload_mutex );
+                        if ( stopping )
+                            return;
+                    }
+
+                    ThreadPlacementScope placement_scope( placement.group >= 0 ? &cpu_groups[ placement.group ] : nullptr );
+
+                    inference_manager.getPipeline( language_code, placement );
+                }
+            }
+        }
+
+        void registerMetricsCallbacks() {
+
+            registerMemoryMetrics();
+
+            const CancellationCounters& cancellation_counters = inference_manager.getCancellationCounters();
+
+            metrics().addCallback( "ppocr_queue_depth", "Requests waiting for a scheduler slot", "gauge",
+                [ this ]() { return double( scheduler.queueDepth() ); } );
+
+            metrics().addCallback( "ppocr_cpu_threads_leased", "Model threads leased by the running requests (CPU governor)", "gauge",
+                [ this ]() { return double( cpu_governor.leasedThreads() ); } );
+
+            metrics().addCallback( "ppocr_rejected_at_admission_total", "Requests dropped before detection", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.rejected_at_admission.load() ); } );
+
+            metrics().addCallback( "ppocr_cancelled_after_detection_total", "Requests dropped after detection", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.cancelled_after_detection.load() ); } );
+
+            metrics().addCallback( "ppocr_cancelled_after_classification_total", "Requests dropped after classification", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.cancelled_after_classification.load() ); } );
+
+            metrics().addCallback( "ppocr_cancelled_during_recognition_total", "Requests dropped between recognizer batches", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.cancelled_during_recognition.load() ); } );
+
+            metrics().addCallback( "ppocr_skipped_rec_batches_total", "Recognizer batches not run because of cancellation", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.skipped_rec_batches.load() ); } );
+
+            metrics().addCallback( "ppocr_skipped_text_lines_total", "Text lines not recognized because of cancellation", "counter",
+                [ &cancellation_counters ]() { return double( cancellation_counters.skipped_text_lines.load() ); } );
+        }
+
+        InferenceResult runRecognition( const EngineRequest& request, RequestContext& context, const CpuPlacement& placement ) {
+
+            context.stream_id = request.client_id;
+
+            preloadReplicas( request.language_code );
+
+            if ( request.encoding == ImageEncoding::BASE64 )
+                return inference_manager.inferBase64( request.image, request.language_code, context, placement );
+
+            return inference_manager.inferBufferString( request.image, request.language_code, context, placement );
+        }
+
+        // Leases the model threads of a request that holds a scheduler slot, and pins the calling
+        // thread to the worker group of the lease (the pipeline replica loads and runs there).
+        // The parallel loops of the request run on the group's loop pool, with the leased threads.
+        // A governed request keeps its slot to the end: handing it over between stages
+        // would not free the leased threads, the request taking it would wait for them
+        CpuPlacement leaseThreads(
+            std::unique_ptr< CpuGovernor::Lease >* lease,
+            std::unique_ptr< ThreadPlacementScope >* placement_scope,
+            std::unique_ptr< LoopScope >* loop_scope,
+            RequestContext& context
+        ) {
+
+            if ( !cpu_governor.enabled() )
+                return CpuPlacement();
+
+            *lease = std::make_unique< CpuGovernor::Lease >( cpu_governor, scheduler.queueDepth() );
+            context.yield = nullptr;
+
+            const CpuPlacement& placement = ( *lease )->placement();
+
+            if ( placement.group >= 0 )
+                *placement_scope = std::make_unique< ThreadPlacementScope >( &cpu_groups[ placement.group ] );
+
+            *loop_scope = std::make_unique< LoopScope >( loop_pools[ std::max( 0, placement.group ) ].get(), placement.cpu_threads );
+
+            return placement;
+        }
+
+        // worker_count: processes of the supervisor, each one governs its share of the budget
+        void initCpuGovernor( const AppSettingsPreset& app_settings, int worker_count ) {
+
+            configureCpuGovernor( app_settings, worker_count, &cpu_governor, &cpu_groups );
+
+            if ( !cpu_governor.enabled() )
+                return;
+
+            // Created here, before any thread is pinned: the helpers of an unpinned pool run anywhere
+            defaultLoopPool(); // Loops outside of a request, e.g. while the replicas load
+
+            for ( int group_idx = 0; group_idx < cpu_governor.groupCount(); ++group_idx ) {
+                loop_pools.push_back( std::make_unique< LoopPool >(
+                    cpu_governor.groupBudget( group_idx ) - 1,
+                    cpu_groups.empty() ? nullptr : &cpu_groups[ group_idx ]
+                ) );
+            }
+
+            // OpenCV's own pool would run the resizes and warps of the requests on top of their leased
+            // threads, on the cores of whichever thread started it: they run on the calling thread instead
+            cv::setNumThreads( 0 );
+        }
+
+    public:
+        RequestEngine( AppOptions app_options ) {
+
+            settings_manager = SettingsManager( app_options );
+
+            settings_manager.initSettings();
+            inference_manager.init(
+                settings_manager.language_presets,
+                settings_manager.getAppSettingsPreset()
+            );
+
+            const AppSettingsPreset app_settings = settings_manager.getAppSettingsPreset();
+
+            initCpuGovernor( app_settings, app_options.worker_count );
+
+            scheduler.setSlots( cpu_governor.maxConcurrentRequests() );
+            scheduler.setWeights( app_settings.scheduler_weights );
+
+            registerMetricsCallbacks();
+
+            // Without either, the only pipeline of a language loads with its first request
+            if ( cpu_governor.enabled() || app_settings.initialize_all_language_presets ) {
+
+                preloader = std::thread( [ this ]() { runPreloader(); } );
+
+                preloadReplicas( settings_manager.getDefaultLanguageCode() );
+
+                if ( app_settings.initialize_all_language_presets ) {
+                    for ( const auto& language_preset : settings_manager.language_presets )
+                        preloadReplicas( language_preset.first );
+                }
+            }
+        }
+
+        ~RequestEngine() {
+
+            {
+                std::lock_guard< std::mutex > lock( preload_mutex );
+                stopping = true;
+            }
+
+            preload_condition.notify_all();
+
+            if ( preloader.joinable() )
+                preloader.join();
+        }
+
+        RequestEngine( const RequestEngine& ) = delete;
+        RequestEngine& operator=( const RequestEngine& ) = delete;
+
+        SettingsManager& getSettingsManager() {
+            return settings_manager;
+        }
+
+        InferenceManager& getInferenceManager() {
+            return inference_manager;
+        }
+
+        int getServerPort() {
+            return settings_manager.getServerPort();
+        }
+
+        std::vector< std::string > getSupportedLanguages() {
+            return settings_manager.getAvailableLanguages();
+        }
+
+        uint32_t getSettingsVersion() const {
+            return settings_version.load();
+        }
+
+        void updateSettings( const UpdateAppSettingsPresetInput& settings_update ) {
+
+            settings_manager.updateSettingsPreset( settings_update );
+            settings_manager.saveAppSettingsPreset();
+
+            settings_version++;
+        }
+
+        InferenceResult recognize( const EngineRequest& request, RequestContext& context ) {
+
+            RequestScheduler::Slot slot( scheduler, request.priority, request.client_id, request.language_code, context );
+
+            if ( slot.status() != InferenceStatus::OK ) {
+                InferenceResult result;
+                result.status = slot.status();
+                return result;
+            }
+
+            std::unique_ptr< CpuGovernor::Lease > lease;
+            std::unique_ptr< ThreadPlacementScope > placement_scope;
+            std::unique_ptr< LoopScope > loop_scope;
+            const CpuPlacement placement = leaseThreads( &lease, &placement_scope, &loop_scope, context );
+
+            InferenceResult result = runRecognition( request, context, placement );
+            result.timings.queue_wait_us = slot.queueWaitMicros();
+
+            return result;
+        }
+
+        // Images of one language in a single scheduler slot (yielding between stages
+        // like any request), a result per image in the same order
+        std::vector< InferenceResult > recognizeBatch(
+            const std::vector< std::string_view >& images,
+            const EngineRequest& request,
+            RequestContext& context
+        ) {
+
+            std::vector< InferenceResult > results( images.size() );
+
+            RequestScheduler::Slot slot( scheduler, request.priority, request.client_id, request.language_code, context );
+
+            std::unique_ptr< CpuGovernor::Lease > lease;
+            std::unique_ptr< ThreadPlacementScope > placement_scope;
+            std::unique_ptr< LoopScope > loop_scope;
+            CpuPlacement placement;
+
+            if ( slot.status() == InferenceStatus::OK )
+                placement = leaseThreads( &lease, &placement_scope, &loop_scope, context );
+
+            EngineRequest image_request = request;
+
+            for ( size_t i = 0; i < images.size(); ++i ) {
+
+                if ( slot.status() != InferenceStatus::OK ) {
+                    results[ i ].status = slot.status();
+                    continue;
+                }
+
+                image_request.image = images[ i ];
+
+                results[ i ] = runRecognition( image_request, context, placement );
+                results[ i ].timings.queue_wait_us = slot.queueWaitMicros();
+            }
+
+            return results;
+        }
+
+        DetectionResult detect( const EngineRequest& request, RequestContext& context ) {
+
+            RequestScheduler::Slot slot( scheduler, request.priority, request.client_id, request.language_code, context );
+
+            if ( slot.status() != InferenceStatus::OK ) {
+                DetectionResult result;
+                result.status = slot.status();
+                return result;
+            }
+
+            std::unique_ptr< CpuGovernor::Lease > lease;
+            std::unique_ptr< ThreadPlacementScope > placement_scope;
+            std::unique_ptr< LoopScope > loop_scope;
+            const CpuPlacement placement = leaseThreads( &lease, &placement_scope, &loop_scope, context );
+
+            DetectionResult result = inference_manager.detect(
+                request.image,
+                request.language_code,
+                request.encoding == ImageEncoding::BASE64,
+                context,
+                placement
+            );
+            result.timings.queue_wait_us = slot.queueWaitMicros();
+
+            return result;
+        }
+
+        // Call once the response is serialized
+        uint64_t finish( const RequestContext& context ) {
+
+            const uint64_t elapsed_us = std::chrono::duration_cast< std::chrono::microseconds >(
+                RequestContext::Clock::now() - context.arrival
+            ).count();
+
+            metrics().observe( MetricHistogram::REQUEST_US, elapsed_us );
+
+            return elapsed_us;
+        }
+};
+
+
+// Calls finish() when the request's handler returns, whatever the path ( cancelled,
+// past its deadline, an exception while serializing ), once the request was admitted
+class RequestFinishScope {
+
+    private:
+        RequestEngine& engine;
+        const RequestContext& context;
+
+    public:
+        RequestFinishScope( RequestEngine& engine, const RequestContext& context ) : engine( engine ), context( context ) {}
+
+        RequestFinishScope( const RequestFinishScope& ) = delete;
+        RequestFinishScope& operator=( const RequestFinishScope& ) = delete;
+
+        ~RequestFinishScope() {
+            engine.finish( context );
+        }
+};
+
+#endif
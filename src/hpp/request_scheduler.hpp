@@ -0,0 +1,318 @@
+#ifndef REQUEST_SCHEDULER_HPP
+#define REQUEST_SCHEDULER_HPP
+
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "metrics.hpp"
+#include "request_context.hpp"
+
+
+enum class RequestPriority {
+    INTERACTIVE = 0, // e.g. user hotkey
+    NORMAL = 1,
+    BULK = 2 // e.g. periodic auto capture
+};
+
+const int request_priority_count = 3;
+
+
+// Orders requests in front of the InferenceManager.
+// Priority classes are strict: a lower class only runs when every higher class is empty.
+// Inside a class, flows ( client_id + language_code ) share the slots by weight
+// using start-time fair queuing, so one busy client can't starve the others.
+class RequestScheduler {
+
+    private:
+        struct Ticket {
+            RequestPriority priority;
+            std::string flow_key;
+            double start_tag = 0;
+            double finish_tag = 0;
+            uint64_t sequence = 0;
+            bool granted = false;
+        };
+
+        struct Flow {
+            double last_finish_tag = 0;
+        };
+
+        const size_t max_idle_flows = 1024;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        int slots;
+        int free_slots;
+        double virtual_time = 0;
+        uint64_t next_sequence = 0;
+
+        std::array< std::vector< Ticket* >, request_priority_count > queues;
+        std::unordered_map< std::string, Flow > flows;
+        std::map< std::string, double > weights; // < client_id or language_code, weight >
+
+        double getWeight( const std::string& client_id, const std::string& language_code ) {
+
+            auto it = weights.find( client_id );
+
+            if ( it == weights.end() )
+                it = weights.find( language_code );
+
+            if ( it == weights.end() || it->second <= 0 )
+                return 1;
+
+            return it->second;
+        }
+
+        void enqueue( Ticket* ticket ) {
+            queues[ static_cast< int >( ticket->priority ) ].push_back( ticket );
+        }
+
+        void dequeue( Ticket* ticket ) {
+
+            auto& queue = queues[ static_cast< int >( ticket->priority ) ];
+
+            for ( auto it = queue.begin(); it != queue.end(); ++it ) {
+                if ( *it == ticket ) {
+                    queue.erase( it );
+                    return;
+                }
+            }
+        }
+
+        bool hasWaitingAbove( RequestPriority priority ) {
+
+            for ( int i = 0; i < static_cast< int >( priority ); ++i ) {
+                if ( !queues[ i ].empty() )
+                    return true;
+            }
+
+            return false;
+        }
+
+        // Hands free slots to the waiting tickets. Caller holds the lock.
+        void dispatch() {
+
+            while ( free_slots > 0 ) {
+
+                Ticket* next = nullptr;
+
+                for ( auto& queue : queues ) {
+
+                    if ( queue.empty() )
+                        continue;
+
+                    // Start-time fair queuing: the smallest start tag goes first ( a flow's next ticket
+                    // starts where its previous one finished, so the weights still space a flow's tickets )
+                    auto next_it = queue.begin();
+                    for ( auto it = queue.begin(); it != queue.end(); ++it ) {
+                        if ( (*it)->start_tag < (*next_it)->start_tag ||
+                             ( (*it)->start_tag == (*next_it)->start_tag && (*it)->sequence < (*next_it)->sequence ) ) {
+                            next_it = it;
+                        }
+                    }
+
+                    next = *next_it;
+                    queue.erase( next_it );
+                    break;
+                }
+
+                if ( next == nullptr )
+                    break;
+
+                next->granted = true;
+                virtual_time = std::max( virtual_time, next->start_tag );
+                free_slots--;
+            }
+
+            condition.notify_all();
+        }
+
+        void pruneIdleFlows() {
+
+            if ( flows.size() <= max_idle_flows )
+                return;
+
+            for ( auto it = flows.begin(); it != flows.end(); ) {
+                if ( it->second.last_finish_tag <= virtual_time )
+                    it = flows.erase( it );
+                else
+                    ++it;
+            }
+        }
+
+        // Waits for the ticket to get a slot, gives up on cancellation or deadline
+        InferenceStatus waitForSlot( std::unique_lock< std::mutex >& lock, Ticket* ticket, const RequestContext& context ) {
+
+            const auto poll_interval = std::chrono::milliseconds( 20 );
+
+            while ( !ticket->granted ) {
+
+                InferenceStatus status = InferenceStatus::OK;
+
+                if ( context.cancelled() )
+                    status = InferenceStatus::CANCELLED;
+                else if ( context.hasDeadline() && RequestContext::Clock::now() >= context.deadline )
+                    status = InferenceStatus::DEADLINE_EXCEEDED;
+
+                if ( status != InferenceStatus::OK ) {
+                    dequeue( ticket );
+                    return status;
+                }
+
+                auto wake_at = RequestContext::Clock::now() + poll_interval;
+                if ( context.hasDeadline() )
+                    wake_at = std::min( wake_at, context.deadline );
+
+                condition.wait_until( lock, wake_at );
+            }
+
+            return InferenceStatus::OK;
+        }
+
+    public:
+        // RAII slot. Holds one of the scheduler slots for the lifetime of a request.
+        class Slot {
+
+            private:
+                RequestScheduler& scheduler;
+                RequestContext& context;
+                Ticket ticket;
+                InferenceStatus slot_status;
+                uint64_t queue_wait_us;
+
+            public:
+                Slot(
+                    RequestScheduler& scheduler,
+                    RequestPriority priority,
+                    const std::string& client_id,
+                    const std::string& language_code,
+                    RequestContext& context
+                ) : scheduler( scheduler ), context( context ) {
+
+                    ticket.priority = priority;
+                    ticket.flow_key = client_id + '|' + language_code;
+
+                    StageTimer queue_timer;
+                    slot_status = scheduler.acquire( &ticket, client_id, language_code, context );
+                    queue_wait_us = queue_timer.lap( MetricHistogram::QUEUE_WAIT_US );
+
+                    if ( slot_status == InferenceStatus::OK ) {
+                        context.yield = [ this ]() {
+                            this->scheduler.yield( &ticket, this->context );
+                        };
+                    }
+                }
+
+                Slot( const Slot& ) = delete;
+                Slot& operator=( const Slot& ) = delete;
+
+                ~Slot() {
+                    context.yield = nullptr;
+
+                    if ( ticket.granted )
+                        scheduler.release( &ticket );
+                }
+
+                InferenceStatus status() const {
+                    return slot_status;
+                }
+
+                uint64_t queueWaitMicros() const {
+                    return queue_wait_us;
+                }
+        };
+
+        RequestScheduler( int slots = 1 ) {
+            this->slots = slots > 0 ? slots : 1;
+            free_slots = this->slots;
+        }
+
+        // Requests that run at once. Slots held over a smaller count are returned as they are released
+        void setSlots( int slots ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            slots = slots > 0 ? slots : 1;
+            free_slots += slots - this->slots;
+            this->slots = slots;
+
+            dispatch();
+        }
+
+        void setWeights( const std::map< std::string, double >& weights ) {
+            std::lock_guard< std::mutex > lock( mutex );
+            this->weights = weights;
+        }
+
+        size_t queueDepth() {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            size_t depth = 0;
+            for ( const auto& queue : queues )
+                depth += queue.size();
+
+            return depth;
+        }
+
+        InferenceStatus acquire(
+            Ticket* ticket,
+            const std::string& client_id,
+            const std::string& language_code,
+            const RequestContext& context
+        ) {
+
+            std::unique_lock< std::mutex > lock( mutex );
+
+            Flow& flow = flows[ ticket->flow_key ];
+
+            ticket->start_tag = std::max( virtual_time, flow.last_finish_tag );
+            ticket->finish_tag = ticket->start_tag + 1.0 / getWeight( client_id, language_code );
+            ticket->sequence = next_sequence++;
+            flow.last_finish_tag = ticket->finish_tag;
+
+            enqueue( ticket );
+            dispatch();
+
+            return waitForSlot( lock, ticket, context );
+        }
+
+        void release( Ticket* ticket ) {
+
+            std::lock_guard< std::mutex > lock( mutex );
+
+            ticket->granted = false;
+            free_slots++;
+
+            pruneIdleFlows();
+            dispatch();
+        }
+
+        // Called between pipeline stages: if a higher priority request is waiting,
+        // hand over the slot and queue again (keeping the original tags, so this
+        // request is still first in line for its class).
+        void yield( Ticket* ticket, const RequestContext& context ) {
+
+            std::unique_lock< std::mutex > lock( mutex );
+
+            if ( !ticket->granted || free_slots > 0 || !hasWaitingAbove( ticket->priority ) )
+                return;
+
+            ticket->granted = false;
+            free_slots++;
+
+            enqueue( ticket );
+            dispatch();
+
+            // On cancellation/deadline the slot is not taken back,
+            // the stage checkpoint that called yield() then stops the pipeline.
+            waitForSlot( lock, ticket, context );
+        }
+};
+
+#endif
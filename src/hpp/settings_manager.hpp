@@ -14,6 +14,8 @@ struct AppOptions {
   std::string language_code = "default";
   std::string inference_backend = "default"; //! "Paddle_CPU", "Open_VINO", "ONNX_CPU", "Paddle_Lite", "Paddle_GPU", "Paddle_GPU_Tensor_RT", "ONNX_GPU", "Tensor_RT"
   int server_port = 0;
+  int worker_count = 1; // Worker processes of the supervisor sharing the machine ( set by it, not an argument )
+  int worker_index = 0;
 };
 
 // App settings preset JSON
@@ -24,6 +26,10 @@ struct AppSettingsPreset {
   bool initialize_all_language_presets = false;
   std::string inference_backend;
   int cpu_threads = 8;
+  int cpu_thread_budget = 0; // CPU governor: threads shared by all requests, -1 = every hardware thread (0 = off, each model uses "cpu_threads")
+  int cpu_threads_under_load = 1; // CPU governor: threads per request when the budget is saturated
+  int cpu_max_replicas = 16; // CPU governor: pipeline replicas of a language per worker group (0 = no cap), the narrowest tiers are dropped to fit
+  std::string cpu_placement = "none"; // CPU governor worker groups: none | numa | l3 ( one group per NUMA node or L3 cache, Linux )
   int server_port;
   int max_image_width = 1920; // Maximum image width
   double det_db_thresh = 0.3; // Only pixels with a score greater than this threshold will be considered as text pixels
@@ -31,7 +37,32 @@ struct AppSettingsPreset {
   double det_db_unclip_ratio = 1.5; // Expansion factor of the Vatti clipping algorithm, which is used to expand the text area
   std::string det_db_score_mode = "slow"; // DB detection result score calculation method
   bool use_dilation = false; // Whether to inflate the segmentation results to obtain better detection results
+  std::string preprocessor = "fastdeploy"; // Detector and recognizer input preprocessing: fastdeploy | fused ( fused_preprocess.hpp, SIMD )
+  int det_probe_side = 0; // Coarse to fine detection: longest side of the low resolution probe pass, e.g. 480 (0 = off)
+  int det_min_text_height = 0; // Per stream detection resolution: median text height kept at the detector input, in pixels (0 = off)
+  int det_resolution_recheck_frames = 50; // Per stream detection resolution: a frame at max_image_width every N frames
+  int det_resolution_hysteresis_frames = 5; // Per stream detection resolution: frames allowing a lower resolution before moving to it
+  double det_probe_max_coverage = 0.5; // Coarse to fine detection: share of the frame above which the text regions are detected in one full pass
+  std::string det_db_postprocessor = "fastdeploy"; // DB postprocessing implementation: fastdeploy | native ( db_postprocessor.hpp )
+  std::string crop_extraction = "fastdeploy"; // Text line crops: fastdeploy | native ( text_crops.hpp, parallel, at the recognizer height )
+  std::string rec_postprocessor = "fastdeploy"; // CTC decoding of the recognizer output: fastdeploy | native ( ctc_decoder.hpp, SIMD )
+  std::vector< std::array< int, 2 > > det_input_buckets; // < width, height > Fixed detector input sizes frames are letterboxed into (empty = any size)
+  std::vector< int > rec_width_buckets; // Fixed recognizer input widths (empty = widest line of each batch)
   double cls_thresh = 0.9; // Prediction threshold, when the model prediction result is 180 degrees, and the score is greater than the threshold, the final prediction result is considered to be 180 degrees and needs to be flipped
+  std::string cls_policy = "always"; // Lines sent to the angle classifier: always | adaptive ( classifier_policy.hpp )
+  double cls_sample_ratio = 0.1; // adaptive: share of the lines classified while no flipped text is seen
+  double cls_low_confidence = 0.6; // adaptive: lines recognized below this score are classified, and recognized again if flipped
+  int cls_flip_memory_frames = 30; // adaptive: frames of a language that classify every line after a flipped one
+  std::map< std::string, double > scheduler_weights; // < client_id or language_code, weight > Fair share of a flow inside its priority class (default 1)
+  std::string capture_file; // Records incoming requests for replay (empty = off)
+  int capture_max_mb = 1024; // Disk used by the capture files
+  int pipeline_memory_cap_mb = 0; // Working set above which a pipeline releases its reused buffers after the request (0 = no cap)
+  int buffer_pool_max_mb = 256; // Idle frame buffers kept for reuse
+  int http_threads = 0; // HTTP service worker threads, one per open connection (0 = cpp-httplib default)
+  int http_keep_alive_max_count = 100; // Requests served on a keep-alive connection before it is closed
+  int http_keep_alive_timeout_s = 5; // Idle time before a keep-alive connection is closed
+  int worker_processes = 1; // gRPC service processes sharing the port, restarted by a supervisor when they exit ( Linux )
+  bool worker_shared_models = false; // The supervisor loads the models before forking the workers, which share the weights copy-on-write
 };
 
 struct UpdateAppSettingsPresetInput {
@@ -55,6 +86,7 @@ struct LanguagePreset {
   std::string classification_model_dir;
   std::string recognition_model_dir;
   std::string recognition_label_file_dir; // Also known as Dictionary
+  std::string precision = "fp32"; // fp32 | int8 ( inference_int8.onnx of each model directory, made by ppocr_calibrate )
 };
 
 
@@ -155,6 +187,114 @@ class SettingsManager {
       app_settings_preset.use_dilation = app_settings_preset_json["use_dilation"].get< bool >();
       app_settings_preset.cls_thresh = app_settings_preset_json["cls_thresh"].get< double >();
 
+      // Optional
+      if ( app_settings_preset_json.contains( "scheduler_weights" ) ) {
+        for ( auto& el : app_settings_preset_json["scheduler_weights"].items() ) {
+          app_settings_preset.scheduler_weights[ el.key() ] = el.value().get< double >();
+        }
+      }
+
+      if ( app_settings_preset_json.contains( "capture_file" ) ) {
+        app_settings_preset.capture_file = app_settings_preset_json["capture_file"].get< std::string >();
+      }
+      if ( app_settings_preset_json.contains( "capture_max_mb" ) ) {
+        app_settings_preset.capture_max_mb = app_settings_preset_json["capture_max_mb"].get< int >();
+      }
+
+      if ( app_settings_preset_json.contains( "pipeline_memory_cap_mb" ) ) {
+        app_settings_preset.pipeline_memory_cap_mb = app_settings_preset_json["pipeline_memory_cap_mb"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "buffer_pool_max_mb" ) ) {
+        app_settings_preset.buffer_pool_max_mb = app_settings_preset_json["buffer_pool_max_mb"].get< int >();
+      }
+
+      if ( app_settings_preset_json.contains( "det_db_postprocessor" ) ) {
+        app_settings_preset.det_db_postprocessor = app_settings_preset_json["det_db_postprocessor"].get< std::string >();
+      }
+
+      if ( app_settings_preset_json.contains( "det_input_buckets" ) ) {
+        app_settings_preset.det_input_buckets = app_settings_preset_json["det_input_buckets"].get< std::vector< std::array< int, 2 > > >();
+      }
+      if ( app_settings_preset_json.contains( "rec_width_buckets" ) ) {
+        app_settings_preset.rec_width_buckets = app_settings_preset_json["rec_width_buckets"].get< std::vector< int > >();
+      }
+
+      if ( app_settings_preset_json.contains( "initialize_all_language_presets" ) ) {
+        app_settings_preset.initialize_all_language_presets = app_settings_preset_json["initialize_all_language_presets"].get< bool >();
+      }
+
+      if ( app_settings_preset_json.contains( "cpu_thread_budget" ) ) {
+        app_settings_preset.cpu_thread_budget = app_settings_preset_json["cpu_thread_budget"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "cpu_threads_under_load" ) ) {
+        app_settings_preset.cpu_threads_under_load = app_settings_preset_json["cpu_threads_under_load"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "cpu_max_replicas" ) ) {
+        app_settings_preset.cpu_max_replicas = app_settings_preset_json["cpu_max_replicas"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "cpu_placement" ) ) {
+        app_settings_preset.cpu_placement = app_settings_preset_json["cpu_placement"].get< std::string >();
+      }
+
+      if ( app_settings_preset_json.contains( "crop_extraction" ) ) {
+        app_settings_preset.crop_extraction = app_settings_preset_json["crop_extraction"].get< std::string >();
+      }
+
+      if ( app_settings_preset_json.contains( "rec_postprocessor" ) ) {
+        app_settings_preset.rec_postprocessor = app_settings_preset_json["rec_postprocessor"].get< std::string >();
+      }
+
+      if ( app_settings_preset_json.contains( "preprocessor" ) ) {
+        app_settings_preset.preprocessor = app_settings_preset_json["preprocessor"].get< std::string >();
+      }
+
+      if ( app_settings_preset_json.contains( "det_probe_side" ) ) {
+        app_settings_preset.det_probe_side = app_settings_preset_json["det_probe_side"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "det_probe_max_coverage" ) ) {
+        app_settings_preset.det_probe_max_coverage = app_settings_preset_json["det_probe_max_coverage"].get< double >();
+      }
+
+      if ( app_settings_preset_json.contains( "det_min_text_height" ) ) {
+        app_settings_preset.det_min_text_height = app_settings_preset_json["det_min_text_height"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "det_resolution_recheck_frames" ) ) {
+        app_settings_preset.det_resolution_recheck_frames = app_settings_preset_json["det_resolution_recheck_frames"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "det_resolution_hysteresis_frames" ) ) {
+        app_settings_preset.det_resolution_hysteresis_frames = app_settings_preset_json["det_resolution_hysteresis_frames"].get< int >();
+      }
+
+      if ( app_settings_preset_json.contains( "cls_policy" ) ) {
+        app_settings_preset.cls_policy = app_settings_preset_json["cls_policy"].get< std::string >();
+      }
+      if ( app_settings_preset_json.contains( "cls_sample_ratio" ) ) {
+        app_settings_preset.cls_sample_ratio = app_settings_preset_json["cls_sample_ratio"].get< double >();
+      }
+      if ( app_settings_preset_json.contains( "cls_low_confidence" ) ) {
+        app_settings_preset.cls_low_confidence = app_settings_preset_json["cls_low_confidence"].get< double >();
+      }
+      if ( app_settings_preset_json.contains( "cls_flip_memory_frames" ) ) {
+        app_settings_preset.cls_flip_memory_frames = app_settings_preset_json["cls_flip_memory_frames"].get< int >();
+      }
+
+      if ( app_settings_preset_json.contains( "worker_processes" ) ) {
+        app_settings_preset.worker_processes = app_settings_preset_json["worker_processes"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "worker_shared_models" ) ) {
+        app_settings_preset.worker_shared_models = app_settings_preset_json["worker_shared_models"].get< bool >();
+      }
+
+      if ( app_settings_preset_json.contains( "http_threads" ) ) {
+        app_settings_preset.http_threads = app_settings_preset_json["http_threads"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "http_keep_alive_max_count" ) ) {
+        app_settings_preset.http_keep_alive_max_count = app_settings_preset_json["http_keep_alive_max_count"].get< int >();
+      }
+      if ( app_settings_preset_json.contains( "http_keep_alive_timeout_s" ) ) {
+        app_settings_preset.http_keep_alive_timeout_s = app_settings_preset_json["http_keep_alive_timeout_s"].get< int >();
+      }
+
       if ( app_settings_preset_json["language_presets"].is_null() )
         return;
 
@@ -194,6 +334,11 @@ class SettingsManager {
         language_preset.recognition_model_dir = language_preset_json["recognition_model_dir"].get<std::string>();
         language_preset.recognition_label_file_dir = language_preset_json["recognition_label_file_dir"].get<std::string>();
 
+        // Optional
+        if ( language_preset_json.contains( "precision" ) ) {
+          language_preset.precision = language_preset_json["precision"].get<std::string>();
+        }
+
         language_presets[ language_preset.language_code ] = language_preset;
 
         std::cout << "language_code: " << language_preset.language_code << ", preset_name: " << language_preset.name << std::endl;
@@ -244,6 +389,10 @@ class SettingsManager {
       settings_preset_json["initialize_all_language_presets"] = app_settings_preset.initialize_all_language_presets;
       settings_preset_json["inference_backend"] = app_settings_preset.inference_backend;
       settings_preset_json["cpu_threads"] = app_settings_preset.cpu_threads;
+      settings_preset_json["cpu_thread_budget"] = app_settings_preset.cpu_thread_budget;
+      settings_preset_json["cpu_threads_under_load"] = app_settings_preset.cpu_threads_under_load;
+      settings_preset_json["cpu_max_replicas"] = app_settings_preset.cpu_max_replicas;
+      settings_preset_json["cpu_placement"] = app_settings_preset.cpu_placement;
       settings_preset_json["port"] = app_settings_preset.server_port;
       settings_preset_json["max_image_width"] = app_settings_preset.max_image_width;
       settings_preset_json["det_db_thresh"] = app_settings_preset.det_db_thresh;
@@ -252,6 +401,44 @@ class SettingsManager {
       settings_preset_json["det_db_score_mode"] = app_settings_preset.det_db_score_mode;
       settings_preset_json["use_dilation"] = app_settings_preset.use_dilation;
       settings_preset_json["cls_thresh"] = app_settings_preset.cls_thresh;
+      settings_preset_json["cls_policy"] = app_settings_preset.cls_policy;
+      settings_preset_json["cls_sample_ratio"] = app_settings_preset.cls_sample_ratio;
+      settings_preset_json["cls_low_confidence"] = app_settings_preset.cls_low_confidence;
+      settings_preset_json["cls_flip_memory_frames"] = app_settings_preset.cls_flip_memory_frames;
+
+      if ( !app_settings_preset.scheduler_weights.empty() ) {
+        settings_preset_json["scheduler_weights"] = app_settings_preset.scheduler_weights;
+      }
+
+      if ( !app_settings_preset.capture_file.empty() ) {
+        settings_preset_json["capture_file"] = app_settings_preset.capture_file;
+        settings_preset_json["capture_max_mb"] = app_settings_preset.capture_max_mb;
+      }
+
+      settings_preset_json["pipeline_memory_cap_mb"] = app_settings_preset.pipeline_memory_cap_mb;
+      settings_preset_json["buffer_pool_max_mb"] = app_settings_preset.buffer_pool_max_mb;
+      settings_preset_json["det_db_postprocessor"] = app_settings_preset.det_db_postprocessor;
+      settings_preset_json["crop_extraction"] = app_settings_preset.crop_extraction;
+      settings_preset_json["rec_postprocessor"] = app_settings_preset.rec_postprocessor;
+      settings_preset_json["preprocessor"] = app_settings_preset.preprocessor;
+      settings_preset_json["det_probe_side"] = app_settings_preset.det_probe_side;
+      settings_preset_json["det_probe_max_coverage"] = app_settings_preset.det_probe_max_coverage;
+      settings_preset_json["det_min_text_height"] = app_settings_preset.det_min_text_height;
+      settings_preset_json["det_resolution_recheck_frames"] = app_settings_preset.det_resolution_recheck_frames;
+      settings_preset_json["det_resolution_hysteresis_frames"] = app_settings_preset.det_resolution_hysteresis_frames;
+
+      if ( !app_settings_preset.det_input_buckets.empty() ) {
+        settings_preset_json["det_input_buckets"] = app_settings_preset.det_input_buckets;
+      }
+      if ( !app_settings_preset.rec_width_buckets.empty() ) {
+        settings_preset_json["rec_width_buckets"] = app_settings_preset.rec_width_buckets;
+      }
+
+      settings_preset_json["worker_processes"] = app_settings_preset.worker_processes;
+      settings_preset_json["worker_shared_models"] = app_settings_preset.worker_shared_models;
+      settings_preset_json["http_threads"] = app_settings_preset.http_threads;
+      settings_preset_json["http_keep_alive_max_count"] = app_settings_preset.http_keep_alive_max_count;
+      settings_preset_json["http_keep_alive_timeout_s"] = app_settings_preset.http_keep_alive_timeout_s;
       
       file_path = file_path + file_name;
       std::cout << "Saving settings..." << std::endl;
@@ -0,0 +1,144 @@
+#ifndef SHAPE_BUCKETS_HPP
+#define SHAPE_BUCKETS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+// A few fixed model input shapes, so backends that compile per input shape (OpenVINO, TensorRT)
+// see every shape once at load time instead of recompiling for each new frame size.
+// Detector frames are letterboxed into < width, height > buckets, recognizer batches padded to bucket widths.
+class ShapeBuckets {
+
+    private:
+        std::vector< std::array< int, 2 > > det_buckets; // < width, height >, by area
+        std::vector< int > rec_widths; // Ascending
+        int max_side_len = 0; // Downscale applied before bucketing, as the detector preprocessor does
+
+        static int roundUp32( int value ) {
+            return std::max( 32, ( value + 31 ) / 32 * 32 );
+        }
+
+    public:
+        ShapeBuckets() = default;
+
+        // Sizes are rounded up to multiples of 32 (the detector's stride)
+        ShapeBuckets(
+            const std::vector< std::array< int, 2 > >& det_input_buckets,
+            const std::vector< int >& rec_width_buckets,
+            int max_side_len
+        ) {
+
+            this->max_side_len = max_side_len;
+
+            for ( const auto& bucket : det_input_buckets )
+                det_buckets.push_back( { roundUp32( bucket[0] ), roundUp32( bucket[1] ) } );
+
+            std::sort( det_buckets.begin(), det_buckets.end(), []( const auto& a, const auto& b ) {
+                return a[0] * a[1] < b[0] * b[1];
+            } );
+            det_buckets.erase( std::unique( det_buckets.begin(), det_buckets.end() ), det_buckets.end() );
+
+            for ( const int width : rec_width_buckets )
+                rec_widths.push_back( roundUp32( width ) );
+
+            std::sort( rec_widths.begin(), rec_widths.end() );
+            rec_widths.erase( std::unique( rec_widths.begin(), rec_widths.end() ), rec_widths.end() );
+        }
+
+        bool hasDetectorBuckets() const {
+            return !det_buckets.empty();
+        }
+
+        bool hasRecognizerBuckets() const {
+            return !rec_widths.empty();
+        }
+
+        const std::vector< std::array< int, 2 > >& detectorBuckets() const {
+            return det_buckets;
+        }
+
+        const std::vector< int >& recognizerWidths() const {
+            return rec_widths;
+        }
+
+        // Longest bucket side, the detector preprocessor must not downscale past it
+        int maxDetectorSide() const {
+
+            int side = 0;
+
+            for ( const auto& bucket : det_buckets )
+                side = std::max( side, std::max( bucket[0], bucket[1] ) );
+
+            return side;
+        }
+
+        // Copies the image, downscaled to max_side_len, into the top left corner of the smallest bucket
+        // that holds it (the rest is zero padded). When none does, it is scaled down to fit the bucket
+        // that keeps the most resolution.
+        // bucket_image is reused between calls, scaled_size is the size of the image inside it.
+        void letterbox( const cv::Mat& image, cv::Mat* bucket_image, cv::Size* scaled_size ) const {
+
+            float ratio = 1.0f;
+
+            if ( max_side_len > 0 && std::max( image.cols, image.rows ) > max_side_len )
+                ratio = float( max_side_len ) / std::max( image.cols, image.rows );
+
+            const std::array< int, 2 >* selected = nullptr;
+            float selected_ratio = 0;
+
+            for ( const auto& bucket : det_buckets ) {
+
+                const float fit_ratio = std::min(
+                    ratio,
+                    std::min( float( bucket[0] ) / image.cols, float( bucket[1] ) / image.rows )
+                );
+
+                if ( fit_ratio >= ratio ) { // Smallest bucket holding the whole image
+                    selected = &bucket;
+                    selected_ratio = ratio;
+                    break;
+                }
+
+                if ( fit_ratio > selected_ratio ) {
+                    selected = &bucket;
+                    selected_ratio = fit_ratio;
+                }
+            }
+
+            const int bucket_width = ( *selected )[0];
+            const int bucket_height = ( *selected )[1];
+
+            scaled_size->width = std::clamp( int( std::round( image.cols * selected_ratio ) ), 1, bucket_width );
+            scaled_size->height = std::clamp( int( std::round( image.rows * selected_ratio ) ), 1, bucket_height );
+
+            bucket_image->create( bucket_height, bucket_width, image.type() );
+
+            cv::Mat image_area = ( *bucket_image )( cv::Rect( 0, 0, scaled_size->width, scaled_size->height ) );
+
+            if ( scaled_size->width == image.cols && scaled_size->height == image.rows )
+                image.copyTo( image_area );
+            else
+                cv::resize( image, image_area, *scaled_size, 0, 0, cv::INTER_LINEAR );
+
+            if ( scaled_size->width < bucket_width )
+                ( *bucket_image )( cv::Rect( scaled_size->width, 0, bucket_width - scaled_size->width, bucket_height ) ).setTo( cv::Scalar::all( 0 ) );
+
+            if ( scaled_size->height < bucket_height )
+                ( *bucket_image )( cv::Rect( 0, scaled_size->height, scaled_size->width, bucket_height - scaled_size->height ) ).setTo( cv::Scalar::all( 0 ) );
+        }
+
+        // Recognizer input width for a batch whose widest line needs required_width,
+        // required_width itself when it is wider than every bucket
+        int recognizerWidth( int required_width ) const {
+
+            const auto bucket = std::lower_bound( rec_widths.begin(), rec_widths.end(), required_width );
+
+            return bucket != rec_widths.end() ? *bucket : required_width;
+        }
+};
+
+#endif
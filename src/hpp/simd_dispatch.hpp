@@ -0,0 +1,100 @@
+#ifndef SIMD_DISPATCH_HPP
+#define SIMD_DISPATCH_HPP
+
+#include <cstdint>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define PPOCR_SIMD_X86
+#include <immintrin.h>
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+#define PPOCR_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+// The x86 kernels are compiled for their instruction set only, the build targets the baseline ISA
+#if defined( PPOCR_SIMD_X86 ) && !defined( _MSC_VER )
+#define PPOCR_TARGET_AVX2 __attribute__( ( target( "avx2,fma" ) ) )
+#define PPOCR_TARGET_AVX512 __attribute__( ( target( "avx512f,avx2,fma" ) ) )
+#else
+#define PPOCR_TARGET_AVX2
+#define PPOCR_TARGET_AVX512
+#endif
+
+
+enum class SimdLevel {
+    SCALAR,
+    NEON,
+    AVX2, // + FMA
+    AVX512 // AVX-512F
+};
+
+std::string simdLevelName( SimdLevel level ) {
+
+    switch ( level ) {
+        case SimdLevel::NEON: return "neon";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// Widest instruction set of this CPU ( and OS, for the AVX register state ) the kernels have
+SimdLevel detectSimdLevel() {
+
+#if defined( PPOCR_SIMD_NEON )
+    return SimdLevel::NEON;
+#elif defined( PPOCR_SIMD_X86 ) && defined( _MSC_VER )
+    int info[ 4 ];
+    __cpuid( info, 0 );
+    const int max_leaf = info[ 0 ];
+
+    __cpuid( info, 1 );
+    const bool osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+    const bool fma = ( info[ 2 ] & ( 1 << 12 ) ) != 0;
+
+    if ( !osxsave || max_leaf < 7 )
+        return SimdLevel::SCALAR;
+
+    const unsigned long long xcr0 = _xgetbv( 0 );
+    __cpuidex( info, 7, 0 );
+
+    if ( ( info[ 1 ] & ( 1 << 16 ) ) && ( xcr0 & 0xE6 ) == 0xE6 && fma )
+        return SimdLevel::AVX512;
+
+    if ( ( info[ 1 ] & ( 1 << 5 ) ) && ( xcr0 & 0x6 ) == 0x6 && fma )
+        return SimdLevel::AVX2;
+
+    return SimdLevel::SCALAR;
+#elif defined( PPOCR_SIMD_X86 )
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "fma" ) )
+        return SimdLevel::AVX512;
+
+    if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+        return SimdLevel::AVX2;
+
+    return SimdLevel::SCALAR;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+
+// Index of the lowest set bit of a non zero mask
+int lowestSetBit( uint32_t mask ) {
+#if defined( _MSC_VER )
+    unsigned long index;
+    _BitScanForward( &index, mask );
+    return int( index );
+#else
+    return __builtin_ctz( mask );
+#endif
+}
+
+#endif
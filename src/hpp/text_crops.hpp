@@ -0,0 +1,159 @@
+#ifndef TEXT_CROPS_HPP
+#define TEXT_CROPS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "loop_pool.hpp"
+#include "memory_manager.hpp"
+#include "metrics.hpp"
+
+
+// Where a text line crop comes from and where it goes in the batch buffer
+struct TextCropLayout {
+    cv::Rect roi; // Bounding rectangle of the box in the frame
+    bool axis_aligned = false; // The box is roi: no warp
+    bool vertical = false; // Turned 90 degrees counter clockwise after the warp ( taller than 1.5 x wide, as FastDeploy )
+    cv::Size warp_size; // Before the turn
+    cv::Size size; // Of the crop
+    size_t offset = 0; // In the batch buffer, bytes
+};
+
+// line_height: the crops are scaled to it ( the recognizer input height ), 0 = their size in the frame
+TextCropLayout textCropLayout( const std::array< int, 8 > &box, const cv::Size &frame_size, int line_height ) {
+
+    TextCropLayout layout;
+
+    const int left = std::min( { box[0], box[2], box[4], box[6] } );
+    const int right = std::max( { box[0], box[2], box[4], box[6] } );
+    const int top = std::min( { box[1], box[3], box[5], box[7] } );
+    const int bottom = std::max( { box[1], box[3], box[5], box[7] } );
+
+    layout.roi = cv::Rect( left, top, std::max( 1, right - left ), std::max( 1, bottom - top ) ) & cv::Rect( cv::Point( 0, 0 ), frame_size );
+
+    // Top left, top right, bottom right, bottom left
+    layout.axis_aligned = box[1] == box[3] && box[5] == box[7] && box[0] == box[6] && box[2] == box[4] &&
+                          box[0] == left && box[1] == top && box[4] == right && box[5] == bottom &&
+                          layout.roi.width == right - left && layout.roi.height == bottom - top;
+
+    const int width = std::max( 1, int( std::hypot( box[0] - box[2], box[1] - box[3] ) ) );
+    const int height = std::max( 1, int( std::hypot( box[0] - box[6], box[1] - box[7] ) ) );
+
+    layout.vertical = float( height ) >= float( width ) * 1.5f;
+    layout.warp_size = cv::Size( width, height );
+
+    if ( line_height > 0 ) {
+        // Scaled so the height after the turn is line_height
+        const double scale = double( line_height ) / ( layout.vertical ? width : height );
+        layout.warp_size = layout.vertical
+            ? cv::Size( line_height, std::max( 1, int( std::round( height * scale ) ) ) )
+            : cv::Size( std::max( 1, int( std::round( width * scale ) ) ), line_height );
+    }
+
+    layout.size = layout.vertical ? cv::Size( layout.warp_size.height, layout.warp_size.width ) : layout.warp_size;
+
+    return layout;
+}
+
+// Writes the crop of one box into text_image ( sized by the layout ). The same pixels as
+// fastdeploy::vision::ocr::GetRotateCropImage at the frame size, without its copy of the whole frame
+void extractTextCrop( const cv::Mat &image, const std::array< int, 8 > &box, const TextCropLayout &layout, cv::Mat &text_image ) {
+
+    const cv::Mat region = image( layout.roi ); // View
+
+    thread_local cv::Mat warped; // Vertical lines, before the turn
+
+    cv::Mat &target = layout.vertical ? warped : text_image;
+
+    if ( layout.axis_aligned ) {
+        if ( layout.warp_size == region.size() )
+            region.copyTo( target );
+        else
+            cv::resize( region, target, layout.warp_size, 0, 0, cv::INTER_LINEAR );
+    }
+    else {
+
+        const cv::Point2f source[4] = {
+            cv::Point2f( float( box[0] - layout.roi.x ), float( box[1] - layout.roi.y ) ),
+            cv::Point2f( float( box[2] - layout.roi.x ), float( box[3] - layout.roi.y ) ),
+            cv::Point2f( float( box[4] - layout.roi.x ), float( box[5] - layout.roi.y ) ),
+            cv::Point2f( float( box[6] - layout.roi.x ), float( box[7] - layout.roi.y ) )
+        };
+
+        const float width = float( layout.warp_size.width );
+        const float height = float( layout.warp_size.height );
+
+        const cv::Point2f destination[4] = {
+            cv::Point2f( 0, 0 ), cv::Point2f( width, 0 ), cv::Point2f( width, height ), cv::Point2f( 0, height )
+        };
+
+        // FastDeploy's warp: bilinear, black outside the box's bounding rectangle
+        cv::warpPerspective(
+            region, target, cv::getPerspectiveTransform( source, destination ), layout.warp_size,
+            cv::INTER_LINEAR, cv::BORDER_CONSTANT
+        );
+    }
+
+    if ( layout.vertical )
+        cv::rotate( warped, text_image, cv::ROTATE_90_COUNTERCLOCKWISE );
+}
+
+// The crops of every box, cut in parallel into one pooled buffer ( a view of it per line ) in place of
+// GetRotateCropImage one box at a time. Axis-aligned boxes, most of the screen text, are resized views
+// of the frame instead of warps. line_height: see textCropLayout. Returns the bytes of the crops
+size_t extractTextCrops(
+    const cv::Mat &image,
+    const std::vector< std::array< int, 8 > > &boxes,
+    int line_height,
+    std::vector< cv::Mat > *text_images
+) {
+
+    static constexpr int parallel_min_lines = 8;
+
+    std::vector< TextCropLayout > layouts( boxes.size() );
+
+    size_t total_bytes = 0;
+    size_t axis_aligned = 0;
+
+    for ( size_t i = 0; i < boxes.size(); ++i ) {
+        layouts[ i ] = textCropLayout( boxes[ i ], image.size(), line_height );
+        layouts[ i ].offset = total_bytes;
+        total_bytes += layouts[ i ].size.area() * image.elemSize();
+        axis_aligned += layouts[ i ].axis_aligned;
+    }
+
+    text_images->resize( boxes.size() );
+
+    if ( boxes.empty() )
+        return 0;
+
+    // Rows of bytes reshaped into the crops: they share the buffer's reference count
+    cv::Mat buffer;
+    buffer.allocator = &pooledMatAllocator();
+    buffer.create( 1, int( total_bytes ), CV_8UC1 );
+
+    for ( size_t i = 0; i < boxes.size(); ++i ) {
+        const size_t bytes = layouts[ i ].size.area() * image.elemSize();
+        ( *text_images )[ i ] = buffer.colRange( int( layouts[ i ].offset ), int( layouts[ i ].offset + bytes ) )
+                                      .reshape( image.channels(), layouts[ i ].size.height );
+    }
+
+    auto extractCrops = [&]( const cv::Range &range ) {
+        for ( int i = range.start; i < range.end; ++i )
+            extractTextCrop( image, boxes[ i ], layouts[ i ], ( *text_images )[ i ] );
+    };
+
+    if ( int( boxes.size() ) >= parallel_min_lines )
+        parallelFor( cv::Range( 0, int( boxes.size() ) ), extractCrops );
+    else
+        extractCrops( cv::Range( 0, int( boxes.size() ) ) );
+
+    metrics().increment( MetricCounter::TEXT_CROPS_AXIS_ALIGNED, axis_aligned );
+    metrics().increment( MetricCounter::TEXT_CROPS_WARPED, boxes.size() - axis_aligned );
+
+    return total_bytes;
+}
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef TEXT_DETECTOR_HPP
+#define TEXT_DETECTOR_HPP
+
+#include <algorithm>
+#include <fastdeploy/vision.h>
+#include "db_postprocessor.hpp"
+#include "fused_preprocess.hpp"
+#include "metrics.hpp"
+#include "request_context.hpp"
+#include "shape_buckets.hpp"
+
+
+// Preprocess + inference of DBDetector::Predict, the probability map goes to output_tensors[0].
+// det_img_info: < original width, original height, resized width, resized height >
+// With detector buckets the frame is letterboxed into one of them first; det_img_info then holds the
+// size of the frame inside the bucket, so the postprocessing maps the boxes back to the original frame.
+// fused_preprocessor replaces the detector's preprocessing when set
+bool runTextDetector(
+    fastdeploy::vision::ocr::DBDetector* detector,
+    const cv::Mat& image,
+    std::vector< fastdeploy::FDTensor >* output_tensors,
+    std::array< int, 4 >* det_img_info,
+    RequestTimings* timings,
+    const ShapeBuckets* shape_buckets = nullptr,
+    const FusedPreprocessor* fused_preprocessor = nullptr
+) {
+
+    StageTimer timer;
+
+    thread_local cv::Mat letterboxed; // Reused by the frames of this thread (bounded by the biggest bucket)
+    cv::Size scaled_size;
+
+    const bool use_buckets = shape_buckets != nullptr && shape_buckets->hasDetectorBuckets();
+
+    if ( use_buckets )
+        shape_buckets->letterbox( image, &letterboxed, &scaled_size );
+
+    const cv::Mat& input_image = use_buckets ? letterboxed : image;
+
+    std::vector< fastdeploy::FDTensor > input_tensors;
+    thread_local std::vector< fastdeploy::FDTensor > fused_input_tensors( 1 ); // Kept: sized by the biggest input so far
+    std::vector< fastdeploy::FDTensor >* inputs = &input_tensors;
+
+    if ( fused_preprocessor != nullptr && FusedPreprocessor::supports( input_image ) ) {
+
+        if ( !fused_preprocessor->detectorInput( input_image, detector->GetPreprocessor().GetMaxSideLen(), &fused_input_tensors[0], det_img_info ) ) {
+            std::cerr << "Failed to preprocess the detector input." << std::endl;
+            return false;
+        }
+
+        inputs = &fused_input_tensors;
+    }
+    else {
+
+        std::vector< cv::Mat > images = { input_image };
+        std::vector< fastdeploy::vision::FDMat > fd_images = fastdeploy::vision::WrapMat( images );
+
+        if ( !detector->GetPreprocessor().Run( &fd_images, &input_tensors ) ) {
+            std::cerr << "Failed to preprocess the detector input." << std::endl;
+            return false;
+        }
+
+        *det_img_info = ( *detector->GetPreprocessor().GetBatchImgInfo() )[0];
+    }
+
+    if ( use_buckets )
+        *det_img_info = { image.cols, image.rows, scaled_size.width, scaled_size.height };
+
+    timings->det_preprocess_us = timer.elapsedMicros();
+    timer = StageTimer();
+
+    ( *inputs )[0].name = detector->InputInfoOfRuntime(0).name;
+
+    if ( !detector->Infer( *inputs, output_tensors ) ) {
+        std::cerr << "Failed to run the detector." << std::endl;
+        return false;
+    }
+
+    timings->det_infer_us = timer.elapsedMicros();
+
+    return true;
+}
+
+// DB postprocessing of runTextDetector's output, by db_postprocessor when set or else by the detector's own
+bool postprocessTextDetection(
+    fastdeploy::vision::ocr::DBDetector* detector,
+    const std::vector< fastdeploy::FDTensor >& output_tensors,
+    const std::array< int, 4 >& det_img_info,
+    std::vector< std::array< int, 8 > >* boxes,
+    const DBPostprocessor* db_postprocessor = nullptr
+) {
+
+    if ( db_postprocessor != nullptr )
+        return db_postprocessor->Run( output_tensors[0], det_img_info, detector->GetPostprocessor(), boxes );
+
+    std::vector< std::vector< std::array< int, 8 > > > batch_boxes;
+
+    if ( !detector->GetPostprocessor().Run( output_tensors, &batch_boxes, { det_img_info } ) )
+        return false;
+
+    *boxes = std::move( batch_boxes[0] );
+
+    return true;
+}
+
+// Same steps as DBDetector::Predict ( preprocess -> infer -> DB postprocess ),
+// called one by one so each step can be timed.
+// db_postprocessor replaces the detector's postprocessing when set
+bool detectText(
+    fastdeploy::vision::ocr::DBDetector* detector,
+    const cv::Mat& image,
+    std::vector< std::array< int, 8 > >* boxes,
+    RequestTimings* timings,
+    const DBPostprocessor* db_postprocessor = nullptr,
+    const ShapeBuckets* shape_buckets = nullptr,
+    const FusedPreprocessor* fused_preprocessor = nullptr
+) {
+
+    std::vector< fastdeploy::FDTensor > output_tensors;
+    std::array< int, 4 > det_img_info;
+
+    if ( !runTextDetector( detector, image, &output_tensors, &det_img_info, timings, shape_buckets, fused_preprocessor ) )
+        return false;
+
+    StageTimer timer;
+
+    if ( !postprocessTextDetection( detector, output_tensors, det_img_info, boxes, db_postprocessor ) ) {
+        std::cerr << "Failed to postprocess the detector output." << std::endl;
+        return false;
+    }
+
+    timings->det_postprocess_us = timer.elapsedMicros();
+
+    metrics().observe(
+        MetricHistogram::DETECT_US,
+        timings->det_preprocess_us + timings->det_infer_us + timings->det_postprocess_us
+    );
+    metrics().observe( MetricHistogram::BOXES_PER_FRAME, boxes->size() );
+
+    return true;
+}
+
+
+// Coarse to fine detection: the detector first runs on the frame downscaled to probe_side, a pass cheap
+// enough to tell where text may be. A frame without text ends there; otherwise the detector runs at full
+// resolution ( max_image_width ) on padded crops around the regions the probe found, and the boxes of the
+// crops are mapped back to the frame. Frames where the regions cover most of the frame get one full pass
+struct DetectionProbe {
+    int probe_side = 0; // Longest side of the probe pass, 0 = off
+    int full_side = 960; // Longest side of the full resolution pass ( max_image_width )
+    double max_coverage = 0.5; // Share of the frame above which the regions are detected in one full pass
+    static constexpr int padding = 32; // Around each region, in pixels of the full resolution pass
+    static constexpr size_t max_regions = 16; // More regions ( after merging ): one full pass
+
+    bool enabled() const {
+        return probe_side > 0;
+    }
+
+    // The probe is letterboxed into one square input of this side ( probe_side rounded up to the detector's
+    // stride ), whatever the frame's aspect ratio, so backends that compile per input shape see one probe shape
+    int inputSide() const {
+        return std::max( 32, ( probe_side + 31 ) / 32 * 32 );
+    }
+};
+
+// Regions of the frame where the probe's probability map is above the DB threshold, padded and merged
+// until none overlap. map_tensor: detector output of the probe pass, frame_size: size of the original frame,
+// probe_size: size of the frame in the top left corner of the probe input, of probe_input_side pixels a side
+std::vector< cv::Rect > probeTextRegions(
+    const fastdeploy::FDTensor& map_tensor,
+    double db_thresh,
+    const cv::Size& frame_size,
+    const cv::Size& probe_size,
+    int probe_input_side,
+    int padding
+) {
+
+    std::vector< cv::Rect > regions;
+
+    if ( map_tensor.shape.size() != 4 || map_tensor.dtype != fastdeploy::FDDataType::FP32 )
+        return regions;
+
+    const int map_height = int( map_tensor.shape[ 2 ] );
+    const int map_width = int( map_tensor.shape[ 3 ] );
+
+    // The part of the map over the frame, the padding of the letterbox is left out
+    const int width = std::clamp( int( std::ceil( float( probe_size.width ) * map_width / probe_input_side ) ), 1, map_width );
+    const int height = std::clamp( int( std::ceil( float( probe_size.height ) * map_height / probe_input_side ) ), 1, map_height );
+
+    const cv::Mat pred = cv::Mat( map_height, map_width, CV_32F, const_cast< void* >( map_tensor.Data() ) )(
+        cv::Rect( 0, 0, width, height )
+    );
+
+    // A tiny line is a few probe pixels: dilate so the characters of a word make one region
+    cv::Mat bitmap;
+    cv::compare( pred, db_thresh, bitmap, cv::CMP_GT );
+    cv::dilate( bitmap, bitmap, cv::getStructuringElement( cv::MORPH_RECT, cv::Size( 3, 3 ) ) );
+
+    cv::Mat labels, stats, centroids;
+    const int label_count = cv::connectedComponentsWithStats( bitmap, labels, stats, centroids, 8, CV_32S );
+
+    const float scale_x = float( frame_size.width ) / width;
+    const float scale_y = float( frame_size.height ) / height;
+    const cv::Rect frame( 0, 0, frame_size.width, frame_size.height );
+
+    for ( int label = 1; label < label_count; ++label ) {
+
+        const int* stat = stats.ptr< int >( label );
+
+        const int left = int( stat[ cv::CC_STAT_LEFT ] * scale_x ) - padding;
+        const int top = int( stat[ cv::CC_STAT_TOP ] * scale_y ) - padding;
+        const int right = int( std::ceil( ( stat[ cv::CC_STAT_LEFT ] + stat[ cv::CC_STAT_WIDTH ] ) * scale_x ) ) + padding;
+        const int bottom = int( std::ceil( ( stat[ cv::CC_STAT_TOP ] + stat[ cv::CC_STAT_HEIGHT ] ) * scale_y ) ) + padding;
+
+        const cv::Rect region = cv::Rect( left, top, right - left, bottom - top ) & frame;
+
+        if ( !region.empty() )
+            regions.push_back( region );
+    }
+
+    // Overlapping regions become their bounding rect, so a line is only detected once
+    for ( bool merged = true; merged; ) {
+
+        merged = false;
+
+        for ( size_t i = 0; i < regions.size() && !merged; ++i ) {
+            for ( size_t j = i + 1; j < regions.size(); ++j ) {
+
+                if ( ( regions[ i ] & regions[ j ] ).empty() )
+                    continue;
+
+                regions[ i ] = regions[ i ] | regions[ j ];
+                regions.erase( regions.begin() + j );
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    return regions;
+}
+
+// detectText, coarse to fine ( DetectionProbe ). Timings add up the passes
+bool detectTextCoarseToFine(
+    fastdeploy::vision::ocr::DBDetector* detector,
+    const cv::Mat& image,
+    std::vector< std::array< int, 8 > >* boxes,
+    RequestTimings* timings,
+    const DetectionProbe& probe,
+    const DBPostprocessor* db_postprocessor = nullptr,
+    const ShapeBuckets* shape_buckets = nullptr,
+    const FusedPreprocessor* fused_preprocessor = nullptr
+) {
+
+    const int frame_side = std::max( image.cols, image.rows );
+
+    if ( frame_side <= probe.probe_side )
+        return detectText( detector, image, boxes, timings, db_postprocessor, shape_buckets, fused_preprocessor );
+
+    boxes->clear();
+
+    auto addTimings = [&]( const RequestTimings& pass_timings ) {
+        timings->det_preprocess_us += pass_timings.det_preprocess_us;
+        timings->det_infer_us += pass_timings.det_infer_us;
+        timings->det_postprocess_us += pass_timings.det_postprocess_us;
+    };
+
+    timings->det_preprocess_us = 0;
+    timings->det_infer_us = 0;
+    timings->det_postprocess_us = 0;
+
+    // Probe pass, letterboxed into its fixed square input ( not the detector buckets, sized for full passes )
+    thread_local cv::Mat probe_image;
+    thread_local cv::Mat region_image;
+
+    StageTimer timer;
+
+    const int probe_input_side = probe.inputSide();
+    const float probe_ratio = float( probe.probe_side ) / frame_side;
+    const cv::Size probe_size(
+        std::clamp( int( image.cols * probe_ratio ), 1, probe_input_side ),
+        std::clamp( int( image.rows * probe_ratio ), 1, probe_input_side )
+    );
+
+    probe_image.create( probe_input_side, probe_input_side, image.type() );
+    probe_image.setTo( cv::Scalar::all( 0 ) );
+
+    cv::Mat probe_area = probe_image( cv::Rect( 0, 0, probe_size.width, probe_size.height ) );
+    cv::resize( image, probe_area, probe_size, 0, 0, cv::INTER_AREA );
+
+    const uint64_t probe_resize_us = timer.elapsedMicros();
+
+    std::vector< fastdeploy::FDTensor > output_tensors;
+    std::array< int, 4 > det_img_info;
+    RequestTimings pass_timings;
+
+    if ( !runTextDetector( detector, probe_image, &output_tensors, &det_img_info, &pass_timings, nullptr, fused_preprocessor ) )
+        return false;
+
+    pass_timings.det_preprocess_us += probe_resize_us;
+    timer = StageTimer();
+
+    // Regions in frame pixels: the padding is in pixels of the full resolution pass
+    const float full_ratio = std::min( 1.0f, float( probe.full_side ) / frame_side );
+
+    const std::vector< cv::Rect > regions = probeTextRegions(
+        output_tensors[0],
+        detector->GetPostprocessor().GetDetDBThresh(),
+        image.size(),
+        probe_size,
+        probe_input_side,
+        int( DetectionProbe::padding / full_ratio )
+    );
+
+    pass_timings.det_postprocess_us = timer.elapsedMicros();
+    addTimings( pass_timings );
+
+    size_t region_area = 0;
+    for ( const cv::Rect& region : regions )
+        region_area += size_t( region.area() );
+
+    if ( regions.empty() ) {
+        metrics().increment( MetricCounter::DET_PROBE_EMPTY_FRAMES );
+    }
+    else if ( regions.size() > DetectionProbe::max_regions || region_area > probe.max_coverage * image.total() ) {
+
+        // Dense frame: one full pass costs less than the crops
+        metrics().increment( MetricCounter::DET_PROBE_FULL_FRAMES );
+
+        if ( !runTextDetector( detector, image, &output_tensors, &det_img_info, &pass_timings, shape_buckets, fused_preprocessor ) )
+            return false;
+
+        timer = StageTimer();
+
+        if ( !postprocessTextDetection( detector, output_tensors, det_img_info, boxes, db_postprocessor ) ) {
+            std::cerr << "Failed to postprocess the detector output." << std::endl;
+            return false;
+        }
+
+        pass_timings.det_postprocess_us = timer.elapsedMicros();
+        addTimings( pass_timings );
+    }
+    else {
+
+        metrics().increment( MetricCounter::DET_PROBE_REGION_FRAMES );
+
+        std::vector< std::array< int, 8 > > region_boxes;
+
+        for ( const cv::Rect& region : regions ) {
+
+            timer = StageTimer();
+
+            // Scaled like the full frame would be, and continuous for the preprocessor
+            if ( full_ratio < 1.0f ) {
+                cv::resize(
+                    image( region ), region_image,
+                    cv::Size( std::max( 1, int( region.width * full_ratio ) ), std::max( 1, int( region.height * full_ratio ) ) ),
+                    0, 0, cv::INTER_AREA
+                );
+            }
+            else {
+                image( region ).copyTo( region_image );
+            }
+
+            const uint64_t crop_us = timer.elapsedMicros();
+
+            if ( !runTextDetector( detector, region_image, &output_tensors, &det_img_info, &pass_timings, shape_buckets, fused_preprocessor ) )
+                return false;
+
+            pass_timings.det_preprocess_us += crop_us;
+            timer = StageTimer();
+
+            if ( !postprocessTextDetection( detector, output_tensors, det_img_info, &region_boxes, db_postprocessor ) ) {
+                std::cerr << "Failed to postprocess the detector output." << std::endl;
+                return false;
+            }
+
+            const float scale_x = float( region.width ) / region_image.cols;
+            const float scale_y = float( region.height ) / region_image.rows;
+
+            for ( auto& box : region_boxes ) {
+                for ( size_t i = 0; i < box.size(); i += 2 ) {
+                    box[ i ] = std::min( image.cols - 1, region.x + int( std::round( box[ i ] * scale_x ) ) );
+                    box[ i + 1 ] = std::min( image.rows - 1, region.y + int( std::round( box[ i + 1 ] * scale_y ) ) );
+                }
+                boxes->push_back( box );
+            }
+
+            pass_timings.det_postprocess_us = timer.elapsedMicros();
+            addTimings( pass_timings );
+        }
+    }
+
+    metrics().observe(
+        MetricHistogram::DETECT_US,
+        timings->det_preprocess_us + timings->det_infer_us + timings->det_postprocess_us
+    );
+    metrics().observe( MetricHistogram::BOXES_PER_FRAME, boxes->size() );
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef WORKER_SUPERVISOR_HPP
+#define WORKER_SUPERVISOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined( __linux__ )
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+class SharedMetricsBoard; // Linux only
+
+
+// Sums the samples of several Prometheus text snapshots ( one per worker process ) by series.
+// Series are grouped by metric family ( the # HELP / # TYPE lines and the samples after them ), families
+// in the order of the first snapshot that has them, so a series only some snapshots have stays with its
+// family. Counters, histograms and the gauges the service exports ( queue depth, memory, leased threads )
+// all add up across processes. cumulative_only: only the counter, histogram and summary families
+std::string aggregatePrometheusText( const std::vector< std::string >& snapshots, bool cumulative_only = false ) {
+
+    struct Family {
+        std::vector< std::string > comments; // # HELP, # TYPE
+        std::string type = "untyped";
+        std::vector< std::string > series; // Name + labels, in output order
+    };
+
+    std::vector< std::string > family_order;
+    std::map< std::string, Family > families;
+    std::map< std::string, double > totals; // < series, sum >
+
+    auto familyOf = [&]( const std::string& name ) -> Family& {
+        auto family = families.find( name );
+        if ( family == families.end() ) {
+            family_order.push_back( name );
+            family = families.emplace( name, Family() ).first;
+        }
+        return family->second;
+    };
+
+    for ( const auto& snapshot : snapshots ) {
+
+        std::istringstream input( snapshot );
+        std::string line;
+        std::string current_family; // Of the last # HELP / # TYPE line: the samples after it belong to it
+
+        while ( std::getline( input, line ) ) {
+
+            if ( line.empty() )
+                continue;
+
+            if ( line[0] == '#' ) {
+
+                std::istringstream comment( line );
+                std::string hash, keyword, name, type;
+                comment >> hash >> keyword >> name >> type;
+
+                if ( keyword != "HELP" && keyword != "TYPE" )
+                    continue;
+
+                current_family = name;
+                Family& family = familyOf( name );
+
+                if ( std::find( family.comments.begin(), family.comments.end(), line ) == family.comments.end() )
+                    family.comments.push_back( line );
+                if ( keyword == "TYPE" )
+                    family.type = type;
+
+                continue;
+            }
+
+            const size_t space = line.rfind( ' ' );
+
+            if ( space == std::string::npos )
+                continue;
+
+            const std::string series = line.substr( 0, space );
+            const double value = std::strtod( line.c_str() + space + 1, nullptr );
+
+            auto total = totals.find( series );
+
+            if ( total != totals.end() ) {
+                total->second += value;
+                continue;
+            }
+
+            totals[ series ] = value;
+
+            // A sample without a family line: its own family
+            familyOf( current_family.empty() ? series.substr( 0, series.find( '{' ) ) : current_family ).series.push_back( series );
+        }
+    }
+
+    std::string out;
+    char value[ 32 ];
+
+    for ( const auto& name : family_order ) {
+
+        const Family& family = families[ name ];
+
+        if ( cumulative_only && family.type != "counter" && family.type != "histogram" && family.type != "summary" )
+            continue;
+
+        for ( const auto& comment : family.comments )
+            out += comment + "\n";
+
+        for ( const auto& series : family.series ) {
+            std::snprintf( value, sizeof( value ), "%.17g", totals[ series ] );
+            out += series + " " + value + "\n";
+        }
+    }
+
+    return out;
+}
+
+
+#if defined( __linux__ )
+
+// Metrics snapshots of the worker processes in shared memory ( mapped before the fork, so every
+// worker and its restarts see the same pages ). One slot per worker, each behind a seqlock:
+// the worker writes its slot, any worker reads all of them without blocking the writers.
+// When a worker exits, the supervisor moves the cumulative series of its last snapshot into a
+// retired snapshot, so the summed counters don't drop when its restart counts from 0 again
+class SharedMetricsBoard {
+
+    private:
+        static constexpr size_t max_snapshot_bytes = 256 * 1024;
+
+        struct Slot {
+            std::atomic< uint32_t > sequence; // Odd while the snapshot is written
+            uint32_t length;
+            char text[ max_snapshot_bytes ];
+        };
+
+        struct Header {
+            std::atomic< uint64_t > restarts; // Workers restarted by the supervisor
+            std::atomic< uint32_t > retire_sequence; // Odd while a worker's snapshot moves to the retired one
+        };
+
+        void* memory = MAP_FAILED;
+        size_t memory_bytes = 0;
+        int slot_count = 0;
+
+        std::mutex publish_mutex; // One writer per slot: the threads of a worker take turns
+
+        Header* header() {
+            return static_cast< Header* >( memory );
+        }
+
+        // Cumulative series of the workers that exited
+        Slot* retiredSlot() {
+            return reinterpret_cast< Slot* >( static_cast< char* >( memory ) + sizeof( Header ) );
+        }
+
+        Slot* slot( int worker_idx ) {
+            return retiredSlot() + 1 + worker_idx;
+        }
+
+        // Snapshots bigger than a slot are cut at their last complete line
+        static void writeSlot( Slot* target, const std::string& snapshot ) {
+
+            size_t length = std::min( snapshot.size(), max_snapshot_bytes );
+            if ( length < snapshot.size() )
+                length = snapshot.rfind( '\n', length - 1 ) + 1;
+
+            // Odd from here on, even if a crashed previous run of this worker left it odd
+            const uint32_t sequence = ( target->sequence.load( std::memory_order_relaxed ) + 1 ) | 1;
+            target->sequence.store( sequence, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+
+            std::memcpy( target->text, snapshot.data(), length );
+            target->length = uint32_t( length );
+
+            target->sequence.store( sequence + 1, std::memory_order_release );
+        }
+
+        // Retries while the slot is being written, empty if it stays odd ( its writer died )
+        static std::string readSlot( Slot* source ) {
+
+            const int max_attempts = 10000;
+
+            std::string snapshot;
+
+            for ( int attempt = 0; attempt < max_attempts; ++attempt ) {
+
+                const uint32_t before = source->sequence.load( std::memory_order_acquire );
+
+                if ( before & 1 ) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                const uint32_t length = std::min< uint32_t >( source->length, max_snapshot_bytes );
+                snapshot.assign( source->text, length );
+
+                std::atomic_thread_fence( std::memory_order_acquire );
+
+                if ( source->sequence.load( std::memory_order_relaxed ) == before )
+                    return snapshot;
+            }
+
+            return "";
+        }
+
+    public:
+        SharedMetricsBoard( int workers ) : slot_count( workers ) {
+
+            memory_bytes = sizeof( Header ) + sizeof( Slot ) * ( workers + 1 );
+            memory = mmap( nullptr, memory_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+
+            if ( memory == MAP_FAILED ) {
+                std::cerr << "Failed to map the shared metrics ( " << std::strerror( errno ) << " )" << std::endl;
+                return;
+            }
+
+            // Zeroed pages: every sequence is 0, every slot empty
+            new ( &header()->restarts ) std::atomic< uint64_t >( 0 );
+            new ( &header()->retire_sequence ) std::atomic< uint32_t >( 0 );
+            for ( int i = -1; i < workers; ++i )
+                new ( &slot( i )->sequence ) std::atomic< uint32_t >( 0 );
+        }
+
+        SharedMetricsBoard( const SharedMetricsBoard& ) = delete;
+        SharedMetricsBoard& operator=( const SharedMetricsBoard& ) = delete;
+
+        ~SharedMetricsBoard() {
+            if ( memory != MAP_FAILED )
+                munmap( memory, memory_bytes );
+        }
+
+        bool valid() const {
+            return memory != MAP_FAILED;
+        }
+
+        void addRestart() {
+            if ( valid() )
+                header()->restarts++;
+        }
+
+        void publish( int worker_idx, const std::string& snapshot ) {
+
+            if ( !valid() || worker_idx < 0 || worker_idx >= slot_count )
+                return;
+
+            std::lock_guard< std::mutex > lock( publish_mutex );
+
+            writeSlot( slot( worker_idx ), snapshot );
+        }
+
+        // Empty for a worker that has not published yet, or that died while writing it ( until its restart publishes again )
+        std::string read( int worker_idx ) {
+
+            if ( !valid() || worker_idx < 0 || worker_idx >= slot_count )
+                return "";
+
+            return readSlot( slot( worker_idx ) );
+        }
+
+        // Supervisor, once the worker exited ( nothing writes its slot ): its counters, histograms and
+        // summaries are added to the retired snapshot and its slot is emptied, in one step for the readers.
+        // A worker killed while writing its snapshot loses what it counted since the previous one
+        void retireWorker( int worker_idx ) {
+
+            if ( !valid() || worker_idx < 0 || worker_idx >= slot_count )
+                return;
+
+            const std::string retired = aggregatePrometheusText( { readSlot( retiredSlot() ), readSlot( slot( worker_idx ) ) }, true );
+
+            const uint32_t sequence = ( header()->retire_sequence.load( std::memory_order_relaxed ) + 1 ) | 1;
+            header()->retire_sequence.store( sequence, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+
+            writeSlot( retiredSlot(), retired );
+            writeSlot( slot( worker_idx ), "" );
+
+            header()->retire_sequence.store( sequence + 1, std::memory_order_release );
+        }
+
+        // Every worker's last snapshot and the retired one, summed, plus the supervisor's restarts
+        std::string aggregate() {
+
+            std::vector< std::string > snapshots;
+
+            if ( valid() ) {
+
+                const int max_attempts = 1000;
+
+                for ( int attempt = 0; attempt < max_attempts; ++attempt ) {
+
+                    const uint32_t before = header()->retire_sequence.load( std::memory_order_acquire );
+
+                    if ( before & 1 ) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    snapshots.clear();
+                    snapshots.push_back( readSlot( retiredSlot() ) );
+
+                    for ( int i = 0; i < slot_count; ++i )
+                        snapshots.push_back( readSlot( slot( i ) ) );
+
+                    std::atomic_thread_fence( std::memory_order_acquire );
+
+                    if ( header()->retire_sequence.load( std::memory_order_relaxed ) == before )
+                        break;
+                }
+            }
+
+            std::string out = aggregatePrometheusText( snapshots );
+
+            out += "# HELP ppocr_worker_processes Worker processes of the supervisor\n";
+            out += "# TYPE ppocr_worker_processes gauge\n";
+            out += "ppocr_worker_processes " + std::to_string( slot_count ) + "\n";
+            out += "# HELP ppocr_worker_restarts_total Workers restarted after they exited\n";
+            out += "# TYPE ppocr_worker_restarts_total counter\n";
+            out += "ppocr_worker_restarts_total " + std::to_string( valid() ? header()->restarts.load() : 0 ) + "\n";
+
+            return out;
+        }
+};
+
+
+// Threads of this process ( /proc/self/status ), 0 if unknown. fork() only carries over the calling
+// thread: with others running, the child may inherit locks they hold and pools without their threads
+int processThreadCount() {
+
+    std::ifstream status( "/proc/self/status" );
+    std::string line;
+
+    while ( std::getline( status, line ) ) {
+        if ( line.compare( 0, 8, "Threads:" ) == 0 )
+            return std::atoi( line.c_str() + 8 );
+    }
+
+    return 0;
+}
+
+std::atomic< bool > supervisor_stopping{ false };
+
+void onSupervisorSignal( int ) {
+    supervisor_stopping = true;
+}
+
+// Forks the workers, restarts the ones that exit and stops them all on SIGINT / SIGTERM.
+// A worker that exits soon after it started waits longer before each restart ( 1s doubled up to 30s ),
+// so a worker that can't start doesn't spin. Returns the process exit code
+int superviseWorkers( int workers, SharedMetricsBoard& metrics_board, const std::function< int( int worker_idx ) >& worker_main ) {
+
+    using Clock = std::chrono::steady_clock;
+
+    const auto stable_after = std::chrono::seconds( 10 );
+    const auto max_backoff = std::chrono::seconds( 30 );
+
+    struct Worker {
+        pid_t pid = -1;
+        Clock::time_point started_at;
+        Clock::time_point restart_at;
+        std::chrono::seconds backoff{ 1 };
+    };
+
+    std::vector< Worker > children( workers );
+
+    struct sigaction action;
+    std::memset( &action, 0, sizeof( action ) );
+    action.sa_handler = onSupervisorSignal;
+    sigaction( SIGINT, &action, nullptr );
+    sigaction( SIGTERM, &action, nullptr );
+
+    auto start = [&]( int worker_idx ) {
+
+        const pid_t pid = fork();
+
+        if ( pid == 0 ) {
+            signal( SIGINT, SIG_DFL );
+            signal( SIGTERM, SIG_DFL );
+            std::_Exit( worker_main( worker_idx ) );
+        }
+
+        if ( pid < 0 ) {
+            std::cerr << "Failed to fork worker " << worker_idx << " ( " << std::strerror( errno ) << " )" << std::endl;
+            children[ worker_idx ].restart_at = Clock::now() + children[ worker_idx ].backoff;
+            return;
+        }
+
+        children[ worker_idx ].pid = pid;
+        children[ worker_idx ].started_at = Clock::now();
+
+        std::cout << "Worker " << worker_idx << " started ( pid " << pid << " )" << std::endl;
+    };
+
+    for ( int i = 0; i < workers; ++i )
+        start( i );
+
+    while ( !supervisor_stopping ) {
+
+        int status = 0;
+        const pid_t pid = waitpid( -1, &status, WNOHANG );
+
+        if ( pid > 0 ) {
+
+            for ( size_t i = 0; i < children.size(); ++i ) {
+
+                Worker& worker = children[ i ];
+
+                if ( worker.pid != pid )
+                    continue;
+
+                worker.pid = -1;
+                metrics_board.retireWorker( int( i ) );
+
+                if ( Clock::now() - worker.started_at >= stable_after )
+                    worker.backoff = std::chrono::seconds( 1 );
+
+                worker.restart_at = Clock::now() + worker.backoff;
+                worker.backoff = std::min( worker.backoff * 2, max_backoff );
+
+                if ( WIFSIGNALED( status ) )
+                    std::cerr << "Worker " << i << " killed by signal " << WTERMSIG( status ) << std::endl;
+                else
+                    std::cerr << "Worker " << i << " exited with code " << WEXITSTATUS( status ) << std::endl;
+            }
+
+            continue;
+        }
+
+        for ( size_t i = 0; i < children.size(); ++i ) {
+            if ( children[ i ].pid < 0 && Clock::now() >= children[ i ].restart_at ) {
+                metrics_board.addRestart();
+                start( int( i ) );
+            }
+        }
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+    }
+
+    std::cout << "Stopping the workers..." << std::endl;
+
+    for ( const auto& worker : children ) {
+        if ( worker.pid > 0 )
+            kill( worker.pid, SIGTERM );
+    }
+
+    for ( const auto& worker : children ) {
+        if ( worker.pid > 0 )
+            waitpid( worker.pid, nullptr, 0 );
+    }
+
+    return 0;
+}
+
+#endif
+
+#endif
@@ -2,65 +2,124 @@
 #define GRPC_HELPERS_HPP
 
 #include "../hpp/inference_manager.hpp"
+#include "../hpp/request_engine.hpp"
+#include "../hpp/request_scheduler.hpp"
 #include "ocr_service.grpc.pb.h"
 
 using ocr_service::RecognizeDefaultResponse;
 using ocr_service::RecognizeDefaultResponse;
 using ocr_service::DetectResponse;
 
+// Carries the client deadline and cancellation into the inference pipeline
+RequestContext requestContextGRPCHelper( grpc::ServerContext* context ) {
+
+    RequestContext request_context;
+
+    request_context.is_cancelled = [ context ]() {
+        return context->IsCancelled();
+    };
+
+    auto const deadline = context->deadline(); // system_clock::time_point::max() when the client set none
+
+    if ( deadline != std::chrono::system_clock::time_point::max() ) {
+        request_context.deadline = request_context.arrival +
+            std::chrono::duration_cast< RequestContext::Clock::duration >( deadline - std::chrono::system_clock::now() );
+    }
+
+    return request_context;
+}
+
+RequestPriority priorityGRPCHelper( ocr_service::Priority priority ) {
+
+    switch ( priority ) {
+        case ocr_service::PRIORITY_INTERACTIVE:
+            return RequestPriority::INTERACTIVE;
+        case ocr_service::PRIORITY_BULK:
+            return RequestPriority::BULK;
+        default:
+            return RequestPriority::NORMAL;
+    }
+}
+
+uint64_t elapsedMicrosGRPCHelper( const RequestContext& request_context ) {
+    return std::chrono::duration_cast< std::chrono::microseconds >(
+        RequestContext::Clock::now() - request_context.arrival
+    ).count();
+}
+
+void timingsGRPCHelper(
+    const RequestTimings& timings,
+    const RequestContext& request_context,
+    ocr_service::RequestTimings* response_timings
+) {
+    response_timings->set_queue_wait_us( timings.queue_wait_us );
+    response_timings->set_decode_us( timings.decode_us );
+    response_timings->set_det_preprocess_us( timings.det_preprocess_us );
+    response_timings->set_det_infer_us( timings.det_infer_us );
+    response_timings->set_det_postprocess_us( timings.det_postprocess_us );
+    response_timings->set_cls_us( timings.cls_us );
+
+    for ( const uint64_t rec_batch_us : timings.rec_batch_us )
+        response_timings->add_rec_batch_us( rec_batch_us );
+
+    response_timings->set_serialize_us( timings.serialize_us );
+    response_timings->set_total_us( elapsedMicrosGRPCHelper( request_context ) );
+}
+
+grpc::Status statusGRPCHelper( InferenceStatus status ) {
+
+    switch ( status ) {
+        case InferenceStatus::CANCELLED:
+            return grpc::Status( grpc::StatusCode::CANCELLED, "Request cancelled" );
+        case InferenceStatus::DEADLINE_EXCEEDED:
+            return grpc::Status( grpc::StatusCode::DEADLINE_EXCEEDED, "Request can't finish before its deadline" );
+        default:
+            return grpc::Status::OK; // Failed inferences still answer with an empty result
+    }
+}
+
+void boxGRPCHelper( const std::array< int, 8 >& box, ocr_service::Box* grpc_box ) {
+
+    // box: [ x, y ] of top_left, top_right, bottom_right, bottom_left
+    ocr_service::Vertex* const vertices[ 4 ] = {
+        grpc_box->mutable_top_left(),
+        grpc_box->mutable_top_right(),
+        grpc_box->mutable_bottom_right(),
+        grpc_box->mutable_bottom_left()
+    };
+
+    for ( int box_vertex_idx = 0; box_vertex_idx < 4; ++box_vertex_idx ) {
+        vertices[ box_vertex_idx ]->set_x( box[ box_vertex_idx * 2 ] );
+        vertices[ box_vertex_idx ]->set_y( box[ box_vertex_idx * 2 + 1 ] );
+    }
+}
+
+// The response messages are allocated on the response's arena when it has one
 void ocrResultGRPCHelper(
     const InferenceResult& inference_result,
     RecognizeDefaultResponse* response
 ) {
 
+    const auto& ocr_result = inference_result.ocr_result;
+
     auto context_resolution = response->mutable_context_resolution();
     context_resolution->set_width( inference_result.context_resolution.width );
     context_resolution->set_height( inference_result.context_resolution.height );
-    
-    int item_idx = 0;
-    for ( const std::string& text : inference_result.ocr_result.text ) {
+
+    response->mutable_results()->Reserve( ocr_result.text.size() );
+
+    for ( size_t item_idx = 0; item_idx < ocr_result.text.size(); ++item_idx ) {
 
         auto new_result = response->add_results();
-        new_result->set_recognition_score( inference_result.ocr_result.rec_scores[ item_idx ] );
-        new_result->set_classification_score( inference_result.ocr_result.cls_scores[ item_idx ] ); // Text direction
-        new_result->set_classification_label( inference_result.ocr_result.cls_labels[ item_idx ] ); // Text direction
-
-        auto new_box = new_result->mutable_box();
-
-        auto const box = inference_result.ocr_result.boxes[ item_idx ];
-        int box_vertex_idx = 0;
-        for ( int b_axis_idx = 0; b_axis_idx < 8; ++b_axis_idx ) {
-        
-            const int x = box[ b_axis_idx ];
-            const int y = box[ b_axis_idx + 1 ];
-
-            ocr_service::Vertex* vertex;
-
-            if ( box_vertex_idx == 0 ) {
-                vertex = new_box->mutable_top_left();
-            }
-            else if ( box_vertex_idx == 1 ) {
-                vertex = new_box->mutable_top_right();
-            }
-            else if ( box_vertex_idx == 2 ) {
-                vertex = new_box->mutable_bottom_right();
-            }
-            else if ( box_vertex_idx == 3 ) {
-                vertex = new_box->mutable_bottom_left();
-            }
-
-            vertex->set_x(x);
-            vertex->set_y(y);
-
-            box_vertex_idx++; // [ 1 ... 4 ]
-            b_axis_idx++; // [ 1 ... 8]
-        }
+        new_result->set_recognition_score( ocr_result.rec_scores[ item_idx ] );
+        new_result->set_classification_score( ocr_result.cls_scores[ item_idx ] ); // Text direction
+        new_result->set_classification_label( ocr_result.cls_labels[ item_idx ] ); // Text direction
 
-        auto text_line = new_result->add_text_lines();
-        text_line->set_content(text);
-        text_line->mutable_box()->CopyFrom(*new_box);
+        boxGRPCHelper( ocr_result.boxes[ item_idx ], new_result->mutable_box() );
 
-        item_idx++;
+        auto text_line = new_result->add_text_lines();
+        text_line->set_content( ocr_result.text[ item_idx ] );
+        boxGRPCHelper( ocr_result.boxes[ item_idx ], text_line->mutable_box() );
     }
 }
 
@@ -72,50 +131,16 @@ void detectionResultGRPCHelper(
     auto context_resolution = response->mutable_context_resolution();
     context_resolution->set_width( detection_result.context_resolution.width );
     context_resolution->set_height( detection_result.context_resolution.height );
-    
-    int item_idx = 0;
-    for ( const auto _box : detection_result.ocr_result.boxes ) {
-
-        std::cout << item_idx;
-
-        auto new_result = response->add_results();
-
-        auto new_box = new_result->mutable_box();
 
-        auto const box = detection_result.ocr_result.boxes[ item_idx ];
-        int box_vertex_idx = 0;
-        for ( int b_axis_idx = 0; b_axis_idx < 8; ++b_axis_idx ) {
+    response->mutable_results()->Reserve( detection_result.ocr_result.boxes.size() );
 
-        
-            const int x = box[ b_axis_idx ];
-            const int y = box[ b_axis_idx + 1 ];
+    for ( const auto& box : detection_result.ocr_result.boxes ) {
 
-            ocr_service::Vertex* vertex;
-
-            if ( box_vertex_idx == 0 ) {
-                vertex = new_box->mutable_top_left();
-            }
-            else if ( box_vertex_idx == 1 ) {
-                vertex = new_box->mutable_top_right();
-            }
-            else if ( box_vertex_idx == 2 ) {
-                vertex = new_box->mutable_bottom_right();
-            }
-            else if ( box_vertex_idx == 3 ) {
-                vertex = new_box->mutable_bottom_left();
-            }
-
-            vertex->set_x(x);
-            vertex->set_y(y);
-
-            box_vertex_idx++; // [ 1 ... 4 ]
-            b_axis_idx++; // [ 1 ... 8]
-        }
+        auto new_result = response->add_results();
+        boxGRPCHelper( box, new_result->mutable_box() );
 
         auto text_line = new_result->add_text_lines();
-        text_line->mutable_box()->CopyFrom(*new_box);
-
-        item_idx++;
+        boxGRPCHelper( box, text_line->mutable_box() );
     }
 }
 
@@ -0,0 +1,315 @@
+#ifndef OCR_ROUTER_HPP
+#define OCR_ROUTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include "ocr_service.grpc.pb.h"
+#include "../hpp/worker_supervisor.hpp"
+
+using grpc::ServerContext;
+using grpc::Status;
+
+using ocr_service::OCRService;
+
+
+// One ppocr_infer_service_grpc instance behind the router
+struct RouterBackend {
+    std::string target; // host:port
+    std::unique_ptr< OCRService::Stub > stub;
+
+    std::mutex mutex;
+    std::set< std::string > languages; // From its GetSupportedLanguages
+
+    std::atomic< bool > healthy{ false };
+    std::atomic< int > outstanding{ 0 }; // Requests forwarded and not answered yet
+    std::atomic< uint64_t > forwarded{ 0 };
+    std::atomic< uint64_t > failed{ 0 };
+
+    bool serves( const std::string& language_code ) {
+        std::lock_guard< std::mutex > lock( mutex );
+        return languages.count( language_code ) > 0;
+    }
+};
+
+
+// Language sharded front end: exposes the OCRService of the instances behind it and forwards each
+// request to a healthy instance that loaded its language, the one with the fewest outstanding requests.
+// A health check asks every instance for its languages ( GetSupportedLanguages ), so instances can be
+// added with other presets, restarted or scaled per language without touching the clients.
+class OCRRouterService final : public OCRService::Service {
+
+    private:
+        std::vector< std::unique_ptr< RouterBackend > > backends;
+        std::chrono::milliseconds health_check_interval;
+        std::atomic< bool > stopping{ false };
+        std::thread health_checker;
+
+        std::atomic< uint64_t > unroutable{ 0 }; // No healthy instance for the language
+        std::atomic< uint64_t > next_pick{ 0 }; // Rotates the ties
+
+        // Healthy backend of the language with the fewest outstanding requests, nullptr if none
+        RouterBackend* pick( const std::string& language_code, const RouterBackend* excluded = nullptr ) {
+
+            RouterBackend* picked = nullptr;
+            const size_t offset = next_pick++;
+
+            for ( size_t i = 0; i < backends.size(); ++i ) {
+
+                RouterBackend* backend = backends[ ( offset + i ) % backends.size() ].get();
+
+                if ( backend == excluded || !backend->healthy || !backend->serves( language_code ) )
+                    continue;
+
+                if ( picked == nullptr || backend->outstanding < picked->outstanding )
+                    picked = backend;
+            }
+
+            return picked;
+        }
+
+        void checkHealth( RouterBackend* backend ) {
+
+            grpc::ClientContext context;
+            context.set_deadline( std::chrono::system_clock::now() + health_check_interval );
+
+            ocr_service::GetSupportedLanguagesRequest request;
+            ocr_service::GetSupportedLanguagesResponse response;
+
+            const Status status = backend->stub->GetSupportedLanguages( &context, request, &response );
+
+            if ( status.ok() ) {
+                std::lock_guard< std::mutex > lock( backend->mutex );
+                backend->languages = std::set< std::string >( response.language_codes().begin(), response.language_codes().end() );
+            }
+
+            if ( status.ok() != backend->healthy.load() )
+                std::cout << backend->target << ( status.ok() ? " is healthy" : " is unhealthy: " + status.error_message() ) << std::endl;
+
+            backend->healthy = status.ok();
+        }
+
+        void checkHealthLoop() {
+
+            while ( !stopping ) {
+
+                for ( auto& backend : backends )
+                    checkHealth( backend.get() );
+
+                const auto wake_at = std::chrono::steady_clock::now() + health_check_interval;
+                while ( !stopping && std::chrono::steady_clock::now() < wake_at )
+                    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+            }
+        }
+
+        // Forwards to the picked backend with the caller's deadline and cancellation.
+        // An instance that can't be reached is marked unhealthy and the request goes to the next one
+        template< typename Request, typename Response >
+        Status forward(
+            ServerContext* context,
+            const Request* request,
+            Response* response,
+            Status ( OCRService::Stub::*rpc )( grpc::ClientContext*, const Request&, Response* )
+        ) {
+
+            RouterBackend* excluded = nullptr;
+
+            for ( int attempt = 0; attempt < 2; ++attempt ) {
+
+                RouterBackend* backend = pick( request->language_code(), excluded );
+
+                if ( backend == nullptr )
+                    break;
+
+                std::unique_ptr< grpc::ClientContext > client_context = grpc::ClientContext::FromServerContext( *context );
+
+                backend->outstanding++;
+                backend->forwarded++;
+                const Status status = ( backend->stub.get()->*rpc )( client_context.get(), *request, response );
+                backend->outstanding--;
+
+                if ( status.error_code() != grpc::StatusCode::UNAVAILABLE )
+                    return status;
+
+                backend->failed++;
+                backend->healthy = false;
+                excluded = backend;
+                response->Clear();
+            }
+
+            unroutable++;
+
+            return Status( grpc::StatusCode::UNAVAILABLE, "No healthy instance serves language \"" + request->language_code() + "\"" );
+        }
+
+        std::string routerMetricsText() {
+
+            std::string out;
+
+            out += "# HELP ppocr_router_backend_healthy Instance passed its last health check\n";
+            out += "# TYPE ppocr_router_backend_healthy gauge\n";
+            for ( const auto& backend : backends )
+                out += "ppocr_router_backend_healthy{backend=\"" + backend->target + "\"} " + std::to_string( int( backend->healthy ) ) + "\n";
+
+            out += "# HELP ppocr_router_backend_outstanding Requests waiting for the instance\n";
+            out += "# TYPE ppocr_router_backend_outstanding gauge\n";
+            for ( const auto& backend : backends )
+                out += "ppocr_router_backend_outstanding{backend=\"" + backend->target + "\"} " + std::to_string( backend->outstanding.load() ) + "\n";
+
+            out += "# HELP ppocr_router_forwarded_total Requests forwarded to the instance\n";
+            out += "# TYPE ppocr_router_forwarded_total counter\n";
+            for ( const auto& backend : backends )
+                out += "ppocr_router_forwarded_total{backend=\"" + backend->target + "\"} " + std::to_string( backend->forwarded.load() ) + "\n";
+
+            out += "# HELP ppocr_router_failed_total Requests the instance could not be reached for\n";
+            out += "# TYPE ppocr_router_failed_total counter\n";
+            for ( const auto& backend : backends )
+                out += "ppocr_router_failed_total{backend=\"" + backend->target + "\"} " + std::to_string( backend->failed.load() ) + "\n";
+
+            out += "# HELP ppocr_router_unroutable_total Requests with no healthy instance for their language\n";
+            out += "# TYPE ppocr_router_unroutable_total counter\n";
+            out += "ppocr_router_unroutable_total " + std::to_string( unroutable.load() ) + "\n";
+
+            return out;
+        }
+
+    public:
+        OCRRouterService( const std::vector< std::string >& targets, std::chrono::milliseconds health_check_interval )
+            : health_check_interval( health_check_interval ) {
+
+            for ( const auto& target : targets ) {
+                auto backend = std::make_unique< RouterBackend >();
+                backend->target = target;
+                backend->stub = OCRService::NewStub( grpc::CreateChannel( target, grpc::InsecureChannelCredentials() ) );
+                backends.push_back( std::move( backend ) );
+            }
+
+            // Routes from the first request on
+            for ( auto& backend : backends )
+                checkHealth( backend.get() );
+
+            health_checker = std::thread( [ this ]() { checkHealthLoop(); } );
+        }
+
+        OCRRouterService( const OCRRouterService& ) = delete;
+        OCRRouterService& operator=( const OCRRouterService& ) = delete;
+
+        ~OCRRouterService() {
+            stopping = true;
+            if ( health_checker.joinable() )
+                health_checker.join();
+        }
+
+        // Languages of the healthy instances
+        Status GetSupportedLanguages(
+            ServerContext* context,
+            const ocr_service::GetSupportedLanguagesRequest* request,
+            ocr_service::GetSupportedLanguagesResponse* response
+        ) override {
+
+            std::set< std::string > languages;
+
+            for ( const auto& backend : backends ) {
+
+                if ( !backend->healthy )
+                    continue;
+
+                std::lock_guard< std::mutex > lock( backend->mutex );
+                languages.insert( backend->languages.begin(), backend->languages.end() );
+            }
+
+            for ( const auto& language_code : languages )
+                response->add_language_codes( language_code );
+
+            return Status::OK;
+        }
+
+        Status RecognizeBytes(
+            ServerContext* context,
+            const ocr_service::RecognizeBytesRequest* request,
+            ocr_service::RecognizeDefaultResponse* response
+        ) override {
+            return forward( context, request, response, &OCRService::Stub::RecognizeBytes );
+        }
+
+        Status RecognizeBase64(
+            ServerContext* context,
+            const ocr_service::RecognizeBase64Request* request,
+            ocr_service::RecognizeDefaultResponse* response
+        ) override {
+            return forward( context, request, response, &OCRService::Stub::RecognizeBase64 );
+        }
+
+        Status Detect(
+            ServerContext* context,
+            const ocr_service::DetectRequest* request,
+            ocr_service::DetectResponse* response
+        ) override {
+            return forward( context, request, response, &OCRService::Stub::Detect );
+        }
+
+        // The router's own series, then the instances' metrics summed
+        Status GetMetrics(
+            ServerContext* context,
+            const ocr_service::GetMetricsRequest* request,
+            ocr_service::GetMetricsResponse* response
+        ) override {
+
+            std::vector< std::string > snapshots;
+
+            for ( const auto& backend : backends ) {
+
+                if ( !backend->healthy )
+                    continue;
+
+                grpc::ClientContext client_context;
+                client_context.set_deadline( std::chrono::system_clock::now() + health_check_interval );
+
+                ocr_service::GetMetricsResponse backend_response;
+
+                if ( backend->stub->GetMetrics( &client_context, *request, &backend_response ).ok() )
+                    snapshots.push_back( backend_response.prometheus_text() );
+            }
+
+            response->set_prometheus_text( routerMetricsText() + aggregatePrometheusText( snapshots ) );
+
+            return Status::OK;
+        }
+
+        // Sent to every healthy instance, successful when all of them applied it
+        Status UpdatePpOcrSettings(
+            ServerContext* context,
+            const ocr_service::UpdatePpOcrSettingsRequest* request,
+            ocr_service::UpdateSettingsResponse* response
+        ) override {
+
+            bool success = true;
+
+            for ( const auto& backend : backends ) {
+
+                if ( !backend->healthy )
+                    continue;
+
+                std::unique_ptr< grpc::ClientContext > client_context = grpc::ClientContext::FromServerContext( *context );
+                ocr_service::UpdateSettingsResponse backend_response;
+
+                const Status status = backend->stub->UpdatePpOcrSettings( client_context.get(), *request, &backend_response );
+
+                success = success && status.ok() && backend_response.success();
+            }
+
+            response->set_success( success );
+
+            return Status::OK;
+        }
+};
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef PPOCR_SERVICE_HPP
+#define PPOCR_SERVICE_HPP
+
+#include "../hpp/request_engine.hpp"
+#include "../hpp/worker_supervisor.hpp"
+
+#include <grpcpp/grpcpp.h>
+#include "ocr_service.grpc.pb.h"
+#include "grpc_helpers.hpp"
+#include "request_capture.hpp"
+
+using grpc::Server;
+using grpc::ServerBuilder;
+using grpc::ServerContext;
+using grpc::Status;
+
+using ocr_service::RecognizeBase64Request;
+using ocr_service::RecognizeDefaultResponse;
+using ocr_service::RecognizeBytesRequest;
+
+using ocr_service::DetectRequest;
+using ocr_service::DetectResponse;
+
+using ocr_service::GetSupportedLanguagesRequest;
+using ocr_service::GetSupportedLanguagesResponse;
+
+using ocr_service::UpdatePpOcrSettingsRequest;
+using ocr_service::UpdateSettingsResponse;
+
+using ocr_service::GetMetricsRequest;
+using ocr_service::GetMetricsResponse;
+
+
+using ocr_service::OCRService;
+
+
+class PPOCRService final : public OCRService::Service {
+
+  private:
+    RequestEngine engine;
+    std::unique_ptr< RequestCapture > request_capture; // Only when "capture_file" is set
+
+#if defined( __linux__ )
+    SharedMetricsBoard* metrics_board = nullptr; // Worker mode: the metrics of every worker process
+    int worker_index = 0;
+#endif
+
+    EngineRequest engineRequest( const RecognizeBytesRequest& request ) {
+      EngineRequest engine_request;
+      engine_request.image = request.image_bytes();
+      engine_request.language_code = request.language_code();
+      engine_request.client_id = request.client_id();
+      engine_request.priority = priorityGRPCHelper( request.priority() );
+      return engine_request;
+    }
+
+    EngineRequest engineRequest( const RecognizeBase64Request& request ) {
+      EngineRequest engine_request;
+      engine_request.image = request.base64_image();
+      engine_request.encoding = ImageEncoding::BASE64;
+      engine_request.language_code = request.language_code();
+      engine_request.client_id = request.client_id();
+      engine_request.priority = priorityGRPCHelper( request.priority() );
+      return engine_request;
+    }
+
+    EngineRequest engineRequest( const DetectRequest& request ) {
+      EngineRequest engine_request;
+      engine_request.image = request.image_bytes();
+      engine_request.language_code = request.language_code();
+      engine_request.client_id = request.client_id();
+      engine_request.priority = priorityGRPCHelper( request.priority() );
+      return engine_request;
+    }
+
+    template< typename Request >
+    Status recognize(
+      ocr_service::CapturedRpc captured_rpc,
+      ServerContext* context,
+      const Request* request,
+      RecognizeDefaultResponse* response
+    ) {
+
+      RequestContext request_context = requestContextGRPCHelper( context );
+      RequestFinishScope finish_scope( engine, request_context );
+
+      if ( request_capture )
+        request_capture->capture( captured_rpc, *request, engine.getSettingsVersion(), request_context );
+
+      InferenceResult inference_result = engine.recognize( engineRequest( *request ), request_context );
+
+      if ( inference_result.status == InferenceStatus::CANCELLED ||
+           inference_result.status == InferenceStatus::DEADLINE_EXCEEDED )
+        return statusGRPCHelper( inference_result.status );
+
+      response->set_id( request->id() );
+
+      StageTimer serialize_timer;
+      ocrResultGRPCHelper( inference_result, response );
+      inference_result.timings.serialize_us = serialize_timer.lap( MetricHistogram::SERIALIZE_US );
+
+      if ( request->include_timings() )
+        timingsGRPCHelper( inference_result.timings, request_context, response->mutable_timings() );
+
+      return Status::OK;
+    }
+  
+  public:
+
+    PPOCRService( AppOptions app_options ) : engine( app_options ) {
+
+      const auto app_settings = engine.getSettingsManager().getAppSettingsPreset();
+
+      // One capture file per worker process
+      std::string capture_file = app_settings.capture_file;
+      if ( !capture_file.empty() && app_options.worker_count > 1 )
+        capture_file += ".worker" + std::to_string( app_options.worker_index );
+
+      if ( !capture_file.empty() )
+        request_capture = std::make_unique< RequestCapture >( capture_file, app_settings.capture_max_mb );
+    }
+
+#if defined( __linux__ )
+    // GetMetrics then answers for all the workers
+    void setMetricsBoard( SharedMetricsBoard* metrics_board, int worker_index ) {
+      this->metrics_board = metrics_board;
+      this->worker_index = worker_index;
+    }
+
+    void publishMetrics() {
+      if ( metrics_board != nullptr )
+        metrics_board->publish( worker_index, metrics().toPrometheusText() );
+    }
+#endif
+
+    SettingsManager& getSettingsManager() {
+      return engine.getSettingsManager();
+    }
+
+    InferenceManager& getInferenceManager() {
+      return engine.getInferenceManager();
+    }
+
+    int getServerPort() {
+      return engine.getServerPort();
+    }
+
+    Status GetSupportedLanguages(
+      ServerContext* context,
+      const GetSupportedLanguagesRequest* request,
+      GetSupportedLanguagesResponse* response
+    ) override {
+
+      for ( const std::string& language_code : engine.getSupportedLanguages() ) {
+        
+        response->add_language_codes(language_code);        
+      }
+      
+      return Status::OK;
+    }
+
+    Status RecognizeBase64(
+      ServerContext* context,
+      const RecognizeBase64Request* request,
+      RecognizeDefaultResponse* response
+    ) override {    
+
+      return recognize( ocr_service::CAPTURED_RECOGNIZE_BASE64, context, request, response );
+    }
+
+    Status RecognizeBytes(
+      ServerContext* context,
+      const RecognizeBytesRequest* request,
+      RecognizeDefaultResponse* response
+    ) override {    
+
+      return recognize( ocr_service::CAPTURED_RECOGNIZE_BYTES, context, request, response );
+    }
+
+    Status Detect(
+      ServerContext* context,
+      const DetectRequest* request,
+      DetectResponse* response
+    ) override {    
+
+      RequestContext request_context = requestContextGRPCHelper( context );
+      RequestFinishScope finish_scope( engine, request_context );
+
+      if ( request_capture )
+        request_capture->capture( ocr_service::CAPTURED_DETECT, *request, engine.getSettingsVersion(), request_context );
+
+      DetectionResult result = engine.detect( engineRequest( *request ), request_context );
+
+      if ( result.status == InferenceStatus::CANCELLED ||
+           result.status == InferenceStatus::DEADLINE_EXCEEDED )
+        return statusGRPCHelper( result.status );
+
+      response->set_id( request->id() );
+
+      StageTimer serialize_timer;
+      detectionResultGRPCHelper( result, response );
+      result.timings.serialize_us = serialize_timer.lap( MetricHistogram::SERIALIZE_US );
+
+      if ( request->include_timings() )
+        timingsGRPCHelper( result.timings, request_context, response->mutable_timings() );
+
+      return Status::OK;
+    }
+
+    Status GetMetrics(
+      ServerContext* context,
+      const GetMetricsRequest* request,
+      GetMetricsResponse* response
+    ) override {
+
+#if defined( __linux__ )
+      if ( metrics_board != nullptr ) {
+        publishMetrics();
+        response->set_prometheus_text( metrics_board->aggregate() );
+        return Status::OK;
+      }
+#endif
+
+      response->set_prometheus_text( metrics().toPrometheusText() );
+
+      return Status::OK;
+    }
+
+    Status UpdatePpOcrSettings(
+      ServerContext* context,
+      const UpdatePpOcrSettingsRequest* request,
+      UpdateSettingsResponse* response
+    ) override {
+
+      UpdateAppSettingsPresetInput settingsUpdate;
+      settingsUpdate.inference_backend = request->inference_runtime();
+      settingsUpdate.cpu_threads = request->cpu_threads();
+      settingsUpdate.max_image_width = request->max_image_width();
+      settingsUpdate.det_db_thresh = request->det_db_thresh();
+      settingsUpdate.det_db_box_thresh = request->det_db_box_thresh();
+      settingsUpdate.det_db_unclip_ratio = request->det_db_unclip_ratio();
+      settingsUpdate.det_db_score_mode = request->det_db_score_mode();
+      settingsUpdate.use_dilation = request->use_dilation();
+      settingsUpdate.cls_thresh = request->cls_thresh();
+      
+      engine.updateSettings( settingsUpdate );
+
+      response->set_success( true );
+
+      return Status::OK;
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef REQUEST_CAPTURE_HPP
+#define REQUEST_CAPTURE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "../hpp/metrics.hpp"
+#include "../hpp/request_context.hpp"
+#include "ocr_service.grpc.pb.h"
+
+
+// Capture file layout: "PPOCRCAP" magic, then records of
+// [ uint32 little endian length ][ serialized ocr_service::CapturedRequest ]
+const char capture_file_magic[] = "PPOCRCAP";
+const size_t capture_file_magic_size = 8;
+
+
+// Appends incoming requests to a capture file for later replay (ppocr_replay).
+// Disk usage is bounded by two segments ( file + file.1 ) of max_bytes / 2 each:
+// when the current segment is full it replaces file.1 and a new one is started.
+// Requests are written by a background thread, when it falls behind they are dropped.
+class RequestCapture {
+
+    private:
+        const size_t max_pending_bytes = 64 * 1024 * 1024;
+
+        std::string file_path;
+        uint64_t max_segment_bytes;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque< std::string > pending; // Serialized records
+        size_t pending_bytes = 0;
+        bool stopping = false;
+
+        std::ofstream file;
+        uint64_t segment_bytes = 0;
+        std::thread writer;
+
+        void openSegment() {
+
+            file.open( file_path, std::ios::binary | std::ios::app );
+            file.seekp( 0, std::ios::end );
+            segment_bytes = uint64_t( file.tellp() );
+
+            if ( segment_bytes == 0 ) {
+                file.write( capture_file_magic, capture_file_magic_size );
+                segment_bytes = capture_file_magic_size;
+            }
+        }
+
+        void rotateSegment() {
+
+            file.close();
+
+            const std::string previous_path = file_path + ".1";
+            std::remove( previous_path.c_str() );
+            std::rename( file_path.c_str(), previous_path.c_str() );
+
+            openSegment();
+        }
+
+        void writeRecord( const std::string& record ) {
+
+            if ( segment_bytes + 4 + record.size() > max_segment_bytes && segment_bytes > capture_file_magic_size )
+                rotateSegment();
+
+            const uint32_t length = record.size();
+            const char length_bytes[ 4 ] = {
+                char( length & 0xff ), char( ( length >> 8 ) & 0xff ), char( ( length >> 16 ) & 0xff ), char( ( length >> 24 ) & 0xff )
+            };
+
+            file.write( length_bytes, 4 );
+            file.write( record.data(), record.size() );
+            segment_bytes += 4 + record.size();
+        }
+
+        static void appendVarint( std::string& out, uint64_t value ) {
+
+            while ( value >= 0x80 ) {
+                out.push_back( char( ( value & 0x7f ) | 0x80 ) );
+                value >>= 7;
+            }
+
+            out.push_back( char( value ) );
+        }
+
+        void writeLoop() {
+
+            std::unique_lock< std::mutex > lock( mutex );
+
+            while ( true ) {
+
+                condition.wait( lock, [ this ]() { return stopping || !pending.empty(); } );
+
+                if ( pending.empty() && stopping )
+                    return;
+
+                std::deque< std::string > batch;
+                batch.swap( pending );
+                pending_bytes = 0;
+
+                lock.unlock();
+
+                for ( const auto& record : batch )
+                    writeRecord( record );
+
+                file.flush();
+                metrics().increment( MetricCounter::CAPTURE_WRITTEN, batch.size() );
+
+                lock.lock();
+            }
+        }
+
+    public:
+        RequestCapture( const std::string& file_path, int max_mb ) {
+
+            this->file_path = file_path;
+            this->max_segment_bytes = uint64_t( std::max( max_mb, 2 ) ) * 1024 * 1024 / 2;
+
+            openSegment();
+
+            if ( !file.is_open() ) {
+                std::cerr << "Failed to open the capture file: " << file_path << std::endl;
+                return;
+            }
+
+            std::cout << "Capturing requests to: " << file_path << std::endl;
+
+            writer = std::thread( &RequestCapture::writeLoop, this );
+        }
+
+        RequestCapture( const RequestCapture& ) = delete;
+        RequestCapture& operator=( const RequestCapture& ) = delete;
+
+        ~RequestCapture() {
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+                stopping = true;
+            }
+            condition.notify_one();
+
+            if ( writer.joinable() )
+                writer.join();
+        }
+
+        template< typename Request >
+        void capture(
+            ocr_service::CapturedRpc rpc,
+            const Request& request,
+            uint32_t settings_version,
+            const RequestContext& request_context
+        ) {
+
+            if ( !writer.joinable() )
+                return;
+
+            ocr_service::CapturedRequest captured;
+            captured.set_arrival_unix_us( std::chrono::duration_cast< std::chrono::microseconds >(
+                std::chrono::system_clock::now().time_since_epoch()
+            ).count() );
+            captured.set_rpc( rpc );
+            captured.set_language_code( request.language_code() );
+            captured.set_settings_version( settings_version );
+
+            if ( request_context.hasDeadline() ) {
+                captured.set_deadline_ms( std::max< int64_t >( 1,
+                    std::chrono::duration_cast< std::chrono::milliseconds >( request_context.remaining() ).count()
+                ) );
+            }
+
+            // The other fields, then the request serialized once straight into the record as its field
+            // ( a serialized message is the concatenation of its fields ), not into captured.request
+            // and copied again with the record
+            std::string record;
+            captured.SerializeToString( &record );
+
+            const size_t request_size = request.ByteSizeLong();
+
+            appendVarint( record, ( uint64_t( ocr_service::CapturedRequest::kRequestFieldNumber ) << 3 ) | 2 ); // Length delimited
+            appendVarint( record, request_size );
+
+            const size_t request_offset = record.size();
+            record.resize( request_offset + request_size );
+            request.SerializeWithCachedSizesToArray( reinterpret_cast< uint8_t* >( &record[ request_offset ] ) );
+
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+
+                if ( pending_bytes + record.size() > max_pending_bytes ) {
+                    metrics().increment( MetricCounter::CAPTURE_DROPPED );
+                    return;
+                }
+
+                pending_bytes += record.size();
+                pending.push_back( std::move( record ) );
+            }
+
+            condition.notify_one();
+        }
+};
+
+
+// Reads the records of a capture file written by RequestCapture
+class CaptureReader {
+
+    private:
+        std::ifstream file;
+
+    public:
+        CaptureReader( const std::string& file_path ) : file( file_path, std::ios::binary ) {
+
+            char magic[ capture_file_magic_size ];
+
+            if ( !file.read( magic, capture_file_magic_size ) ||
+                 std::string( magic, capture_file_magic_size ) != std::string( capture_file_magic, capture_file_magic_size ) ) {
+                file.close();
+            }
+        }
+
+        bool isOpen() const {
+            return file.is_open();
+        }
+
+        // False at the end of the file (or at a truncated last record)
+        bool next( ocr_service::CapturedRequest* captured ) {
+
+            if ( !file.is_open() )
+                return false;
+
+            unsigned char length_bytes[ 4 ];
+
+            if ( !file.read( reinterpret_cast< char* >( length_bytes ), 4 ) )
+                return false;
+
+            const uint32_t length = uint32_t( length_bytes[ 0 ] ) | ( uint32_t( length_bytes[ 1 ] ) << 8 ) |
+                                    ( uint32_t( length_bytes[ 2 ] ) << 16 ) | ( uint32_t( length_bytes[ 3 ] ) << 24 );
+
+            std::string record( length, '\0' );
+
+            if ( !file.read( &record[ 0 ], length ) )
+                return false;
+
+            return captured->ParseFromString( record );
+        }
+};
+
+#endif
@@ -0,0 +1,97 @@
+// ppocr_router_grpc: language sharded front end for several ppocr_infer_service_grpc instances
+//
+// e.g. two instances with different presets on loopback, behind one address:
+//   ppocr_infer_service_grpc ./presets/ ja_only 12346
+//   ppocr_infer_service_grpc ./presets/ en_only 12347
+//   ppocr_router_grpc --port 12345 --backends localhost:12346,localhost:12347
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/health_check_service_interface.h>
+#include "ocr_service.grpc.pb.h"
+#include "ocr_router.hpp"
+
+
+struct RouterOptions {
+  int port = 12345;
+  std::vector< std::string > backends;
+  int health_check_interval_ms = 2000;
+};
+
+void printRouterUsage() {
+  std::cout << "Usage: ppocr_router_grpc --backends HOST:PORT,HOST:PORT,... [--port N] [--health-check-interval-ms MS]\n"
+            << std::endl;
+}
+
+bool handleRouterArgs( int argc, char *argv[], RouterOptions& options ) {
+
+  for ( int i = 1; i < argc; ++i ) {
+
+    const std::string arg = argv[ i ];
+
+    if ( i + 1 >= argc ) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[ ++i ];
+
+    if ( arg == "--port" ) options.port = std::atoi( value.c_str() );
+    else if ( arg == "--health-check-interval-ms" ) options.health_check_interval_ms = std::atoi( value.c_str() );
+    else if ( arg == "--backends" ) {
+      std::stringstream stream( value );
+      std::string target;
+      while ( std::getline( stream, target, ',' ) ) {
+        if ( !target.empty() )
+          options.backends.push_back( target );
+      }
+    }
+    else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  return !options.backends.empty() && options.port > 0 && options.health_check_interval_ms > 0;
+}
+
+
+int main( int argc, char *argv[] ) {
+
+  RouterOptions options;
+
+  if ( !handleRouterArgs( argc, argv, options ) ) {
+    printRouterUsage();
+    return 1;
+  }
+
+  OCRRouterService router( options.backends, std::chrono::milliseconds( options.health_check_interval_ms ) );
+
+  const std::string server_address( "0.0.0.0:" + std::to_string( options.port ) );
+
+  grpc::EnableDefaultHealthCheckService( true );
+
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort( server_address, grpc::InsecureServerCredentials() );
+  builder.RegisterService( &router );
+  builder.SetMaxReceiveMessageSize( 15 * 1024 * 1024 );
+
+  std::unique_ptr< grpc::Server > server( builder.BuildAndStart() );
+
+  if ( server == nullptr ) {
+    std::cerr << "Failed to listen on " << server_address << std::endl;
+    return 1;
+  }
+
+  std::cout << "Router listening on " << server_address << ", " << options.backends.size() << " instances" << std::endl;
+
+  server->Wait();
+
+  return 0;
+}
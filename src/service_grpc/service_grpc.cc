@@ -1,172 +1,47 @@
 #include "../hpp/inference_manager.hpp"
 #include "../hpp/settings_manager.hpp"
+#include <cerrno>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include "ocr_service.grpc.pb.h"
-#include "grpc_helpers.hpp"
+#include "ppocr_service.hpp"
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
-using grpc::Status;
 
-using ocr_service::RecognizeBase64Request;
-using ocr_service::RecognizeDefaultResponse;
-using ocr_service::RecognizeBytesRequest;
 
-using ocr_service::DetectRequest;
-using ocr_service::DetectResponse;
+// metrics_board: worker mode ( Linux ), shared with the other workers of the supervisor
+void RunServer( AppOptions app_options, SharedMetricsBoard* metrics_board = nullptr ) {
 
-using ocr_service::GetSupportedLanguagesRequest;
-using ocr_service::GetSupportedLanguagesResponse;
-
-using ocr_service::UpdatePpOcrSettingsRequest;
-using ocr_service::UpdateSettingsResponse;
-
-
-using ocr_service::OCRService;
-
-
-class PPOCRService final : public OCRService::Service {
-
-  private:
-    SettingsManager settings_manager;
-    InferenceManager inference_manager;
-  
-  public:
-
-    PPOCRService( AppOptions app_options ) {
-
-      settings_manager = SettingsManager( app_options );
-
-      settings_manager.initSettings();
-      inference_manager.init(
-        settings_manager.language_presets,
-        settings_manager.getAppSettingsPreset()
-      );
-    }
+  PPOCRService service( app_options );
 
-    SettingsManager& getSettingsManager() {
-      return settings_manager;
-    }
+#if defined( __linux__ )
+  if ( metrics_board != nullptr ) {
 
-    int getServerPort() {
-      return settings_manager.getServerPort();
-    }
+    service.setMetricsBoard( metrics_board, app_options.worker_index );
 
-    Status GetSupportedLanguages(
-      ServerContext* context,
-      const GetSupportedLanguagesRequest* request,
-      GetSupportedLanguagesResponse* response
-    ) override {
-
-      for ( const std::string& language_code : settings_manager.getAvailableLanguages() ) {
-        
-        response->add_language_codes(language_code);        
+    // Keeps this worker's snapshot fresh for the GetMetrics calls the other workers answer
+    std::thread( [ &service ]() {
+      while ( true ) {
+        service.publishMetrics();
+        std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
       }
-      
-      return Status::OK;
-    }
-
-    Status RecognizeBase64(
-      ServerContext* context,
-      const RecognizeBase64Request* request,
-      RecognizeDefaultResponse* response
-    ) override {    
-
-      InferenceResult const inference_result = inference_manager.inferBase64(
-        request->base64_image(),
-        request->language_code()
-      );
-
-      response->set_id( request->id() );
-
-      ocrResultGRPCHelper( inference_result, response );
-
-      return Status::OK;
-    }
-
-    Status RecognizeBytes(
-      ServerContext* context,
-      const RecognizeBytesRequest* request,
-      RecognizeDefaultResponse* response
-    ) override {    
-
-      std::string image_str = request->image_bytes();
-      
-      InferenceResult const inference_result = inference_manager.inferBufferString(
-        request->image_bytes(),
-        request->language_code()
-      );
-
-      response->set_id( request->id() );
-
-      ocrResultGRPCHelper( inference_result, response );
-      
-      return Status::OK;
-    }
-
-    Status Detect(
-      ServerContext* context,
-      const DetectRequest* request,
-      DetectResponse* response
-    ) override {    
-
-      std::string image_str = request->image_bytes();
-      
-      DetectionResult const result = inference_manager.detect(
-        request->image_bytes(),
-        request->language_code(),
-        false
-      );
-
-      response->set_id( request->id() );
-
-      detectionResultGRPCHelper( result, response );
-      
-      return Status::OK;
-    }
-
-    Status UpdatePpOcrSettings(
-      ServerContext* context,
-      const UpdatePpOcrSettingsRequest* request,
-      UpdateSettingsResponse* response
-    ) override {
-
-      UpdateAppSettingsPresetInput settingsUpdate;
-      settingsUpdate.inference_backend = request->inference_runtime();
-      settingsUpdate.cpu_threads = request->cpu_threads();
-      settingsUpdate.max_image_width = request->max_image_width();
-      settingsUpdate.det_db_thresh = request->det_db_thresh();
-      settingsUpdate.det_db_box_thresh = request->det_db_box_thresh();
-      settingsUpdate.det_db_unclip_ratio = request->det_db_unclip_ratio();
-      settingsUpdate.det_db_score_mode = request->det_db_score_mode();
-      settingsUpdate.use_dilation = request->use_dilation();
-      settingsUpdate.cls_thresh = request->cls_thresh();
-      
-      settings_manager.updateSettingsPreset( settingsUpdate );
-      settings_manager.saveAppSettingsPreset();
-
-      response->set_success( true );
-
-      return Status::OK;
-    }
-};
-
-
-void RunServer( AppOptions app_options ) {
-
-  PPOCRService service( app_options );
+    } ).detach();
+  }
+#endif
 
   std::string server_address( "0.0.0.0:" + std::to_string( service.getServerPort() ) );
 
@@ -177,6 +52,9 @@ void RunServer( AppOptions app_options ) {
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort( server_address, grpc::InsecureServerCredentials() );
 
+  // The workers of the supervisor all listen on the port, the kernel spreads the connections
+  builder.AddChannelArgument( GRPC_ARG_ALLOW_REUSEPORT, 1 );
+
   // Register "service" as the instance through which we'll communicate with
   // clients. In this case it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
@@ -201,7 +79,60 @@ int main( int argc, char *argv[] ) {
   // OCR 
   AppOptions app_options = handleAppArgs( argc, argv );
 
+  // Only the settings: the workers load the models after the fork ( unless "worker_shared_models" )
+  const AppSettingsPreset app_settings = SettingsManager( app_options ).getAppSettingsPreset();
+  const int worker_processes = app_settings.worker_processes;
+
+  if ( worker_processes <= 1 ) {
+    RunServer( app_options );
+    return 0;
+  }
+
+#if defined( __linux__ )
+  // Loaded once, before the fork: the workers share the weights copy-on-write. Only when loading left
+  // no other thread running ( backends with thread pools start theirs at load time ), otherwise the
+  // supervisor starts over without shared models, a fresh process image
+  if ( app_settings.worker_shared_models && std::getenv( "PPOCR_NO_SHARED_MODELS" ) == nullptr ) {
+
+    AppOptions worker_options = app_options;
+    worker_options.worker_count = worker_processes;
+
+    preloadWorkerModels( worker_options );
+
+    const int threads = processThreadCount();
+
+    if ( threads != 1 ) {
+
+      std::cerr << "Loading the models left " << threads << " threads running, which the workers would not inherit: "
+                   "restarting without \"worker_shared_models\"" << std::endl;
+
+      setenv( "PPOCR_NO_SHARED_MODELS", "1", 1 );
+      execv( "/proc/self/exe", argv );
+
+      std::cerr << "Failed to restart the supervisor ( " << std::strerror( errno ) << " )" << std::endl;
+      return 1;
+    }
+
+    std::cout << "Models loaded before the workers start, their weights are shared" << std::endl;
+  }
+
+  SharedMetricsBoard metrics_board( worker_processes );
+
+  return superviseWorkers( worker_processes, metrics_board, [ &app_options, &metrics_board, worker_processes ]( int worker_idx ) {
+
+    AppOptions worker_options = app_options;
+    worker_options.worker_count = worker_processes;
+    worker_options.worker_index = worker_idx;
+
+    RunServer( worker_options, &metrics_board );
+
+    return 0;
+  } );
+#else
+  std::cerr << "\"worker_processes\" is only available on Linux, running one process" << std::endl;
+
   RunServer( app_options );
   
   return 0;
+#endif
 }
@@ -1,5 +1,5 @@
-#include "../hpp/inference_manager.hpp"
-#include "../hpp/settings_manager.hpp"
+#include "../hpp/json_reader.hpp"
+#include "../hpp/request_engine.hpp"
 #include <chrono>
 #include <cstdio>
 #include <httplib.h>
@@ -63,6 +63,86 @@ std::string log(const Request &req, const Response &res) {
 }
 
 
+// Per thread request/response buffers are reused across requests, unless they grew past this
+const size_t max_retained_buffer_bytes = 16 * 1024 * 1024;
+
+void releaseOversizedBuffer( std::string& buffer ) {
+  if ( buffer.capacity() > max_retained_buffer_bytes )
+    std::string().swap( buffer );
+}
+
+void readBody( const Request &req, const ContentReader &content_reader, std::string& body ) {
+
+  body.clear();
+  const size_t content_length = std::strtoull( req.get_header_value( "Content-Length" ).c_str(), nullptr, 10 );
+  body.reserve( std::min< size_t >( content_length, 64 * 1024 * 1024 ) );
+
+  content_reader( [&]( const char *data, size_t data_length ) {
+    body.append(data, data_length);
+    return true;
+  });
+}
+
+// Query parameters shared by every endpoint: client_id, priority ( interactive | normal | bulk ), timeout_ms
+EngineRequest engineRequestHTTP( const Request &req, std::string language_code, std::string_view image, ImageEncoding encoding ) {
+
+  EngineRequest engine_request;
+  engine_request.image = image;
+  engine_request.encoding = encoding;
+  engine_request.language_code = std::move( language_code );
+  engine_request.client_id = req.get_param_value( "client_id" );
+
+  const std::string priority = req.get_param_value( "priority" );
+
+  if ( priority == "interactive" )
+    engine_request.priority = RequestPriority::INTERACTIVE;
+  else if ( priority == "bulk" )
+    engine_request.priority = RequestPriority::BULK;
+
+  return engine_request;
+}
+
+RequestContext requestContextHTTP( const Request &req ) {
+
+  RequestContext request_context;
+
+  const long long timeout_ms = std::atoll( req.get_param_value( "timeout_ms" ).c_str() );
+
+  if ( timeout_ms > 0 )
+    request_context.deadline = request_context.arrival + std::chrono::milliseconds( timeout_ms );
+
+  return request_context;
+}
+
+// Failed inferences still answer with an empty result (like the gRPC service)
+int statusHTTP( InferenceStatus status ) {
+
+  switch ( status ) {
+    case InferenceStatus::CANCELLED:
+      return 499;
+    case InferenceStatus::DEADLINE_EXCEEDED:
+      return 504;
+    default:
+      return 200;
+  }
+}
+
+template< typename Result, typename Serializer >
+void setResultContent( const Result& result, std::string_view id, Serializer serializer, Response &res ) {
+
+  thread_local std::string result_json;
+
+  StageTimer serialize_timer;
+  result_json.clear();
+  serializer( result, id, result_json );
+
+  res.set_content( result_json.data(), result_json.size(), "application/json" );
+  serialize_timer.lap( MetricHistogram::SERIALIZE_US );
+
+  releaseOversizedBuffer( result_json );
+}
+
+
 int main( int argc, char *argv[] ) {  
 
   // OCR 
@@ -71,14 +151,9 @@ int main( int argc, char *argv[] ) {
 
   AppOptions app_options = handleAppArgs( argc, argv );
 
-  SettingsManager settings_manager( app_options );
-
-  InferenceManager inference_manager;
+  RequestEngine engine( app_options );
 
-  inference_manager.initAll(
-    settings_manager.language_presets,
-    settings_manager.getAppSettingsPreset()
-  );
+  const AppSettingsPreset app_settings = engine.getSettingsManager().getAppSettingsPreset();
 
 
   // SERVER
@@ -95,28 +170,160 @@ int main( int argc, char *argv[] ) {
     return -1;
   }
 
-  svr.Post("/recognize", [&](const Request &req, Response &res,
+  // Each open connection holds a worker, size it for the expected clients
+  if ( app_settings.http_threads > 0 ) {
+    const size_t http_threads = app_settings.http_threads;
+    svr.new_task_queue = [ http_threads ]() { return new ThreadPool( http_threads ); };
+  }
+
+  svr.set_keep_alive_max_count( std::max( 1, app_settings.http_keep_alive_max_count ) );
+  svr.set_keep_alive_timeout( std::max( 1, app_settings.http_keep_alive_timeout_s ) );
+
+  auto serializeOcrResult = []( const InferenceResult& result, std::string_view id, std::string& out ) {
+    ocrResultToJson( result, id, out );
+  };
+
+  auto serializeDetectionResult = []( const DetectionResult& result, std::string_view id, std::string& out ) {
+    detectionResultToJson( result, id, out );
+  };
+
+  // JSON body: { "id", "language_code", "base64Image" }
+  auto handleBase64 = [&]( bool detection_only ) {
+    return [ &, detection_only ]( const Request &req, Response &res, const ContentReader &content_reader ) {
+
+      thread_local std::string body;
+      readBody( req, content_reader, body );
+
+      JsonRequestFields fields;
+
+      if ( !fields.parse( body ) || fields.get( "language_code" ).empty() ) {
+        res.status = 400;
+        return;
+      }
+
+      // std::cout << "\n Request language_code: " << language_code << std::endl;
+
+      RequestContext request_context = requestContextHTTP( req );
+      RequestFinishScope finish_scope( engine, request_context );
+      const EngineRequest engine_request = engineRequestHTTP(
+        req, std::string( fields.get( "language_code" ) ), fields.get( "base64Image" ), ImageEncoding::BASE64
+      );
+
+      if ( detection_only ) {
+        const DetectionResult result = engine.detect( engine_request, request_context );
+        res.status = statusHTTP( result.status );
+        if ( res.status == 200 )
+          setResultContent( result, fields.get( "id" ), serializeDetectionResult, res );
+      }
+      else {
+        const InferenceResult result = engine.recognize( engine_request, request_context );
+        res.status = statusHTTP( result.status );
+        if ( res.status == 200 )
+          setResultContent( result, fields.get( "id" ), serializeOcrResult, res );
+      }
+
+      releaseOversizedBuffer( body );
+    };
+  };
+
+  // Raw image bytes as the body (no base64), id and language_code as query parameters
+  auto handleBytes = [&]( bool detection_only ) {
+    return [ &, detection_only ]( const Request &req, Response &res, const ContentReader &content_reader ) {
+
+      thread_local std::string body;
+      readBody( req, content_reader, body );
+
+      const std::string id = req.get_param_value( "id" );
+      std::string language_code = req.get_param_value( "language_code" );
+
+      if ( language_code.empty() ) {
+        res.status = 400;
+        return;
+      }
+
+      RequestContext request_context = requestContextHTTP( req );
+      RequestFinishScope finish_scope( engine, request_context );
+      const EngineRequest engine_request = engineRequestHTTP( req, std::move( language_code ), body, ImageEncoding::RAW );
+
+      if ( detection_only ) {
+        const DetectionResult result = engine.detect( engine_request, request_context );
+        res.status = statusHTTP( result.status );
+        if ( res.status == 200 )
+          setResultContent( result, id, serializeDetectionResult, res );
+      }
+      else {
+        const InferenceResult result = engine.recognize( engine_request, request_context );
+        res.status = statusHTTP( result.status );
+        if ( res.status == 200 )
+          setResultContent( result, id, serializeOcrResult, res );
+      }
+
+      releaseOversizedBuffer( body );
+    };
+  };
+
+  svr.Post( "/recognize", handleBase64( false ) );
+  svr.Post( "/recognize-bytes", handleBytes( false ) );
+  svr.Post( "/detect", handleBase64( true ) );
+  svr.Post( "/detect-bytes", handleBytes( true ) );
+
+  // multipart/form-data, one image per part (the part name is its id), language_code as query parameter.
+  // Answers { "results": [ ... ] } in the order of the parts.
+  svr.Post("/recognize-batch", [&](const Request &req, Response &res,
                                     const ContentReader &content_reader) {
-    std::string body;
-    content_reader( [&]( const char *data, size_t data_length ) {
-      body.append(data, data_length);
-      return true;
-    });
 
-    auto bodyJson = json::parse(body);
+    std::string language_code = req.get_param_value( "language_code" );
+
+    if ( language_code.empty() || !req.is_multipart_form_data() ) {
+      res.status = 400;
+      return;
+    }
+
+    std::vector< MultipartFormData > parts;
+
+    content_reader(
+      [&]( const MultipartFormData &part ) {
+        parts.push_back( part );
+        return true;
+      },
+      [&]( const char *data, size_t data_length ) {
+        parts.back().content.append( data, data_length );
+        return true;
+      }
+    );
+
+    std::vector< std::string_view > images;
+    images.reserve( parts.size() );
+    for ( const auto& part : parts )
+      images.push_back( part.content );
+
+    RequestContext request_context = requestContextHTTP( req );
+    RequestFinishScope finish_scope( engine, request_context );
+    const EngineRequest engine_request = engineRequestHTTP( req, std::move( language_code ), std::string_view(), ImageEncoding::RAW );
+
+    const std::vector< InferenceResult > results = engine.recognizeBatch( images, engine_request, request_context );
+
+    res.status = 200;
+    for ( const auto& result : results ) {
+      if ( statusHTTP( result.status ) != 200 )
+        res.status = statusHTTP( result.status );
+    }
 
-    std::string id = bodyJson["id"].get<std::string>();
-    std::string language_code = bodyJson["language_code"].get<std::string>();
-    std::string base64EncodedImage = bodyJson["base64Image"].get<std::string>();
+    if ( res.status == 200 ) {
 
-    // std::cout << "\n Request language_code: " << language_code << std::endl;
+      StageTimer serialize_timer;
 
-    InferenceResult const result = inference_manager.inferBase64( base64EncodedImage, language_code );
+      std::string results_json;
+      JsonWriter writer( results_json );
 
-    auto resultJson = ocrResultToJson( result );
-    resultJson["id"] = id;
+      writer.beginObject().key( "results" ).beginArray();
+      for ( size_t i = 0; i < results.size(); ++i )
+        ocrResultToJson( results[ i ], parts[ i ].name, writer );
+      writer.endArray().endObject();
 
-    res.set_content( resultJson.dump(), "application/json" );
+      res.set_content( std::move( results_json ), "application/json" );
+      serialize_timer.lap( MetricHistogram::SERIALIZE_US );
+    }
   });
 
   svr.Get("/supported-languages", [&](const Request & /*req*/, Response &res) {
@@ -124,7 +331,7 @@ int main( int argc, char *argv[] ) {
     nlohmann::json resultsJson;
     resultsJson["language_codes"] = json::array();
 
-    for ( const std::string& language_code : settings_manager.getAvailableLanguages() ) {
+    for ( const std::string& language_code : engine.getSupportedLanguages() ) {
       
       resultsJson["language_codes"].push_back( language_code );      
     }
@@ -133,6 +340,11 @@ int main( int argc, char *argv[] ) {
   });
 
 
+  svr.Get("/metrics", [&](const Request & /*req*/, Response &res) {
+    res.set_content( metrics().toPrometheusText(), "text/plain; version=0.0.4" );
+  });
+
+
   svr.set_error_handler([](const Request & /*req*/, Response &res) {
     const char *fmt = "<p>Error Status: <span style='color:red;'>%d</span></p>";
     char buf[BUFSIZ];
@@ -144,8 +356,8 @@ int main( int argc, char *argv[] ) {
   //   printf("%s", log(req, res).c_str());
   // });
   
-  std::cout << "\n Listening on port: " << settings_manager.getServerPort() << std::endl;
-  svr.listen( "0.0.0.0", settings_manager.getServerPort() );
+  std::cout << "\n Listening on port: " << engine.getServerPort() << std::endl;
+  svr.listen( "0.0.0.0", engine.getServerPort() );
   
   return 0;
 }